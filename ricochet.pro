@@ -29,8 +29,8 @@
 # (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 # OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
-lessThan(QT_MAJOR_VERSION,5)|lessThan(QT_MINOR_VERSION,1) {
-    error("Qt 5.1 or greater is required. You can build your own, or get the SDK at https://qt-project.org/downloads")
+lessThan(QT_MAJOR_VERSION,5)|lessThan(QT_MINOR_VERSION,2) {
+    error("Qt 5.2 or greater is required. You can build your own, or get the SDK at https://qt-project.org/downloads")
 }
 
 TARGET = ricochet
@@ -41,7 +41,10 @@ CONFIG += c++11
 VERSION = 1.1.0
 
 # Pass DEFINES+=RICOCHET_NO_PORTABLE for a system-wide installation
+# Pass DEFINES+=RICOCHET_NO_TRACE to compile out span tracing (see src/utils/Trace.h)
 
+# Plain qDebug and qWarning are compiled out of release builds; the categorized
+# logging in src/utils/Log.h stays in, and is disabled at runtime by default
 CONFIG(release,debug|release):DEFINES += QT_NO_DEBUG_OUTPUT QT_NO_WARNING_OUTPUT
 
 contains(DEFINES, RICOCHET_NO_PORTABLE) {
@@ -135,6 +138,7 @@ SOURCES += src/main.cpp \
     src/tor/ProtocolInfoCommand.cpp \
     src/tor/AuthenticateCommand.cpp \
     src/tor/SetConfCommand.cpp \
+    src/tor/AddOnionCommand.cpp \
     src/utils/StringUtil.cpp \
     src/core/ContactsManager.cpp \
     src/core/ContactUser.cpp \
@@ -142,18 +146,30 @@ SOURCES += src/main.cpp \
     src/tor/HiddenService.cpp \
     src/utils/CryptoKey.cpp \
     src/utils/SecureRNG.cpp \
+    src/utils/KeyPool.cpp \
+    src/utils/OnionId.cpp \
+    src/utils/LinkScanner.cpp \
+    src/utils/Metrics.cpp \
+    src/utils/Trace.cpp \
+    src/utils/StallWatchdog.cpp \
+    src/utils/Log.cpp \
     src/core/OutgoingContactRequest.cpp \
     src/core/IncomingRequestManager.cpp \
+    src/core/HostnameBlocklist.cpp \
     src/core/ContactIDValidator.cpp \
     src/core/UserIdentity.cpp \
     src/core/IdentityManager.cpp \
     src/core/ConversationModel.cpp \
+    src/core/ShutdownCoordinator.cpp \
     src/tor/TorProcess.cpp \
     src/tor/TorManager.cpp \
     src/tor/TorSocket.cpp \
+    src/tor/TorTelemetry.cpp \
+    src/tor/TorLogModel.cpp \
     src/ui/LinkedText.cpp \
     src/utils/Settings.cpp \
-    src/utils/PendingOperation.cpp
+    src/utils/PendingOperation.cpp \
+    src/utils/UnixSocket.cpp
 
 HEADERS += src/ui/MainWindow.h \
     src/ui/ContactsModel.h \
@@ -163,6 +179,7 @@ HEADERS += src/ui/MainWindow.h \
     src/tor/ProtocolInfoCommand.h \
     src/tor/AuthenticateCommand.h \
     src/tor/SetConfCommand.h \
+    src/tor/AddOnionCommand.h \
     src/utils/StringUtil.h \
     src/core/ContactsManager.h \
     src/core/ContactUser.h \
@@ -170,19 +187,31 @@ HEADERS += src/ui/MainWindow.h \
     src/tor/HiddenService.h \
     src/utils/CryptoKey.h \
     src/utils/SecureRNG.h \
+    src/utils/KeyPool.h \
+    src/utils/OnionId.h \
+    src/utils/LinkScanner.h \
+    src/utils/Metrics.h \
+    src/utils/Trace.h \
+    src/utils/StallWatchdog.h \
+    src/utils/Log.h \
     src/core/OutgoingContactRequest.h \
     src/core/IncomingRequestManager.h \
+    src/core/HostnameBlocklist.h \
     src/core/ContactIDValidator.h \
     src/core/UserIdentity.h \
     src/core/IdentityManager.h \
     src/core/ConversationModel.h \
+    src/core/ShutdownCoordinator.h \
     src/tor/TorProcess.h \
     src/tor/TorProcess_p.h \
     src/tor/TorManager.h \
     src/tor/TorSocket.h \
+    src/tor/TorTelemetry.h \
+    src/tor/TorLogModel.h \
     src/ui/LinkedText.h \
     src/utils/Settings.h \
-    src/utils/PendingOperation.h
+    src/utils/PendingOperation.h \
+    src/utils/UnixSocket.h
 
 SOURCES += src/protocol/Channel.cpp \
     src/protocol/ControlChannel.cpp \
@@ -190,7 +219,8 @@ SOURCES += src/protocol/Channel.cpp \
     src/protocol/OutboundConnector.cpp \
     src/protocol/AuthHiddenServiceChannel.cpp \
     src/protocol/ChatChannel.cpp \
-    src/protocol/ContactRequestChannel.cpp
+    src/protocol/ContactRequestChannel.cpp \
+    src/protocol/ContactRequestProof.cpp
 
 HEADERS += src/protocol/Channel.h \
     src/protocol/Channel_p.h \
@@ -200,7 +230,8 @@ HEADERS += src/protocol/Channel.h \
     src/protocol/OutboundConnector.h \
     src/protocol/AuthHiddenServiceChannel.h \
     src/protocol/ChatChannel.h \
-    src/protocol/ContactRequestChannel.h
+    src/protocol/ContactRequestChannel.h \
+    src/protocol/ContactRequestProof.h
 
 include(protobuf.pri)
 PROTOS += src/protocol/ControlChannel.proto \
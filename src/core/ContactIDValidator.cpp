@@ -31,8 +31,29 @@
  */
 
 #include "ContactIDValidator.h"
+#include "utils/CryptoKey.h"
+#include "utils/OnionId.h"
 
-static QRegularExpression regex(QStringLiteral("(torsion|ricochet):([a-z2-7]{16})"));
+// 16 characters for legacy (v2) onion services, or 56 for v3
+static QRegularExpression regex(QStringLiteral("^(torsion|ricochet):([a-z2-7]{56}|[a-z2-7]{16})$"));
+
+/* v3 addresses end with a checksum of the key and a version byte, so most
+ * typos are caught here instead of as a connection that never succeeds.
+ * Legacy addresses have no checksum. */
+static bool hasValidChecksum(const QString &serviceId)
+{
+    // Also rejects a v3 version byte other than 3
+    OnionId id = OnionId::fromString(serviceId);
+    if (!id.isValid())
+        return false;
+    if (id.version() != 3)
+        return true;
+
+    QByteArray data = id.data();
+    QByteArray checksum = CryptoKey::torServiceChecksum(data.left(32));
+    // Without SHA3 support, only the version byte can be checked
+    return checksum.isEmpty() || checksum == data.mid(32, 2);
+}
 
 ContactIDValidator::ContactIDValidator(QObject *parent)
     : QRegularExpressionValidator(parent), m_uniqueIdentity(0)
@@ -54,6 +75,12 @@ QValidator::State ContactIDValidator::validate(QString &text, int &pos) const
         return re;
     }
 
+    // Still editable, as it's most likely a typo
+    if (!isValidID(text)) {
+        emit failed();
+        return QValidator::Intermediate;
+    }
+
     if (matchingContact(text) || matchesIdentity(text)) {
         emit failed();
         return QValidator::Invalid;
@@ -82,13 +109,14 @@ void ContactIDValidator::fixup(QString &text) const
 
 bool ContactIDValidator::isValidID(const QString &text)
 {
-    return regex.match(text).hasMatch();
+    QRegularExpressionMatch match = regex.match(text);
+    return match.hasMatch() && hasValidChecksum(match.captured(2));
 }
 
 QString ContactIDValidator::hostnameFromID(const QString &ID)
 {
     QRegularExpressionMatch match = regex.match(ID);
-    if (!match.hasMatch())
+    if (!match.hasMatch() || !hasValidChecksum(match.captured(2)))
         return QString();
 
     return match.captured(2) + QStringLiteral(".onion");
@@ -98,9 +126,9 @@ QString ContactIDValidator::idFromHostname(const QString &hostname)
 {
     QString re = hostname;
 
-    if (re.size() != 16)
+    if (re.size() != 16 && re.size() != 56)
     {
-        if (re.size() == 22 && re.toLower().endsWith(QLatin1String(".onion")))
+        if ((re.size() == 22 || re.size() == 62) && re.toLower().endsWith(QLatin1String(".onion")))
             re.chop(6);
         else
             return QString();
@@ -35,11 +35,14 @@
 #include "ContactsManager.h"
 #include "utils/SecureRNG.h"
 #include "utils/Useful.h"
+#include "utils/Trace.h"
+#include "utils/Log.h"
 #include "core/ContactIDValidator.h"
 #include "core/OutgoingContactRequest.h"
 #include "core/ConversationModel.h"
 #include "tor/HiddenService.h"
 #include "protocol/OutboundConnector.h"
+#include "protocol/ControlChannel.h"
 #include <QtDebug>
 #include <QDateTime>
 #include <QTcpSocket>
@@ -55,11 +58,22 @@ ContactUser::ContactUser(UserIdentity *ident, int id, QObject *parent)
     , m_contactRequest(0)
     , m_settings(0)
     , m_conversation(0)
+    , m_idleTimer(this)
+    , m_idleReopenTimer(this)
+    , m_idleClosed(false)
+    , m_closingIdle(false)
 {
     Q_ASSERT(uniqueID >= 0);
 
-    m_settings = new SettingsObject(QStringLiteral("contacts.%1").arg(uniqueID));
+    m_idleTimer.setSingleShot(true);
+    connect(&m_idleTimer, &QTimer::timeout, this, &ContactUser::checkIdleConnection);
+    m_idleReopenTimer.setSingleShot(true);
+    m_idleReopenTimer.setInterval(IdleReopenTimeout * 1000);
+    connect(&m_idleReopenTimer, &QTimer::timeout, this, &ContactUser::idleReopenTimedOut);
+
+    m_settings = new SettingsObject(identity->settingsPath(QStringLiteral("contacts.%1").arg(uniqueID)), this);
     connect(m_settings, &SettingsObject::modified, this, &ContactUser::onSettingsModified);
+    m_onionId = OnionId::fromString(hostname());
 
     m_conversation = new ConversationModel(this);
     m_conversation->setContact(this);
@@ -82,9 +96,9 @@ void ContactUser::loadContactRequest()
     }
 }
 
-ContactUser *ContactUser::addNewContact(UserIdentity *identity, int id)
+ContactUser *ContactUser::addNewContact(UserIdentity *identity, int id, QObject *parent)
 {
-    ContactUser *user = new ContactUser(identity, id);
+    ContactUser *user = new ContactUser(identity, id, parent);
     user->settings()->write("whenCreated", QDateTime::currentDateTime());
 
     return user;
@@ -103,6 +117,9 @@ void ContactUser::updateStatus()
         }
     } else if (m_connection && m_connection->isConnected()) {
         newStatus = Online;
+    } else if (m_idleClosed) {
+        // The connection was closed for being idle, and will be reopened on demand
+        newStatus = Online;
     } else if (settings()->read("rejected").toBool()) {
         newStatus = RequestRejected;
     } else if (settings()->read("sentUpgradeNotification").toBool()) {
@@ -125,11 +142,22 @@ void ContactUser::onSettingsModified(const QString &key, const QJsonValue &value
     Q_UNUSED(value);
     if (key == QLatin1String("nickname"))
         emit nicknameChanged();
+    else if (key == QLatin1String("idleTimeout"))
+        checkIdleConnection();
+}
+
+bool ContactUser::wantsOutgoingSocket() const
+{
+    // An idle contact is Online, but wants a connection while reopening
+    if (m_idleClosed)
+        return m_idleReopenTimer.isActive();
+    return m_status == Offline || m_status == RequestPending;
 }
 
 void ContactUser::updateOutgoingSocket()
 {
-    if (m_status != Offline && m_status != RequestPending) {
+    TRACE_SPAN("contact.updateOutgoingSocket");
+    if (!wantsOutgoingSocket()) {
         if (m_outgoingSocket) {
             m_outgoingSocket->disconnect(this);
             m_outgoingSocket->abort();
@@ -153,12 +181,24 @@ void ContactUser::updateOutgoingSocket()
     if (!m_outgoingSocket) {
         m_outgoingSocket = new Protocol::OutboundConnector(this);
         m_outgoingSocket->setAuthPrivateKey(identity->hiddenService()->cryptoKey());
+        CryptoKey legacyKey = identity->hiddenService()->legacyCryptoKey();
+        if (legacyKey.isLoaded())
+            m_outgoingSocket->setLegacyAuthPrivateKey(legacyKey);
         connect(m_outgoingSocket, &Protocol::OutboundConnector::ready, this,
             [this]() {
                 assignConnection(m_outgoingSocket->takeConnection(this));
             }
         );
 
+        // A failed attempt while reopening an idle connection means the contact is
+        // offline now; the connector keeps retrying with its usual backoff
+        connect(m_outgoingSocket, &Protocol::OutboundConnector::statusChanged, this,
+            [this]() {
+                if (m_idleClosed && m_outgoingSocket->status() == Protocol::OutboundConnector::Error)
+                    metaObject()->invokeMethod(this, "idleReopenTimedOut", Qt::QueuedConnection);
+            }
+        );
+
         /* As an ugly hack, because Ricochet 1.0.x versions have no way to notify about
          * protocol issues, and it's not feasible to support both protocols for this
          * tiny upgrade period:
@@ -212,7 +252,7 @@ void ContactUser::onConnected()
     m_settings->write("lastConnected", QDateTime::currentDateTime());
 
     if (m_contactRequest && m_connection->purpose() == Protocol::Connection::Purpose::OutboundRequest) {
-        qDebug() << "Sending contact request for" << uniqueID << nickname();
+        LOG_DEBUG(lcContact) << "Sending contact request for" << uniqueID << nickname();
         m_contactRequest->sendRequest(m_connection);
     }
 
@@ -225,7 +265,7 @@ void ContactUser::onConnected()
      * it will be automatically accepted. If this happens, unset the 'rejected' flag for correct UI.
      */
     if (m_settings->read("rejected").toBool()) {
-        qDebug() << "Contact had marked us as rejected, but now they've connected again. Re-enabling.";
+        LOG_DEBUG(lcContact) << "Contact had marked us as rejected, but now they've connected again. Re-enabling.";
         m_settings->unset("rejected");
     }
 
@@ -236,12 +276,39 @@ void ContactUser::onConnected()
     if (m_status != Online && m_status != RequestPending) {
         BUG() << "Contact has a connection while in status" << m_status << "which is not expected.";
         m_connection->close();
+        return;
     }
+
+    /* Ask the peer to take part in closing idle connections. Until it agrees,
+     * the connection is kept open even when idle. */
+    Protocol::ControlChannel *control = m_connection->findChannel<Protocol::ControlChannel>();
+    if (control) {
+        QPointer<Protocol::Connection> connection = m_connection;
+        connect(control, &Protocol::ControlChannel::peerClosingIdle, this,
+            [this,connection]() {
+                if (!connection || connection != m_connection)
+                    return;
+                LOG_DEBUG(lcContact) << "Contact" << uniqueID << "is closing the connection for being idle";
+                m_closingIdle = true;
+            }
+        );
+        control->enableFeatures(QStringList() << QLatin1String(Protocol::ControlChannel::idleCloseFeature));
+    }
+
+    checkIdleConnection();
+
+    /* For conversations that are likely to be used soon, open the outbound chat
+     * channel now rather than when the first message is sent, so that message
+     * doesn't have to wait for the channel request round trip. Channels for cold
+     * conversations are opened on demand, and are closed again after being idle.
+     */
+    if (isConnected() && m_conversation->isHot())
+        m_conversation->prewarmOutboundChannel();
 }
 
 void ContactUser::onDisconnected()
 {
-    qDebug() << "Contact" << uniqueID << "disconnected";
+    LOG_DEBUG(lcContact) << "Contact" << uniqueID << "disconnected";
     m_settings->write("lastConnected", QDateTime::currentDateTime());
 
     if (m_connection) {
@@ -250,6 +317,18 @@ void ContactUser::onDisconnected()
             return;
         }
 
+        /* When either side closed the connection for being idle, the contact
+         * stays online and the connection is reopened when there is something
+         * to send. The peer says so before closing; any other close means the
+         * contact is offline, and it is redialed as usual.
+         */
+        if (m_closingIdle) {
+            LOG_DEBUG(lcContact) << "Contact" << uniqueID << "connection closed after being idle; will reconnect on demand";
+            m_idleClosed = true;
+            m_closingIdle = false;
+        }
+
+        m_idleTimer.stop();
         m_connection->deleteLater();
         m_connection = 0;
     } else {
@@ -265,6 +344,66 @@ SettingsObject *ContactUser::settings()
     return m_settings;
 }
 
+int ContactUser::idleTimeout() const
+{
+    // In minutes, which may be fractional; a per-contact value overrides the default for the identity
+    QJsonValue value = m_settings->read("idleTimeout");
+    if (value.isUndefined())
+        value = identity->settings()->read("contactIdleTimeout");
+    return qMax(int(value.toDouble() * 60), 0);
+}
+
+void ContactUser::checkIdleConnection()
+{
+    int timeout = idleTimeout();
+    if (timeout <= 0 || !m_connection || !m_connection->isConnected() ||
+        m_connection->purpose() != Protocol::Connection::Purpose::KnownContact)
+    {
+        m_idleTimer.stop();
+        return;
+    }
+
+    int idle = m_connection->idleTime();
+    if (idle < timeout) {
+        m_idleTimer.start((timeout - idle) * 1000);
+        return;
+    }
+
+    // A peer that can't be told about the close would take it as us going away, and redial at once
+    Protocol::ControlChannel *control = m_connection->findChannel<Protocol::ControlChannel>();
+    if (!control || !control->isFeatureEnabled(QLatin1String(Protocol::ControlChannel::idleCloseFeature))) {
+        LOG_DEBUG(lcContact) << "Keeping idle connection to contact" << uniqueID << "open; the peer can't close it gracefully";
+        m_idleTimer.stop();
+        return;
+    }
+
+    LOG_DEBUG(lcContact) << "Closing connection to contact" << uniqueID << "after" << idle << "seconds without activity";
+    m_closingIdle = true;
+    control->closeIdle();
+}
+
+void ContactUser::reopenIdleConnection()
+{
+    if (!m_idleClosed || m_connection || m_idleReopenTimer.isActive())
+        return;
+
+    LOG_DEBUG(lcContact) << "Reopening idle connection to contact" << uniqueID;
+    m_idleReopenTimer.start();
+    updateOutgoingSocket();
+}
+
+void ContactUser::idleReopenTimedOut()
+{
+    if (!m_idleClosed)
+        return;
+
+    // The outgoing connection attempt continues as it would for any offline contact
+    LOG_DEBUG(lcContact) << "Reopening idle connection to contact" << uniqueID << "failed; contact is offline";
+    m_idleReopenTimer.stop();
+    m_idleClosed = false;
+    updateStatus();
+}
+
 QString ContactUser::nickname() const
 {
     return m_settings->read("nickname").toString();
@@ -298,6 +437,7 @@ void ContactUser::setHostname(const QString &hostname)
         fh.append(QLatin1String(".onion"));
 
     m_settings->write("hostname", fh);
+    m_onionId = OnionId::fromString(fh);
     updateOutgoingSocket();
 }
 
@@ -306,10 +446,10 @@ void ContactUser::deleteContact()
     /* Anything that uses ContactUser is required to either respond to the contactDeleted signal
      * synchronously, or make use of QWeakPointer. */
 
-    qDebug() << "Deleting contact" << uniqueID;
+    LOG_DEBUG(lcContact) << "Deleting contact" << uniqueID;
 
     if (m_contactRequest) {
-        qDebug() << "Cancelling request associated with contact to be deleted";
+        LOG_DEBUG(lcContact) << "Cancelling request associated with contact to be deleted";
         m_contactRequest->cancel();
         m_contactRequest->deleteLater();
     }
@@ -367,7 +507,7 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
         return;
     }
 
-    if (!connection->hasAuthenticatedAs(Protocol::Connection::HiddenServiceAuth, hostname())) {
+    if (!connection->hasAuthenticatedAs(Protocol::Connection::HiddenServiceAuth, m_onionId)) {
         BUG() << "Connection assigned to contact without matching authentication";
         connection->close();
         connection->deleteLater();
@@ -389,7 +529,7 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
             if (m_contactRequest)
                 BUG() << "Outgoing contact request not unset after implicit accept during connection";
         } else if (!m_contactRequest && !knownToPeer) {
-            qDebug() << "Contact says we're unknown; marking as rejected";
+            LOG_DEBUG(lcContact) << "Contact says we're unknown; marking as rejected";
             settings()->write("rejected", true);
             connection->close();
             connection->deleteLater();
@@ -400,7 +540,7 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
     }
 
     if (m_connection && !m_connection->isConnected()) {
-        qDebug() << "Replacing dead connection with new connection";
+        LOG_DEBUG(lcContact) << "Replacing dead connection with new connection";
         clearConnection();
     }
 
@@ -410,7 +550,7 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
      * always use the new one.
      */
     if (m_connection && connection->direction() == m_connection->direction()) {
-        qDebug() << "Replacing existing connection with contact because the new one goes the same direction";
+        LOG_DEBUG(lcContact) << "Replacing existing connection with contact because the new one goes the same direction";
         clearConnection();
     }
 
@@ -418,7 +558,7 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
      * when it was successfully established, it's replaced with the new one.
      */
     if (m_connection && m_connection->age() > 30) {
-        qDebug() << "Replacing existing connection with contact because it's more than 30 seconds old";
+        LOG_DEBUG(lcContact) << "Replacing existing connection with contact because it's more than 30 seconds old";
         clearConnection();
     }
 
@@ -432,7 +572,7 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
             clearConnection();
         } else {
             // Old connection wins
-            qDebug() << "Closing new connection with contact because the old connection won comparison";
+            LOG_DEBUG(lcContact) << "Closing new connection with contact because the old connection won comparison";
             connection->close();
             connection->deleteLater();
             return;
@@ -446,10 +586,10 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
     if (!isOutbound && m_outgoingSocket) {
         if (m_outgoingSocket->status() != Protocol::OutboundConnector::Authenticating || !preferOutbound) {
             // Inbound connection wins; outbound connection attempt will abort when status changes
-            qDebug() << "Aborting outbound connection attempt because we got an inbound connection instead";
+            LOG_DEBUG(lcContact) << "Aborting outbound connection attempt because we got an inbound connection instead";
         } else {
             // Outbound attempt wins
-            qDebug() << "Closing inbound connection with contact because the pending outbound connection won comparison";
+            LOG_DEBUG(lcContact) << "Closing inbound connection with contact because the pending outbound connection won comparison";
             connection->close();
             connection->deleteLater();
             return;
@@ -463,23 +603,23 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
         return;
     }
 
-    qDebug() << "Assigned" << (isOutbound ? "outbound" : "inbound") << "connection to contact" << uniqueID;
+    LOG_DEBUG(lcContact) << "Assigned" << (isOutbound ? "outbound" : "inbound") << "connection to contact" << uniqueID;
 
     if (m_contactRequest && isOutbound) {
         if (!connection->setPurpose(Protocol::Connection::Purpose::OutboundRequest)) {
-            qWarning() << "BUG: Failed setting connection purpose for request";
+            LOG_WARNING(lcContact) << "BUG: Failed setting connection purpose for request";
             connection->close();
             connection->deleteLater();
             return;
         }
     } else {
         if (m_contactRequest && !isOutbound) {
-            qDebug() << "Implicitly accepting outgoing contact request for" << uniqueID << "due to incoming connection";
+            LOG_DEBUG(lcContact) << "Implicitly accepting outgoing contact request for" << uniqueID << "due to incoming connection";
             m_contactRequest->accept();
         }
 
         if (!connection->setPurpose(Protocol::Connection::Purpose::KnownContact)) {
-            qWarning() << "BUG: Failed setting connection purpose";
+            LOG_WARNING(lcContact) << "BUG: Failed setting connection purpose";
             connection->close();
             connection->deleteLater();
             return;
@@ -487,6 +627,14 @@ void ContactUser::assignConnection(Protocol::Connection *connection)
     }
 
     m_connection = connection;
+    m_closingIdle = false;
+
+    if (m_idleClosed) {
+        m_idleClosed = false;
+        m_idleReopenTimer.stop();
+        // Status is unchanged, so discard the outgoing socket explicitly
+        updateOutgoingSocket();
+    }
 
     /* Use a queued connection to onDisconnected, because it clears m_connection.
      * If we cleared that immediately, it would be possible for the value to change
@@ -38,8 +38,10 @@
 #include <QMetaType>
 #include <QVariant>
 #include <QPointer>
+#include <QTimer>
 #include "utils/Settings.h"
 #include "protocol/Connection.h"
+#include "utils/OnionId.h"
 
 class UserIdentity;
 class OutgoingContactRequest;
@@ -86,6 +88,11 @@ public:
     UserIdentity * const identity;
     const int uniqueID;
 
+    /* Time in seconds to wait for a connection when reopening after being idle.
+     * This covers a dial that has to fetch the descriptor and build a fresh
+     * rendezvous circuit; an attempt that fails sooner ends the wait early. */
+    static const int IdleReopenTimeout = 120;
+
     explicit ContactUser(UserIdentity *identity, int uniqueID, QObject *parent = 0);
 
     Protocol::Connection *connection() { return m_connection.data(); }
@@ -100,12 +107,21 @@ public:
     QString nickname() const;
     /* Hostname is in the onion hostname format, i.e. it ends with .onion */
     QString hostname() const;
+    /* Decoded form of hostname(), for comparisons */
+    OnionId onionId() const { return m_onionId; }
     quint16 port() const;
     /* Contact ID in the ricochet: format */
     QString contactID() const;
 
     Status status() const { return m_status; }
 
+    /* Seconds without channel activity before the connection is closed,
+     * or 0 if connections are never closed for being idle */
+    int idleTimeout() const;
+    /* True if the connection was closed for being idle. The contact is still
+     * considered to be online, and the connection will be reopened on demand. */
+    bool isIdle() const { return m_idleClosed; }
+
     SettingsObject *settings();
 
     Q_INVOKABLE void deleteContact();
@@ -132,6 +148,14 @@ public slots:
 
     void updateStatus();
 
+    /* Reconnect to a contact whose connection was closed for being idle
+     *
+     * This should be called when there is something to send. If the
+     * connection isn't reopened within IdleReopenTimeout seconds, the
+     * contact is considered to be offline.
+     */
+    void reopenIdleConnection();
+
 signals:
     void statusChanged();
     void connected();
@@ -146,6 +170,8 @@ private slots:
     void requestRemoved();
     void requestAccepted();
     void onSettingsModified(const QString &key, const QJsonValue &value);
+    void checkIdleConnection();
+    void idleReopenTimedOut();
 
 private:
     QPointer<Protocol::Connection> m_connection;
@@ -155,12 +181,19 @@ private:
     quint16 m_lastReceivedChatID;
     OutgoingContactRequest *m_contactRequest;
     SettingsObject *m_settings;
+    OnionId m_onionId;
     ConversationModel *m_conversation;
+    QTimer m_idleTimer;
+    QTimer m_idleReopenTimer;
+    bool m_idleClosed;
+    // Set when either side closes the connection for being idle, until it has closed
+    bool m_closingIdle;
 
     /* See ContactsManager::addContact */
-    static ContactUser *addNewContact(UserIdentity *identity, int id);
+    static ContactUser *addNewContact(UserIdentity *identity, int id, QObject *parent);
 
     void loadContactRequest();
+    bool wantsOutgoingSocket() const;
     void updateOutgoingSocket();
 
     void clearConnection();
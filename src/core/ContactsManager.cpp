@@ -41,14 +41,16 @@
 ContactsManager *contactsManager = 0;
 
 ContactsManager::ContactsManager(UserIdentity *id)
-    : identity(id), incomingRequests(this), highestID(-1)
+    : QObject(id), identity(id), incomingRequests(this), highestID(-1)
 {
-    contactsManager = this;
+    // The global refers to the contacts of the first identity
+    if (!contactsManager)
+        contactsManager = this;
 }
 
 void ContactsManager::loadFromSettings()
 {
-    SettingsObject settings(QStringLiteral("contacts"));
+    SettingsObject settings(identity->settingsPath(QStringLiteral("contacts")));
     foreach (const QString &key, settings.data().keys())
     {
         bool ok = false;
@@ -73,8 +75,8 @@ ContactUser *ContactsManager::addContact(const QString &nickname)
     Q_ASSERT(!nickname.isEmpty());
 
     highestID++;
-    ContactUser *user = ContactUser::addNewContact(identity, highestID);
-    user->setParent(this);
+    // Parented at construction, so it follows the identity into moveToThread()
+    ContactUser *user = ContactUser::addNewContact(identity, highestID, this);
     user->setNickname(nickname);
     connectSignals(user);
 
@@ -136,16 +138,17 @@ ContactUser *ContactsManager::lookupSecret(const QByteArray &secret) const
 
 ContactUser *ContactsManager::lookupHostname(const QString &hostname) const
 {
-    QString ohost = ContactIDValidator::hostnameFromID(hostname);
-    if (ohost.isNull())
-        ohost = hostname;
+    return lookupHostname(OnionId::fromString(hostname));
+}
 
-    if (!ohost.endsWith(QLatin1String(".onion")))
-        ohost.append(QLatin1String(".onion"));
+ContactUser *ContactsManager::lookupHostname(const OnionId &id) const
+{
+    if (!id.isValid())
+        return 0;
 
     for (QList<ContactUser*>::ConstIterator it = pContacts.begin(); it != pContacts.end(); ++it)
     {
-        if (ohost.compare((*it)->hostname(), Qt::CaseInsensitive) == 0)
+        if ((*it)->onionId() == id)
             return *it;
     }
 
@@ -61,7 +61,9 @@ public:
 
     const QList<ContactUser*> &contacts() const { return pContacts; }
     ContactUser *lookupSecret(const QByteArray &secret) const;
+    /* Accepts a hostname with or without .onion, or a contact ID */
     ContactUser *lookupHostname(const QString &hostname) const;
+    ContactUser *lookupHostname(const OnionId &id) const;
     ContactUser *lookupNickname(const QString &nickname) const;
     ContactUser *lookupUniqueID(int uniqueID) const;
 
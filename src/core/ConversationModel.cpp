@@ -33,13 +33,50 @@
 #include "ConversationModel.h"
 #include "protocol/Connection.h"
 #include "protocol/ChatChannel.h"
+#include "utils/LinkScanner.h"
+#include "utils/Useful.h"
+#include "utils/Trace.h"
+#include "utils/Metrics.h"
+#include "utils/Log.h"
 #include <QDebug>
 
+static MetricHistogram *firstDeliveryDuration(bool prewarmed)
+{
+    static MetricHistogram *histograms[2] = {
+        MetricsRegistry::instance()->histogram("ricochet_chat_first_delivery_duration_microseconds",
+                                               "Time to deliver the first chat message written after connecting",
+                                               MetricsRegistry::label("channel", QStringLiteral("on_demand"))),
+        MetricsRegistry::instance()->histogram("ricochet_chat_first_delivery_duration_microseconds",
+                                               "Time to deliver the first chat message written after connecting",
+                                               MetricsRegistry::label("channel", QStringLiteral("prewarmed")))
+    };
+    return histograms[prewarmed ? 1 : 0];
+}
+
 ConversationModel::ConversationModel(QObject *parent)
     : QAbstractListModel(parent)
     , m_contact(0)
+    , m_loadedRows(0)
+    , m_nextHandle(1)
+    , m_parsedText(ParsedTextCacheSize)
     , m_unreadCount(0)
+    , m_windowOpen(false)
+    , m_channelPrewarmed(false)
+    , m_firstDeliveryStarted(false)
+    , m_firstDeliveryPrewarmed(false)
+    , m_firstDeliveryHandle(0)
+    , m_idleTimer(this)
+    , m_dataChangedTimer(this)
+    , m_changedFirst(-1)
+    , m_changedLast(-1)
 {
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(OutboundIdleTimeout * 1000);
+    connect(&m_idleTimer, &QTimer::timeout, this, &ConversationModel::closeIdleChannel);
+
+    m_dataChangedTimer.setSingleShot(true);
+    m_dataChangedTimer.setInterval(DataChangedDelay);
+    connect(&m_dataChangedTimer, &QTimer::timeout, this, &ConversationModel::emitPendingDataChanged);
 }
 
 void ConversationModel::setContact(ContactUser *contact)
@@ -49,6 +86,14 @@ void ConversationModel::setContact(ContactUser *contact)
 
     beginResetModel();
     messages.clear();
+    m_loadedRows = 0;
+    m_changedFirst = m_changedLast = -1;
+    m_dataChangedTimer.stop();
+    m_parsedText.clear();
+    m_idleTimer.stop();
+    m_channelPrewarmed = false;
+    m_firstDeliveryStarted = false;
+    m_firstDeliveryHandle = 0;
 
     if (m_contact)
         disconnect(m_contact, 0, this, 0);
@@ -61,6 +106,7 @@ void ConversationModel::setContact(ContactUser *contact)
 
                 if (chat->direction() == Protocol::Channel::Outbound) {
                     connect(chat, &Protocol::Channel::invalidated, this, &ConversationModel::outboundChannelClosed);
+                    m_idleTimer.start();
                     sendQueuedMessages();
                 }
             }
@@ -68,6 +114,8 @@ void ConversationModel::setContact(ContactUser *contact)
 
         auto connectConnection = [this,connectChannel]() {
             if (m_contact->connection()) {
+                m_firstDeliveryStarted = false;
+                m_firstDeliveryHandle = 0;
                 connect(m_contact->connection(), &Protocol::Connection::channelOpened, this, connectChannel);
                 foreach (auto channel, m_contact->connection()->findChannels<Protocol::ChatChannel>())
                     connectChannel(channel);
@@ -91,18 +139,20 @@ void ConversationModel::sendMessage(const QString &text)
         return;
 
     MessageData message(text, QDateTime::currentDateTime(), 0, Queued);
+    message.handle = m_nextHandle++;
 
     if (m_contact->connection()) {
-        auto channel = m_contact->connection()->findChannel<Protocol::ChatChannel>(Protocol::Channel::Outbound);
-        if (!channel) {
-            channel = new Protocol::ChatChannel(Protocol::Channel::Outbound, m_contact->connection());
-            if (!channel->openChannel()) {
-                message.status = Error;
-                delete channel;
-                channel = 0;
-            }
+        if (!m_firstDeliveryStarted) {
+            m_firstDeliveryStarted = true;
+            m_firstDeliveryPrewarmed = m_channelPrewarmed;
+            m_firstDeliveryHandle = message.handle;
+            m_firstDeliveryTimer.start();
         }
 
+        auto channel = outboundChannel();
+        if (!channel)
+            message.status = Error;
+
         if (channel && channel->isOpened()) {
             MessageId id = 0;
             if (channel->sendChatMessage(text, QDateTime(), id))
@@ -112,11 +162,16 @@ void ConversationModel::sendMessage(const QString &text)
             message.identifier = id;
             message.attemptCount++;
         }
+    } else {
+        // Queued until the contact is connected
+        m_contact->reopenIdleConnection();
     }
 
-    beginInsertRows(QModelIndex(), 0, 0);
-    messages.prepend(message);
-    endInsertRows();
+    if (message.status == Queued)
+        TRACE_ASYNC_BEGIN("conversation", "queued", Tracing::pointerId(this) ^ message.handle);
+    insertMessage(0, message);
+
+    m_idleTimer.start();
 }
 
 void ConversationModel::sendQueuedMessages()
@@ -136,14 +191,9 @@ void ConversationModel::sendQueuedMessages()
     if (!haveQueued)
         return;
 
-    auto channel = m_contact->connection()->findChannel<Protocol::ChatChannel>(Protocol::Channel::Outbound);
-    if (!channel) {
-        channel = new Protocol::ChatChannel(Protocol::Channel::Outbound, m_contact->connection());
-        if (!channel->openChannel()) {
-            delete channel;
-            return;
-        }
-    }
+    auto channel = outboundChannel();
+    if (!channel)
+        return;
 
     // sendQueuedMessages is called at channelOpened
     if (!channel->isOpened())
@@ -152,6 +202,7 @@ void ConversationModel::sendQueuedMessages()
     // Iterate backwards, from oldest to newest messages
     for (int i = messages.size() - 1; i >= 0; i--) {
         if (messages[i].status == Queued) {
+            TRACE_ASYNC_END("conversation", "queued", Tracing::pointerId(this) ^ messages[i].handle);
             qDebug() << "Sending queued chat message";
             bool ok = false;
             if (messages[i].identifier)
@@ -163,7 +214,7 @@ void ConversationModel::sendQueuedMessages()
             else
                 messages[i].status = Error;
             messages[i].attemptCount++;
-            emit dataChanged(index(i, 0), index(i, 0));
+            queueDataChanged(i, i);
         }
     }
 }
@@ -181,13 +232,14 @@ void ConversationModel::messageReceived(const QString &text, const QDateTime &ti
         }
     }
 
-    beginInsertRows(QModelIndex(), row, row);
     MessageData message(text, time, id, Received);
-    messages.insert(row, message);
-    endInsertRows();
+    message.handle = m_nextHandle++;
+    insertMessage(row, message);
 
     m_unreadCount++;
     emit unreadCountChanged();
+
+    m_idleTimer.start();
 }
 
 void ConversationModel::messageAcknowledged(MessageId id, bool accepted)
@@ -198,11 +250,34 @@ void ConversationModel::messageAcknowledged(MessageId id, bool accepted)
 
     MessageData &data = messages[row];
     data.status = accepted ? Delivered : Error;
-    emit dataChanged(index(row, 0), index(row, 0));
+    queueDataChanged(row, row);
+
+    if (m_firstDeliveryHandle && data.handle == m_firstDeliveryHandle) {
+        m_firstDeliveryHandle = 0;
+        if (accepted) {
+            qint64 elapsed = m_firstDeliveryTimer.nsecsElapsed() / 1000;
+            firstDeliveryDuration(m_firstDeliveryPrewarmed)->record(elapsed);
+
+            MetricHistogram *prewarmed = firstDeliveryDuration(true);
+            MetricHistogram *onDemand = firstDeliveryDuration(false);
+            LOG_DEBUG(lcContact) << "First chat message for contact" << m_contact->uniqueID << "delivered in"
+                                 << elapsed / 1000 << "ms with" << (m_firstDeliveryPrewarmed ? "a prewarmed" : "an on-demand")
+                                 << "channel; median" << prewarmed->percentile(0.5) / 1000 << "ms over" << prewarmed->count()
+                                 << "prewarmed and" << onDemand->percentile(0.5) / 1000 << "ms over" << onDemand->count()
+                                 << "on-demand";
+        }
+    }
+
+    m_idleTimer.start();
 }
 
 void ConversationModel::outboundChannelClosed()
 {
+    m_idleTimer.stop();
+    m_channelPrewarmed = false;
+    // A message that has to be re-sent isn't comparable
+    m_firstDeliveryHandle = 0;
+
     // Any messages that are Sending are moved back to Queued, so they
     // will be re-sent when we reconnect.
     for (int i = 0; i < messages.size(); i++) {
@@ -214,8 +289,9 @@ void ConversationModel::outboundChannelClosed()
         } else {
             qDebug() << "Outbound chat channel closed, putting unacknowledged chat message back in queue";
             messages[i].status = Queued;
+            TRACE_ASYNC_BEGIN("conversation", "queued", Tracing::pointerId(this) ^ messages[i].handle);
         }
-        emit dataChanged(index(i, 0), index(i, 0));
+        queueDataChanged(i, i);
     }
 
     // Try to reopen the channel if we're still connected
@@ -229,9 +305,15 @@ void ConversationModel::clear()
     if (messages.isEmpty())
         return;
 
-    beginRemoveRows(QModelIndex(), 0, messages.size()-1);
+    emitPendingDataChanged();
+    if (m_loadedRows > 0)
+        beginRemoveRows(QModelIndex(), 0, m_loadedRows - 1);
     messages.clear();
-    endRemoveRows();
+    m_parsedText.clear();
+    if (m_loadedRows > 0) {
+        m_loadedRows = 0;
+        endRemoveRows();
+    }
 
     resetUnreadCount();
 }
@@ -244,10 +326,204 @@ void ConversationModel::resetUnreadCount()
     emit unreadCountChanged();
 }
 
+void ConversationModel::setWindowOpen(bool open)
+{
+    if (m_windowOpen == open)
+        return;
+
+    m_windowOpen = open;
+    emit windowOpenChanged();
+
+    if (m_windowOpen) {
+        if (m_contact)
+            m_contact->reopenIdleConnection();
+        prewarmOutboundChannel();
+    }
+}
+
+QDateTime ConversationModel::lastActivity() const
+{
+    // Received messages can be positioned below the last few outgoing
+    // messages, so the newest isn't necessarily the first row
+    QDateTime re;
+    for (int i = 0; i < messages.size() && i <= 5; i++) {
+        if (re.isNull() || messages[i].time > re)
+            re = messages[i].time;
+    }
+    return re;
+}
+
+bool ConversationModel::hasPendingMessages() const
+{
+    foreach (const MessageData &data, messages) {
+        if (data.status == Queued || data.status == Sending)
+            return true;
+    }
+    return false;
+}
+
+bool ConversationModel::isHot() const
+{
+    if (m_windowOpen || m_unreadCount > 0 || hasPendingMessages())
+        return true;
+
+    QDateTime last = lastActivity();
+    return !last.isNull() && last.secsTo(QDateTime::currentDateTime()) < HotActivityWindow;
+}
+
+/* Find the outbound chat channel for the contact's connection, and send a
+ * request to open one if there isn't one yet. The returned channel might
+ * not be opened yet. Returns null if the channel can't be opened.
+ */
+Protocol::ChatChannel *ConversationModel::outboundChannel()
+{
+    if (!m_contact || !m_contact->connection())
+        return 0;
+
+    auto channel = m_contact->connection()->findChannel<Protocol::ChatChannel>(Protocol::Channel::Outbound);
+    if (!channel) {
+        channel = new Protocol::ChatChannel(Protocol::Channel::Outbound, m_contact->connection());
+        if (!channel->openChannel()) {
+            delete channel;
+            return 0;
+        }
+    }
+
+    return channel;
+}
+
+void ConversationModel::prewarmOutboundChannel()
+{
+    if (!m_contact || !m_contact->isConnected() || !m_contact->connection())
+        return;
+
+    if (m_contact->connection()->findChannel<Protocol::ChatChannel>(Protocol::Channel::Outbound))
+        return;
+
+    qDebug() << "Opening outbound chat channel ahead of use for contact" << m_contact->uniqueID;
+    if (outboundChannel())
+        m_channelPrewarmed = true;
+}
+
+void ConversationModel::closeIdleChannel()
+{
+    if (!m_contact || !m_contact->connection())
+        return;
+
+    auto channel = m_contact->connection()->findChannel<Protocol::ChatChannel>(Protocol::Channel::Outbound);
+    if (!channel)
+        return;
+
+    // Keep the channel while it's likely to be used, and check again later
+    if (m_windowOpen || m_unreadCount > 0 || hasPendingMessages()) {
+        m_idleTimer.start();
+        return;
+    }
+
+    qDebug() << "Closing idle outbound chat channel for contact" << m_contact->uniqueID;
+    channel->closeChannel();
+}
+
 void ConversationModel::onContactStatusChanged()
 {
     // Update in case section has changed
-    emit dataChanged(index(0, 0), index(rowCount()-1, 0), QVector<int>() << SectionRole);
+    if (m_loadedRows > 0)
+        queueDataChanged(0, m_loadedRows - 1, QVector<int>() << SectionRole);
+}
+
+/* Insert a message at row, which must be within or just after the loaded rows.
+ * New messages are always near the top, so this holds as long as at least a
+ * page is loaded.
+ */
+void ConversationModel::insertMessage(int row, const MessageData &message)
+{
+    if (row > m_loadedRows) {
+        BUG() << "Inserting conversation message at row" << row << "beyond the" << m_loadedRows << "loaded rows";
+        row = m_loadedRows;
+    }
+
+    // Pending row numbers would be wrong after the insert
+    emitPendingDataChanged();
+
+    beginInsertRows(QModelIndex(), row, row);
+    messages.insert(row, message);
+    m_loadedRows++;
+    endInsertRows();
+}
+
+void ConversationModel::queueDataChanged(int first, int last, const QVector<int> &roles)
+{
+    last = qMin(last, m_loadedRows - 1);
+    if (first > last)
+        return;
+
+    if (m_changedFirst < 0) {
+        m_changedFirst = first;
+        m_changedLast = last;
+        m_changedRoles = roles;
+        m_dataChangedTimer.start();
+        return;
+    }
+
+    m_changedFirst = qMin(m_changedFirst, first);
+    m_changedLast = qMax(m_changedLast, last);
+    if (roles.isEmpty()) {
+        m_changedRoles.clear();
+    } else if (!m_changedRoles.isEmpty()) {
+        foreach (int role, roles) {
+            if (!m_changedRoles.contains(role))
+                m_changedRoles.append(role);
+        }
+    }
+}
+
+void ConversationModel::emitPendingDataChanged()
+{
+    m_dataChangedTimer.stop();
+    if (m_changedFirst < 0)
+        return;
+
+    int first = m_changedFirst, last = qMin(m_changedLast, m_loadedRows - 1);
+    QVector<int> roles = m_changedRoles;
+    m_changedFirst = m_changedLast = -1;
+    m_changedRoles.clear();
+
+    if (first <= last)
+        emit dataChanged(index(first, 0), index(last, 0), roles);
+}
+
+bool ConversationModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return false;
+    return m_loadedRows < messages.size();
+}
+
+void ConversationModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid() || m_loadedRows >= messages.size())
+        return;
+
+    int count = qMin(int(PageSize), messages.size() - m_loadedRows);
+    beginInsertRows(QModelIndex(), m_loadedRows, m_loadedRows + count - 1);
+    m_loadedRows += count;
+    endInsertRows();
+}
+
+void ConversationModel::releaseRowsAfter(int lastVisibleRow)
+{
+    if (lastVisibleRow < 0)
+        return;
+
+    // Keep whole pages, so fetchMore and release don't alternate at a boundary
+    int keep = ((lastVisibleRow + ReleaseMargin) / PageSize + 1) * PageSize;
+    if (keep >= m_loadedRows)
+        return;
+
+    emitPendingDataChanged();
+    beginRemoveRows(QModelIndex(), keep, m_loadedRows - 1);
+    m_loadedRows = keep;
+    endRemoveRows();
 }
 
 QHash<int,QByteArray> ConversationModel::roleNames() const
@@ -259,6 +535,7 @@ QHash<int,QByteArray> ConversationModel::roleNames() const
     roles[StatusRole] = "status";
     roles[SectionRole] = "section";
     roles[TimespanRole] = "timespan";
+    roles[ParsedTextRole] = "parsedText";
     return roles;
 }
 
@@ -266,12 +543,12 @@ int ConversationModel::rowCount(const QModelIndex &parent) const
 {
     if (parent.isValid())
         return 0;
-    return messages.size();
+    return m_loadedRows;
 }
 
 QVariant ConversationModel::data(const QModelIndex &index, int role) const
 {
-    if (!index.isValid() || index.row() >= messages.size())
+    if (!index.isValid() || index.row() >= m_loadedRows)
         return QVariant();
 
     const MessageData &message = messages[index.row()];
@@ -282,6 +559,14 @@ QVariant ConversationModel::data(const QModelIndex &index, int role) const
         case IsOutgoingRole: return message.status != Received;
         case StatusRole: return message.status;
 
+        case ParsedTextRole: {
+            if (QString *cached = m_parsedText.object(message.handle))
+                return *cached;
+            QString parsed = LinkScanner::toHtml(message.text);
+            m_parsedText.insert(message.handle, new QString(parsed));
+            return parsed;
+        }
+
         case SectionRole: {
             if (m_contact->status() == ContactUser::Online)
                 return QString();
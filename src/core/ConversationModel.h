@@ -35,6 +35,9 @@
 
 #include <QAbstractListModel>
 #include <QDateTime>
+#include <QTimer>
+#include <QCache>
+#include <QElapsedTimer>
 #include "core/ContactUser.h"
 #include "protocol/ChatChannel.h"
 
@@ -45,6 +48,7 @@ class ConversationModel : public QAbstractListModel
 
     Q_PROPERTY(ContactUser* contact READ contact WRITE setContact NOTIFY contactChanged)
     Q_PROPERTY(int unreadCount READ unreadCount RESET resetUnreadCount NOTIFY unreadCountChanged)
+    Q_PROPERTY(bool windowOpen READ isWindowOpen WRITE setWindowOpen NOTIFY windowOpenChanged)
 
 public:
     typedef Protocol::ChatChannel::MessageId MessageId;
@@ -54,7 +58,8 @@ public:
         IsOutgoingRole,
         StatusRole,
         SectionRole,
-        TimespanRole
+        TimespanRole,
+        ParsedTextRole
     };
 
     enum MessageStatus {
@@ -65,6 +70,19 @@ public:
         Error
     };
 
+    // Conversations with activity within this many seconds are considered hot
+    static const int HotActivityWindow = 30 * 60;
+    // Time in seconds before an unused outbound chat channel is closed
+    static const int OutboundIdleTimeout = 10 * 60;
+    // Messages whose HTML for ParsedTextRole is kept
+    static const int ParsedTextCacheSize = 500;
+    // Rows exposed to views at a time by fetchMore
+    static const int PageSize = 100;
+    // Rows kept loaded beyond the last visible row before older pages are released
+    static const int ReleaseMargin = 2 * PageSize;
+    // Milliseconds that dataChanged for message rows is held to coalesce updates, about one frame
+    static const int DataChangedDelay = 16;
+
     ConversationModel(QObject *parent = 0);
 
     ContactUser *contact() const { return m_contact; }
@@ -73,9 +91,35 @@ public:
     int unreadCount() const { return m_unreadCount; }
     Q_INVOKABLE void resetUnreadCount();
 
+    /* A chat window showing this conversation is open */
+    bool isWindowOpen() const { return m_windowOpen; }
+    void setWindowOpen(bool open);
+
+    /* Time of the most recent message in either direction */
+    QDateTime lastActivity() const;
+
+    /* Hot conversations are likely to send a message soon: there is an open
+     * chat window, unread or queued messages, or recent activity. The outbound
+     * chat channel is opened eagerly for hot conversations, and kept open
+     * while they stay that way.
+     */
+    bool isHot() const;
+
+    /* Open the outbound chat channel, if connected and it isn't already open */
+    void prewarmOutboundChannel();
+
     virtual QHash<int,QByteArray> roleNames() const;
     virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
     virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    virtual bool canFetchMore(const QModelIndex &parent) const;
+    virtual void fetchMore(const QModelIndex &parent);
+
+    /* Only the newest messages are exposed as rows, and older messages are
+     * loaded a page at a time with fetchMore as the view scrolls towards them.
+     * Views call this with the oldest row on screen, to unload pages that are
+     * far outside of the visible range. The messages themselves are kept.
+     */
+    Q_INVOKABLE void releaseRowsAfter(int lastVisibleRow);
 
 public slots:
     void sendMessage(const QString &text);
@@ -84,6 +128,7 @@ public slots:
 signals:
     void contactChanged();
     void unreadCountChanged();
+    void windowOpenChanged();
 
 private slots:
     void messageReceived(const QString &text, const QDateTime &time, MessageId id);
@@ -91,6 +136,8 @@ private slots:
     void outboundChannelClosed();
     void sendQueuedMessages();
     void onContactStatusChanged();
+    void closeIdleChannel();
+    void emitPendingDataChanged();
 
 private:
     struct MessageData {
@@ -99,18 +146,43 @@ private:
         MessageId identifier;
         MessageStatus status;
         quint8 attemptCount;
+        // Unique within the model, unlike identifier
+        quint64 handle;
 
         MessageData(const QString &text, const QDateTime &time, MessageId id, MessageStatus status)
-            : text(text), time(time), identifier(id), status(status), attemptCount(0)
+            : text(text), time(time), identifier(id), status(status), attemptCount(0), handle(0)
         {
         }
     };
 
     ContactUser *m_contact;
     QList<MessageData> messages;
+    // Number of messages, from the newest, that are exposed as rows
+    int m_loadedRows;
+    quint64 m_nextHandle;
+    // Text converted to HTML with links, by message handle, filled as rows are displayed
+    mutable QCache<quint64,QString> m_parsedText;
     int m_unreadCount;
+    bool m_windowOpen;
+    bool m_channelPrewarmed;
+    /* The first message written after each connect is timed until it's
+     * acknowledged, to compare delivery over prewarmed and on-demand channels.
+     * The handle is 0 when no message is being timed. */
+    bool m_firstDeliveryStarted;
+    bool m_firstDeliveryPrewarmed;
+    quint64 m_firstDeliveryHandle;
+    QElapsedTimer m_firstDeliveryTimer;
+    QTimer m_idleTimer;
+    // Rows with changes not yet signaled by dataChanged; an empty role list is all roles
+    QTimer m_dataChangedTimer;
+    int m_changedFirst, m_changedLast;
+    QVector<int> m_changedRoles;
 
     int indexOfIdentifier(MessageId identifier, bool isOutgoing) const;
+    void queueDataChanged(int first, int last, const QVector<int> &roles = QVector<int>());
+    void insertMessage(int row, const MessageData &message);
+    bool hasPendingMessages() const;
+    Protocol::ChatChannel *outboundChannel();
 };
 
 #endif
@@ -0,0 +1,204 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HostnameBlocklist.h"
+#include "utils/Settings.h"
+#include "utils/Useful.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QJsonArray>
+#include <QDebug>
+#include <algorithm>
+
+HostnameBlocklist::HostnameBlocklist(QObject *parent)
+    : QObject(parent)
+    , m_settings(0)
+{
+}
+
+void HostnameBlocklist::load(SettingsObject *settings)
+{
+    m_settings = settings;
+    m_hosts.clear();
+
+    QByteArray data = m_settings->read<Base64Encode>("hostnameBlocklist");
+    for (int p = 0; p < data.size(); ) {
+        int size = quint8(data[p++]);
+        OnionId id = OnionId::fromData(data.mid(p, size));
+        if (!id.isValid()) {
+            qWarning() << "Ignoring invalid data in hostname blocklist";
+            break;
+        }
+        m_hosts.insert(id);
+        p += size;
+    }
+
+    QJsonArray legacy = m_settings->read<QJsonArray>("hostnameBlacklist");
+    if (!legacy.isEmpty()) {
+        foreach (const QJsonValue &value, legacy) {
+            OnionId id = OnionId::fromString(value.toString());
+            if (id.isValid())
+                m_hosts.insert(id);
+        }
+        save();
+        m_settings->write("hostnameBlacklist", QJsonValue::Undefined);
+    }
+
+    emit countChanged();
+}
+
+void HostnameBlocklist::save()
+{
+    if (!m_settings) {
+        BUG() << "Hostname blocklist modified before it was loaded";
+        return;
+    }
+
+    QByteArray data;
+    data.reserve(m_hosts.size() * (OnionId::V3Size + 1));
+    foreach (const OnionId &id, m_hosts) {
+        QByteArray raw = id.data();
+        data.append(char(raw.size()));
+        data.append(raw);
+    }
+
+    if (data.isEmpty())
+        m_settings->write("hostnameBlocklist", QJsonValue::Undefined);
+    else
+        m_settings->write("hostnameBlocklist", Base64Encode(data));
+}
+
+bool HostnameBlocklist::add(const OnionId &id)
+{
+    if (!id.isValid() || m_hosts.contains(id))
+        return false;
+
+    m_hosts.insert(id);
+    save();
+    emit countChanged();
+    return true;
+}
+
+bool HostnameBlocklist::remove(const OnionId &id)
+{
+    if (!m_hosts.remove(id))
+        return false;
+
+    save();
+    emit countChanged();
+    return true;
+}
+
+void HostnameBlocklist::clear()
+{
+    if (m_hosts.isEmpty())
+        return;
+
+    m_hosts.clear();
+    save();
+    emit countChanged();
+}
+
+int HostnameBlocklist::import(const QList<OnionId> &hosts)
+{
+    int added = 0;
+    foreach (const OnionId &id, hosts) {
+        if (id.isValid() && !m_hosts.contains(id)) {
+            m_hosts.insert(id);
+            added++;
+        }
+    }
+
+    if (added) {
+        save();
+        emit countChanged();
+    }
+    return added;
+}
+
+QList<OnionId> HostnameBlocklist::parseList(const QByteArray &data)
+{
+    QList<OnionId> re;
+    foreach (const QByteArray &rawLine, data.split('\n')) {
+        QByteArray line = rawLine.trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        OnionId id = OnionId::fromString(QString::fromLatin1(line));
+        if (id.isValid())
+            re.append(id);
+        else
+            qWarning() << "Ignoring invalid hostname in blocklist:" << line;
+    }
+    return re;
+}
+
+QByteArray HostnameBlocklist::exportList() const
+{
+    QStringList ids;
+    ids.reserve(m_hosts.size());
+    foreach (const OnionId &id, m_hosts)
+        ids.append(QStringLiteral("ricochet:") + id.serviceId());
+    std::sort(ids.begin(), ids.end());
+
+    QByteArray re;
+    foreach (const QString &id, ids) {
+        re.append(id.toLatin1());
+        re.append('\n');
+    }
+    return re;
+}
+
+int HostnameBlocklist::importFile(const QUrl &fileUrl)
+{
+    QString path = fileUrl.toLocalFile();
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open blocklist" << path << "-" << file.errorString();
+        return -1;
+    }
+
+    int added = import(parseList(file.readAll()));
+    qDebug() << "Imported" << added << "new hosts to the blocklist from" << path;
+    return added;
+}
+
+bool HostnameBlocklist::exportFile(const QUrl &fileUrl) const
+{
+    QString path = fileUrl.toLocalFile();
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text) || file.write(exportList()) < 0 || !file.commit()) {
+        qWarning() << "Failed to write blocklist" << path << "-" << file.errorString();
+        return false;
+    }
+    return true;
+}
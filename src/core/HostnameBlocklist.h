@@ -0,0 +1,99 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HOSTNAMEBLOCKLIST_H
+#define HOSTNAMEBLOCKLIST_H
+
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QUrl>
+#include "utils/OnionId.h"
+
+class SettingsObject;
+
+/* Hosts whose contact requests are rejected without being shown
+ *
+ * The list is kept in memory as a set of OnionId, so checking an incoming
+ * request is a single hash lookup. It's stored in the identity's
+ * "hostnameBlocklist" setting as base64 of the raw IDs, each with a length
+ * byte, and migrated from the older "hostnameBlacklist" array of hostnames.
+ *
+ * Lists can be imported and exported as text files with one contact ID or
+ * hostname per line; lines starting with '#' are ignored.
+ */
+class HostnameBlocklist : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(HostnameBlocklist)
+
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+
+public:
+    explicit HostnameBlocklist(QObject *parent = 0);
+
+    /* Called by IncomingRequestManager once the identity's settings exist */
+    void load(SettingsObject *settings);
+
+    int count() const { return m_hosts.size(); }
+    bool contains(const OnionId &id) const { return m_hosts.contains(id); }
+    Q_INVOKABLE bool contains(const QString &hostname) const { return contains(OnionId::fromString(hostname)); }
+    QList<OnionId> hosts() const { return m_hosts.toList(); }
+
+    /* Returns true if the host wasn't already in the list */
+    bool add(const OnionId &id);
+    Q_INVOKABLE bool add(const QString &hostname) { return add(OnionId::fromString(hostname)); }
+    bool remove(const OnionId &id);
+    Q_INVOKABLE bool remove(const QString &hostname) { return remove(OnionId::fromString(hostname)); }
+    Q_INVOKABLE void clear();
+
+    /* Add every valid host, saving once; returns the number of new hosts */
+    int import(const QList<OnionId> &hosts);
+    /* Read a list from a local file URL, as given by a file dialog, returning
+     * the number of new hosts or -1 on error */
+    Q_INVOKABLE int importFile(const QUrl &file);
+    Q_INVOKABLE bool exportFile(const QUrl &file) const;
+
+    static QList<OnionId> parseList(const QByteArray &data);
+    QByteArray exportList() const;
+
+signals:
+    void countChanged();
+
+private:
+    SettingsObject *m_settings;
+    QSet<OnionId> m_hosts;
+
+    void save();
+};
+
+#endif // HOSTNAMEBLOCKLIST_H
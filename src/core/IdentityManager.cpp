@@ -31,15 +31,20 @@
  */
 
 #include "IdentityManager.h"
-#include "ContactIDValidator.h"
 #include "core/OutgoingContactRequest.h"
+#include "utils/Trace.h"
+#include <QJsonObject>
+#include <QQmlEngine>
+#include <QThread>
 #include <QDebug>
+#include <algorithm>
 
 IdentityManager *identityManager = 0;
 
 IdentityManager::IdentityManager(QObject *parent)
     : QObject(parent), highestID(-1)
 {
+    TRACE_SPAN("identity.load");
     identityManager = this;
 
     loadFromSettings();
@@ -47,14 +52,33 @@ IdentityManager::IdentityManager(QObject *parent)
 
 IdentityManager::~IdentityManager()
 {
+    // Identities on worker threads are deleted as their thread finishes
+    foreach (QThread *thread, m_threads) {
+        thread->quit();
+        thread->wait();
+    }
+
     identityManager = 0;
 }
 
 void IdentityManager::addIdentity(UserIdentity *identity)
 {
-    m_identities.append(identity);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_identities.append(identity);
+        m_hostnames.insert(identity, OnionId::fromString(identity->hostname()));
+    }
     highestID = qMax(identity->uniqueID, highestID);
 
+    // Runs on the identity's thread, which is the only one that may read its hostname
+    connect(identity, &UserIdentity::contactIDChanged, identity,
+        [this,identity]() {
+            OnionId id = OnionId::fromString(identity->hostname());
+            QMutexLocker locker(&m_mutex);
+            m_hostnames.insert(identity, id);
+        }
+    );
+
     connect(&identity->contacts, SIGNAL(contactAdded(ContactUser*)), SLOT(onContactAdded(ContactUser*)));
     connect(&identity->contacts, SIGNAL(outgoingRequestAdded(OutgoingContactRequest*)),
             SLOT(onOutgoingRequest(OutgoingContactRequest*)));
@@ -63,9 +87,35 @@ void IdentityManager::addIdentity(UserIdentity *identity)
     connect(&identity->contacts.incomingRequests, SIGNAL(requestRemoved(IncomingContactRequest*)),
             SLOT(onIncomingRequestRemoved(IncomingContactRequest*)));
 
+    if (identity->settings()->read("workerThread").toBool()) {
+        // The first identity is used directly by the UI, so it can't be moved
+        if (identity->uniqueID == 0)
+            qWarning() << "Ignoring workerThread setting for the primary identity";
+        else
+            moveToWorkerThread(identity);
+    }
+
     emit identityAdded(identity);
 }
 
+void IdentityManager::moveToWorkerThread(UserIdentity *identity)
+{
+    Q_ASSERT(identity->thread() == thread());
+
+    QThread *thread = new QThread(this);
+    thread->setObjectName(QStringLiteral("identity-%1").arg(identity->uniqueID));
+
+    // Objects can't be moved to a different thread than their parent
+    identity->setParent(0);
+    identity->moveToThread(thread);
+    connect(thread, &QThread::finished, identity, &QObject::deleteLater);
+
+    m_threads.insert(identity, thread);
+    thread->start();
+
+    qDebug() << "Identity" << identity->uniqueID << "is running in a worker thread";
+}
+
 void IdentityManager::loadFromSettings()
 {
     SettingsObject settings;
@@ -78,14 +128,52 @@ void IdentityManager::loadFromSettings()
         /* No identities exist (probably inital run); create one */
         createIdentity();
     }
+
+    /* Additional identities are stored under "identities", by uniqueID. All
+     * identities share the same Tor instance, and only differ by their hidden
+     * service, listening socket, and contacts. */
+    QList<int> ids;
+    foreach (const QString &key, settings.read<QJsonObject>("identities").keys())
+    {
+        bool ok = false;
+        int id = key.toInt(&ok);
+        if (!ok || id <= 0)
+        {
+            qWarning() << "Ignoring identity" << key << "with an invalid ID";
+            continue;
+        }
+        ids.append(id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+    foreach (int id, ids)
+    {
+        if (SettingsObject(UserIdentity::settingsPath(id, QStringLiteral("identity"))).data().isEmpty())
+            continue;
+        addIdentity(new UserIdentity(id, this));
+    }
+}
+
+QList<QObject*> IdentityManager::identityObjects() const
+{
+    QList<QObject*> re;
+    foreach (UserIdentity *identity, m_identities) {
+        if (!m_threads.contains(identity))
+            re.append(identity);
+    }
+    return re;
 }
 
-UserIdentity *IdentityManager::createIdentity(const QString &serviceDirectory, const QString &nickname)
+UserIdentity *IdentityManager::createIdentity(const QString &nickname, const QString &serviceDirectory)
 {
     UserIdentity *identity = UserIdentity::createIdentity(++highestID, serviceDirectory);
     if (!identity)
         return identity;
 
+    identity->setParent(this);
+    // Identities moved to a worker thread have no parent, which QML would otherwise collect
+    QQmlEngine::setObjectOwnership(identity, QQmlEngine::CppOwnership);
+
     if (!nickname.isEmpty())
         identity->setNickname(nickname);
 
@@ -96,17 +184,19 @@ UserIdentity *IdentityManager::createIdentity(const QString &serviceDirectory, c
 
 UserIdentity *IdentityManager::lookupHostname(const QString &hostname) const
 {
-    QString ohost = ContactIDValidator::hostnameFromID(hostname);
-    if (ohost.isNull())
-        ohost = hostname;
+    return lookupHostname(OnionId::fromString(hostname));
+}
 
-    if (!ohost.endsWith(QLatin1String(".onion")))
-        ohost.append(QLatin1String(".onion"));
+UserIdentity *IdentityManager::lookupHostname(const OnionId &id) const
+{
+    if (!id.isValid())
+        return 0;
 
-    for (QList<UserIdentity*>::ConstIterator it = m_identities.begin(); it != m_identities.end(); ++it)
+    QMutexLocker locker(&m_mutex);
+    for (QHash<UserIdentity*,OnionId>::ConstIterator it = m_hostnames.begin(); it != m_hostnames.end(); ++it)
     {
-        if (ohost.compare((*it)->hostname(), Qt::CaseInsensitive) == 0)
-            return *it;
+        if (it.value() == id)
+            return it.key();
     }
 
     return 0;
@@ -114,6 +204,7 @@ UserIdentity *IdentityManager::lookupHostname(const QString &hostname) const
 
 UserIdentity *IdentityManager::lookupNickname(const QString &nickname) const
 {
+    QMutexLocker locker(&m_mutex);
     for (QList<UserIdentity*>::ConstIterator it = m_identities.begin(); it != m_identities.end(); ++it)
     {
         if (QString::compare(nickname, (*it)->nickname(), Qt::CaseInsensitive) == 0)
@@ -125,6 +216,7 @@ UserIdentity *IdentityManager::lookupNickname(const QString &nickname) const
 
 UserIdentity *IdentityManager::lookupUniqueID(int uniqueID) const
 {
+    QMutexLocker locker(&m_mutex);
     for (QList<UserIdentity*>::ConstIterator it = m_identities.begin(); it != m_identities.end(); ++it)
     {
         if ((*it)->uniqueID == uniqueID)
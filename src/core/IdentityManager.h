@@ -34,13 +34,20 @@
 #define IDENTITYMANAGER_H
 
 #include <QObject>
+#include <QHash>
+#include <QMutex>
 #include "UserIdentity.h"
+#include "utils/OnionId.h"
+
+class QThread;
 
 class IdentityManager : public QObject
 {
     Q_OBJECT
     Q_DISABLE_COPY(IdentityManager)
 
+    Q_PROPERTY(QList<QObject*> identities READ identityObjects NOTIFY identityAdded)
+
 public:
     explicit IdentityManager(QObject *parent = 0);
     ~IdentityManager();
@@ -48,9 +55,27 @@ public:
     const QList<UserIdentity*> &identities() const { return m_identities; }
     UserIdentity *lookupNickname(const QString &nickname) const;
     UserIdentity *lookupHostname(const QString &hostname) const;
+    UserIdentity *lookupHostname(const OnionId &id) const;
     UserIdentity *lookupUniqueID(int uniqueID) const;
 
-    UserIdentity *createIdentity(const QString &serviceDirectory = QString(), const QString &nickname = QString());
+    /* Identities with the "workerThread" setting run in their own thread,
+     * along with their contacts and connections. The UI only interacts with
+     * them through the queued signals of IdentityManager. Returns 0 for
+     * identities on the main thread.
+     *
+     * Tor stays on the main thread: the HiddenService of an identity belongs
+     * to its TorControl, and TorSocket only reads the connectivity of
+     * TorControl, which is locked. */
+    QThread *identityThread(UserIdentity *identity) const { return m_threads.value(identity); }
+
+    /* Identities on the main thread, for the UI */
+    QList<QObject*> identityObjects() const;
+
+    /* Create a new identity with its own hidden service, which is published
+     * on the same Tor instance as the existing identities. The service
+     * directory defaults to "data-<id>". With "tor.keyPoolSize" set, the key
+     * is taken from KeyPool, so the contact ID is known immediately. */
+    Q_INVOKABLE UserIdentity *createIdentity(const QString &nickname = QString(), const QString &serviceDirectory = QString());
 
 signals:
     void identityAdded(UserIdentity *identity);
@@ -67,11 +92,17 @@ private slots:
     void onIncomingRequestRemoved(IncomingContactRequest *request);
 
 private:
+    /* Guards m_identities and m_hostnames, which are looked up from identity threads */
+    mutable QMutex m_mutex;
     QList<UserIdentity*> m_identities;
+    /* Written on each identity's thread as its service is created */
+    QHash<UserIdentity*,OnionId> m_hostnames;
+    QHash<UserIdentity*,QThread*> m_threads;
     int highestID;
 
     void loadFromSettings();
     void addIdentity(UserIdentity *identity);
+    void moveToWorkerThread(UserIdentity *identity);
 };
 
 extern IdentityManager *identityManager;
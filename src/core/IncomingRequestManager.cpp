@@ -38,15 +38,45 @@
 #include "utils/Useful.h"
 #include "protocol/Connection.h"
 #include "protocol/ContactRequestChannel.h"
+#include "protocol/ContactRequestProof.h"
 
 IncomingRequestManager::IncomingRequestManager(ContactsManager *c)
-    : QObject(c), contacts(c)
+    : QObject(c), contacts(c), m_blocklist(this)
+    , m_saveTimer(this)
+    , m_floodTimer(this)
+    , m_maxPending(DefaultMaxPending)
+    , m_rateLimit(DefaultRateLimit)
+    , m_flooded(false)
+    , m_refusedCount(0)
+    , m_proofEnabled(true)
+    , m_attemptWindowStart(0)
+    , m_attempts(0)
+    , m_previousAttempts(0)
 {
     connect(this, SIGNAL(requestAdded(IncomingContactRequest*)), this, SIGNAL(requestsChanged()));
     connect(this, SIGNAL(requestRemoved(IncomingContactRequest*)), this, SIGNAL(requestsChanged()));
 
+    m_clock.start();
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SaveDelay);
+    connect(&m_saveTimer, &QTimer::timeout, this, &IncomingRequestManager::saveRequests);
+    m_floodTimer.setSingleShot(true);
+    connect(&m_floodTimer, &QTimer::timeout, this, &IncomingRequestManager::updateFlooded);
+
     auto attachChannel = [this](Protocol::Channel *channel) {
         if (Protocol::ContactRequestChannel *req = qobject_cast<Protocol::ContactRequestChannel*>(channel)) {
+            // Blocked hosts are answered before their request is parsed or stored
+            OnionId id = req->connection()->authenticatedIdentity(Protocol::Connection::HiddenServiceAuth);
+            if (req->direction() == Protocol::Channel::Inbound && m_blocklist.contains(id)) {
+                qDebug() << "Rejecting contact request due to a blocklist match for" << id;
+                req->setResponseStatus(Protocol::Data::ContactRequest::Response::Rejected);
+                return;
+            }
+            if (req->direction() == Protocol::Channel::Inbound && !requestFromHostname(id)) {
+                int difficulty = recordAttempt();
+                if (difficulty > 0)
+                    req->setRequiredProof(difficulty);
+            }
             connect(req, &Protocol::ContactRequestChannel::requestReceived, this, &IncomingRequestManager::requestReceived);
         }
     };
@@ -59,9 +89,20 @@ IncomingRequestManager::IncomingRequestManager(ContactsManager *c)
     );
 }
 
+IncomingRequestManager::~IncomingRequestManager()
+{
+    saveRequests();
+}
+
 void IncomingRequestManager::loadRequests()
 {
-    SettingsObject settings(QStringLiteral("contactRequests"));
+    SettingsObject *identitySettings = contacts->identity->settings();
+    m_blocklist.load(identitySettings);
+    m_maxPending = qMax(identitySettings->read("maxPendingRequests", DefaultMaxPending).toInt(), 1);
+    m_rateLimit = qMax(identitySettings->read("requestRateLimit", DefaultRateLimit).toInt(), 1);
+    m_proofEnabled = identitySettings->read("requestProofOfWork", true).toBool();
+
+    SettingsObject settings(contacts->identity->settingsPath(QStringLiteral("contactRequests")));
 
     foreach (const QString &hostStr, settings.data().keys()) {
         QByteArray host = hostStr.toLatin1();
@@ -85,14 +126,13 @@ QList<QObject*> IncomingRequestManager::requestObjects() const
     return re;
 }
 
-IncomingContactRequest *IncomingRequestManager::requestFromHostname(const QByteArray &hostname)
+IncomingContactRequest *IncomingRequestManager::requestFromHostname(const OnionId &id)
 {
-    Q_ASSERT(hostname.endsWith(".onion"));
-
-    Q_ASSERT(hostname == hostname.toLower());
+    if (!id.isValid())
+        return 0;
 
     for (QList<IncomingContactRequest*>::ConstIterator it = m_requests.begin(); it != m_requests.end(); ++it)
-        if ((*it)->hostname() == hostname)
+        if ((*it)->onionId() == id)
             return *it;
 
     return 0;
@@ -108,42 +148,43 @@ void IncomingRequestManager::requestReceived()
 
     using namespace Protocol::Data::ContactRequest;
 
-    QString hostname = channel->connection()->authenticatedIdentity(Protocol::Connection::HiddenServiceAuth);
-    if (hostname.isEmpty() || !hostname.endsWith(QStringLiteral(".onion"))) {
+    OnionId id = channel->connection()->authenticatedIdentity(Protocol::Connection::HiddenServiceAuth);
+    if (!id.isValid()) {
         BUG() << "Incoming contact request received but connection isn't authenticated";
         channel->setResponseStatus(Response::Error);
         return;
     }
 
-    if (isHostnameRejected(hostname.toLatin1())) {
-        qDebug() << "Rejecting contact request due to a blacklist match for" << hostname;
-        channel->setResponseStatus(Response::Rejected);
-        return;
-    }
-
-    if (identityManager->lookupHostname(hostname)) {
+    QByteArray hostname = id.hostname().toLatin1();
+    if (identityManager->lookupHostname(id)) {
         qDebug() << "Rejecting contact request from a local identity (which shouldn't have been allowed)";
         channel->setResponseStatus(Response::Error);
         return;
     }
 
-    IncomingContactRequest *request = requestFromHostname(hostname.toLatin1());
+    IncomingContactRequest *request = requestFromHostname(id);
     bool newRequest = false;
 
+    if (!request && !recordNewRequest()) {
+        // Error rather than Rejected, so the peer may try again after the flood
+        channel->setResponseStatus(Response::Error);
+        return;
+    }
+
     if (request) {
         // Update the existing request
         request->setChannel(channel);
-        request->renew();
     } else {
         newRequest = true;
-        request = new IncomingContactRequest(this, hostname.toLatin1());
+        request = new IncomingContactRequest(this, hostname);
         request->setChannel(channel);
     }
+    request->renew();
 
     /* It shouldn't be possible to get an incoming contact request for a known
      * contact, including an outgoing request. Those are implicitly accepted at
      * a different level. */
-    if (contacts->lookupHostname(hostname)) {
+    if (contacts->lookupHostname(id)) {
         BUG() << "Created an inbound contact request matching a known contact; this shouldn't be allowed";
         return;
     }
@@ -151,35 +192,126 @@ void IncomingRequestManager::requestReceived()
     qDebug() << "Recording" << (newRequest ? "new" : "existing") << "incoming contact request from" << hostname;
     channel->setResponseStatus(Response::Pending);
 
-    request->save();
+    scheduleSave(request);
     if (newRequest) {
         m_requests.append(request);
         emit requestAdded(request);
+        enforceLimit(request);
     }
 }
 
-void IncomingRequestManager::removeRequest(IncomingContactRequest *request)
+bool IncomingRequestManager::recordNewRequest()
 {
-    if (m_requests.removeOne(request))
-        emit requestRemoved(request);
+    qint64 now = m_clock.elapsed();
+    while (!m_recentRequests.isEmpty() && now - m_recentRequests.head() >= RateWindow * 1000)
+        m_recentRequests.dequeue();
 
-    request->deleteLater();
+    if (m_recentRequests.size() < m_rateLimit) {
+        m_recentRequests.enqueue(now);
+        return true;
+    }
+
+    // The flood ends once a full window passes without refused requests
+    m_floodTimer.start(RateWindow * 1000);
+    if (!m_flooded) {
+        qWarning() << "More than" << m_rateLimit << "contact requests in" << RateWindow
+                   << "seconds; refusing new requests";
+        m_flooded = true;
+        m_refusedCount = 0;
+        emit floodedChanged();
+    }
+    m_refusedCount++;
+    emit refusedCountChanged();
+    return false;
 }
 
-void IncomingRequestManager::addRejectedHost(const QByteArray &hostname)
+int IncomingRequestManager::recordAttempt()
 {
-    SettingsObject *settings = contacts->identity->settings();
-    QJsonArray blacklist = settings->read<QJsonArray>("hostnameBlacklist");
-    if (!blacklist.contains(QString::fromLatin1(hostname))) {
-        blacklist.append(QString::fromLatin1(hostname));
-        settings->write("hostnameBlacklist", blacklist);
+    qint64 now = m_clock.elapsed();
+    qint64 window = RateWindow * 1000;
+    if (now - m_attemptWindowStart >= window) {
+        m_previousAttempts = (now - m_attemptWindowStart < window * 2) ? m_attempts : 0;
+        m_attempts = 0;
+        m_attemptWindowStart = now;
     }
+    m_attempts++;
+
+    if (!m_proofEnabled)
+        return 0;
+    return Protocol::ContactRequestProof::difficultyForRate(qMax(m_attempts, m_previousAttempts), m_rateLimit);
 }
 
-bool IncomingRequestManager::isHostnameRejected(const QByteArray &hostname) const
+void IncomingRequestManager::updateFlooded()
 {
-    QJsonArray blacklist = contacts->identity->settings()->read<QJsonArray>("hostnameBlacklist");
-    return blacklist.contains(QString::fromLatin1(hostname));
+    if (!m_flooded)
+        return;
+
+    qWarning() << "Contact request flood has ended," << m_refusedCount << "new requests were refused";
+    m_flooded = false;
+    emit floodedChanged();
+}
+
+void IncomingRequestManager::enforceLimit(IncomingContactRequest *keep)
+{
+    while (m_requests.size() > m_maxPending) {
+        // Drop requests without a connection, then the least recently renewed
+        IncomingContactRequest *victim = 0;
+        foreach (IncomingContactRequest *request, m_requests) {
+            if (request == keep)
+                continue;
+            if (!victim) {
+                victim = request;
+                continue;
+            }
+
+            if (request->hasActiveConnection() != victim->hasActiveConnection()) {
+                if (!request->hasActiveConnection())
+                    victim = request;
+            } else if (request->lastRequestDate() < victim->lastRequestDate()) {
+                victim = request;
+            }
+        }
+
+        if (!victim)
+            break;
+        victim->drop();
+    }
+}
+
+void IncomingRequestManager::scheduleSave(IncomingContactRequest *request)
+{
+    m_unsaved.insert(request);
+    if (!m_saveTimer.isActive())
+        m_saveTimer.start();
+}
+
+void IncomingRequestManager::scheduleRemoval(const QString &settingsKey)
+{
+    m_unsavedRemovals.append(settingsKey);
+    if (!m_saveTimer.isActive())
+        m_saveTimer.start();
+}
+
+void IncomingRequestManager::saveRequests()
+{
+    m_saveTimer.stop();
+    // Removals go first, in case the same host has made a new request since
+    foreach (const QString &key, m_unsavedRemovals)
+        SettingsObject(key).undefine();
+    m_unsavedRemovals.clear();
+
+    foreach (IncomingContactRequest *request, m_unsaved)
+        request->save();
+    m_unsaved.clear();
+}
+
+void IncomingRequestManager::removeRequest(IncomingContactRequest *request)
+{
+    m_unsaved.remove(request);
+    if (m_requests.removeOne(request))
+        emit requestRemoved(request);
+
+    request->deleteLater();
 }
 
 IncomingContactRequest::IncomingContactRequest(IncomingRequestManager *m, const QByteArray &h
@@ -187,6 +319,7 @@ IncomingContactRequest::IncomingContactRequest(IncomingRequestManager *m, const
     : QObject(m)
     , manager(m)
     , m_hostname(h)
+    , m_onionId(OnionId::fromString(QString::fromLatin1(h)))
 {
     Q_ASSERT(manager);
     Q_ASSERT(m_hostname.endsWith(".onion"));
@@ -198,7 +331,7 @@ QString IncomingContactRequest::settingsKey() const
 {
     QString key = QString(QLatin1String(m_hostname));
     key.chop(QStringLiteral(".onion").size());
-    return QStringLiteral("contactRequests.%1").arg(key);
+    return manager->contacts->identity->settingsPath(QStringLiteral("contactRequests.%1").arg(key));
 }
 
 void IncomingContactRequest::load()
@@ -347,6 +480,20 @@ void IncomingContactRequest::accept(ContactUser *user)
     user->updateStatus();
 }
 
+void IncomingContactRequest::drop()
+{
+    qDebug() << "Dropping contact request from" << m_hostname << "to stay within the pending request limit";
+
+    if (connection) {
+        connection->close();
+        connection.clear();
+    }
+
+    // Floods drop many requests at once, so their settings are removed in a batch
+    manager->scheduleRemoval(settingsKey());
+    manager->removeRequest(this);
+}
+
 void IncomingContactRequest::reject()
 {
     qDebug() << "Rejecting contact request from" << m_hostname;
@@ -364,7 +511,7 @@ void IncomingContactRequest::reject()
     // Remove the request from the config
     removeRequest();
     // Blacklist the host to prevent repeat requests
-    manager->addRejectedHost(m_hostname);
+    manager->blocklist()->add(m_onionId);
     // Remove the request from the manager
     manager->removeRequest(this);
 
@@ -36,7 +36,14 @@
 #include <QObject>
 #include <QPointer>
 #include <QDateTime>
+#include <QSet>
+#include <QQueue>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
 #include "protocol/Connection.h"
+#include "utils/OnionId.h"
+#include "HostnameBlocklist.h"
 
 class IncomingRequestManager;
 class ContactsManager;
@@ -59,12 +66,15 @@ class IncomingContactRequest : public QObject
     Q_PROPERTY(QDateTime requestDate READ requestDate CONSTANT)
     Q_PROPERTY(QDateTime lastRequestDate READ lastRequestDate CONSTANT)
 
+    friend class IncomingRequestManager;
+
 public:
     IncomingRequestManager * const manager;
 
     IncomingContactRequest(IncomingRequestManager *manager, const QByteArray &hostname);
 
     QByteArray hostname() const { return m_hostname; }
+    OnionId onionId() const { return m_onionId; }
     QString contactId() const;
 
     QByteArray remoteSecret() const { return m_remoteSecret; }
@@ -99,11 +109,14 @@ signals:
 private:
     QPointer<Protocol::Connection> connection;
     QByteArray m_hostname;
+    OnionId m_onionId;
     QByteArray m_remoteSecret;
     QString m_message, m_nickname;
     QDateTime m_requestDate, m_lastRequestDate;
 
     void removeRequest();
+    // Remove the request without an answer when there are too many pending
+    void drop();
 };
 
 /* IncomingRequestManager handles all incoming contact requests under a
@@ -115,6 +128,19 @@ private:
  *
  * Each request has an IncomingContactRequest instance. This manager handles
  * those instances.
+ *
+ * Unsolicited requests are limited. At most "requestRateLimit" new requests
+ * are recorded within RateWindow seconds; beyond that the manager is flooded,
+ * and further new requests are answered with an error without being stored,
+ * only adding to refusedCount. The flood ends once a full window passes
+ * without a refused request. At most "maxPendingRequests" are kept, dropping
+ * requests without a connection first, then the oldest. Requests, including
+ * the removal of dropped requests, are saved in batches every SaveDelay
+ * milliseconds.
+ *
+ * Once new request channels arrive faster than the rate limit, they must also
+ * carry a proof of work (see Protocol::ContactRequestProof) of a difficulty
+ * that grows with the rate, unless "requestProofOfWork" is false.
  */
 class IncomingRequestManager : public QObject
 {
@@ -122,40 +148,83 @@ class IncomingRequestManager : public QObject
     Q_DISABLE_COPY(IncomingRequestManager)
 
     Q_PROPERTY(QList<QObject*> requests READ requestObjects NOTIFY requestsChanged)
+    Q_PROPERTY(HostnameBlocklist* blocklist READ blocklist CONSTANT)
+    Q_PROPERTY(bool flooded READ isFlooded NOTIFY floodedChanged)
+    Q_PROPERTY(int refusedCount READ refusedCount NOTIFY refusedCountChanged)
 
     friend class IncomingContactRequest;
 
 public:
+    static const int DefaultMaxPending = 200;
+    static const int DefaultRateLimit = 20;
+    static const int RateWindow = 60;
+    static const int SaveDelay = 1000;
+
     ContactsManager * const contacts;
 
     explicit IncomingRequestManager(ContactsManager *contactsManager);
+    virtual ~IncomingRequestManager();
 
     QList<QObject*> requestObjects() const;
     QList<IncomingContactRequest*> requests() const { return m_requests; }
 
-    /* Hostname is an onion address, including the '.onion' suffix */
-    IncomingContactRequest *requestFromHostname(const QByteArray &hostname);
+    IncomingContactRequest *requestFromHostname(const OnionId &id);
 
     /* Called by ContactsManager to trigger loading past requests from the
      * configuration. */
     void loadRequests();
 
-    /* Blacklist a host for immediate rejection in the future */
-    void addRejectedHost(const QByteArray &hostname);
-    bool isHostnameRejected(const QByteArray &hostname) const;
+    /* Hosts whose requests are rejected as soon as the channel is opened */
+    HostnameBlocklist *blocklist() { return &m_blocklist; }
+
+    bool isFlooded() const { return m_flooded; }
+    /* New requests refused since the latest flood began */
+    int refusedCount() const { return m_refusedCount; }
+
+public slots:
+    /* Write requests with unsaved changes now, rather than after SaveDelay */
+    void saveRequests();
 
 signals:
     void requestAdded(IncomingContactRequest *request);
     void requestRemoved(IncomingContactRequest *request);
     void requestsChanged();
+    void floodedChanged();
+    void refusedCountChanged();
 
 private slots:
     void requestReceived();
+    void updateFlooded();
 
 private:
     QList<IncomingContactRequest*> m_requests;
+    HostnameBlocklist m_blocklist;
+    QSet<IncomingContactRequest*> m_unsaved;
+    // Settings keys of dropped requests, removed with the next save
+    QStringList m_unsavedRemovals;
+    // Times of the new requests recorded within the last window
+    QQueue<qint64> m_recentRequests;
+    QElapsedTimer m_clock;
+    QTimer m_saveTimer;
+    QTimer m_floodTimer;
+    int m_maxPending;
+    int m_rateLimit;
+    bool m_flooded;
+    int m_refusedCount;
+    bool m_proofEnabled;
+    // Contact request channels from unknown hosts, in this and the previous window
+    qint64 m_attemptWindowStart;
+    int m_attempts;
+    int m_previousAttempts;
 
     void removeRequest(IncomingContactRequest *request);
+    void scheduleSave(IncomingContactRequest *request);
+    void scheduleRemoval(const QString &settingsKey);
+    // Record a new request, returning false if it's over the rate limit and must be refused
+    bool recordNewRequest();
+    // Record a request channel from an unknown host, returning the proof of work difficulty to require
+    int recordAttempt();
+    void enforceLimit(IncomingContactRequest *keep);
 };
 
 #endif // INCOMINGREQUESTMANAGER_H
@@ -37,6 +37,7 @@
 #include "IncomingRequestManager.h"
 #include "utils/Useful.h"
 #include "protocol/ContactRequestChannel.h"
+#include "protocol/ContactRequestProof.h"
 #include <QDebug>
 
 OutgoingContactRequest *OutgoingContactRequest::createNewRequest(ContactUser *user, const QString &myNickname,
@@ -57,6 +58,8 @@ OutgoingContactRequest *OutgoingContactRequest::createNewRequest(ContactUser *us
 OutgoingContactRequest::OutgoingContactRequest(ContactUser *u)
     : QObject(u), user(u)
     , m_settings(new SettingsObject(u->settings(), QStringLiteral("request"), this))
+    , m_proofSolver(0)
+    , m_proofNonce(0)
 {
     emit user->identity->contacts.outgoingRequestAdded(this);
 
@@ -102,9 +105,7 @@ void OutgoingContactRequest::attemptAutoAccept()
 {
     /* Check if there is an existing incoming request that matches this one; if so, treat this as accepted
      * automatically and accept that incoming request for this user */
-    QByteArray hostname = user->hostname().toLatin1();
-
-    IncomingContactRequest *incomingReq = user->identity->contacts.incomingRequests.requestFromHostname(hostname);
+    IncomingContactRequest *incomingReq = user->identity->contacts.incomingRequests.requestFromHostname(user->onionId());
     if (incomingReq)
     {
         qDebug() << "Automatically accepting an incoming contact request matching a newly created outgoing request";
@@ -130,6 +131,8 @@ void OutgoingContactRequest::sendRequest(Protocol::Connection *connection)
     Protocol::ContactRequestChannel *channel = new Protocol::ContactRequestChannel(Protocol::Channel::Outbound, connection);
     connect(channel, &Protocol::ContactRequestChannel::requestStatusChanged,
             this, &OutgoingContactRequest::requestStatusChanged);
+    connect(channel, &Protocol::ContactRequestChannel::proofRequired,
+            this, &OutgoingContactRequest::solveProof);
 
     // On any final response, the channel will be closed. Unless the purpose has been
     // changed (to KnownContact, on accept), close the connection at that time. That
@@ -149,6 +152,8 @@ void OutgoingContactRequest::sendRequest(Protocol::Connection *connection)
         channel->setMessage(message());
     if (!myNickname().isEmpty())
         channel->setNickname(myNickname());
+    if (!m_proofSalt.isEmpty())
+        channel->setProof(m_proofSalt, m_proofNonce);
 
     if (!channel->openChannel()) {
         BUG() << "Channel for outgoing contact request failed";
@@ -156,6 +161,38 @@ void OutgoingContactRequest::sendRequest(Protocol::Connection *connection)
     }
 }
 
+void OutgoingContactRequest::solveProof(int difficulty, const QByteArray &salt)
+{
+    // The connection is closed after a challenge, and the solution is sent when the request is retried
+    if (m_proofSolver) {
+        if (m_proofSolver->salt() == salt && m_proofSolver->difficulty() >= difficulty)
+            return;
+        delete m_proofSolver;
+    }
+
+    OnionId self = OnionId::fromString(user->identity->hostname());
+    qDebug() << "Solving a proof of work of difficulty" << difficulty << "for a contact request";
+    m_proofSolver = new Protocol::ContactRequestProofSolver(difficulty, self, salt, this);
+    connect(m_proofSolver, &QThread::finished, this, &OutgoingContactRequest::proofSolved);
+    m_proofSolver->start(QThread::LowPriority);
+}
+
+void OutgoingContactRequest::proofSolved()
+{
+    if (!m_proofSolver || sender() != m_proofSolver)
+        return;
+
+    if (m_proofSolver->isSolved()) {
+        m_proofSalt = m_proofSolver->salt();
+        m_proofNonce = m_proofSolver->nonce();
+    } else {
+        qWarning() << "Failed to solve proof of work for a contact request";
+    }
+
+    m_proofSolver->deleteLater();
+    m_proofSolver = 0;
+}
+
 void OutgoingContactRequest::removeRequest()
 {
     if (user->connection()) {
@@ -34,6 +34,7 @@
 #define OUTGOINGCONTACTREQUEST_H
 
 #include <QObject>
+#include <QByteArray>
 #include "utils/Settings.h"
 
 class ContactUser;
@@ -41,6 +42,7 @@ class ContactRequestClient;
 
 namespace Protocol {
     class Connection;
+    class ContactRequestProofSolver;
 }
 
 class OutgoingContactRequest : public QObject
@@ -92,9 +94,15 @@ signals:
 
 private slots:
     void requestStatusChanged(int status);
+    void solveProof(int difficulty, const QByteArray &salt);
+    void proofSolved();
 
 private:
     SettingsObject *m_settings;
+    Protocol::ContactRequestProofSolver *m_proofSolver;
+    // Solution to the peer's last challenge, sent with the next attempt
+    QByteArray m_proofSalt;
+    quint64 m_proofNonce;
 
     void setStatus(Status newStatus);
     void removeRequest();
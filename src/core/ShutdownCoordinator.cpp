@@ -0,0 +1,110 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ShutdownCoordinator.h"
+#include "IdentityManager.h"
+#include "tor/TorManager.h"
+#include "utils/Settings.h"
+#include <QEventLoop>
+#include <QDebug>
+
+ShutdownCoordinator::ShutdownCoordinator(SettingsFile *settings, QObject *parent)
+    : PendingOperation(parent)
+    , m_settings(settings)
+    , m_deadline(this)
+    , m_pendingSteps(0)
+{
+    m_deadline.setSingleShot(true);
+    connect(&m_deadline, &QTimer::timeout, this, &ShutdownCoordinator::deadlineReached);
+}
+
+void ShutdownCoordinator::start(int deadline)
+{
+    if (m_deadline.isActive() || isFinished())
+        return;
+
+    qDebug() << "Shutting down";
+    m_deadline.start(deadline);
+
+    // Hold a step until everything is started, in case some finish immediately
+    m_pendingSteps = 1;
+
+    // Save anything pending first, so it is written even if later steps time out
+    if (m_settings)
+        m_settings->sync();
+
+    if (identityManager) {
+        foreach (UserIdentity *identity, identityManager->identities()) {
+            m_pendingSteps++;
+            connect(identity, &UserIdentity::connectionsClosed, this, &ShutdownCoordinator::stepFinished);
+            QMetaObject::invokeMethod(identity, "closeConnections", Qt::QueuedConnection);
+        }
+    }
+
+    Tor::TorManager *torManager = Tor::TorManager::instance();
+    m_pendingSteps++;
+    connect(torManager, &Tor::TorManager::stopped, this, &ShutdownCoordinator::stepFinished);
+    torManager->requestStop();
+
+    stepFinished();
+}
+
+void ShutdownCoordinator::exec()
+{
+    start();
+    if (isFinished())
+        return;
+
+    QEventLoop loop;
+    connect(this, &PendingOperation::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+void ShutdownCoordinator::stepFinished()
+{
+    if (isFinished() || --m_pendingSteps > 0)
+        return;
+
+    m_deadline.stop();
+    // Closing connections may have updated contacts
+    if (m_settings)
+        m_settings->sync();
+    finishWithSuccess();
+}
+
+void ShutdownCoordinator::deadlineReached()
+{
+    qWarning() << "Shutdown did not finish before the deadline;" << m_pendingSteps << "steps abandoned";
+    if (m_settings)
+        m_settings->sync();
+    finishWithError(QStringLiteral("Shutdown timed out"));
+}
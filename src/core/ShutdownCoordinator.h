@@ -0,0 +1,74 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHUTDOWNCOORDINATOR_H
+#define SHUTDOWNCOORDINATOR_H
+
+#include "utils/PendingOperation.h"
+#include <QTimer>
+
+class SettingsFile;
+
+/* Shut down identities, connections, and Tor without blocking
+ *
+ * Settings and pending contact requests are saved, connections of every
+ * identity are gracefully closed, and bundled Tor processes are asked to
+ * exit, all at once. The operation
+ * finishes when every step is done, or with an error when the deadline
+ * passes first; anything still pending is then abandoned.
+ */
+class ShutdownCoordinator : public PendingOperation
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ShutdownCoordinator)
+
+public:
+    static const int DefaultDeadline = 3000;
+
+    explicit ShutdownCoordinator(SettingsFile *settings, QObject *parent = 0);
+
+    /* Start shutdown, finishing within deadline milliseconds */
+    void start(int deadline = DefaultDeadline);
+    /* Start if necessary, and run an event loop until finished */
+    void exec();
+
+private slots:
+    void stepFinished();
+    void deadlineReached();
+
+private:
+    SettingsFile *m_settings;
+    QTimer m_deadline;
+    int m_pendingSteps;
+};
+
+#endif // SHUTDOWNCOORDINATOR_H
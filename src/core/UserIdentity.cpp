@@ -32,14 +32,19 @@
 
 #include "UserIdentity.h"
 #include "tor/TorControl.h"
+#include "tor/TorManager.h"
 #include "tor/HiddenService.h"
 #include "core/ContactIDValidator.h"
 #include "protocol/Connection.h"
 #include "utils/Useful.h"
+#include "utils/KeyPool.h"
+#include "utils/UnixSocket.h"
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QBuffer>
 #include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
 
 using namespace Protocol;
 
@@ -50,15 +55,36 @@ UserIdentity::UserIdentity(int id, QObject *parent)
     , m_settings(0)
     , m_hiddenService(0)
     , m_incomingServer(0)
+    , m_incomingSocketServer(0)
+    , m_closingConnections(0)
 {
-    m_settings = new SettingsObject(QStringLiteral("identity"), this);
+    m_settings = new SettingsObject(settingsPath(QStringLiteral("identity")), this);
     connect(m_settings, &SettingsObject::modified, this, &UserIdentity::onSettingsModified);
 
     QString dir = m_settings->read("dataDirectory", QString::fromLatin1("data-%1").arg(uniqueID)).toString();
 
     m_hiddenService = new Tor::HiddenService(dir, this);
+    Tor::TorControl *serviceControl = 0;
+    if (m_settings->read("nonAnonymousService").toBool()) {
+        serviceControl = Tor::TorManager::instance()->singleHopControl();
+        if (serviceControl) {
+            qWarning("Identity %d is using a NON-ANONYMOUS single-hop hidden service", uniqueID);
+            m_hiddenService->setSingleHop(true);
+        } else {
+            qWarning("Identity %d requests a non-anonymous service, but that requires a bundled tor; "
+                     "using a normal hidden service", uniqueID);
+        }
+    }
+    if (!serviceControl)
+        serviceControl = Tor::TorManager::instance()->controlForKey(dir.toUtf8(), Tor::TorManager::ServiceKey);
     connect(m_hiddenService, SIGNAL(statusChanged(int,int)), SLOT(onStatusChanged(int,int)));
 
+    // Resume from the introduction points TorControl last tuned this service to
+    if (SettingsObject(QStringLiteral("tor")).read("adaptiveIntroPoints").toBool())
+        m_hiddenService->setIntroductionPoints(m_settings->read("introductionPoints").toInt());
+    connect(m_hiddenService, &Tor::HiddenService::introductionPointsChanged, this,
+        [this](int count) { m_settings->write("introductionPoints", count); });
+
     // Generally, these are not used, and we bind to localhost and port 0
     // for an automatic (and portable) selection.
     QHostAddress address(m_settings->read("localListenAddress").toString());
@@ -66,12 +92,41 @@ UserIdentity::UserIdentity(int id, QObject *parent)
         address = QHostAddress::LocalHost;
     quint16 port = (quint16)m_settings->read("localListenPort").toInt();
 
-    if (!m_settings->read("initializing").toBool() && m_hiddenService->status() == Tor::HiddenService::NotCreated)
+    bool initializing = m_settings->read("initializing").toBool();
+
+    // New identities are created with, and existing ones moved to, a v3 service with "onionVersion"
+    if (m_settings->read("onionVersion").toInt() >= 3 && m_hiddenService->version() < 3 &&
+        (initializing || m_hiddenService->status() != Tor::HiddenService::NotCreated))
+    {
+        if (!CryptoKey::hasEd25519Support())
+            qWarning("Identity %d requests a v3 hidden service, which is not supported by this build", uniqueID);
+        else if (!m_hiddenService->createEd25519Key())
+            qWarning("Failed to create a v3 hidden service for identity %d", uniqueID);
+        else {
+            qDebug("Identity %d is using a v3 hidden service", uniqueID);
+            if (m_hiddenService->legacyCryptoKey().isLoaded())
+                m_settings->write("legacyServiceUntil", QDateTime::currentDateTime().addDays(LegacyServiceDays));
+        }
+    }
+
+    // After moving to v3, the v2 service stays published for contacts that haven't connected since
+    CryptoKey legacyKey = m_hiddenService->legacyCryptoKey();
+    QDateTime legacyUntil = m_settings->read<QDateTime>("legacyServiceUntil");
+    if (legacyKey.isLoaded() && legacyUntil.isValid() && QDateTime::currentDateTime() < legacyUntil) {
+        m_hiddenService->setPublishLegacyService(true);
+        m_legacyHostname = legacyKey.torServiceID() + QStringLiteral(".onion");
+    }
+
+    if (!initializing && m_hiddenService->status() == Tor::HiddenService::NotCreated)
     {
         qWarning("Hidden service data for identity %d in %s does not exist", uniqueID, qPrintable(dir));
         delete m_hiddenService;
         m_hiddenService = 0;
     }
+    else if (SettingsObject(QStringLiteral("tor")).read("unixSockets").toBool() && listenUnixSocket())
+    {
+        publishService(serviceControl);
+    }
     else
     {
         m_incomingServer = new QTcpServer(this);
@@ -83,26 +138,52 @@ UserIdentity::UserIdentity(int id, QObject *parent)
         connect(m_incomingServer, &QTcpServer::newConnection, this, &UserIdentity::onIncomingConnection);
 
         m_hiddenService->addTarget(9878, m_incomingServer->serverAddress(), m_incomingServer->serverPort());
-        torControl->addHiddenService(m_hiddenService);
+        publishService(serviceControl);
     }
 
     contacts.loadFromSettings();
 }
 
+/* The service is handed to the TorControl that publishes it, and stays on
+ * its thread if this identity is moved to a worker thread. Its signals reach
+ * the identity through queued connections. */
+void UserIdentity::publishService(Tor::TorControl *control)
+{
+    m_hiddenService->setParent(control);
+    control->addHiddenService(m_hiddenService);
+}
+
 UserIdentity *UserIdentity::createIdentity(int uniqueID, const QString &dataDirectory)
 {
-    // There is actually no support for multiple identities currently.
-    Q_ASSERT(uniqueID == 0);
-    if (uniqueID != 0)
+    Q_ASSERT(uniqueID >= 0);
+    if (uniqueID < 0)
         return 0;
 
-    SettingsObject settings(QStringLiteral("identity"));
+    SettingsObject settings(settingsPath(uniqueID, QStringLiteral("identity")));
     settings.write("initializing", true);
+    int onionVersion = SettingsObject(QStringLiteral("tor")).read("onionVersion").toInt();
+    if (onionVersion)
+        settings.write("onionVersion", onionVersion);
     if (dataDirectory.isEmpty())
         settings.write("dataDirectory", QString::fromLatin1("data-%1").arg(uniqueID));
     else
         settings.write("dataDirectory", dataDirectory);
 
+    // New identities take a pregenerated key, so they have an ID and can be published without waiting on tor
+    if (KeyPool::instance()->isEnabled())
+    {
+        Tor::HiddenService service(settings.read("dataDirectory").toString());
+        if (service.status() == Tor::HiddenService::NotCreated)
+        {
+            bool v3 = onionVersion >= 3 && CryptoKey::hasEd25519Support();
+            KeyPool::Key key = KeyPool::instance()->takeKey(v3 ? CryptoKey::Ed25519Key : CryptoKey::RSAKey);
+            if (!key.key.isLoaded() || !service.createFromKey(key.key, key.serviceID))
+                qWarning("Failed to create a hidden service from a pooled key for identity %d", uniqueID);
+            else
+                settings.write("initializing", QJsonValue::Undefined); // Already created, so onStatusChanged won't clear it
+        }
+    }
+
     return new UserIdentity(uniqueID);
 }
 
@@ -111,6 +192,13 @@ SettingsObject *UserIdentity::settings()
     return m_settings;
 }
 
+QString UserIdentity::settingsPath(int uniqueID, const QString &key)
+{
+    if (uniqueID == 0)
+        return key;
+    return QStringLiteral("identities.%1.%2").arg(uniqueID).arg(key);
+}
+
 QString UserIdentity::hostname() const
 {
     return m_hiddenService ? m_hiddenService->hostname() : QString();
@@ -153,6 +241,43 @@ bool UserIdentity::isServiceOnline() const
     return m_hiddenService && m_hiddenService->status() == Tor::HiddenService::Online;
 }
 
+bool UserIdentity::isSingleHopService() const
+{
+    return m_hiddenService && m_hiddenService->isSingleHop();
+}
+
+/* Listen for connections from Tor on a unix socket, which avoids loopback TCP.
+ * The socket is in a directory only accessible to the user; if that isn't
+ * possible, or the path is too long, the TCP listener is used instead. */
+bool UserIdentity::listenUnixSocket()
+{
+    QString socketDir = QFileInfo(SettingsObject::defaultFile()->filePath()).absolutePath() + QStringLiteral("/sockets");
+    QString socketPath = socketDir + QStringLiteral("/identity-%1.sock").arg(uniqueID);
+
+    QString error;
+    if (!unixSocketPathUsable(socketPath)) {
+        qWarning() << "Cannot use unix socket for identity" << uniqueID << "- unsupported, or path is too long";
+        return false;
+    }
+
+    if (!ensurePrivateSocketDirectory(socketDir, &error)) {
+        qWarning() << "Cannot use unix socket for identity" << uniqueID << "-" << error;
+        return false;
+    }
+
+    m_incomingSocketServer = new UnixSocketServer(this);
+    if (!m_incomingSocketServer->listenPath(socketPath)) {
+        qWarning() << "Failed to open incoming unix socket:" << m_incomingSocketServer->errorString();
+        delete m_incomingSocketServer;
+        m_incomingSocketServer = 0;
+        return false;
+    }
+
+    connect(m_incomingSocketServer, &QLocalServer::newConnection, this, &UserIdentity::onIncomingConnection);
+    m_hiddenService->addTarget(9878, m_incomingSocketServer->fullServerName());
+    return true;
+}
+
 /* Handle an incoming connection to this service
  *
  * A Protocol::Connection is created to handle this socket. The
@@ -166,37 +291,75 @@ bool UserIdentity::isServiceOnline() const
  */
 void UserIdentity::onIncomingConnection()
 {
-    while (m_incomingServer->hasPendingConnections()) {
-        QTcpSocket *socket = m_incomingServer->nextPendingConnection();
+    while (m_incomingServer && m_incomingServer->hasPendingConnections())
+        handleIncomingSocket(m_incomingServer->nextPendingConnection());
+    while (m_incomingSocketServer && m_incomingSocketServer->hasPendingSockets())
+        handleIncomingSocket(m_incomingSocketServer->nextPendingSocket());
+}
 
-        /* The localHostname property is used by Connection to determine the
-         * server onion hostname that this socket is connected to, which is
-         * used by the serverHostname() method.
-         */
-        socket->setProperty("localHostname", m_hiddenService->hostname());
+void UserIdentity::handleIncomingSocket(QTcpSocket *socket)
+{
+    /* The localHostname property is used by Connection to determine the
+     * server onion hostname that this socket is connected to, which is
+     * used by the serverHostname() method.
+     */
+    socket->setProperty("localHostname", m_hiddenService->hostname());
+    if (!m_legacyHostname.isEmpty())
+        socket->setProperty("localLegacyHostname", m_legacyHostname);
+
+    qDebug() << "Accepted new incoming connection";
+    Connection *conn = new Connection(socket, Connection::ServerSide, this);
+    Q_ASSERT(socket->parent());
+
+    // The accept rate is used to tune the service's introduction points
+    m_hiddenService->connectionAccepted();
+
+    // Delete connection when closed, if it's still owned by this object
+    connect(conn, &Connection::closed, this,
+        [this,conn]() {
+            if (conn->parent() == this) {
+                qDebug() << "Deleting closed incoming connection that was never claimed by an owner";
+                conn->deleteLater();
+            }
+        }
+    );
 
-        qDebug() << "Accepted new incoming connection";
-        Connection *conn = new Connection(socket, Connection::ServerSide, this);
-        Q_ASSERT(socket->parent());
+    connect(conn, &Connection::authenticated, this,
+        [this,conn](Connection::AuthenticationType type) {
+            if (type == Connection::HiddenServiceAuth)
+                handleIncomingAuthedConnection(conn);
+        }
+    );
 
-        // Delete connection when closed, if it's still owned by this object
-        connect(conn, &Connection::closed, this,
-            [this,conn]() {
-                if (conn->parent() == this) {
-                    qDebug() << "Deleting closed incoming connection that was never claimed by an owner";
-                    conn->deleteLater();
-                }
-            }
-        );
+    emit incomingConnection(conn);
+}
+
+void UserIdentity::closeConnections()
+{
+    // The identity isn't destroyed at exit, so batched requests are written here
+    contacts.incomingRequests.saveRequests();
+
+    // Contacts, requests, and unclaimed incoming connections are all descendants
+    QList<Connection*> connections;
+    foreach (Connection *conn, findChildren<Connection*>()) {
+        if (conn->isConnected())
+            connections.append(conn);
+    }
+
+    m_closingConnections = connections.size();
+    if (!m_closingConnections) {
+        emit connectionsClosed();
+        return;
+    }
 
-        connect(conn, &Connection::authenticated, this,
-            [this,conn](Connection::AuthenticationType type) {
-                if (type == Connection::HiddenServiceAuth)
-                    handleIncomingAuthedConnection(conn);
+    foreach (Connection *conn, connections) {
+        connect(conn, &Connection::closed, this,
+            [this]() {
+                if (--m_closingConnections == 0)
+                    emit connectionsClosed();
             }
         );
-
-        emit incomingConnection(conn);
+        conn->close();
     }
 }
 
@@ -205,13 +368,22 @@ void UserIdentity::handleIncomingAuthedConnection(Connection *conn)
     if (conn->purpose() != Connection::Purpose::Unknown)
         return;
 
-    QString clientName = conn->authenticatedIdentity(Connection::HiddenServiceAuth);
-    if (clientName.isEmpty()) {
+    OnionId clientName = conn->authenticatedIdentity(Connection::HiddenServiceAuth);
+    if (!clientName.isValid()) {
         BUG() << "Called to handle incoming authed connection without any authed name";
         return;
     }
 
     ContactUser *user = contacts.lookupHostname(clientName);
+    if (!user) {
+        // A contact that moved to a v3 identity also proves its previous hostname
+        OnionId legacyName = conn->authenticatedIdentity(Connection::LegacyHiddenServiceAuth);
+        if (legacyName.isValid() && (user = contacts.lookupHostname(legacyName))) {
+            qDebug() << "Contact" << user->uniqueID << "moved from" << legacyName << "to" << clientName;
+            user->setHostname(clientName.hostname());
+        }
+    }
+
     if (!user) {
         // This client can start a contact request, for example. The purpose stays unknown, and the
         // connection will be killed if the purpose isn't changed before the timeout.
@@ -40,6 +40,7 @@
 namespace Tor
 {
     class HiddenService;
+    class TorControl;
 }
 
 namespace Protocol
@@ -48,6 +49,8 @@ namespace Protocol
 }
 
 class QTcpServer;
+class QTcpSocket;
+class UnixSocketServer;
 
 /* UserIdentity represents the local identity offered by the user.
  *
@@ -69,6 +72,7 @@ class UserIdentity : public QObject
     Q_PROPERTY(QString nickname READ nickname WRITE setNickname NOTIFY nicknameChanged)
     Q_PROPERTY(QString contactID READ contactID NOTIFY contactIDChanged)
     Q_PROPERTY(bool isOnline READ isServiceOnline NOTIFY statusChanged)
+    Q_PROPERTY(bool isSingleHop READ isSingleHopService CONSTANT)
     Q_PROPERTY(ContactsManager *contacts READ getContacts CONSTANT)
     Q_PROPERTY(SettingsObject *settings READ settings CONSTANT)
 
@@ -76,6 +80,11 @@ public:
     const int uniqueID;
     ContactsManager contacts;
 
+    /* Days that the v2 service is still published after an identity moves to
+     * v3 with the "onionVersion" setting. Contacts connecting in that time
+     * learn the new hostname from the legacy proof. */
+    static const int LegacyServiceDays = 90;
+
     explicit UserIdentity(int uniqueID, QObject *parent = 0);
 
     /* Properties */
@@ -91,16 +100,35 @@ public:
 
     /* State */
     bool isServiceOnline() const;
+    /* The service is published in non-anonymous single-hop mode, which makes
+     * the location of this server public in exchange for lower latency. This
+     * is set with the "nonAnonymousService" setting, and only intended for bots. */
+    bool isSingleHopService() const;
+    /* Owned by its TorControl. Only the status, hostname and keys may be
+     * read from the thread of the identity. */
     Tor::HiddenService *hiddenService() const { return m_hiddenService; }
 
     SettingsObject *settings();
 
+    /* Settings of each identity are namespaced by its uniqueID. The first
+     * identity uses the top level for compatibility, so "contacts" becomes
+     * "identities.3.contacts" for identity 3. */
+    static QString settingsPath(int uniqueID, const QString &key);
+    QString settingsPath(const QString &key) const { return settingsPath(uniqueID, key); }
+
+    /* Save pending contact requests, and gracefully close all connections of
+     * this identity and its contacts, emitting connectionsClosed() when none
+     * remain open. Invoke through a
+     * queued call when the identity is on a worker thread. */
+    Q_INVOKABLE void closeConnections();
+
 signals:
     void statusChanged();
     void contactIDChanged(); // only possible during creation
     void nicknameChanged();
     void settingsChanged(const QString &key);
     void incomingConnection(Protocol::Connection *connection);
+    void connectionsClosed();
 
 private slots:
     void onStatusChanged(int newStatus, int oldStatus);
@@ -110,10 +138,18 @@ private slots:
 private:
     SettingsObject *m_settings;
     Tor::HiddenService *m_hiddenService;
+    // Previous v2 hostname, while it is still published after moving to v3
+    QString m_legacyHostname;
     QTcpServer *m_incomingServer;
+    UnixSocketServer *m_incomingSocketServer;
+    int m_closingConnections;
 
     static UserIdentity *createIdentity(int uniqueID, const QString &dataDirectory = QString());
 
+    bool listenUnixSocket();
+    void publishService(Tor::TorControl *control);
+    void handleIncomingSocket(QTcpSocket *socket);
+
     void handleIncomingAuthedConnection(Protocol::Connection *connection);
 };
 
@@ -32,10 +32,16 @@
 
 #include "ui/MainWindow.h"
 #include "core/IdentityManager.h"
+#include "core/ShutdownCoordinator.h"
 #include "tor/TorManager.h"
 #include "tor/TorControl.h"
 #include "utils/CryptoKey.h"
 #include "utils/SecureRNG.h"
+#include "utils/KeyPool.h"
+#include "utils/Metrics.h"
+#include "utils/Trace.h"
+#include "utils/StallWatchdog.h"
+#include "utils/Log.h"
 #include "utils/Settings.h"
 #include <QApplication>
 #include <QIcon>
@@ -48,15 +54,22 @@
 #include <QLocale>
 #include <QLockFile>
 #include <QStandardPaths>
+#include <QMutex>
 #include <openssl/crypto.h>
 
 static bool initSettings(SettingsFile *settings, QLockFile **lockFile, QString &errorMessage);
 static bool importLegacySettings(SettingsFile *settings, const QString &oldPath);
 static void initTranslation();
+static void initOpenSSLLocking();
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+
+    QString tracePath = QString::fromLocal8Bit(qgetenv("RICOCHET_TRACE"));
+    if (!tracePath.isEmpty())
+        Tracing::start(tracePath);
+
     a.setApplicationVersion(QLatin1String("1.1.0"));
     a.setOrganizationName(QStringLiteral("Ricochet"));
     initTranslation();
@@ -76,9 +89,15 @@ int main(int argc, char *argv[])
     }
     QScopedPointer<QLockFile> lockFile(lock);
 
+    /* Write log output from a background thread, filtered by the logging settings */
+    AsyncLogger logger;
+
     /* Initialize OpenSSL's allocator */
     CRYPTO_malloc_init();
 
+    /* Identities may use OpenSSL from worker threads */
+    initOpenSSLLocking();
+
     /* Seed the OpenSSL RNG */
     if (!SecureRNG::seed())
         qFatal("Failed to initialize RNG");
@@ -88,8 +107,18 @@ int main(int argc, char *argv[])
     Tor::TorManager *torManager = Tor::TorManager::instance();
     torManager->setDataDirectory(QFileInfo(settings->filePath()).path() + QStringLiteral("/tor/"));
     torControl = torManager->control();
+    TRACE_ASYNC_BEGIN("tor", "bootstrap", Tracing::pointerId(torControl));
     torManager->start();
 
+    /* Start pregenerating keys for new identities, if enabled */
+    KeyPool::instance();
+
+    /* Export metrics, if enabled */
+    MetricsExporter metricsExporter;
+
+    /* Watch for stalls of the main event loop */
+    StallWatchdog stallWatchdog;
+
     /* Identities */
     identityManager = new IdentityManager;
 
@@ -98,7 +127,44 @@ int main(int argc, char *argv[])
     if (!w.showUI())
         return 1;
 
-    return a.exec();
+    TRACE_INSTANT("main.exec");
+    int re = a.exec();
+
+    /* Close connections and stop tor in parallel, without waiting on each in turn */
+    ShutdownCoordinator shutdown(settings.data());
+    shutdown.exec();
+
+    metricsExporter.writeFile();
+    Tracing::stop();
+
+    return re;
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static QMutex *opensslLocks = 0;
+
+static void opensslLockingCallback(int mode, int n, const char *file, int line)
+{
+    Q_UNUSED(file);
+    Q_UNUSED(line);
+
+    if (mode & CRYPTO_LOCK)
+        opensslLocks[n].lock();
+    else
+        opensslLocks[n].unlock();
+}
+#endif
+
+static void initOpenSSLLocking()
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    // QtNetwork may have already installed callbacks for its own use
+    if (CRYPTO_get_locking_callback())
+        return;
+
+    opensslLocks = new QMutex[CRYPTO_num_locks()];
+    CRYPTO_set_locking_callback(opensslLockingCallback);
+#endif
 }
 
 static QString userConfigPath()
@@ -128,6 +194,8 @@ static QString appBundlePath()
 
 static bool initSettings(SettingsFile *settings, QLockFile **lockFile, QString &errorMessage)
 {
+    TRACE_SPAN("main.initSettings");
+
     /* If built in portable mode (default), configuration is stored in the 'config'
      * directory next to the binary. If not writable, launching fails.
      *
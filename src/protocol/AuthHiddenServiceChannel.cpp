@@ -37,6 +37,8 @@
 #include "utils/SecureRNG.h"
 #include "utils/CryptoKey.h"
 #include "utils/Useful.h"
+#include "utils/Trace.h"
+#include "utils/Log.h"
 #include <QMessageAuthenticationCode>
 
 using namespace Protocol;
@@ -47,16 +49,25 @@ class AuthHiddenServiceChannelPrivate : public ChannelPrivate
 {
 public:
     CryptoKey privateKey;
+    CryptoKey legacyPrivateKey;
     QByteArray clientCookie, serverCookie;
+    // Hostname the client dialed, if it isn't the serverHostname() of the connection
+    QString serverHostname;
+    Data::AuthHiddenService::ProofType proofType;
     bool accepted;
+    QElapsedTimer authTimer;
 
     AuthHiddenServiceChannelPrivate(Channel *q, Channel::Direction direction, Connection *conn)
         : ChannelPrivate(q, QStringLiteral("im.ricochet.auth.hidden-service"), direction, conn)
+        , proofType(Data::AuthHiddenService::RSA_SHA256)
         , accepted(false)
     {
+        authTimer.start();
     }
 
     QByteArray getProofData(const QString &clientHostname);
+    QByteArray getProofHMAC(const QString &clientHostname);
+    bool verifyLegacyProof(const QByteArray &publicKeyData, const QByteArray &signature, OnionId *identity);
 };
 
 }
@@ -70,6 +81,12 @@ AuthHiddenServiceChannel::AuthHiddenServiceChannel(Direction dir, Connection *co
     connect(this, &Channel::invalidated, this,
         [this]() {
             Q_D(AuthHiddenServiceChannel);
+            QByteArray labels = MetricsRegistry::labels("direction", (direction() == Outbound) ? QStringLiteral("outbound") : QStringLiteral("inbound"),
+                                                        "result", d->accepted ? QStringLiteral("accepted") : QStringLiteral("failed"));
+            MetricsRegistry::instance()->histogram("ricochet_auth_duration_microseconds",
+                                                   "Time from creating a hidden service authentication channel to its result",
+                                                   labels)->record(d->authTimer.nsecsElapsed() / 1000);
+
             if (d->accepted)
                 emit authSuccessful();
             else
@@ -94,6 +111,22 @@ void AuthHiddenServiceChannel::setPrivateKey(const CryptoKey &key)
     d->privateKey = key;
 }
 
+void AuthHiddenServiceChannel::setLegacyPrivateKey(const CryptoKey &key)
+{
+    Q_D(AuthHiddenServiceChannel);
+    if (isOpened()) {
+        BUG() << "Channel is already open";
+        return;
+    }
+
+    if (!key.isLoaded() || !key.isPrivate() || key.algorithm() != CryptoKey::RSAKey) {
+        BUG() << "AuthHiddenServiceChannel legacy proof requires an RSA private key";
+        return;
+    }
+
+    d->legacyPrivateKey = key;
+}
+
 bool AuthHiddenServiceChannel::allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result)
 {
     Q_D(AuthHiddenServiceChannel);
@@ -102,21 +135,21 @@ bool AuthHiddenServiceChannel::allowInboundChannelRequest(const Data::Control::O
 
     if (connection()->direction() != Connection::ServerSide) {
         // Hidden service authentication is only allowed from the client-side connection
-        qDebug() << "Rejecting AuthHiddenServiceChannel from server side";
+        LOG_DEBUG(lcChannel) << "Rejecting AuthHiddenServiceChannel from server side";
         result->set_common_error(ChannelResult::BadUsageError);
         return false;
     }
 
     if (connection()->hasAuthenticated(Connection::HiddenServiceAuth)) {
         // You can only authenticate a connection once
-        qDebug() << "Rejecting AuthHiddenServiceChannel on authenticated connection";
+        LOG_DEBUG(lcChannel) << "Rejecting AuthHiddenServiceChannel on authenticated connection";
         result->set_common_error(ChannelResult::BadUsageError);
         return false;
     }
 
     if (connection()->findChannel<AuthHiddenServiceChannel>()) {
         // Refuse if another channel already exists
-        qDebug() << "Rejecting instance of AuthHiddenServiceChannel on a connection that already has one";
+        LOG_DEBUG(lcChannel) << "Rejecting instance of AuthHiddenServiceChannel on a connection that already has one";
         result->set_common_error(ChannelResult::BadUsageError);
         return false;
     }
@@ -124,20 +157,31 @@ bool AuthHiddenServiceChannel::allowInboundChannelRequest(const Data::Control::O
     // Store client cookie
     std::string clientCookie = request->GetExtension(Data::AuthHiddenService::client_cookie);
     if (clientCookie.size() != 16) {
-        qDebug() << "Received OpenChannel for" << type() << "with no valid client_cookie";
+        LOG_DEBUG(lcChannel) << "Received OpenChannel for" << type() << "with no valid client_cookie";
         result->set_common_error(ChannelResult::BadUsageError);
         return false;
     }
     d->clientCookie = QByteArray(clientCookie.c_str(), clientCookie.size());
 
+    // Clients without the extension only know about RSA proofs
+    if (request->HasExtension(Data::AuthHiddenService::client_proof_type))
+        d->proofType = request->GetExtension(Data::AuthHiddenService::client_proof_type);
+    if (d->proofType == Data::AuthHiddenService::ED25519 && !CryptoKey::hasEd25519Support()) {
+        LOG_DEBUG(lcChannel) << "Rejecting AuthHiddenServiceChannel with unsupported Ed25519 proof";
+        result->set_common_error(ChannelResult::FailedError);
+        return false;
+    }
+
     // Generate a random cookie and return result
     d->serverCookie = SecureRNG::random(16);
     if (d->serverCookie.isEmpty())
         return false;
 
-    qDebug() << "Accepted inbound AuthHiddenServiceChannel";
+    LOG_DEBUG(lcChannel) << "Accepted inbound AuthHiddenServiceChannel";
 
     result->SetExtension(Data::AuthHiddenService::server_cookie, std::string(d->serverCookie.constData(), d->serverCookie.size()));
+    if (d->proofType != Data::AuthHiddenService::RSA_SHA256)
+        result->SetExtension(Data::AuthHiddenService::server_proof_type, d->proofType);
     return true;
 }
 
@@ -154,6 +198,11 @@ bool AuthHiddenServiceChannel::allowOutboundChannelRequest(Data::Control::OpenCh
     if (d->clientCookie.isEmpty())
         return false;
     request->SetExtension(Data::AuthHiddenService::client_cookie, std::string(d->clientCookie.constData(), d->clientCookie.size()));
+
+    if (d->privateKey.algorithm() == CryptoKey::Ed25519Key) {
+        d->proofType = Data::AuthHiddenService::ED25519;
+        request->SetExtension(Data::AuthHiddenService::client_proof_type, d->proofType);
+    }
     return true;
 }
 
@@ -164,11 +213,30 @@ bool AuthHiddenServiceChannel::processChannelOpenResult(const Data::Control::Cha
     if (result->opened()) {
         std::string cookie = result->GetExtension(Data::AuthHiddenService::server_cookie);
         if (cookie.size() != 16) {
-            qDebug() << "Received ChannelResult for" << type() << "with no valid server_cookie";
+            LOG_DEBUG(lcChannel) << "Received ChannelResult for" << type() << "with no valid server_cookie";
             return false;
         }
 
         d->serverCookie = QByteArray(cookie.c_str(), cookie.size());
+
+        // Peers that only support RSA proofs ignore client_proof_type
+        if (d->proofType != Data::AuthHiddenService::RSA_SHA256 &&
+            (!result->HasExtension(Data::AuthHiddenService::server_proof_type) ||
+             result->GetExtension(Data::AuthHiddenService::server_proof_type) != d->proofType))
+        {
+            if (!d->legacyPrivateKey.isLoaded()) {
+                LOG_WARNING(lcChannel) << "Peer does not support authentication with a v3 identity on" << type();
+                return false;
+            }
+
+            // The peer expects an RSA proof on this channel, which the v2 identity can still give
+            LOG_DEBUG(lcChannel) << "Peer does not support authentication with a v3 identity on" << type()
+                                 << "- authenticating with the legacy identity";
+            d->privateKey = d->legacyPrivateKey;
+            d->legacyPrivateKey = CryptoKey();
+            d->proofType = Data::AuthHiddenService::RSA_SHA256;
+        }
+
         return true;
     }
 
@@ -187,6 +255,7 @@ void AuthHiddenServiceChannel::sendAuthMessage()
     if (!isOpened())
         return;
 
+    TRACE_SPAN("auth.createProof");
     if (d->clientCookie.size() != 16 || d->serverCookie.size() != 16) {
         BUG() << "AuthHiddenServiceChannel can't create a proof without valid cookies";
         closeChannel();
@@ -201,12 +270,9 @@ void AuthHiddenServiceChannel::sendAuthMessage()
     }
 
     QByteArray signature;
-    QByteArray proofData = d->getProofData(d->privateKey.torServiceID());
-    if (!proofData.isEmpty()) {
-        QByteArray proofHMAC = QMessageAuthenticationCode::hash(proofData, d->clientCookie + d->serverCookie,
-                QCryptographicHash::Sha256);
+    QByteArray proofHMAC = d->getProofHMAC(d->privateKey.torServiceID());
+    if (!proofHMAC.isEmpty())
         signature = d->privateKey.signSHA256(proofHMAC);
-    }
 
     if (signature.isEmpty()) {
         BUG() << "Creating proof on AuthHiddenServiceChannel failed";
@@ -218,19 +284,39 @@ void AuthHiddenServiceChannel::sendAuthMessage()
     proof->set_public_key(std::string(publicKey.constData(), publicKey.size()));
     proof->set_signature(std::string(signature.constData(), signature.size()));
 
+    if (d->proofType == Data::AuthHiddenService::ED25519 && d->legacyPrivateKey.isLoaded()) {
+        QByteArray legacyPublicKey = d->legacyPrivateKey.encodedPublicKey(CryptoKey::DER);
+        QByteArray legacyHMAC = d->getProofHMAC(d->legacyPrivateKey.torServiceID());
+        QByteArray legacySignature;
+        if (!legacyHMAC.isEmpty())
+            legacySignature = d->legacyPrivateKey.signSHA256(legacyHMAC);
+
+        if (!legacySignature.isEmpty() && legacyPublicKey.size() <= 150) {
+            proof->set_legacy_public_key(std::string(legacyPublicKey.constData(), legacyPublicKey.size()));
+            proof->set_legacy_signature(std::string(legacySignature.constData(), legacySignature.size()));
+        } else {
+            LOG_WARNING(lcChannel) << "Creating legacy proof on AuthHiddenServiceChannel failed";
+        }
+    }
+
     Data::AuthHiddenService::Packet message;
     message.set_allocated_proof(proof.take());
     sendMessage(message);
 
-    qDebug() << "AuthHiddenServiceChannel sent outbound authentication packet";
+    LOG_DEBUG(lcChannel) << "AuthHiddenServiceChannel sent outbound authentication packet";
 }
 
 QByteArray AuthHiddenServiceChannelPrivate::getProofData(const QString &client)
 {
-    QByteArray serverHostname = connection->serverHostname().toLatin1().mid(0, 16);
+    QByteArray serverHostname = (this->serverHostname.isEmpty() ? connection->serverHostname() : this->serverHostname).toLatin1();
+    if (serverHostname.endsWith(".onion"))
+        serverHostname.chop(6);
     QByteArray clientHostname = client.toLatin1();
 
-    if (clientHostname.size() != 16 || serverHostname.size() != 16) {
+    // Legacy (v2) hostnames are 16 characters, and v3 hostnames are 56
+    if ((clientHostname.size() != 16 && clientHostname.size() != 56) ||
+        (serverHostname.size() != 16 && serverHostname.size() != 56))
+    {
         BUG() << "AuthHiddenServiceChannel can't figure out the client and server hostnames";
         return QByteArray();
     }
@@ -238,6 +324,34 @@ QByteArray AuthHiddenServiceChannelPrivate::getProofData(const QString &client)
     return clientHostname + serverHostname;
 }
 
+QByteArray AuthHiddenServiceChannelPrivate::getProofHMAC(const QString &client)
+{
+    QByteArray proofData = getProofData(client);
+    if (proofData.isEmpty())
+        return QByteArray();
+
+    return QMessageAuthenticationCode::hash(proofData, clientCookie + serverCookie, QCryptographicHash::Sha256);
+}
+
+bool AuthHiddenServiceChannelPrivate::verifyLegacyProof(const QByteArray &publicKeyData, const QByteArray &signature,
+                                                        OnionId *identity)
+{
+    CryptoKey publicKey;
+    if (signature.size() != 128 || publicKeyData.size() > 150 ||
+        !publicKey.loadFromData(publicKeyData, CryptoKey::PublicKey, CryptoKey::DER) ||
+        publicKey.bits() != 1024)
+    {
+        return false;
+    }
+
+    QByteArray proofHMAC = getProofHMAC(publicKey.torServiceID());
+    if (proofHMAC.isEmpty() || !publicKey.verifySHA256(proofHMAC, signature))
+        return false;
+
+    *identity = OnionId::fromString(publicKey.torServiceID());
+    return true;
+}
+
 void AuthHiddenServiceChannel::receivePacket(const QByteArray &packet)
 {
     Data::AuthHiddenService::Packet message;
@@ -251,7 +365,7 @@ void AuthHiddenServiceChannel::receivePacket(const QByteArray &packet)
     } else if (message.has_result()) {
         handleResult(message.result());
     } else {
-        qWarning() << "Unrecognized message on" << type();
+        LOG_WARNING(lcChannel) << "Unrecognized message on" << type();
         closeChannel();
     }
 }
@@ -259,9 +373,10 @@ void AuthHiddenServiceChannel::receivePacket(const QByteArray &packet)
 void AuthHiddenServiceChannel::handleProof(const Data::AuthHiddenService::Proof &message)
 {
     Q_D(AuthHiddenServiceChannel);
+    TRACE_SPAN("auth.verifyProof");
 
     if (direction() != Inbound) {
-        qWarning() << "Received unexpected proof on outbound" << type();
+        LOG_WARNING(lcChannel) << "Received unexpected proof on outbound" << type();
         closeChannel();
         return;
     }
@@ -278,36 +393,55 @@ void AuthHiddenServiceChannel::handleProof(const Data::AuthHiddenService::Proof
     QScopedPointer<Data::AuthHiddenService::Result> result(new Data::AuthHiddenService::Result);
     result->set_accepted(false);
 
-    // Hidden services always use a 1024bit key. A valid signature will always be exactly 128 bytes.
+    // Legacy hidden services always use a 1024bit key. A valid signature will always be exactly 128 bytes.
+    // Ed25519 keys are 32 bytes, with 64 byte signatures.
+    bool ed25519 = (d->proofType == Data::AuthHiddenService::ED25519);
     CryptoKey publicKey;
-    if (signature.size() != 128) {
-        qWarning() << "Received invalid signature (size" << signature.size() << ") on" << type();
-    } else if (publicKeyData.size() > 150) {
-        qWarning() << "Received invalid public key (size" << publicKeyData.size() << ") on" << type();
-    } else if (!publicKey.loadFromData(publicKeyData, CryptoKey::PublicKey, CryptoKey::DER)) {
-        qWarning() << "Unable to parse public key from" << type();
-    } else if (publicKey.bits() != 1024) {
-        qWarning() << "Received invalid public key (" << publicKey.bits() << "bits) on" << type();
+    if (signature.size() != (ed25519 ? 64 : 128)) {
+        LOG_WARNING(lcChannel) << "Received invalid signature (size" << signature.size() << ") on" << type();
+    } else if (ed25519 ? (publicKeyData.size() != 32) : (publicKeyData.size() > 150)) {
+        LOG_WARNING(lcChannel) << "Received invalid public key (size" << publicKeyData.size() << ") on" << type();
+    } else if (ed25519 ? !publicKey.loadEd25519(publicKeyData, CryptoKey::PublicKey)
+                       : !publicKey.loadFromData(publicKeyData, CryptoKey::PublicKey, CryptoKey::DER)) {
+        LOG_WARNING(lcChannel) << "Unable to parse public key from" << type();
+    } else if (!ed25519 && publicKey.bits() != 1024) {
+        LOG_WARNING(lcChannel) << "Received invalid public key (" << publicKey.bits() << "bits) on" << type();
     } else {
         bool ok = false;
-        QByteArray proofData = d->getProofData(publicKey.torServiceID());
-        if (!proofData.isEmpty()) {
-            QByteArray proofHMAC = QMessageAuthenticationCode::hash(proofData, d->clientCookie + d->serverCookie,
-                    QCryptographicHash::Sha256);
+        QByteArray proofHMAC = d->getProofHMAC(publicKey.torServiceID());
+        if (!proofHMAC.isEmpty())
             ok = publicKey.verifySHA256(proofHMAC, signature);
+
+        // Clients that don't know the new hostname of a service moving to v3 dial the old one
+        QString legacyServerHostname = connection()->legacyServerHostname();
+        if (!ok && !legacyServerHostname.isEmpty()) {
+            d->serverHostname = legacyServerHostname;
+            proofHMAC = d->getProofHMAC(publicKey.torServiceID());
+            ok = !proofHMAC.isEmpty() && publicKey.verifySHA256(proofHMAC, signature);
         }
 
         if (!ok) {
-            qWarning() << "Signature verification failed on" << type();
+            LOG_WARNING(lcChannel) << "Signature verification failed on" << type();
             result->set_accepted(false);
         } else {
             result->set_accepted(true);
-            qDebug() << type() << "accepted inbound authentication for" << publicKey.torServiceID();
+            LOG_DEBUG(lcChannel) << type() << "accepted inbound authentication for" << publicKey.torServiceID();
         }
     }
 
+    if (result->accepted() && ed25519 && message.has_legacy_public_key()) {
+        // A valid legacy proof lets contacts that know the client by its v2 hostname recognize it
+        QByteArray legacyKey(message.legacy_public_key().c_str(), message.legacy_public_key().size());
+        QByteArray legacySignature(message.legacy_signature().c_str(), message.legacy_signature().size());
+        OnionId legacyIdentity;
+        if (d->verifyLegacyProof(legacyKey, legacySignature, &legacyIdentity))
+            connection()->grantAuthentication(Connection::LegacyHiddenServiceAuth, legacyIdentity);
+        else
+            LOG_WARNING(lcChannel) << "Ignoring invalid legacy proof on" << type();
+    }
+
     if (result->accepted()) {
-        connection()->grantAuthentication(Connection::HiddenServiceAuth, publicKey.torServiceID() + QStringLiteral(".onion"));
+        connection()->grantAuthentication(Connection::HiddenServiceAuth, OnionId::fromString(publicKey.torServiceID()));
         d->accepted = true;
         result->set_is_known_contact(connection()->purpose() == Connection::Purpose::KnownContact);
     } else {
@@ -331,18 +465,18 @@ void AuthHiddenServiceChannel::handleResult(const Data::AuthHiddenService::Resul
     Q_D(AuthHiddenServiceChannel);
 
     if (direction() != Outbound) {
-        qWarning() << "Received invalid message on AuthHiddenServiceChannel";
+        LOG_WARNING(lcChannel) << "Received invalid message on AuthHiddenServiceChannel";
         closeChannel();
         return;
     }
 
     if (message.accepted()) {
-        qDebug() << "AuthHiddenServiceChannel succeeded as" << (message.is_known_contact() ? "known" : "unknown") << "contact";
+        LOG_DEBUG(lcChannel) << "AuthHiddenServiceChannel succeeded as" << (message.is_known_contact() ? "known" : "unknown") << "contact";
         d->accepted = true;
         if (message.is_known_contact())
             connection()->grantAuthentication(Connection::KnownToPeer);
     } else {
-        qWarning() << "AuthHiddenServiceChannel rejected";
+        LOG_WARNING(lcChannel) << "AuthHiddenServiceChannel rejected";
         d->accepted = false;
     }
 
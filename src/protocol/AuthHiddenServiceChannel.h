@@ -52,6 +52,11 @@ public:
     explicit AuthHiddenServiceChannel(Direction direction, Connection *connection);
 
     void setPrivateKey(const CryptoKey &key);
+    /* For an Ed25519 identity, also prove ownership of the previous RSA
+     * (v2) identity, so that contacts can migrate to the new hostname.
+     * Peers that only know RSA proofs are given a proof of the v2 identity
+     * alone, as they know the contact by that hostname. */
+    void setLegacyPrivateKey(const CryptoKey &key);
 
 signals:
     void authSuccessful();
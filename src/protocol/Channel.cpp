@@ -34,6 +34,8 @@
 #include "Connection_p.h"
 #include "ControlChannel.h"
 #include "utils/Useful.h"
+#include "utils/Log.h"
+#include <QMutex>
 #include <QDebug>
 
 #include "AuthHiddenServiceChannel.h"
@@ -141,7 +143,7 @@ void Channel::closeChannel()
         d->hasSentClose = true;
         bool ok = connection()->d->writePacket(this, QByteArray());
         if (!ok)
-            qDebug() << "Failed sending channel close message";
+            LOG_DEBUG(lcChannel) << "Failed sending channel close message";
     }
 
     // Invalidate will remove and eventually destroy the Channel
@@ -206,6 +208,7 @@ bool ChannelPrivate::openChannelOutbound(Data::Control::OpenChannel *request)
 
     request->set_channel_type(type.toStdString());
     identifier = request->channel_identifier();
+    openTimer.start();
     return true;
 }
 
@@ -227,6 +230,7 @@ bool ChannelPrivate::openChannelResult(const Data::Control::ChannelResult *resul
     }
 
     if (ok) {
+        metrics->openDuration->record(openTimer.nsecsElapsed() / 1000);
         isOpened = true;
         emit q->channelOpened();
     } else {
@@ -276,9 +280,37 @@ ChannelPrivate::ChannelPrivate(Channel *q, const QString &type, Channel::Directi
     , isOpened(false)
     , hasSentClose(false)
     , isInvalidated(false)
+    , metrics(ChannelMetrics::forType(type))
 {
 }
 
+ChannelMetrics *ChannelMetrics::forType(const QString &type)
+{
+    // Channels are created on identity threads too
+    static QMutex mutex;
+    static QHash<QString,ChannelMetrics*> types;
+
+    QMutexLocker locker(&mutex);
+    ChannelMetrics *&m = types[type];
+    if (!m) {
+        MetricsRegistry *registry = MetricsRegistry::instance();
+        QByteArray received = MetricsRegistry::labels("type", type, "direction", QStringLiteral("received"));
+        QByteArray sent = MetricsRegistry::labels("type", type, "direction", QStringLiteral("sent"));
+        const char *packetsHelp = "Packets on channels of each type";
+        const char *bytesHelp = "Packet data bytes on channels of each type";
+
+        m = new ChannelMetrics;
+        m->packetsReceived = registry->counter("ricochet_channel_packets_total", packetsHelp, received);
+        m->bytesReceived = registry->counter("ricochet_channel_bytes_total", bytesHelp, received);
+        m->packetsSent = registry->counter("ricochet_channel_packets_total", packetsHelp, sent);
+        m->bytesSent = registry->counter("ricochet_channel_bytes_total", bytesHelp, sent);
+        m->openDuration = registry->histogram("ricochet_channel_open_duration_microseconds",
+                                              "Time from requesting an outbound channel to its opening",
+                                              MetricsRegistry::label("type", type));
+    }
+    return m;
+}
+
 ChannelPrivate::~ChannelPrivate()
 {
     Q_Q(Channel);
@@ -296,7 +328,7 @@ void ChannelPrivate::invalidate()
 
     Q_ASSERT(!isOpened);
 
-    qDebug() << "Invalidating channel" << q << "type" << type << "id" << identifier;
+    LOG_DEBUG(lcChannel) << "Invalidating channel" << q << "type" << type << "id" << identifier;
 
     isInvalidated = true;
     emit q->invalidated();
@@ -36,11 +36,23 @@
 #include "Channel.h"
 #include "Connection_p.h"
 #include "utils/Useful.h"
+#include "utils/Metrics.h"
+#include <QElapsedTimer>
 #include <QDebug>
 
 namespace Protocol
 {
 
+// Traffic and open latency, shared by all channels of one type
+struct ChannelMetrics
+{
+    MetricCounter *packetsReceived, *bytesReceived;
+    MetricCounter *packetsSent, *bytesSent;
+    MetricHistogram *openDuration;
+
+    static ChannelMetrics *forType(const QString &type);
+};
+
 class ChannelPrivate : public QObject
 {
     Q_OBJECT
@@ -59,6 +71,8 @@ public:
     bool isOpened;
     bool hasSentClose;
     bool isInvalidated;
+    ChannelMetrics *metrics;
+    QElapsedTimer openTimer;
 
     void invalidate();
 
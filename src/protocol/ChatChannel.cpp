@@ -35,6 +35,8 @@
 #include "Connection.h"
 #include "utils/SecureRNG.h"
 #include "utils/Useful.h"
+#include "utils/Trace.h"
+#include "utils/Log.h"
 
 using namespace Protocol;
 
@@ -51,13 +53,13 @@ bool ChatChannel::allowInboundChannelRequest(const Data::Control::OpenChannel *r
     Q_UNUSED(request);
 
     if (connection()->purpose() != Connection::Purpose::KnownContact) {
-        qDebug() << "Rejecting request for" << type() << "channel from connection with purpose" << int(connection()->purpose());
+        LOG_DEBUG(lcChannel) << "Rejecting request for" << type() << "channel from connection with purpose" << int(connection()->purpose());
         result->set_common_error(Data::Control::ChannelResult::UnauthorizedError);
         return false;
     }
 
     if (connection()->findChannel<ChatChannel>(Channel::Inbound)) {
-        qDebug() << "Rejecting request for" << type() << "channel because one is already open";
+        LOG_DEBUG(lcChannel) << "Rejecting request for" << type() << "channel because one is already open";
         return false;
     }
 
@@ -94,7 +96,7 @@ void ChatChannel::receivePacket(const QByteArray &packet)
     } else if (message.has_chat_acknowledge()) {
         handleChatAcknowledge(message.chat_acknowledge());
     } else {
-        qWarning() << "Unrecognized message on" << type();
+        LOG_WARNING(lcChannel) << "Unrecognized message on" << type();
         closeChannel();
     }
 }
@@ -135,6 +137,7 @@ bool ChatChannel::sendChatMessageWithId(QString text, QDateTime time, MessageId
         return false;
 
     pendingMessages.insert(id);
+    TRACE_ASYNC_BEGIN("chat", "awaiting ack", Tracing::pointerId(this) ^ id);
     return true;
 }
 
@@ -147,13 +150,13 @@ void ChatChannel::handleChatMessage(const Data::Chat::ChatMessage &message)
     QString text = QString::fromStdString(message.message_text());
 
     if (direction() != Inbound) {
-        qWarning() << "Rejected inbound message on an outbound chat channel";
+        LOG_WARNING(lcChannel) << "Rejected inbound message on an outbound chat channel";
         response->set_accepted(false);
     } else if (text.isEmpty()) {
-        qWarning() << "Rejected empty chat message";
+        LOG_WARNING(lcChannel) << "Rejected empty chat message";
         response->set_accepted(false);
     } else if (text.size() > MessageMaxCharacters) {
-        qWarning() << "Rejected oversize chat message of" << text.size() << "characters";
+        LOG_WARNING(lcChannel) << "Rejected oversize chat message of" << text.size() << "characters";
         response->set_accepted(false);
     } else {
         QDateTime time = QDateTime::currentDateTime();
@@ -175,22 +178,23 @@ void ChatChannel::handleChatMessage(const Data::Chat::ChatMessage &message)
 void ChatChannel::handleChatAcknowledge(const Data::Chat::ChatAcknowledge &message)
 {
     if (direction() != Outbound) {
-        qWarning() << "Rejected inbound acknowledgement on an inbound chat channel";
+        LOG_WARNING(lcChannel) << "Rejected inbound acknowledgement on an inbound chat channel";
         closeChannel();
         return;
     }
 
     if (!message.has_message_id()) {
-        qDebug() << "Chat acknowledgement doesn't have a message ID we understand";
+        LOG_DEBUG(lcChannel) << "Chat acknowledgement doesn't have a message ID we understand";
         closeChannel();
         return;
     }
 
     MessageId id = message.message_id();
     if (pendingMessages.remove(id)) {
+        TRACE_ASYNC_END("chat", "awaiting ack", Tracing::pointerId(this) ^ id);
         emit messageAcknowledged(id, message.accepted());
     } else {
-        qDebug() << "Received chat acknowledgement for unknown message" << id;
+        LOG_DEBUG(lcChannel) << "Received chat acknowledgement for unknown message" << id;
     }
 }
 
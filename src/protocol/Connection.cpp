@@ -31,8 +31,11 @@
  */
 
 #include "Connection_p.h"
+#include "Channel_p.h"
 #include "ControlChannel.h"
 #include "utils/Useful.h"
+#include "utils/Metrics.h"
+#include "utils/Log.h"
 #include <QTcpSocket>
 #include <QTimer>
 #include <QtEndian>
@@ -40,6 +43,24 @@
 
 using namespace Protocol;
 
+static MetricGauge *connectionGauge(Connection::Direction direction)
+{
+    static MetricGauge *gauges[2] = {
+        MetricsRegistry::instance()->gauge("ricochet_connections", "Open protocol connections",
+                                           MetricsRegistry::label("direction", QStringLiteral("client"))),
+        MetricsRegistry::instance()->gauge("ricochet_connections", "Open protocol connections",
+                                           MetricsRegistry::label("direction", QStringLiteral("server")))
+    };
+    return gauges[direction == Connection::ServerSide ? 1 : 0];
+}
+
+static MetricHistogram *handshakeDuration()
+{
+    static MetricHistogram *histogram = MetricsRegistry::instance()->histogram(
+        "ricochet_connection_handshake_duration_microseconds", "Time from connection to version negotiation");
+    return histogram;
+}
+
 Connection::Connection(QTcpSocket *socket, Direction direction, QObject *parent)
     : QObject(parent)
     , d(new ConnectionPrivate(this))
@@ -58,6 +79,7 @@ ConnectionPrivate::ConnectionPrivate(Connection *qq)
     , nextOutboundChannelId(-1)
 {
     ageTimer.start();
+    activityTimer.start();
 
     QTimer *timeout = new QTimer(this);
     timeout->setSingleShot(true);
@@ -65,7 +87,7 @@ ConnectionPrivate::ConnectionPrivate(Connection *qq)
     connect(timeout, &QTimer::timeout, this,
         [this,timeout]() {
             if (purpose == Connection::Purpose::Unknown) {
-                qDebug() << "Closing connection" << q << "with unknown purpose after timeout";
+                LOG_DEBUG(lcConnection) << "Closing connection" << q << "with unknown purpose after timeout";
                 q->close();
             }
             timeout->deleteLater();
@@ -96,6 +118,9 @@ Connection::~Connection()
 
 ConnectionPrivate::~ConnectionPrivate()
 {
+    if (socket)
+        connectionGauge(direction)->add(-1);
+
     // Reset q pointer, for the same reason as above
     q = 0;
 }
@@ -130,11 +155,23 @@ QString Connection::serverHostname() const
     return hostname;
 }
 
+QString Connection::legacyServerHostname() const
+{
+    if (direction() != ServerSide)
+        return QString();
+    return d->socket->property("localLegacyHostname").toString();
+}
+
 int Connection::age() const
 {
     return qRound(d->ageTimer.elapsed() / 1000.0);
 }
 
+int Connection::idleTime() const
+{
+    return qRound(d->activityTimer.elapsed() / 1000.0);
+}
+
 void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
 {
     if (socket) {
@@ -144,6 +181,7 @@ void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
 
     socket = s;
     direction = d;
+    connectionGauge(direction)->add(1);
     connect(socket, &QAbstractSocket::disconnected, this, &ConnectionPrivate::socketDisconnected);
     connect(socket, &QIODevice::readyRead, this, &ConnectionPrivate::socketReadable);
 
@@ -166,8 +204,8 @@ void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
 
     if (direction == Connection::ClientSide) {
         // The server side is implicitly authenticated (by the transport) as the correct service, so grant that
-        QString serverName = q->serverHostname();
-        if (serverName.isEmpty()) {
+        OnionId serverName = OnionId::fromString(q->serverHostname());
+        if (!serverName.isValid()) {
             BUG() << "Server side of connection doesn't have an authenticated name, aborting";
             q->close();
             return;
@@ -178,7 +216,7 @@ void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
         // Send the introduction version handshake message
         char intro[] = { 0x49, 0x4D, 0x02, ProtocolVersion, 0 };
         if (socket->write(intro, sizeof(intro)) < (int)sizeof(intro)) {
-            qDebug() << "Failed writing introduction message to socket";
+            LOG_DEBUG(lcConnection) << "Failed writing introduction message to socket";
             q->close();
             return;
         }
@@ -189,7 +227,7 @@ void Connection::close()
 {
     if (isConnected()) {
         Q_ASSERT(!d->wasClosed);
-        qDebug() << "Disconnecting socket for connection" << this;
+        LOG_DEBUG(lcConnection) << "Disconnecting socket for connection" << this;
         d->socket->disconnectFromHost();
 
         // If not fully closed in 5 seconds, abort
@@ -213,14 +251,14 @@ void ConnectionPrivate::closeImmediately()
 
     if (!channels.isEmpty()) {
         foreach (Channel *c, channels)
-            qDebug() << "Open channel:" << c << c->type() << c->connection();
+            LOG_DEBUG(lcConnection) << "Open channel:" << c << c->type() << c->connection();
         BUG() << "Channels remain open after forcefully closing connection socket";
     }
 }
 
 void ConnectionPrivate::socketDisconnected()
 {
-    qDebug() << "Connection" << this << "disconnected";
+    LOG_DEBUG(lcConnection) << "Connection" << this << "disconnected";
     closeAllChannels();
 
     if (!wasClosed) {
@@ -242,19 +280,20 @@ void ConnectionPrivate::socketReadable()
             // Expecting a single byte in response with the chosen version
             uchar version = ProtocolVersionFailed;
             if (socket->read(reinterpret_cast<char*>(&version), 1) < 1) {
-                qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
+                LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
                 socket->abort();
                 return;
             }
 
             handshakeDone = true;
+            handshakeDuration()->record(ageTimer.nsecsElapsed() / 1000);
             if (version == 0) {
-                qDebug() << "Server in outbound connection is using the version 1.0 protocol";
+                LOG_DEBUG(lcConnection) << "Server in outbound connection is using the version 1.0 protocol";
                 emit q->oldVersionNegotiated(socket);
                 q->close();
                 return;
             } else if (version != ProtocolVersion) {
-                qDebug() << "Version negotiation failed on outbound connection";
+                LOG_DEBUG(lcConnection) << "Version negotiation failed on outbound connection";
                 emit q->versionNegotiationFailed();
                 socket->abort();
                 return;
@@ -265,14 +304,14 @@ void ConnectionPrivate::socketReadable()
             uchar intro[3] = { 0 };
             qint64 re = socket->peek(reinterpret_cast<char*>(intro), sizeof(intro));
             if (re < (int)sizeof(intro)) {
-                qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
+                LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
                 socket->abort();
                 return;
             }
 
             quint8 nVersions = intro[2];
             if (intro[0] != 0x49 || intro[1] != 0x4D || nVersions == 0) {
-                qDebug() << "Invalid introduction sequence on inbound connection";
+                LOG_DEBUG(lcConnection) << "Invalid introduction sequence on inbound connection";
                 socket->abort();
                 return;
             }
@@ -286,7 +325,7 @@ void ConnectionPrivate::socketReadable()
             QByteArray versions(nVersions, 0);
             re = socket->read(versions.data(), versions.size());
             if (re != versions.size()) {
-                qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
+                LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
                 socket->abort();
                 return;
             }
@@ -301,14 +340,15 @@ void ConnectionPrivate::socketReadable()
 
             re = socket->write(reinterpret_cast<char*>(&selectedVersion), 1);
             if (re != 1) {
-                qDebug() << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
+                LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
                 socket->abort();
                 return;
             }
 
             handshakeDone = true;
+            handshakeDuration()->record(ageTimer.nsecsElapsed() / 1000);
             if (selectedVersion != ProtocolVersion) {
-                qDebug() << "Version negotiation failed on inbound connection";
+                LOG_DEBUG(lcConnection) << "Version negotiation failed on inbound connection";
                 emit q->versionNegotiationFailed();
                 // Close gracefully to allow the response to write
                 q->close();
@@ -327,7 +367,7 @@ void ConnectionPrivate::socketReadable()
         // the entire thing is available within the buffer.
         qint64 re = socket->peek(reinterpret_cast<char*>(header), PacketHeaderSize);
         if (re < 0) {
-            qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
+            LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
             socket->abort();
             return;
         } else if (re < PacketHeaderSize) {
@@ -340,7 +380,7 @@ void ConnectionPrivate::socketReadable()
         quint16 channelId = qFromBigEndian<quint16>(&header[2]);
 
         if (packetSize < PacketHeaderSize) {
-            qWarning() << "Corrupted data from connection (packet size is too small); disconnecting";
+            LOG_WARNING(lcConnection) << "Corrupted data from connection (packet size is too small); disconnecting";
             socket->abort();
             return;
         }
@@ -352,7 +392,7 @@ void ConnectionPrivate::socketReadable()
         re = socket->read(reinterpret_cast<char*>(header), PacketHeaderSize);
         if (re != PacketHeaderSize) {
             if (re < 0) {
-                qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
+                LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
             } else {
                 // Because of QTcpSocket buffering, we can expect that up to 'available' bytes
                 // will read. Treat anything less as an error condition.
@@ -367,7 +407,7 @@ void ConnectionPrivate::socketReadable()
         re = (data.size() == 0) ? 0 : socket->read(data.data(), data.size());
         if (re != data.size()) {
             if (re < 0) {
-                qDebug() << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
+                LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during read:" << socket->errorString();
             } else {
                 // As above
                 BUG() << "Socket read was unexpectedly small;" << available << "bytes should've been available but we read" << re;
@@ -380,9 +420,9 @@ void ConnectionPrivate::socketReadable()
         if (!channel) {
             // XXX We should sanity-check and rate limit these responses better
             if (data.isEmpty()) {
-                qDebug() << "Ignoring channel close message for non-existent channel" << channelId;
+                LOG_DEBUG(lcConnection) << "Ignoring channel close message for non-existent channel" << channelId;
             } else {
-                qDebug() << "Ignoring" << data.size() << "byte packet for non-existent channel" << channelId;
+                LOG_DEBUG(lcConnection) << "Ignoring" << data.size() << "byte packet for non-existent channel" << channelId;
                 // Send channel close message
                 writePacket(channelId, QByteArray());
             }
@@ -398,9 +438,15 @@ void ConnectionPrivate::socketReadable()
             return;
         }
 
+        ChannelMetrics *metrics = channel->d_func()->metrics;
+        metrics->packetsReceived->add();
+        metrics->bytesReceived->add(data.size());
+
         if (data.isEmpty()) {
             channel->closeChannel();
         } else {
+            if (channelId != 0)
+                activityTimer.restart();
             channel->receivePacket(data);
         }
     }
@@ -416,7 +462,13 @@ bool ConnectionPrivate::writePacket(Channel *channel, const QByteArray &data)
         return false;
     }
 
-    return writePacket(channel->identifier(), data);
+    if (!writePacket(channel->identifier(), data))
+        return false;
+
+    ChannelMetrics *metrics = channel->d_func()->metrics;
+    metrics->packetsSent->add();
+    metrics->bytesSent->add(data.size());
+    return true;
 }
 
 bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data)
@@ -432,7 +484,7 @@ bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data)
     }
 
     if (!q->isConnected()) {
-        qDebug() << "Cannot write packet to closed connection";
+        LOG_DEBUG(lcConnection) << "Cannot write packet to closed connection";
         return false;
     }
 
@@ -444,18 +496,21 @@ bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data)
 
     qint64 re = socket->write(reinterpret_cast<char*>(header), PacketHeaderSize);
     if (re != PacketHeaderSize) {
-        qDebug() << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
+        LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
         socket->abort();
         return false;
     }
 
     re = socket->write(data);
     if (re != data.size()) {
-        qDebug() << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
+        LOG_DEBUG(lcConnection) << "Connection socket error" << socket->error() << "during write:" << socket->errorString();
         socket->abort();
         return false;
     }
 
+    if (channelId != 0 && !data.isEmpty())
+        activityTimer.restart();
+
     return true;
 }
 
@@ -633,27 +688,27 @@ bool Connection::hasAuthenticated(AuthenticationType type) const
     return d->authentication.contains(type);
 }
 
-bool Connection::hasAuthenticatedAs(AuthenticationType type, const QString &identity) const
+bool Connection::hasAuthenticatedAs(AuthenticationType type, const OnionId &identity) const
 {
     auto it = d->authentication.find(type);
-    if (!identity.isEmpty() && it != d->authentication.end())
+    if (identity.isValid() && it != d->authentication.end())
         return *it == identity;
     return false;
 }
 
-QString Connection::authenticatedIdentity(AuthenticationType type) const
+OnionId Connection::authenticatedIdentity(AuthenticationType type) const
 {
     return d->authentication.value(type);
 }
 
-void Connection::grantAuthentication(AuthenticationType type, const QString &identity)
+void Connection::grantAuthentication(AuthenticationType type, const OnionId &identity)
 {
     if (hasAuthenticated(type)) {
         BUG() << "Tried to redundantly grant" << type << "authentication to connection";
         return;
     }
 
-    qDebug() << "Granting" << type << "authentication as" << identity << "to connection";
+    LOG_DEBUG(lcConnection) << "Granting" << type << "authentication as" << identity << "to connection";
 
     d->authentication.insert(type, identity);
     emit authenticated(type, identity);
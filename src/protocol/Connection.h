@@ -36,6 +36,7 @@
 #include <QObject>
 #include <QHash>
 #include "Channel.h"
+#include "utils/OnionId.h"
 
 class QTcpSocket;
 
@@ -108,10 +109,18 @@ public:
      * In all cases, the returned hostname will end with ".onion"
      */
     QString serverHostname() const;
+    /* For a ServerSide connection to a service that moved to v3, its previous
+     * v2 hostname, which clients that haven't migrated yet may have dialed
+     * instead. Empty otherwise. */
+    QString legacyServerHostname() const;
 
     /* Age of the connection in seconds */
     int age() const;
 
+    /* Time in seconds since a packet was last sent or received on any
+     * channel other than the control channel */
+    int idleTime() const;
+
     /* Assigned purpose of this connection
      *
      * A purpose is assigned to the connection after the peer has
@@ -140,13 +149,15 @@ public:
 
     enum AuthenticationType {
         HiddenServiceAuth,
-        KnownToPeer // For outbound connections, set when the peer indicates we are a known contact
+        KnownToPeer, // For outbound connections, set when the peer indicates we are a known contact
+        // Previous v2 hostname of a client with a v3 HiddenServiceAuth identity, granted first
+        LegacyHiddenServiceAuth
     };
 
     bool hasAuthenticated(AuthenticationType type) const;
-    bool hasAuthenticatedAs(AuthenticationType type, const QString &identity) const;
-    QString authenticatedIdentity(AuthenticationType type) const;
-    void grantAuthentication(AuthenticationType type, const QString &identity = QString());
+    bool hasAuthenticatedAs(AuthenticationType type, const OnionId &identity) const;
+    OnionId authenticatedIdentity(AuthenticationType type) const;
+    void grantAuthentication(AuthenticationType type, const OnionId &identity = OnionId());
 
 public slots:
     /* Close this connection and the underlying socket
@@ -180,7 +191,7 @@ signals:
      */
     void oldVersionNegotiated(QTcpSocket *socket);
 
-    void authenticated(AuthenticationType type, const QString &identity);
+    void authenticated(AuthenticationType type, const OnionId &identity);
     void purposeChanged(Purpose after, Purpose before);
     /* Emitted when a new Channel instance is created, before it has opened
      *
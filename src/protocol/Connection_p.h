@@ -60,8 +60,9 @@ public:
     Connection *q;
     QTcpSocket *socket;
     QHash<int,Channel*> channels;
-    QMap<Connection::AuthenticationType,QString> authentication;
+    QMap<Connection::AuthenticationType,OnionId> authentication;
     QElapsedTimer ageTimer;
+    QElapsedTimer activityTimer;
     Connection::Direction direction;
     Connection::Purpose purpose;
     bool wasClosed;
@@ -32,6 +32,8 @@
 
 #include "ContactRequestChannel.h"
 #include "Channel_p.h"
+#include "ContactRequestProof.h"
+#include "utils/Log.h"
 
 using namespace Protocol;
 
@@ -51,6 +53,8 @@ using namespace Protocol;
 ContactRequestChannel::ContactRequestChannel(Direction direction, Connection *connection)
     : Channel(QStringLiteral("im.ricochet.contact.request"), direction, connection)
     , m_responseStatus(Data::ContactRequest::Response::Undefined)
+    , m_requiredProof(0)
+    , m_proofNonce(0)
 {
 }
 
@@ -97,6 +101,27 @@ static bool isAcceptableNickname(const QString &input)
     return true;
 }
 
+void ContactRequestChannel::setProof(const QByteArray &salt, quint64 nonce)
+{
+    if (direction() != Outbound || isOpened() || identifier() >= 0) {
+        BUG() << "Proofs can only be set on outbound requests before opening the channel";
+        return;
+    }
+
+    m_proofSalt = salt;
+    m_proofNonce = nonce;
+}
+
+void ContactRequestChannel::setRequiredProof(int difficulty)
+{
+    if (direction() != Inbound || isOpened()) {
+        BUG() << "Proofs can only be required on inbound requests before opening the channel";
+        return;
+    }
+
+    m_requiredProof = qBound(0, difficulty, int(ContactRequestProof::MaxDifficulty));
+}
+
 QString ContactRequestChannel::nickname() const
 {
     return m_nickname;
@@ -161,23 +186,48 @@ bool ContactRequestChannel::allowInboundChannelRequest(const Data::Control::Open
     }
 
     ContactRequest contactData = request->GetExtension(Data::ContactRequest::contact_request);
-    QString nickname = QString::fromStdString(contactData.nickname());
-    QString message = QString::fromStdString(contactData.message_text());
 
-    m_responseStatus = Response::Undefined;
-    if (message.size() > Data::ContactRequest::MessageMaxCharacters ||
-        !isAcceptableNickname(nickname))
-    {
-        qWarning() << "Rejecting incoming contact request with invalid nickname/message";
-        setResponseStatus(Response::Error);
-    } else {
-        m_nickname = nickname;
-        m_message = message;
-        emit requestReceived();
-
-        if (m_responseStatus == Response::Undefined) {
-            BUG() << "No response to incoming contact request after requestReceived signal";
+    // Under load, requests without a proof of work are answered with a challenge and aren't
+    // looked at any further
+    if (m_requiredProof > 0 && m_responseStatus <= Response::Pending) {
+        OnionId client = connection()->authenticatedIdentity(Connection::HiddenServiceAuth);
+        if (!contactData.has_proof() ||
+            !ContactRequestProof::verify(m_requiredProof, client,
+                                         QByteArray(contactData.proof().salt().c_str(), contactData.proof().salt().size()),
+                                         contactData.proof().nonce()))
+        {
+            LOG_DEBUG(lcChannel) << "Sending a proof of work challenge of difficulty" << m_requiredProof << "for a contact request";
+            QByteArray salt = ContactRequestProof::challengeSalt(client);
+            QScopedPointer<ProofChallenge> challenge(new ProofChallenge);
+            challenge->set_difficulty(m_requiredProof);
+            challenge->set_salt(salt.constData(), salt.size());
+            result->SetAllocatedExtension(Data::ContactRequest::proof_challenge, challenge.take());
+            result->set_common_error(ChannelResult::FailedError);
+            return false;
+        }
+    }
+
+    // A final response given when the channel was created, e.g. for a blocked host, is sent
+    // without looking at the request
+    if (m_responseStatus <= Response::Pending) {
+        QString nickname = QString::fromStdString(contactData.nickname());
+        QString message = QString::fromStdString(contactData.message_text());
+
+        m_responseStatus = Response::Undefined;
+        if (message.size() > Data::ContactRequest::MessageMaxCharacters ||
+            !isAcceptableNickname(nickname))
+        {
+            LOG_WARNING(lcChannel) << "Rejecting incoming contact request with invalid nickname/message";
             setResponseStatus(Response::Error);
+        } else {
+            m_nickname = nickname;
+            m_message = message;
+            emit requestReceived();
+
+            if (m_responseStatus == Response::Undefined) {
+                BUG() << "No response to incoming contact request after requestReceived signal";
+                setResponseStatus(Response::Error);
+            }
         }
     }
 
@@ -239,14 +289,35 @@ bool ContactRequestChannel::allowOutboundChannelRequest(Data::Control::OpenChann
     if (!m_message.isEmpty())
         contactData->set_message_text(m_message.toStdString());
 
+    if (!m_proofSalt.isEmpty()) {
+        Data::ContactRequest::ProofOfWork *proof = contactData->mutable_proof();
+        proof->set_salt(m_proofSalt.constData(), m_proofSalt.size());
+        proof->set_nonce(m_proofNonce);
+    }
+
     request->SetAllocatedExtension(Data::ContactRequest::contact_request, contactData.take());
     return true;
 }
 
 bool ContactRequestChannel::processChannelOpenResult(const Data::Control::ChannelResult *result)
 {
+    if (!result->HasExtension(Data::ContactRequest::response) &&
+        result->HasExtension(Data::ContactRequest::proof_challenge))
+    {
+        const Data::ContactRequest::ProofChallenge &challenge = result->GetExtension(Data::ContactRequest::proof_challenge);
+        if (challenge.difficulty() <= 0 || challenge.difficulty() > ContactRequestProof::MaxDifficulty ||
+            challenge.salt().size() != ContactRequestProof::SaltSize)
+        {
+            LOG_DEBUG(lcChannel) << "Ignoring invalid proof of work challenge for the contact request";
+        } else {
+            LOG_DEBUG(lcChannel) << "Contact request needs a proof of work of difficulty" << challenge.difficulty();
+            emit proofRequired(challenge.difficulty(), QByteArray(challenge.salt().c_str(), challenge.salt().size()));
+        }
+        return false;
+    }
+
     if (!result->HasExtension(Data::ContactRequest::response)) {
-        qDebug() << "Expected a response for the contact request";
+        LOG_DEBUG(lcChannel) << "Expected a response for the contact request";
         return false;
     }
 
@@ -258,7 +329,7 @@ void ContactRequestChannel::receivePacket(const QByteArray &packet)
 {
     Data::ContactRequest::Response response;
     if (!response.ParseFromArray(packet.constData(), packet.size())) {
-        qDebug() << "Invalid message received on contact request channel";
+        LOG_DEBUG(lcChannel) << "Invalid message received on contact request channel";
         closeChannel();
         return;
     }
@@ -271,12 +342,12 @@ bool ContactRequestChannel::handleResponse(const Data::ContactRequest::Response
 {
     using namespace Data::ContactRequest;
     if (response->status() == Response::Undefined) {
-        qDebug() << "Got an invalid response (undefined status) to a contact request";
+        LOG_DEBUG(lcChannel) << "Got an invalid response (undefined status) to a contact request";
         return false;
     }
 
     if (m_responseStatus > Response::Pending) {
-        qDebug() << "Received a response" << response->status() << "to a contact request which already had a final response" << m_responseStatus;
+        LOG_DEBUG(lcChannel) << "Received a response" << response->status() << "to a contact request which already had a final response" << m_responseStatus;
         return false;
     }
 
@@ -55,9 +55,15 @@ public:
     // Outbound
     void setMessage(const QString &message);
     void setNickname(const QString &nickname);
+    /* Solution to a ProofChallenge from an earlier request */
+    void setProof(const QByteArray &salt, quint64 nonce);
 
     // Inbound
+    /* May also be called with a final status from Connection::channelCreated,
+     * which answers the request without emitting requestReceived. */
     void setResponseStatus(Status status);
+    /* Require a proof of work of this many bits; called from Connection::channelCreated */
+    void setRequiredProof(int difficulty);
 
 signals:
     /* Emitted during the inbound channel request handler, when a new request
@@ -66,6 +72,9 @@ signals:
      */
     void requestReceived();
     void requestStatusChanged(Status status);
+    /* Emitted when the peer answers an outbound request with a challenge. The
+     * channel is closed; the solution can be sent with a later request. */
+    void proofRequired(int difficulty, const QByteArray &salt);
 
 protected:
     virtual bool allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result);
@@ -77,6 +86,9 @@ private:
     QString m_nickname;
     QString m_message;
     Status m_responseStatus;
+    int m_requiredProof;
+    QByteArray m_proofSalt;
+    quint64 m_proofNonce;
 
     bool handleResponse(const Data::ContactRequest::Response *response);
 };
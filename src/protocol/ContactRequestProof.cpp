@@ -0,0 +1,170 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ContactRequestProof.h"
+#include "utils/SecureRNG.h"
+#include <QMessageAuthenticationCode>
+#include <QDateTime>
+#include <QDebug>
+#include <openssl/evp.h>
+
+using namespace Protocol;
+
+static const char proofContext[] = "im.ricochet.contact-request-proof";
+
+static bool hasLeadingZeroBits(const unsigned char *hash, int bits)
+{
+    int i = 0;
+    for (; bits >= 8; bits -= 8) {
+        if (hash[i++])
+            return false;
+    }
+    return !bits || !(hash[i] >> (8 - bits));
+}
+
+/* Hash of everything before the nonce, which is copied for each attempt */
+static bool initProofHash(EVP_MD_CTX *ctx, const OnionId &client, const QByteArray &salt)
+{
+    QByteArray clientData = client.data();
+    return EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) &&
+           EVP_DigestUpdate(ctx, proofContext, sizeof(proofContext)) &&
+           EVP_DigestUpdate(ctx, salt.constData(), salt.size()) &&
+           EVP_DigestUpdate(ctx, clientData.constData(), clientData.size());
+}
+
+static bool finishProofHash(EVP_MD_CTX *ctx, const EVP_MD_CTX *prefix, quint64 nonce, unsigned char *hash)
+{
+    unsigned char nonceData[8];
+    for (int i = 0; i < 8; i++)
+        nonceData[i] = quint8(nonce >> (i * 8));
+
+    return EVP_MD_CTX_copy_ex(ctx, prefix) &&
+           EVP_DigestUpdate(ctx, nonceData, sizeof(nonceData)) &&
+           EVP_DigestFinal_ex(ctx, hash, NULL);
+}
+
+QByteArray ContactRequestProof::challengeSalt(const OnionId &client)
+{
+    return challengeSalt(client, QDateTime::currentMSecsSinceEpoch() / 1000 / ChallengePeriod);
+}
+
+QByteArray ContactRequestProof::challengeSalt(const OnionId &client, qint64 period)
+{
+    static const QByteArray secret = SecureRNG::random(32);
+
+    QByteArray data = client.data();
+    for (int i = 0; i < 8; i++)
+        data.append(char(quint64(period) >> (i * 8)));
+    return QMessageAuthenticationCode::hash(data, secret, QCryptographicHash::Sha256).left(SaltSize);
+}
+
+bool ContactRequestProof::verify(int difficulty, const OnionId &client, const QByteArray &salt, quint64 nonce)
+{
+    if (difficulty <= 0)
+        return true;
+    if (!client.isValid() || salt.size() != SaltSize)
+        return false;
+
+    qint64 period = QDateTime::currentMSecsSinceEpoch() / 1000 / ChallengePeriod;
+    if (salt != challengeSalt(client, period) && salt != challengeSalt(client, period - 1))
+        return false;
+
+    EVP_MD_CTX *prefix = EVP_MD_CTX_create();
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    bool ok = prefix && ctx && initProofHash(prefix, client, salt) &&
+              finishProofHash(ctx, prefix, nonce, hash) &&
+              hasLeadingZeroBits(hash, qMin(difficulty, int(MaxDifficulty)));
+    EVP_MD_CTX_destroy(ctx);
+    EVP_MD_CTX_destroy(prefix);
+    return ok;
+}
+
+int ContactRequestProof::difficultyForRate(int rate, int limit)
+{
+    if (limit <= 0 || rate <= limit)
+        return 0;
+
+    int difficulty = BaseDifficulty;
+    for (int r = rate / limit; r >= 2 && difficulty < MaxDifficulty; r /= 2)
+        difficulty++;
+    return difficulty;
+}
+
+ContactRequestProofSolver::ContactRequestProofSolver(int difficulty, const OnionId &client, const QByteArray &salt,
+                                                     QObject *parent)
+    : QThread(parent)
+    , m_difficulty(qBound(0, difficulty, int(ContactRequestProof::MaxDifficulty)))
+    , m_client(client)
+    , m_salt(salt)
+    , m_cancelled(0)
+    , m_nonce(0)
+    , m_solved(false)
+{
+}
+
+ContactRequestProofSolver::~ContactRequestProofSolver()
+{
+    m_cancelled.fetchAndStoreOrdered(1);
+    wait();
+}
+
+void ContactRequestProofSolver::run()
+{
+    EVP_MD_CTX *prefix = EVP_MD_CTX_create();
+    EVP_MD_CTX *ctx = EVP_MD_CTX_create();
+    if (!prefix || !ctx || !initProofHash(prefix, m_client, m_salt)) {
+        qWarning() << "Failed to start solving a contact request proof";
+        EVP_MD_CTX_destroy(ctx);
+        EVP_MD_CTX_destroy(prefix);
+        return;
+    }
+
+    // Any nonce works, so start at a random one and give up long after a solution is expected
+    quint64 nonce = SecureRNG::randomInt64();
+    quint64 attempts = quint64(64) << m_difficulty;
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    for (quint64 i = 0; i < attempts; i++, nonce++) {
+        if ((i & 0xfff) == 0 && m_cancelled.load())
+            break;
+        if (!finishProofHash(ctx, prefix, nonce, hash))
+            break;
+        if (hasLeadingZeroBits(hash, m_difficulty)) {
+            m_nonce = nonce;
+            m_solved = true;
+            break;
+        }
+    }
+
+    EVP_MD_CTX_destroy(ctx);
+    EVP_MD_CTX_destroy(prefix);
+}
@@ -0,0 +1,109 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PROTOCOL_CONTACTREQUESTPROOF_H
+#define PROTOCOL_CONTACTREQUESTPROOF_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include "utils/OnionId.h"
+
+namespace Protocol
+{
+
+/* Proof of work for contact requests
+ *
+ * An identity receiving a flood of contact requests can require new requests
+ * to carry a proof of work. A request without a valid proof is answered with a
+ * challenge: a difficulty and a salt. The client finds a nonce for which
+ * SHA-256(context, salt, client ID, nonce) starts with that many zero bits,
+ * and sends the salt and nonce with its next request. Checking a proof costs
+ * one HMAC and one hash.
+ *
+ * The salt is an HMAC of the client's ID and the current period under a
+ * random secret of this process. Servers don't keep any state for challenges,
+ * and a solution is only valid for that client, until the end of the next
+ * period.
+ */
+class ContactRequestProof
+{
+public:
+    // Difficulty for a request rate just above the limit; each doubling adds a bit
+    static const int BaseDifficulty = 16;
+    static const int MaxDifficulty = 22;
+    static const int SaltSize = 16;
+    // Seconds in each challenge period
+    static const int ChallengePeriod = 600;
+
+    static QByteArray challengeSalt(const OnionId &client);
+    static bool verify(int difficulty, const OnionId &client, const QByteArray &salt, quint64 nonce);
+    /* Difficulty for a rate of new requests, given the rate where proofs start */
+    static int difficultyForRate(int rate, int limit);
+
+private:
+    static QByteArray challengeSalt(const OnionId &client, qint64 period);
+};
+
+/* Finds the nonce for a challenge on its own thread
+ *
+ * The result is available after QThread::finished. Deleting the solver stops
+ * it early.
+ */
+class ContactRequestProofSolver : public QThread
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ContactRequestProofSolver)
+
+public:
+    ContactRequestProofSolver(int difficulty, const OnionId &client, const QByteArray &salt, QObject *parent = 0);
+    virtual ~ContactRequestProofSolver();
+
+    int difficulty() const { return m_difficulty; }
+    QByteArray salt() const { return m_salt; }
+    bool isSolved() const { return m_solved; }
+    quint64 nonce() const { return m_nonce; }
+
+protected:
+    virtual void run();
+
+private:
+    const int m_difficulty;
+    const OnionId m_client;
+    const QByteArray m_salt;
+    QAtomicInt m_cancelled;
+    quint64 m_nonce;
+    bool m_solved;
+};
+
+}
+
+#endif
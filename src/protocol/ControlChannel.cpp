@@ -34,11 +34,20 @@
 #include "Channel_p.h"
 #include "Connection_p.h"
 #include "utils/Useful.h"
+#include "utils/Log.h"
 #include <QScopedPointer>
 #include <QDebug>
 
 using namespace Protocol;
 
+const char ControlChannel::idleCloseFeature[] = "im.ricochet.idle-close";
+
+// Features this version can enable when the peer asks for them
+static bool isSupportedFeature(const QString &feature)
+{
+    return feature == QLatin1String(ControlChannel::idleCloseFeature);
+}
+
 ControlChannel::ControlChannel(Direction direction, Connection *connection)
     : Channel(QStringLiteral("control"), direction, connection)
 {
@@ -69,7 +78,7 @@ bool ControlChannel::sendOpenChannel(Channel *channel)
     request->set_channel_identifier(channelId);
 
     if (!channel->d_ptr->openChannelOutbound(request.data())) {
-        qDebug() << "Outbound OpenChannel request of type" << channel->type() << "refused locally";
+        LOG_DEBUG(lcChannel) << "Outbound OpenChannel request of type" << channel->type() << "refused locally";
         return false;
     }
 
@@ -105,6 +114,41 @@ void ControlChannel::keepAlive()
     sendMessage(packet);
 }
 
+void ControlChannel::enableFeatures(const QStringList &features)
+{
+    Data::Control::EnableFeatures *request = new Data::Control::EnableFeatures;
+    foreach (const QString &feature, features) {
+        request->add_feature(feature.toStdString());
+        m_requestedFeatures.append(feature);
+    }
+
+    Data::Control::Packet packet;
+    packet.set_allocated_enable_features(request);
+    sendMessage(packet);
+}
+
+bool ControlChannel::isFeatureEnabled(const QString &feature) const
+{
+    return m_enabledFeatures.contains(feature);
+}
+
+bool ControlChannel::closeIdle()
+{
+    if (!isFeatureEnabled(QLatin1String(idleCloseFeature)))
+        return false;
+
+    Data::Control::CloseConnection *message = new Data::Control::CloseConnection;
+    message->set_reason(Data::Control::CloseConnection::Idle);
+
+    Data::Control::Packet packet;
+    packet.set_allocated_close_connection(message);
+    sendMessage(packet);
+
+    // The socket is closed once the message is written
+    connection()->close();
+    return true;
+}
+
 bool ControlChannel::allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result)
 {
     Q_UNUSED(request);
@@ -131,7 +175,7 @@ void ControlChannel::receivePacket(const QByteArray &packet)
 {
     Data::Control::Packet message;
     if (!message.ParseFromArray(packet.constData(), packet.size())) {
-        qWarning() << "Control channel failed parsing packet; connection will be killed";
+        LOG_WARNING(lcChannel) << "Control channel failed parsing packet; connection will be killed";
         closeChannel();
         return;
     }
@@ -146,8 +190,10 @@ void ControlChannel::receivePacket(const QByteArray &packet)
         handleEnableFeatures(message.enable_features());
     } else if (message.has_features_enabled()) {
         handleFeaturesEnabled(message.features_enabled());
+    } else if (message.has_close_connection()) {
+        handleCloseConnection(message.close_connection());
     } else {
-        qWarning() << "Unrecognized message on control channel; connection will be killed";
+        LOG_WARNING(lcChannel) << "Unrecognized message on control channel; connection will be killed";
         closeChannel();
         return;
     }
@@ -159,7 +205,7 @@ void ControlChannel::handleOpenChannel(const Data::Control::OpenChannel &message
     int id = message.channel_identifier();
     Connection::Direction peerSide = (connection()->direction() == Connection::ClientSide) ? Connection::ServerSide : Connection::ClientSide;
     if (!connection()->d->isValidAvailableChannelId(id, peerSide)) {
-        qWarning() << "Received OpenChannel with invalid channel_identifier:" << QString::fromStdString(message.DebugString());
+        LOG_WARNING(lcChannel) << "Received OpenChannel with invalid channel_identifier:" << QString::fromStdString(message.DebugString());
         // Deliberately invalid behavior; kill the connection
         closeChannel();
         return;
@@ -170,7 +216,7 @@ void ControlChannel::handleOpenChannel(const Data::Control::OpenChannel &message
 
     Channel *channel = Channel::create(QString::fromStdString(message.channel_type()), Inbound, connection());
     if (!channel) {
-        qDebug() << "Received OpenChannel for unknown channel type:" << QString::fromStdString(message.channel_type());
+        LOG_DEBUG(lcChannel) << "Received OpenChannel for unknown channel type:" << QString::fromStdString(message.channel_type());
         response->set_opened(false);
         response->set_common_error(Data::Control::ChannelResult::UnknownTypeError);
     } else {
@@ -197,14 +243,14 @@ void ControlChannel::handleOpenChannel(const Data::Control::OpenChannel &message
             channel->closeChannel();
         } else if (!connection()->d->insertChannel(channel)) {
             Q_ASSERT_X(false, "handleOpenChannel", "Valid channel refused by connection");
-            qWarning() << "BUG: Valid channel refused by connection";
+            LOG_WARNING(lcChannel) << "BUG: Valid channel refused by connection";
             response->set_opened(false);
             channel->closeChannel();
         }
     }
 
     if (!response->opened()) {
-        qDebug() << "Rejected OpenChannel request:" << QString::fromStdString(message.DebugString()) << "response:" << QString::fromStdString(response->DebugString());
+        LOG_DEBUG(lcChannel) << "Rejected OpenChannel request:" << QString::fromStdString(message.DebugString()) << "response:" << QString::fromStdString(response->DebugString());
         // Clean up channel instance
         delete channel;
         channel = 0;
@@ -223,12 +269,12 @@ void ControlChannel::handleChannelResult(const Data::Control::ChannelResult &mes
     int id = message.channel_identifier();
     Channel *channel = connection()->channel(id);
     if (!channel) {
-        qWarning() << "Received ChannelResult for unknown identifier, ignoring:" << QString::fromStdString(message.DebugString());
+        LOG_WARNING(lcChannel) << "Received ChannelResult for unknown identifier, ignoring:" << QString::fromStdString(message.DebugString());
         return;
     }
 
     if (channel->direction() != Outbound || channel->isOpened()) {
-        qWarning() << "Received (duplicate?) ChannelResult for existing channel in an unexpected state:" << QString::fromStdString(message.DebugString());
+        LOG_WARNING(lcChannel) << "Received (duplicate?) ChannelResult for existing channel in an unexpected state:" << QString::fromStdString(message.DebugString());
         return;
     }
 
@@ -269,16 +315,63 @@ void ControlChannel::handleKeepAlive(const Data::Control::KeepAlive &message)
 
 void ControlChannel::handleEnableFeatures(const Data::Control::EnableFeatures &message)
 {
-    // This version does not support any features.
     Data::Control::Packet responseMessage;
-    responseMessage.mutable_features_enabled();
+    Data::Control::FeaturesEnabled *response = responseMessage.mutable_features_enabled();
+
+    bool changed = false;
+    for (int i = 0; i < message.feature_size(); i++) {
+        QString feature = QString::fromStdString(message.feature(i));
+        if (!isSupportedFeature(feature))
+            continue;
+        response->add_feature(message.feature(i));
+        if (!m_enabledFeatures.contains(feature)) {
+            m_enabledFeatures.append(feature);
+            changed = true;
+        }
+    }
+
     sendMessage(responseMessage);
+    if (changed)
+        emit featuresEnabled();
 }
 
 void ControlChannel::handleFeaturesEnabled(const Data::Control::FeaturesEnabled &message)
 {
-    // This version does not generate EnableFeatures messages, so receiving this is an error.
-    qDebug() << "Unexpectedly received FeaturesEnabled message from peer, but we never send EnableFeatures";
-    closeChannel();
+    if (m_requestedFeatures.isEmpty()) {
+        LOG_DEBUG(lcChannel) << "Unexpectedly received FeaturesEnabled message from peer, but we never sent EnableFeatures";
+        closeChannel();
+        return;
+    }
+
+    // Peers that don't know a feature leave it out, as this version did before supporting any
+    bool changed = false;
+    for (int i = 0; i < message.feature_size(); i++) {
+        QString feature = QString::fromStdString(message.feature(i));
+        if (!m_requestedFeatures.contains(feature)) {
+            LOG_DEBUG(lcChannel) << "Peer enabled feature" << feature << "which was not requested; ignoring";
+            continue;
+        }
+        if (!m_enabledFeatures.contains(feature)) {
+            m_enabledFeatures.append(feature);
+            changed = true;
+        }
+    }
+
+    if (changed)
+        emit featuresEnabled();
+}
+
+void ControlChannel::handleCloseConnection(const Data::Control::CloseConnection &message)
+{
+    if (!isFeatureEnabled(QLatin1String(idleCloseFeature))) {
+        LOG_WARNING(lcChannel) << "Received CloseConnection without enabling the feature; connection will be killed";
+        closeChannel();
+        return;
+    }
+
+    if (message.reason() == Data::Control::CloseConnection::Idle) {
+        LOG_DEBUG(lcChannel) << "Peer is closing the connection for being idle";
+        emit peerClosingIdle();
+    }
 }
 
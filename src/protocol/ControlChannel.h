@@ -35,6 +35,7 @@
 
 #include "Channel.h"
 #include "ControlChannel.pb.h"
+#include <QStringList>
 
 namespace Protocol
 {
@@ -47,11 +48,27 @@ class ControlChannel : public Channel
     friend class ConnectionPrivate;
 
 public:
+    // Feature of peers that close idle connections gracefully, with closeIdle()
+    static const char idleCloseFeature[];
+
     bool sendOpenChannel(Channel *channel);
     void keepAlive();
 
+    /* Ask the peer to enable features. Features the peer also supports are
+     * enabled when it replies, and featuresEnabled() is emitted. */
+    void enableFeatures(const QStringList &features);
+    bool isFeatureEnabled(const QString &feature) const;
+
+    /* Tell the peer the connection is closed for being idle, and close it.
+     * This requires idleCloseFeature; without it, nothing is sent and false
+     * is returned. */
+    bool closeIdle();
+
 signals:
     void keepAliveResponse();
+    void featuresEnabled();
+    // The peer is closing the connection for being idle
+    void peerClosingIdle();
 
 protected:
     explicit ControlChannel(Direction direction, Connection *connection);
@@ -68,6 +85,10 @@ private:
     void handleKeepAlive(const Data::Control::KeepAlive &message);
     void handleEnableFeatures(const Data::Control::EnableFeatures &message);
     void handleFeaturesEnabled(const Data::Control::FeaturesEnabled &message);
+    void handleCloseConnection(const Data::Control::CloseConnection &message);
+
+    QStringList m_requestedFeatures;
+    QStringList m_enabledFeatures;
 };
 
 }
@@ -32,9 +32,13 @@
 
 #include "OutboundConnector.h"
 #include "utils/Useful.h"
+#include "utils/Metrics.h"
+#include "utils/Trace.h"
+#include "utils/Log.h"
 #include "tor/TorSocket.h"
 #include "ControlChannel.h"
 #include "AuthHiddenServiceChannel.h"
+#include <QElapsedTimer>
 
 using namespace Protocol;
 
@@ -53,9 +57,11 @@ public:
     quint16 port;
     OutboundConnector::Status status;
     CryptoKey authPrivateKey;
+    CryptoKey legacyAuthPrivateKey;
     QString errorMessage;
     QTimer errorRetryTimer;
     int errorRetryCount;
+    QElapsedTimer statusTimer;
 
     OutboundConnectorPrivate(OutboundConnector *q)
         : QObject(q)
@@ -67,6 +73,7 @@ public:
         , errorRetryCount(0)
     {
         connect(&errorRetryTimer, &QTimer::timeout, this, &OutboundConnectorPrivate::retryAfterError);
+        statusTimer.start();
     }
 
     void setStatus(OutboundConnector::Status status);
@@ -100,6 +107,11 @@ void OutboundConnector::setAuthPrivateKey(const CryptoKey &key)
     d->authPrivateKey = key;
 }
 
+void OutboundConnector::setLegacyAuthPrivateKey(const CryptoKey &key)
+{
+    d->legacyAuthPrivateKey = key;
+}
+
 bool OutboundConnector::connectToHost(const QString &hostname, quint16 port)
 {
     if (port <= 0 || hostname.isEmpty()) {
@@ -201,6 +213,26 @@ void OutboundConnectorPrivate::setStatus(OutboundConnector::Status value)
     if (status == value)
         return;
 
+    // Count each transition, and how long was spent in the state being left
+    static const char * const names[] = { "inactive", "connecting", "initializing", "authenticating", "ready", "error" };
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    metrics->counter("ricochet_outbound_connector_transitions_total", "Outbound connector state changes, by new state",
+                     MetricsRegistry::label("state", QLatin1String(names[value])))->add();
+    metrics->histogram("ricochet_outbound_connector_state_duration_microseconds", "Time outbound connectors spent in each state",
+                       MetricsRegistry::label("state", QLatin1String(names[status])))->record(statusTimer.nsecsElapsed() / 1000);
+    statusTimer.restart();
+
+    // An async span covers the whole attempt, with one nested for each step
+    static const char * const traceNames[] = { 0, "socks connect", "version negotiation", "authentication", 0, 0 };
+    if (traceNames[status])
+        TRACE_ASYNC_END("outbound", traceNames[status], Tracing::pointerId(q));
+    else if (traceNames[value])
+        TRACE_ASYNC_BEGIN("outbound", "connection", Tracing::pointerId(q));
+    if (traceNames[value])
+        TRACE_ASYNC_BEGIN("outbound", traceNames[value], Tracing::pointerId(q));
+    else if (traceNames[status])
+        TRACE_ASYNC_END("outbound", "connection", Tracing::pointerId(q));
+
     bool wasActive = q->isActive();
     status = value;
     emit q->statusChanged();
@@ -217,24 +249,24 @@ void OutboundConnectorPrivate::setError(const QString &message)
     // XXX This is a bad solution, but it will hold until we can revisit the
     // reconnecting and connection error behavior as a whole.
     if (++errorRetryCount > 5) {
-        qDebug() << "Outbound connection attempt has had five errors in a row, stopping attempts";
+        LOG_DEBUG(lcConnection) << "Outbound connection attempt has had five errors in a row, stopping attempts";
         return;
     }
 
     errorRetryTimer.setSingleShot(true);
     errorRetryTimer.start(60 * 1000);
-    qDebug() << "Retrying outbound connection attempt in 60 seconds after an error";
+    LOG_DEBUG(lcConnection) << "Retrying outbound connection attempt in 60 seconds after an error";
 }
 
 void OutboundConnectorPrivate::retryAfterError()
 {
     if (status != OutboundConnector::Error) {
-        qDebug() << "Error retry timer triggered, but not in an error state anymore. Ignoring.";
+        LOG_DEBUG(lcConnection) << "Error retry timer triggered, but not in an error state anymore. Ignoring.";
         return;
     }
 
     if (hostname.isEmpty() || port <= 0) {
-        qDebug() << "Connection info cleared during error retry period, stopping OutboundConnector";
+        LOG_DEBUG(lcConnection) << "Connection info cleared during error retry period, stopping OutboundConnector";
         q->abort();
         return;
     }
@@ -291,7 +323,7 @@ void OutboundConnectorPrivate::startAuthentication()
     );
     connect(authChannel, &AuthHiddenServiceChannel::authFailed, this,
         [this]() {
-            qDebug() << "Authentication failed for outbound connection to" << hostname;
+            LOG_DEBUG(lcConnection) << "Authentication failed for outbound connection to" << hostname;
             setError(QStringLiteral("Authentication failed"));
         }
     );
@@ -304,6 +336,8 @@ void OutboundConnectorPrivate::startAuthentication()
     );
 
     authChannel->setPrivateKey(authPrivateKey);
+    if (legacyAuthPrivateKey.isLoaded() && authPrivateKey.algorithm() == CryptoKey::Ed25519Key)
+        authChannel->setLegacyPrivateKey(legacyAuthPrivateKey);
     if (!authChannel->openChannel()) {
         setError(QStringLiteral("Unable to open authentication channel"));
     }
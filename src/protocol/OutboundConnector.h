@@ -77,6 +77,9 @@ public:
 
     bool connectToHost(const QString &hostname, quint16 port);
     void setAuthPrivateKey(const CryptoKey &key);
+    /* Previous RSA key of an identity that moved to v3, proven to the peer
+     * so that it can update the contact's hostname */
+    void setLegacyAuthPrivateKey(const CryptoKey &key);
 
     /* Take ownership of the Connection object when Ready
      *
@@ -0,0 +1,108 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "AddOnionCommand.h"
+#include "HiddenService.h"
+#include "utils/CryptoKey.h"
+#include "utils/Useful.h"
+
+using namespace Tor;
+
+AddOnionCommand::AddOnionCommand()
+    : m_alreadyPublished(false)
+{
+}
+
+bool AddOnionCommand::isSuccessful() const
+{
+    return statusCode() == 250 || m_alreadyPublished;
+}
+
+QByteArray AddOnionCommand::build(HiddenService *service, bool nonAnonymous)
+{
+    QByteArray key = service->cryptoKey().torExpandedEd25519Key();
+    if (key.isEmpty()) {
+        BUG() << "Cannot publish hidden service" << service->dataPath << "without an Ed25519 key";
+        return QByteArray();
+    }
+
+    return buildCommand("ED25519-V3:" + key.toBase64(), service, nonAnonymous);
+}
+
+QByteArray AddOnionCommand::buildLegacy(HiddenService *service, bool nonAnonymous)
+{
+    QByteArray key = service->legacyCryptoKey().encodedPrivateKey(CryptoKey::DER);
+    if (key.isEmpty()) {
+        BUG() << "Cannot publish the legacy hidden service of" << service->dataPath << "without an RSA key";
+        return QByteArray();
+    }
+
+    return buildCommand("RSA1024:" + key.toBase64(), service, nonAnonymous);
+}
+
+QByteArray AddOnionCommand::buildCommand(const QByteArray &key, HiddenService *service, bool nonAnonymous)
+{
+    QByteArray out("ADD_ONION ");
+    out += key;
+    out += nonAnonymous ? " Flags=DiscardPK,NonAnonymous" : " Flags=DiscardPK";
+
+    foreach (const HiddenService::Target &target, service->targets()) {
+        out += " Port=" + QByteArray::number(target.servicePort) + ",";
+        if (!target.unixPath.isEmpty())
+            out += "unix:" + target.unixPath.toLocal8Bit();
+        else
+            out += target.targetAddress.toString().toLatin1() + ":" + QByteArray::number(target.targetPort);
+    }
+
+    out.append("\r\n");
+    return out;
+}
+
+void AddOnionCommand::onReply(int statusCode, const QByteArray &data)
+{
+    TorControlCommand::onReply(statusCode, data);
+
+    // Services added on this control connection remain until it is closed
+    if (statusCode == 550 && data.contains("collision"))
+        m_alreadyPublished = true;
+    else if (statusCode != 250)
+        m_errorMessage = QString::fromLatin1(data);
+}
+
+void AddOnionCommand::onFinished(int statusCode)
+{
+    TorControlCommand::onFinished(statusCode);
+    if (isSuccessful())
+        emit addOnionSucceeded();
+    else
+        emit addOnionFailed(statusCode);
+}
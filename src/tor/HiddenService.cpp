@@ -34,19 +34,26 @@
 #include "TorControl.h"
 #include "TorSocket.h"
 #include "utils/CryptoKey.h"
+#include "utils/Useful.h"
 #include <QDir>
 #include <QFile>
+#include <QSaveFile>
 #include <QTimer>
 #include <QDebug>
 
 using namespace Tor;
 
 HiddenService::HiddenService(const QString &p, QObject *parent)
-    : QObject(parent), dataPath(p), pStatus(NotCreated)
+    : QObject(parent), dataPath(p), pStatus(NotCreated), pVersion(2), pSingleHop(false), pPublishLegacy(false), pIntroPoints(0),
+      pConnectionRate(0)
 {
     /* Set the initial status and, if possible, load the hostname */
     QDir dir(dataPath);
-    if (dir.exists(QLatin1String("hostname")) && dir.exists(QLatin1String("private_key")))
+    if (dir.exists(QLatin1String("private_key_ed25519")))
+        pVersion = 3;
+
+    if (dir.exists(QLatin1String("hostname")) &&
+        dir.exists(QLatin1String(pVersion == 3 ? "private_key_ed25519" : "private_key")))
     {
         readHostname();
         if (!pHostname.isEmpty())
@@ -54,17 +61,31 @@ HiddenService::HiddenService(const QString &p, QObject *parent)
     }
 }
 
+HiddenService::Status HiddenService::status() const
+{
+    QMutexLocker locker(&pMutex);
+    return pStatus;
+}
+
+QString HiddenService::hostname() const
+{
+    QMutexLocker locker(&pMutex);
+    return pHostname;
+}
+
 void HiddenService::setStatus(Status newStatus)
 {
+    QMutexLocker locker(&pMutex);
     if (pStatus == newStatus)
         return;
 
     Status old = pStatus;
     pStatus = newStatus;
+    locker.unlock();
 
-    emit statusChanged(pStatus, old);
+    emit statusChanged(newStatus, old);
 
-    if (pStatus == Online)
+    if (newStatus == Online)
         emit serviceOnline();
 }
 
@@ -75,12 +96,44 @@ void HiddenService::addTarget(const Target &target)
 
 void HiddenService::addTarget(quint16 servicePort, QHostAddress targetAddress, quint16 targetPort)
 {
-    Target t = { targetAddress, servicePort, targetPort };
+    Target t = { targetAddress, servicePort, targetPort, QString() };
     pTargets.append(t);
 }
 
+void HiddenService::addTarget(quint16 servicePort, const QString &unixPath)
+{
+    Target t = { QHostAddress(), servicePort, 0, unixPath };
+    pTargets.append(t);
+}
+
+void HiddenService::setIntroductionPoints(int count)
+{
+    if (pIntroPoints == count)
+        return;
+
+    pIntroPoints = count;
+    emit introductionPointsChanged(count);
+}
+
+void HiddenService::connectionAccepted()
+{
+    pWindowConnections.ref();
+}
+
+void HiddenService::updateLoad(int intervalSecs)
+{
+    // Weight of the latest interval in the moving average
+    static const double alpha = 0.5;
+
+    int connections = pWindowConnections.fetchAndStoreRelaxed(0);
+
+    double rate = connections * 60.0 / qMax(intervalSecs, 1);
+    pConnectionRate = alpha * rate + (1 - alpha) * pConnectionRate;
+}
+
 void HiddenService::readHostname()
 {
+    QMutexLocker locker(&pMutex);
     pHostname.clear();
 
     QFile file(dataPath + QLatin1String("/hostname"));
@@ -91,7 +144,7 @@ void HiddenService::readHostname()
     }
 
     QByteArray data;
-    data.resize(32);
+    data.resize(80);
 
     int rd = file.readLine(data.data(), data.size());
     if (rd < 0)
@@ -103,7 +156,7 @@ void HiddenService::readHostname()
     data.resize(rd);
 
     int sep = data.lastIndexOf('.');
-    if (sep != 16 || data.mid(sep) != ".onion\n")
+    if (sep != (pVersion == 3 ? 56 : 16) || data.mid(sep) != ".onion\n")
     {
         qDebug() << "Failed to read hostname file for hidden service" << dataPath << "- invalid contents";
         return;
@@ -115,8 +168,16 @@ void HiddenService::readHostname()
 
 CryptoKey HiddenService::cryptoKey()
 {
+    QMutexLocker locker(&pMutex);
     if (!pCryptoKey.isLoaded()) {
-        bool ok = pCryptoKey.loadFromFile(dataPath + QLatin1String("/private_key"), CryptoKey::PrivateKey);
+        bool ok;
+        if (pVersion == 3) {
+            QFile file(dataPath + QLatin1String("/private_key_ed25519"));
+            ok = file.open(QIODevice::ReadOnly) &&
+                 pCryptoKey.loadEd25519(QByteArray::fromBase64(file.readAll().trimmed()), CryptoKey::PrivateKey);
+        } else {
+            ok = pCryptoKey.loadFromFile(dataPath + QLatin1String("/private_key"), CryptoKey::PrivateKey);
+        }
         if (!ok)
             qWarning() << "Failed to load hidden service key";
     }
@@ -124,11 +185,96 @@ CryptoKey HiddenService::cryptoKey()
     return pCryptoKey;
 }
 
+CryptoKey HiddenService::legacyCryptoKey()
+{
+    QMutexLocker locker(&pMutex);
+    if (pVersion == 3 && !pLegacyCryptoKey.isLoaded() && QFile::exists(dataPath + QLatin1String("/private_key")))
+        pLegacyCryptoKey.loadFromFile(dataPath + QLatin1String("/private_key"), CryptoKey::PrivateKey);
+    return pLegacyCryptoKey;
+}
+
+bool HiddenService::createEd25519Key()
+{
+    if (pVersion == 3)
+        return true;
+
+    CryptoKey key;
+    if (!key.generateEd25519()) {
+        qWarning() << "Failed to generate Ed25519 key for hidden service" << dataPath;
+        return false;
+    }
+
+    return createFromKey(key);
+}
+
+bool HiddenService::createFromKey(const CryptoKey &key, const QString &serviceID)
+{
+    if (!key.isPrivate()) {
+        BUG() << "Hidden service cannot be created without a private key";
+        return false;
+    }
+
+    bool ed25519 = (key.algorithm() == CryptoKey::Ed25519Key);
+    if (ed25519 ? (pVersion == 3) : (pStatus != NotCreated)) {
+        BUG() << "Refusing to replace the key of hidden service" << dataPath;
+        return false;
+    }
+
+    QDir dir(dataPath);
+    if (!dir.exists()) {
+        if (!QDir().mkpath(dir.absolutePath())) {
+            qWarning() << "Failed to create hidden service directory" << dataPath;
+            return false;
+        }
+        QFile::setPermissions(dir.absolutePath(), QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+    }
+
+    // Tor reads private_key from the service directory. It doesn't read the
+    // Ed25519 key; that is given to it with ADD_ONION.
+    QString keyPath = dataPath + QLatin1String(ed25519 ? "/private_key_ed25519" : "/private_key");
+    QByteArray keyData = ed25519 ? key.rawEd25519Key(CryptoKey::PrivateKey).toBase64() + "\n"
+                                 : key.encodedPrivateKey(CryptoKey::PEM);
+    QSaveFile keyFile(keyPath);
+    if (keyData.isEmpty() || !keyFile.open(QIODevice::WriteOnly) || keyFile.write(keyData) < 0 || !keyFile.commit()) {
+        qWarning() << "Failed to write hidden service key in" << dataPath << "-" << keyFile.errorString();
+        return false;
+    }
+    QFile::setPermissions(keyPath, QFile::ReadOwner | QFile::WriteOwner);
+
+    // The v2 hostname of a service moving to v3 is derived from the legacy key when needed
+    QString id = serviceID.isEmpty() ? key.torServiceID() : serviceID;
+    QSaveFile hostnameFile(dataPath + QLatin1String("/hostname"));
+    if (!hostnameFile.open(QIODevice::WriteOnly | QIODevice::Text) ||
+        hostnameFile.write(id.toLatin1() + ".onion\n") < 0 || !hostnameFile.commit())
+    {
+        qWarning() << "Failed to write hidden service hostname in" << dataPath << "-" << hostnameFile.errorString();
+        QFile::remove(keyPath);
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&pMutex);
+        if (ed25519) {
+            pLegacyCryptoKey = pCryptoKey;
+            pVersion = 3;
+        }
+        pCryptoKey = key;
+    }
+    readHostname();
+
+    QString hostname = this->hostname();
+    qDebug() << "Created version" << pVersion << "hidden service" << hostname << "in" << dataPath;
+
+    if (!hostname.isEmpty() && status() == NotCreated)
+        setStatus(Offline);
+    return !hostname.isEmpty();
+}
+
 void HiddenService::servicePublished()
 {
     readHostname();
 
-    if (pHostname.isEmpty())
+    if (hostname().isEmpty())
     {
         qDebug() << "Failed to read hidden service hostname";
         return;
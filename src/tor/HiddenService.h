@@ -36,6 +36,8 @@
 #include <QObject>
 #include <QHostAddress>
 #include <QList>
+#include <QAtomicInt>
+#include <QMutex>
 #include "utils/CryptoKey.h"
 
 namespace Tor
@@ -55,6 +57,8 @@ public:
     {
         QHostAddress targetAddress;
         quint16 servicePort, targetPort;
+        // If set, connections are forwarded to this unix socket instead of the address
+        QString unixPath;
     };
 
     enum Status
@@ -68,27 +72,81 @@ public:
 
     HiddenService(const QString &dataPath, QObject *parent = 0);
 
-    Status status() const { return pStatus; }
+    /* The service belongs to the thread of its TorControl. Its status,
+     * hostname and keys may also be read from the thread of the identity
+     * that uses it. */
+    Status status() const;
 
-    const QString &hostname() const { return pHostname; }
+    QString hostname() const;
     CryptoKey cryptoKey();
 
+    /* Version 2 services use an RSA key and hostname generated by Tor. Version 3
+     * services use an Ed25519 key generated by createEd25519Key() and are
+     * published with ADD_ONION. */
+    int version() const { return pVersion; }
+    /* Create an Ed25519 key and hostname, making this a version 3 service. The
+     * RSA key of an existing service is kept as legacyCryptoKey(). */
+    bool createEd25519Key();
+    /* Write the service directory for a key created in advance, such as from
+     * KeyPool, instead of waiting for Tor to generate one. An RSA key is only
+     * accepted for a service that doesn't exist yet. serviceID may be given
+     * if it is already known. */
+    bool createFromKey(const CryptoKey &key, const QString &serviceID = QString());
+    /* Previous RSA key of a service that moved to version 3, if any */
+    CryptoKey legacyCryptoKey();
+    /* Also publish the version 2 service of legacyCryptoKey(), so contacts
+     * that only know the previous hostname can still connect and learn the
+     * new one. Tor releases without version 2 support refuse it. */
+    bool publishesLegacyService() const { return pPublishLegacy; }
+    void setPublishLegacyService(bool enabled) { pPublishLegacy = enabled; }
+
+    /* Single-hop services are not anonymous, and are only published by a
+     * TorControl in single-hop mode */
+    bool isSingleHop() const { return pSingleHop; }
+    void setSingleHop(bool singleHop) { pSingleHop = singleHop; }
+
+    /* Number of introduction points requested from Tor, or 0 for its default.
+     * Changes are signalled so the owner can keep them across restarts. This
+     * only applies to version 2 services; ADD_ONION has no such option. */
+    int introductionPoints() const { return pIntroPoints; }
+    void setIntroductionPoints(int count);
+
+    /* Inbound load, used by TorControl to tune introduction points. This
+     * may be called from the thread of the identity that owns the service. */
+    void connectionAccepted();
+    /* Fold the connections since the last call into the moving averages */
+    void updateLoad(int intervalSecs);
+    // Connections per minute, as a moving average
+    double connectionRate() const { return pConnectionRate; }
+
     const QList<Target> &targets() const { return pTargets; }
     void addTarget(const Target &target);
     void addTarget(quint16 servicePort, QHostAddress targetAddress, quint16 targetPort);
+    void addTarget(quint16 servicePort, const QString &unixPath);
 
 signals:
     void statusChanged(int newStatus, int oldStatus);
     void serviceOnline();
+    void introductionPointsChanged(int count);
 
 private slots:
     void servicePublished();
 
 private:
+    // Guards the state that is read from identity threads
+    mutable QMutex pMutex;
     QList<Target> pTargets;
     QString pHostname;
     Status pStatus;
     CryptoKey pCryptoKey;
+    CryptoKey pLegacyCryptoKey;
+    int pVersion;
+    bool pSingleHop;
+    bool pPublishLegacy;
+    int pIntroPoints;
+
+    QAtomicInt pWindowConnections;
+    double pConnectionRate;
 
     void setStatus(Status newStatus);
     void readHostname();
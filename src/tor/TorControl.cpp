@@ -33,20 +33,28 @@
 #include "TorControl.h"
 #include "TorControlSocket.h"
 #include "HiddenService.h"
+#include "TorTelemetry.h"
 #include "ProtocolInfoCommand.h"
 #include "AuthenticateCommand.h"
 #include "SetConfCommand.h"
+#include "AddOnionCommand.h"
 #include "GetConfCommand.h"
 #include "utils/StringUtil.h"
 #include "utils/Settings.h"
 #include "utils/PendingOperation.h"
+#include "utils/UnixSocket.h"
+#include "utils/Useful.h"
+#include "utils/Trace.h"
+#include "utils/Log.h"
 #include <QHostAddress>
+#include <QMutex>
 #include <QDir>
 #include <QNetworkProxy>
 #include <QQmlEngine>
 #include <QTimer>
 #include <QSaveFile>
 #include <QDebug>
+#include <cmath>
 
 Tor::TorControl *torControl = 0;
 
@@ -63,23 +71,32 @@ public:
 
     TorControlSocket *socket;
     QHostAddress torAddress;
+    QString controlSocketPath;
     QString errorMessage;
     QString torVersion;
     QByteArray authPassword;
+    // Guards torStatus and the SOCKS address, which TorSocket reads from identity threads
+    mutable QMutex mutex;
     QHostAddress socksAddress;
     QList<HiddenService*> services;
     quint16 controlPort, socksPort;
     TorControl::Status status;
     TorControl::TorStatus torStatus;
     QVariantMap bootstrapStatus;
+    bool publishQueued;
+    bool singleHopMode;
+    QTimer loadTimer;
+    TorTelemetry *telemetry;
 
     TorControlPrivate(TorControl *parent);
 
     void setStatus(TorControl::Status status);
     void setTorStatus(TorControl::TorStatus status);
+    void setSocksAddress(const QHostAddress &address, quint16 port);
 
     void getTorInfo();
     void publishServices();
+    void connectSocket();
 
 public slots:
     void socketConnected();
@@ -93,6 +110,8 @@ public slots:
 
     void statusEvent(int code, const QByteArray &data);
     void updateBootstrap(const QList<QByteArray> &data);
+    void publishQueuedServices();
+    void tuneIntroductionPoints();
 };
 
 }
@@ -104,8 +123,12 @@ TorControl::TorControl(QObject *parent)
 
 TorControlPrivate::TorControlPrivate(TorControl *parent)
     : QObject(parent), q(parent), controlPort(0), socksPort(0),
-      status(TorControl::NotConnected), torStatus(TorControl::TorUnknown)
+      status(TorControl::NotConnected), torStatus(TorControl::TorUnknown),
+      publishQueued(false), singleHopMode(false), loadTimer(this), telemetry(0)
 {
+    loadTimer.setInterval(TorControl::IntroPointTuningInterval * 1000);
+    QObject::connect(&loadTimer, &QTimer::timeout, this, &TorControlPrivate::tuneIntroductionPoints);
+
     socket = new TorControlSocket;
     QObject::connect(socket, SIGNAL(connected()), this, SLOT(socketConnected()));
     QObject::connect(socket, SIGNAL(disconnected()), this, SLOT(socketDisconnected()));
@@ -115,6 +138,7 @@ TorControlPrivate::TorControlPrivate(TorControl *parent)
 
 QNetworkProxy TorControl::connectionProxy()
 {
+    QMutexLocker locker(&d->mutex);
     return QNetworkProxy(QNetworkProxy::Socks5Proxy, d->socksAddress.toString(), d->socksPort);
 }
 
@@ -143,7 +167,12 @@ void TorControlPrivate::setTorStatus(TorControl::TorStatus n)
         return;
 
     TorControl::TorStatus old = torStatus;
-    torStatus = n;
+    {
+        QMutexLocker locker(&mutex);
+        torStatus = n;
+    }
+    if (torStatus == TorControl::TorReady)
+        TRACE_ASYNC_END("tor", "bootstrap", Tracing::pointerId(q));
     emit q->torStatusChanged(torStatus, old);
     emit q->connectivityChanged();
 
@@ -153,12 +182,19 @@ void TorControlPrivate::setTorStatus(TorControl::TorStatus n)
     }
 }
 
+void TorControlPrivate::setSocksAddress(const QHostAddress &address, quint16 port)
+{
+    QMutexLocker locker(&mutex);
+    socksAddress = address;
+    socksPort = port;
+}
+
 void TorControlPrivate::setError(const QString &message)
 {
     errorMessage = message;
     setStatus(TorControl::Error);
 
-    qWarning() << "torctrl: Error:" << errorMessage;
+    LOG_WARNING(lcTorControl) << "Error:" << errorMessage;
 
     socket->abort();
 
@@ -172,6 +208,7 @@ TorControl::Status TorControl::status() const
 
 TorControl::TorStatus TorControl::torStatus() const
 {
+    QMutexLocker locker(&d->mutex);
     return d->torStatus;
 }
 
@@ -187,16 +224,19 @@ QString TorControl::errorMessage() const
 
 bool TorControl::hasConnectivity() const
 {
-    return torStatus() == TorReady && !d->socksAddress.isNull();
+    QMutexLocker locker(&d->mutex);
+    return d->torStatus == TorReady && !d->socksAddress.isNull();
 }
 
 QHostAddress TorControl::socksAddress() const
 {
+    QMutexLocker locker(&d->mutex);
     return d->socksAddress;
 }
 
 quint16 TorControl::socksPort() const
 {
+    QMutexLocker locker(&d->mutex);
     return d->socksPort;
 }
 
@@ -219,12 +259,34 @@ void TorControl::connect(const QHostAddress &address, quint16 port)
 {
     if (status() > Connecting)
     {
-        qDebug() << "Ignoring TorControl::connect due to existing connection";
+        LOG_DEBUG(lcTorControl) << "Ignoring TorControl::connect due to existing connection";
         return;
     }
 
     d->torAddress = address;
     d->controlPort = port;
+    d->controlSocketPath.clear();
+    d->setTorStatus(TorUnknown);
+
+    bool b = d->socket->blockSignals(true);
+    d->socket->abort();
+    d->socket->blockSignals(b);
+
+    d->setStatus(Connecting);
+    d->connectSocket();
+}
+
+void TorControl::connect(const QString &socketPath)
+{
+    if (status() > Connecting)
+    {
+        LOG_DEBUG(lcTorControl) << "Ignoring TorControl::connect due to existing connection";
+        return;
+    }
+
+    d->torAddress.clear();
+    d->controlPort = 0;
+    d->controlSocketPath = socketPath;
     d->setTorStatus(TorUnknown);
 
     bool b = d->socket->blockSignals(true);
@@ -232,17 +294,36 @@ void TorControl::connect(const QHostAddress &address, quint16 port)
     d->socket->blockSignals(b);
 
     d->setStatus(Connecting);
-    d->socket->connectToHost(address, port);
+    d->connectSocket();
 }
 
 void TorControl::reconnect()
 {
-    Q_ASSERT(!d->torAddress.isNull() && d->controlPort);
-    if (d->torAddress.isNull() || !d->controlPort || status() >= Connecting)
+    Q_ASSERT((!d->torAddress.isNull() && d->controlPort) || !d->controlSocketPath.isEmpty());
+    if (status() >= Connecting)
+        return;
+    if ((d->torAddress.isNull() || !d->controlPort) && d->controlSocketPath.isEmpty())
         return;
 
     d->setStatus(Connecting);
-    d->socket->connectToHost(d->torAddress, d->controlPort);
+    d->connectSocket();
+}
+
+void TorControlPrivate::connectSocket()
+{
+    if (controlSocketPath.isEmpty()) {
+        socket->connectToHost(torAddress, controlPort);
+        return;
+    }
+
+    // Unix sockets connect immediately, and don't emit connected()
+    QString error;
+    if (!connectUnixSocket(socket, controlSocketPath, &error)) {
+        setError(QStringLiteral("Cannot connect to control socket %1: %2").arg(controlSocketPath).arg(error));
+        return;
+    }
+
+    QMetaObject::invokeMethod(this, "socketConnected", Qt::QueuedConnection);
 }
 
 void TorControlPrivate::authenticateReply()
@@ -258,7 +339,7 @@ void TorControlPrivate::authenticateReply()
         return;
     }
 
-    qDebug() << "torctrl: Authentication successful";
+    LOG_DEBUG(lcTorControl) << "Authentication successful";
     setStatus(TorControl::Connected);
 
     setTorStatus(TorControl::TorUnknown);
@@ -267,6 +348,12 @@ void TorControlPrivate::authenticateReply()
     connect(clientEvents, &TorControlCommand::replyLine, this, &TorControlPrivate::statusEvent);
     socket->registerEvent("STATUS_CLIENT", clientEvents);
 
+    if (SettingsObject(QStringLiteral("tor")).read("telemetry").toBool()) {
+        if (!telemetry)
+            telemetry = new TorTelemetry(this);
+        telemetry->registerEvents(socket);
+    }
+
     getTorInfo();
     publishServices();
 
@@ -279,7 +366,7 @@ void TorControlPrivate::socketConnected()
 {
     Q_ASSERT(status == TorControl::Connecting);
 
-    qDebug() << "torctrl: Connected socket; querying information";
+    LOG_DEBUG(lcTorControl) << "Connected socket; querying information";
     setStatus(TorControl::Authenticating);
 
     ProtocolInfoCommand *command = new ProtocolInfoCommand(q);
@@ -291,8 +378,7 @@ void TorControlPrivate::socketDisconnected()
 {
     /* Clear some internal state */
     torVersion.clear();
-    socksAddress.clear();
-    socksPort = 0;
+    setSocksAddress(QHostAddress(), 0);
     setTorStatus(TorControl::TorUnknown);
 
     /* This emits the disconnected() signal as well */
@@ -322,14 +408,14 @@ void TorControlPrivate::protocolInfoReply()
 
         if (methods.testFlag(ProtocolInfoCommand::AuthNull))
         {
-            qDebug() << "torctrl: Using null authentication";
+            LOG_DEBUG(lcTorControl) << "Using null authentication";
             data = auth->build();
         }
         else if (methods.testFlag(ProtocolInfoCommand::AuthCookie) && !info->cookieFile().isEmpty())
         {
             QString cookieFile = info->cookieFile();
             QString cookieError;
-            qDebug() << "torctrl: Using cookie authentication with file" << cookieFile;
+            LOG_DEBUG(lcTorControl) << "Using cookie authentication with file" << cookieFile;
 
             QFile file(cookieFile);
             if (file.open(QIODevice::ReadOnly))
@@ -354,7 +440,7 @@ void TorControlPrivate::protocolInfoReply()
                  * but it has happened. */
                 if (methods.testFlag(ProtocolInfoCommand::AuthHashedPassword) && !authPassword.isEmpty())
                 {
-                    qDebug() << "torctrl: Unable to read authentication cookie file:" << cookieError;
+                    LOG_DEBUG(lcTorControl) << "Unable to read authentication cookie file:" << cookieError;
                     goto usePasswordAuth;
                 }
 
@@ -366,7 +452,7 @@ void TorControlPrivate::protocolInfoReply()
         else if (methods.testFlag(ProtocolInfoCommand::AuthHashedPassword) && !authPassword.isEmpty())
         {
             usePasswordAuth:
-            qDebug() << "torctrl: Using hashed password authentication";
+            LOG_DEBUG(lcTorControl) << "Using hashed password authentication";
             data = auth->build(authPassword);
         }
         else
@@ -399,9 +485,8 @@ void TorControlPrivate::getTorInfo()
     quint16 port = (quint16)settings.read("socksPort").toInt();
 
     if (!forceAddress.isNull() && port) {
-        qDebug() << "torctrl: Using manually specified SOCKS connection settings";
-        socksAddress = forceAddress;
-        socksPort = port;
+        LOG_DEBUG(lcTorControl) << "Using manually specified SOCKS connection settings";
+        setSocksAddress(forceAddress, port);
         emit q->connectivityChanged();
     } else
         keys << QByteArray("net/listeners/socks");
@@ -426,8 +511,7 @@ void TorControlPrivate::getTorInfoReply()
          * just use the first address and rely on the user to reconfigure if necessary (not a problem;
          * their setup is already very customized) */
         if (socksAddress.isNull() || address == socket->peerAddress()) {
-            socksAddress = address;
-            socksPort = port;
+            setSocksAddress(address, port);
             if (address == socket->peerAddress())
                 break;
         }
@@ -437,12 +521,12 @@ void TorControlPrivate::getTorInfoReply()
      * listener yet. To handle that situation, we'll try to read the socks address again when TorReady state
      * is reached. */
     if (!socksAddress.isNull()) {
-        qDebug().nospace() << "torctrl: SOCKS address is " << socksAddress.toString() << ":" << socksPort;
+        LOG_DEBUG(lcTorControl).nospace() << "SOCKS address is " << socksAddress.toString() << ":" << socksPort;
         emit q->connectivityChanged();
     }
 
     if (command->get(QByteArray("status/circuit-established")).toInt() == 1) {
-        qDebug() << "torctrl: Tor indicates that circuits have been established; state is TorReady";
+        LOG_DEBUG(lcTorControl) << "Tor indicates that circuits have been established; state is TorReady";
         setTorStatus(TorControl::TorReady);
     } else {
         setTorStatus(TorControl::TorOffline);
@@ -453,24 +537,95 @@ void TorControlPrivate::getTorInfoReply()
         updateBootstrap(splitQuotedStrings(bootstrap, ' '));
 }
 
+bool TorControl::singleHopMode() const
+{
+    return d->singleHopMode;
+}
+
+void TorControl::setSingleHopMode(bool enabled)
+{
+    d->singleHopMode = enabled;
+}
+
 void TorControl::addHiddenService(HiddenService *service)
 {
     if (d->services.contains(service))
         return;
 
     d->services.append(service);
+    if (!d->loadTimer.isActive())
+        d->loadTimer.start();
+
+    /* Services are normally published after connecting. Services added later
+     * are published by replacing the configuration for all services; when many
+     * identities are created at once, that happens only once. */
+    if (isConnected() && !d->publishQueued) {
+        d->publishQueued = true;
+        QTimer::singleShot(0, d, SLOT(publishQueuedServices()));
+    }
+}
+
+/* Adjust the number of introduction points of each service to its rate of
+ * incoming connections, within the configured bounds, and republish if any
+ * changed. Increases apply immediately; decreases wait until the rate is
+ * well below what the smaller number handles, to avoid flapping.
+ */
+void TorControlPrivate::tuneIntroductionPoints()
+{
+    foreach (HiddenService *service, services)
+        service->updateLoad(loadTimer.interval() / 1000);
+
+    SettingsObject settings(QStringLiteral("tor"));
+    if (!settings.read("adaptiveIntroPoints").toBool())
+        return;
+
+    // Tor's default and maximum for v2 services
+    int minimum = qBound(1, settings.read("introPointsMin", 3).toInt(), 10);
+    int maximum = qBound(minimum, settings.read("introPointsMax", 10).toInt(), 10);
+    // Connections per minute that one introduction point is expected to handle
+    double perPoint = qMax(1, settings.read("introPointConnectionRate", 30).toInt());
+
+    bool changed = false;
+    foreach (HiddenService *service, services) {
+        // Version 3 services are published with ADD_ONION, which can't set introduction points
+        if (service->version() == 3)
+            continue;
+
+        int current = service->introductionPoints() > 0 ? service->introductionPoints() : 3;
+        int desired = qBound(minimum, int(std::ceil(service->connectionRate() / perPoint)), maximum);
+
+        if (desired == current)
+            continue;
+        if (desired < current && service->connectionRate() > desired * perPoint * 0.5)
+            continue;
+
+        LOG_DEBUG(lcTorControl) << "Using" << desired << "introduction points for" << service->hostname()
+                 << "instead of" << current << "at" << service->connectionRate() << "connections per minute";
+        service->setIntroductionPoints(desired);
+        changed = true;
+    }
+
+    if (changed && q->isConnected())
+        publishServices();
+}
+
+void TorControlPrivate::publishQueuedServices()
+{
+    if (publishQueued && q->isConnected())
+        publishServices();
 }
 
 void TorControlPrivate::publishServices()
 {
     Q_ASSERT(q->isConnected());
+    publishQueued = false;
     if (services.isEmpty())
         return;
 
     SettingsObject settings(QStringLiteral("tor"));
     if (settings.read("neverPublishServices").toBool())
     {
-        qDebug() << "torctrl: Skipping service publication because neverPublishService is enabled";
+        LOG_DEBUG(lcTorControl) << "Skipping service publication because neverPublishService is enabled";
 
         /* Call servicePublished under the assumption that they're published externally. */
         for (QList<HiddenService*>::Iterator it = services.begin(); it != services.end(); ++it)
@@ -487,22 +642,82 @@ void TorControlPrivate::publishServices()
         HiddenService *service = *it;
         QDir dir(service->dataPath);
 
-        qDebug() << "torctrl: Configuring hidden service at" << service->dataPath;
+        // Tor applies single-hop mode to every service of an instance
+        if (service->isSingleHop() != singleHopMode) {
+            BUG() << "Refusing to publish" << (service->isSingleHop() ? "single-hop" : "anonymous")
+                  << "hidden service at" << service->dataPath << "on a tor instance in the other mode";
+            continue;
+        }
+
+        LOG_DEBUG(lcTorControl) << "Configuring" << (singleHopMode ? "non-anonymous single-hop" : "")
+                 << "hidden service at" << service->dataPath;
+
+        // Version 3 services have their own key, and are added separately
+        if (service->version() == 3) {
+            AddOnionCommand *addOnion = new AddOnionCommand;
+            QByteArray data = addOnion->build(service, singleHopMode);
+            if (data.isEmpty()) {
+                delete addOnion;
+                continue;
+            }
+
+            QObject::connect(addOnion, &AddOnionCommand::addOnionSucceeded, service, &HiddenService::servicePublished);
+            QObject::connect(addOnion, &AddOnionCommand::addOnionFailed, service,
+                [addOnion,service](int code) {
+                    LOG_WARNING(lcTorControl) << "Publishing v3 hidden service at" << service->dataPath << "failed:"
+                               << code << addOnion->errorMessage();
+                }
+            );
+            socket->sendCommand(addOnion, data);
+
+            if (service->publishesLegacyService()) {
+                AddOnionCommand *legacy = new AddOnionCommand;
+                QByteArray legacyData = legacy->buildLegacy(service, singleHopMode);
+                if (legacyData.isEmpty()) {
+                    delete legacy;
+                    continue;
+                }
+
+                QObject::connect(legacy, &AddOnionCommand::addOnionFailed, service,
+                    [legacy,service](int code) {
+                        LOG_WARNING(lcTorControl) << "Publishing the previous v2 hidden service of" << service->dataPath
+                                   << "failed:" << code << legacy->errorMessage();
+                    }
+                );
+                socket->sendCommand(legacy, legacyData);
+            }
+            continue;
+        }
 
         torConfig.append(qMakePair(QByteArray("HiddenServiceDir"), dir.absolutePath().toLocal8Bit()));
 
         const QList<HiddenService::Target> &targets = service->targets();
         for (QList<HiddenService::Target>::ConstIterator tit = targets.begin(); tit != targets.end(); ++tit)
         {
-            QString target = QString::fromLatin1("%1 %2:%3").arg(tit->servicePort)
-                             .arg(tit->targetAddress.toString())
-                             .arg(tit->targetPort);
+            QString target;
+            if (!tit->unixPath.isEmpty()) {
+                target = QString::fromLatin1("%1 unix:%2").arg(tit->servicePort).arg(tit->unixPath);
+            } else {
+                target = QString::fromLatin1("%1 %2:%3").arg(tit->servicePort)
+                         .arg(tit->targetAddress.toString())
+                         .arg(tit->targetPort);
+            }
             torConfig.append(qMakePair(QByteArray("HiddenServicePort"), target.toLatin1()));
         }
 
+        if (service->introductionPoints() > 0) {
+            torConfig.append(qMakePair(QByteArray("HiddenServiceNumIntroductionPoints"),
+                                       QByteArray::number(service->introductionPoints())));
+        }
+
         QObject::connect(command, &SetConfCommand::setConfSucceeded, service, &HiddenService::servicePublished);
     }
 
+    if (torConfig.isEmpty()) {
+        delete command;
+        return;
+    }
+
     socket->sendCommand(command, command->build(torConfig));
 }
 
@@ -511,16 +726,6 @@ void TorControl::shutdown()
     d->socket->sendCommand("SIGNAL SHUTDOWN\r\n");
 }
 
-void TorControl::shutdownSync()
-{
-    shutdown();
-    while (d->socket->bytesToWrite())
-    {
-        if (!d->socket->waitForBytesWritten(5000))
-            return;
-    }
-}
-
 void TorControlPrivate::statusEvent(int code, const QByteArray &data)
 {
     Q_UNUSED(code);
@@ -529,7 +734,7 @@ void TorControlPrivate::statusEvent(int code, const QByteArray &data)
     if (tokens.size() < 3)
         return;
 
-    qDebug() << "torctrl: status event:" << data.trimmed();
+    LOG_DEBUG(lcTorControl) << "status event:" << data.trimmed();
 
     if (tokens[2] == "CIRCUIT_ESTABLISHED") {
         setTorStatus(TorControl::TorReady);
@@ -555,7 +760,7 @@ void TorControlPrivate::updateBootstrap(const QList<QByteArray> &data)
         bootstrapStatus[key.toLower()] = value;
     }
 
-    qDebug() << bootstrapStatus;
+    LOG_DEBUG(lcTorControl) << bootstrapStatus;
     emit q->bootstrapStatusChanged();
 }
 
@@ -625,13 +830,14 @@ private slots:
             return;
         }
 
-        // Remove these keys when writing torrc; they are set at runtime and contain
-        // absolute paths or port numbers
+        // Remove these keys when writing torrc; they are set at runtime for each
+        // service, and contain absolute paths, port numbers or tuned values
         static const char *bannedKeys[] = {
             "ControlPortWriteToFile",
             "DataDirectory",
             "HiddenServiceDir",
             "HiddenServicePort",
+            "HiddenServiceNumIntroductionPoints",
             0
         };
 
@@ -658,7 +864,7 @@ private slots:
             return;
         }
 
-        qDebug() << "torctrl: Wrote torrc file";
+        LOG_DEBUG(lcTorControl) << "Wrote torrc file";
         finishWithSuccess();
     }
 
@@ -35,6 +35,7 @@
 
 #include <QObject>
 #include <QHostAddress>
+#include <QVariant>
 #include "utils/PendingOperation.h"
 
 class QNetworkProxy;
@@ -77,6 +78,9 @@ public:
         TorReady
     };
 
+    // Seconds between updates of service load and introduction points
+    static const int IntroPointTuningInterval = 60;
+
     explicit TorControl(QObject *parent = 0);
 
     /* Information */
@@ -85,6 +89,8 @@ public:
     QString torVersion() const;
     QString errorMessage() const;
 
+    /* Connectivity and the SOCKS proxy may be read from any thread, such as
+     * by a TorSocket of an identity on a worker thread */
     bool hasConnectivity() const;
     QHostAddress socksAddress() const;
     quint16 socksPort() const;
@@ -96,9 +102,14 @@ public:
     /* Connection */
     bool isConnected() const { return status() == Connected; }
     void connect(const QHostAddress &address, quint16 port);
+    /* Connect to a control port listening on a unix socket */
+    void connect(const QString &socketPath);
     void takeOwnership();
 
     /* Hidden Services */
+    // Whether this instance was launched for non-anonymous single-hop services
+    bool singleHopMode() const;
+    void setSingleHopMode(bool enabled);
     QList<HiddenService*> hiddenServices() const;
     void addHiddenService(HiddenService *service);
 
@@ -118,8 +129,6 @@ signals:
 public slots:
     /* Instruct Tor to shutdown */
     void shutdown();
-    /* Call shutdown(), and wait synchronously for the command to be written */
-    void shutdownSync();
 
     void reconnect();
 
@@ -129,6 +138,9 @@ private:
 
 }
 
+/* Control of the primary Tor instance, which is the one configured from the UI.
+ * With multiple shards, use TorManager::controlForKey to route hidden services
+ * and connections. */
 extern Tor::TorControl *torControl;
 
 #endif // TORCONTROLMANAGER_H
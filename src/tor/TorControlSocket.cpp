@@ -32,6 +32,8 @@
 
 #include "TorControlSocket.h"
 #include "TorControlCommand.h"
+#include "utils/Metrics.h"
+#include "utils/Log.h"
 #include <QDebug>
 
 using namespace Tor;
@@ -41,6 +43,7 @@ TorControlSocket::TorControlSocket(QObject *parent)
 {
     connect(this, SIGNAL(readyRead()), this, SLOT(process()));
     connect(this, SIGNAL(disconnected()), this, SLOT(clear()));
+    clock.start();
 }
 
 TorControlSocket::~TorControlSocket()
@@ -53,9 +56,25 @@ void TorControlSocket::sendCommand(TorControlCommand *command, const QByteArray
     Q_ASSERT(data.endsWith("\r\n"));
 
     commandQueue.append(command);
+    commandTimes.append(qMakePair(data.left(data.indexOf(' ')).trimmed().toUpper(), clock.nsecsElapsed()));
     write(data);
 
-    qDebug() << "torctrl: Sent" << data.trimmed();
+    // Don't log credentials or keys, now that logging can be enabled in release builds
+    if (data.startsWith("AUTHENTICATE ")) {
+        LOG_DEBUG(lcTorControl) << "Sent AUTHENTICATE";
+    } else if (data.startsWith("ADD_ONION ")) {
+        // ADD_ONION KeyType:KeyBlob [options]; the blob is a private key, unless it's NEW
+        QByteArray line = data.trimmed();
+        int keyStart = line.indexOf(':') + 1;
+        int keyEnd = line.indexOf(' ', keyStart);
+        if (keyEnd < 0)
+            keyEnd = line.size();
+        if (keyStart > 0 && !line.startsWith("ADD_ONION NEW:"))
+            line.replace(keyStart, keyEnd - keyStart, "[redacted]");
+        LOG_DEBUG(lcTorControl) << "Sent" << line;
+    } else {
+        LOG_DEBUG(lcTorControl) << "Sent" << data.trimmed();
+    }
 }
 
 void TorControlSocket::registerEvent(const QByteArray &event, TorControlCommand *command)
@@ -76,6 +95,7 @@ void TorControlSocket::clear()
 {
     qDeleteAll(commandQueue);
     commandQueue.clear();
+    commandTimes.clear();
     qDeleteAll(eventCommands);
     eventCommands.clear();
     inDataReply = false;
@@ -141,7 +161,7 @@ void TorControlSocket::process()
                     currentCommand = eventCommands.value(line.mid(0, space));
 
                 if (!currentCommand) {
-                    qWarning() << "torctrl: Ignoring unknown event";
+                    LOG_WARNING(lcTorControl) << "Ignoring unknown event";
                     continue;
                 }
             }
@@ -155,7 +175,7 @@ void TorControlSocket::process()
         }
 
         if (commandQueue.isEmpty()) {
-            qWarning() << "torctrl: Received unexpected data";
+            LOG_WARNING(lcTorControl) << "Received unexpected data";
             continue;
         }
 
@@ -167,6 +187,11 @@ void TorControlSocket::process()
             currentCommand = command;
         } else if (isFinalReply) {
             commandQueue.takeFirst();
+            QPair<QByteArray,qint64> sent = commandTimes.takeFirst();
+            MetricsRegistry::instance()->histogram("ricochet_tor_command_duration_microseconds",
+                                                   "Time from sending a Tor control command to its final reply",
+                                                   MetricsRegistry::label("command", QString::fromLatin1(sent.first)))
+                ->record((clock.nsecsElapsed() - sent.second) / 1000);
             if (command) {
                 command->onFinished(statusCode);
                 command->deleteLater();
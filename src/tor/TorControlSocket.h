@@ -35,6 +35,7 @@
 
 #include <QTcpSocket>
 #include <QQueue>
+#include <QElapsedTimer>
 
 namespace Tor
 {
@@ -64,6 +65,9 @@ private slots:
 
 private:
     QQueue<TorControlCommand*> commandQueue;
+    // Keyword and send time of each command in commandQueue, for metrics
+    QQueue<QPair<QByteArray,qint64> > commandTimes;
+    QElapsedTimer clock;
     QHash<QByteArray,TorControlCommand*> eventCommands;
     QString m_errorMessage;
     TorControlCommand *currentCommand;
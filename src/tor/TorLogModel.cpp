@@ -0,0 +1,162 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TorLogModel.h"
+#include <QDateTime>
+#include <QStringList>
+
+using namespace Tor;
+
+TorLogModel::TorLogModel(int capacity, QObject *parent)
+    : QAbstractListModel(parent)
+    , m_records(qMax(1, capacity))
+    , m_first(0)
+    , m_count(0)
+    , m_minimumSeverity(Notice)
+{
+}
+
+void TorLogModel::setMinimumSeverity(Severity severity)
+{
+    if (m_minimumSeverity == severity)
+        return;
+
+    // Only affects new lines; records are already filtered when stored
+    m_minimumSeverity = severity;
+    emit minimumSeverityChanged();
+}
+
+bool TorLogModel::parseSeverity(const QStringRef &name, Severity *severity)
+{
+    if (name == QLatin1String("notice"))
+        *severity = Notice;
+    else if (name == QLatin1String("warn"))
+        *severity = Warning;
+    else if (name == QLatin1String("err"))
+        *severity = Error;
+    else if (name == QLatin1String("info"))
+        *severity = Info;
+    else if (name == QLatin1String("debug"))
+        *severity = Debug;
+    else
+        return false;
+    return true;
+}
+
+void TorLogModel::appendLine(const QString &line, const QString &source)
+{
+    // Lines look like "Oct 17 12:00:00.000 [notice] Bootstrapped 5%: Connecting to directory server"
+    Severity severity = Notice;
+    int messageStart = 0;
+
+    int open = line.indexOf(QLatin1String(" ["));
+    int close = (open >= 0) ? line.indexOf(QLatin1Char(']'), open) : -1;
+    if (close > open && parseSeverity(line.midRef(open + 2, close - open - 2), &severity))
+        messageStart = close + 1;
+
+    if (severity < m_minimumSeverity)
+        return;
+
+    Record record;
+    record.timestamp = QDateTime::currentMSecsSinceEpoch();
+    record.severity = severity;
+    record.source = source;
+    record.message = line.mid(messageStart).trimmed();
+
+    if (m_count == m_records.size()) {
+        beginRemoveRows(QModelIndex(), 0, 0);
+        m_records[m_first] = Record();
+        m_first = (m_first + 1) % m_records.size();
+        m_count--;
+        endRemoveRows();
+    }
+
+    beginInsertRows(QModelIndex(), m_count, m_count);
+    m_records[(m_first + m_count) % m_records.size()] = record;
+    m_count++;
+    endInsertRows();
+}
+
+void TorLogModel::clear()
+{
+    beginResetModel();
+    m_records.fill(Record());
+    m_first = m_count = 0;
+    endResetModel();
+}
+
+QString TorLogModel::text() const
+{
+    QStringList lines;
+    lines.reserve(m_count);
+    for (int i = 0; i < m_count; i++) {
+        const Record &r = record(i);
+        if (r.source.isEmpty())
+            lines.append(r.message);
+        else
+            lines.append(QStringLiteral("[%1] %2").arg(r.source).arg(r.message));
+    }
+    return lines.join(QLatin1Char('\n'));
+}
+
+QHash<int,QByteArray> TorLogModel::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles[Qt::DisplayRole] = "message";
+    roles[TimestampRole] = "timestamp";
+    roles[SeverityRole] = "severity";
+    roles[SourceRole] = "source";
+    return roles;
+}
+
+int TorLogModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_count;
+}
+
+QVariant TorLogModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_count)
+        return QVariant();
+
+    const Record &r = record(index.row());
+    switch (role) {
+        case Qt::DisplayRole: return r.message;
+        case TimestampRole: return QDateTime::fromMSecsSinceEpoch(r.timestamp);
+        case SeverityRole: return r.severity;
+        case SourceRole: return r.source;
+    }
+
+    return QVariant();
+}
@@ -0,0 +1,121 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TORLOGMODEL_H
+#define TORLOGMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+
+namespace Tor
+{
+
+/* Recent log messages from Tor processes
+ *
+ * Lines are parsed into records with a timestamp, severity, and message, and
+ * kept in a ring buffer with a fixed capacity; the oldest record is removed
+ * for each record beyond that. Lines below the minimum severity are dropped
+ * without being stored.
+ */
+class TorLogModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(TorLogModel)
+    Q_ENUMS(Severity)
+
+    Q_PROPERTY(int capacity READ capacity CONSTANT)
+    Q_PROPERTY(Severity minimumSeverity READ minimumSeverity WRITE setMinimumSeverity NOTIFY minimumSeverityChanged)
+
+public:
+    enum Severity {
+        Debug,
+        Info,
+        Notice,
+        Warning,
+        Error
+    };
+
+    enum {
+        TimestampRole = Qt::UserRole,
+        SeverityRole,
+        SourceRole
+    };
+
+    static const int DefaultCapacity = 1000;
+
+    explicit TorLogModel(int capacity = DefaultCapacity, QObject *parent = 0);
+
+    int capacity() const { return m_records.size(); }
+
+    Severity minimumSeverity() const { return m_minimumSeverity; }
+    void setMinimumSeverity(Severity severity);
+
+    /* Severity for one of tor's names (debug, info, notice, warn, err) */
+    static bool parseSeverity(const QStringRef &name, Severity *severity);
+
+    /* All stored messages as plain text, oldest first */
+    Q_INVOKABLE QString text() const;
+
+    virtual QHash<int,QByteArray> roleNames() const;
+    virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+
+public slots:
+    /* Parse and store a line of output; source identifies the process */
+    void appendLine(const QString &line, const QString &source = QString());
+    void clear();
+
+signals:
+    void minimumSeverityChanged();
+
+private:
+    struct Record
+    {
+        qint64 timestamp;
+        Severity severity;
+        QString source;
+        QString message;
+
+        Record() : timestamp(0), severity(Notice) { }
+    };
+
+    QVector<Record> m_records;
+    int m_first;
+    int m_count;
+    Severity m_minimumSeverity;
+
+    const Record &record(int row) const { return m_records[(m_first + row) % m_records.size()]; }
+};
+
+}
+
+#endif // TORLOGMODEL_H
@@ -33,29 +33,60 @@
 #include "TorManager.h"
 #include "TorProcess.h"
 #include "TorControl.h"
+#include "TorLogModel.h"
 #include "GetConfCommand.h"
 #include "utils/Settings.h"
+#include "utils/Metrics.h"
+#include "utils/Trace.h"
 #include <QFile>
 #include <QDir>
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <QMap>
+#include <QSet>
 
 using namespace Tor;
 
 namespace Tor
 {
 
+/* Additional Tor instance, beyond the primary process and control */
+struct TorShard
+{
+    TorProcess *process;
+    TorControl *control;
+    QString name;
+    QString dataDir;
+    QStringList extraSettings;
+
+    TorShard() : process(0), control(0) { }
+};
+
 class TorManagerPrivate : public QObject
 {
     Q_OBJECT
 
 public:
+    // Points on the hash ring for each shard
+    static const int ShardReplicas = 64;
+    static const int MaxShards = 16;
+
     TorManager *q;
     TorProcess *process;
     TorControl *control;
+    QList<TorShard> shards;
+    // Keys assigned to each shard by controlForKey, indexed by TorManager::KeyType.
+    // These are counted from identity threads, so they must be atomic.
+    MetricCounter *routed[MaxShards][2];
+    QMap<quint32,int> shardRing;
+    // Non-anonymous instance for single-hop services, which is not in the ring
+    TorShard singleHop;
     QString dataDir;
-    QStringList logMessages;
+    TorLogModel *logModel;
     QString errorMessage;
     bool configNeeded;
+    QSet<TorProcess*> stoppingProcesses;
 
     explicit TorManagerPrivate(TorManager *parent = 0);
 
@@ -65,6 +96,12 @@ public:
 
     void setError(const QString &errorMessage);
 
+    static quint32 ringHash(const QByteArray &key);
+    static MetricCounter *routedCounter(int shard, TorManager::KeyType type);
+    void createShards(int count);
+    void startShards();
+    void startShard(TorShard &shard);
+
 public slots:
     void processStateChanged(int state);
     void processErrorChanged(const QString &errorMessage);
@@ -85,9 +122,29 @@ TorManagerPrivate::TorManagerPrivate(TorManager *parent)
     , q(parent)
     , process(0)
     , control(new TorControl(this))
+    , logModel(0)
     , configNeeded(false)
 {
+    memset(routed, 0, sizeof(routed));
+    routed[0][TorManager::ServiceKey] = routedCounter(0, TorManager::ServiceKey);
+    routed[0][TorManager::ConnectionKey] = routedCounter(0, TorManager::ConnectionKey);
+
     connect(control, SIGNAL(statusChanged(int,int)), SLOT(controlStatusChanged(int)));
+
+    SettingsObject settings(QStringLiteral("tor"));
+    logModel = new TorLogModel(settings.read("logCapacity", TorLogModel::DefaultCapacity).toInt(), this);
+    QString logLevel = settings.read("logLevel").toString();
+    TorLogModel::Severity severity;
+    if (!logLevel.isEmpty() && TorLogModel::parseSeverity(QStringRef(&logLevel), &severity))
+        logModel->setMinimumSeverity(severity);
+
+    // Secondary shards copy the configuration of the first once it works
+    connect(control, &TorControl::torStatusChanged, this,
+        [this](int status) {
+            if (status == TorControl::TorReady)
+                startShards();
+        }
+    );
 }
 
 TorManager *TorManager::instance()
@@ -108,6 +165,77 @@ TorProcess *TorManager::process()
     return d->process;
 }
 
+int TorManager::shardCount() const
+{
+    return d->shards.size() + 1;
+}
+
+TorControl *TorManager::shardControl(int shard)
+{
+    if (shard == 0)
+        return d->control;
+    if (shard < 0 || shard > d->shards.size())
+        return 0;
+    return d->shards[shard - 1].control;
+}
+
+TorControl *TorManager::controlForKey(const QByteArray &key, KeyType type)
+{
+    int shard = 0;
+    if (!d->shardRing.isEmpty()) {
+        QMap<quint32,int>::const_iterator it = d->shardRing.lowerBound(TorManagerPrivate::ringHash(key));
+        if (it == d->shardRing.constEnd())
+            it = d->shardRing.constBegin();
+        shard = it.value();
+    }
+
+    d->routed[shard][type]->add();
+    return (shard == 0) ? d->control : d->shards.at(shard - 1).control;
+}
+
+TorControl *TorManager::singleHopControl()
+{
+    // Only possible with a bundled Tor, which can be launched with these options
+    if (!d->process)
+        return 0;
+
+    if (!d->singleHop.control) {
+        d->singleHop.control = new TorControl(d);
+        d->singleHop.control->setSingleHopMode(true);
+        d->singleHop.name = QStringLiteral("single-hop");
+        d->singleHop.dataDir = d->dataDir + QStringLiteral("single-hop/");
+        // Tor refuses to act as a client in this mode, so it has no SOCKS port
+        d->singleHop.extraSettings << QStringLiteral("HiddenServiceSingleHopMode") << QStringLiteral("1")
+                                   << QStringLiteral("HiddenServiceNonAnonymousMode") << QStringLiteral("1")
+                                   << QStringLiteral("SocksPort") << QStringLiteral("0");
+
+        if (d->control->torStatus() == TorControl::TorReady)
+            d->startShard(d->singleHop);
+    }
+
+    return d->singleHop.control;
+}
+
+QVariantList TorManager::shardStatus() const
+{
+    QVariantList re;
+    for (int i = 0; i < shardCount(); i++) {
+        TorControl *control = (i == 0) ? d->control : d->shards[i - 1].control;
+        TorProcess *process = (i == 0) ? d->process : d->shards[i - 1].process;
+
+        QVariantMap shard;
+        shard[QStringLiteral("shard")] = i;
+        shard[QStringLiteral("status")] = control->status();
+        shard[QStringLiteral("torStatus")] = control->torStatus();
+        shard[QStringLiteral("processState")] = process ? process->state() : TorProcess::NotStarted;
+        shard[QStringLiteral("hiddenServices")] = control->hiddenServices().size();
+        shard[QStringLiteral("services")] = d->routed[i][ServiceKey]->value();
+        shard[QStringLiteral("connections")] = d->routed[i][ConnectionKey]->value();
+        re.append(shard);
+    }
+    return re;
+}
+
 QString TorManager::dataDirectory() const
 {
     return d->dataDir;
@@ -125,9 +253,9 @@ bool TorManager::configurationNeeded() const
     return d->configNeeded;
 }
 
-QStringList TorManager::logMessages() const
+TorLogModel *TorManager::log() const
 {
-    return d->logMessages;
+    return d->logModel;
 }
 
 bool TorManager::hasError() const
@@ -142,13 +270,14 @@ QString TorManager::errorMessage() const
 
 void TorManager::start()
 {
+    TRACE_SPAN("tor.start");
     if (!d->errorMessage.isEmpty()) {
         d->errorMessage.clear();
         emit errorChanged();
     }
 
     SettingsObject settings(QStringLiteral("tor"));
-    if (settings.read("controlPort").isUndefined()) {
+    if (settings.read("controlPort").isUndefined() && settings.read("controlSocket").isUndefined()) {
         // Launch a bundled Tor instance
         QString executable = d->torExecutablePath();
         if (executable.isEmpty()) {
@@ -184,7 +313,13 @@ void TorManager::start()
         d->process->setExecutable(executable);
         d->process->setDataDir(d->dataDir);
         d->process->setDefaultTorrc(defaultTorrc);
+        d->process->setUseUnixControlSocket(settings.read("unixSockets").toBool());
         d->process->start();
+
+        d->createShards(settings.read("shards").toInt());
+    } else if (!settings.read("controlSocket").isUndefined()) {
+        d->control->setAuthPassword(settings.read("controlPassword").toString().toLatin1());
+        d->control->connect(settings.read("controlSocket").toString());
     } else {
         QHostAddress address(settings.read("controlAddress").toString());
         quint16 port = (quint16)settings.read("controlPort").toInt();
@@ -196,12 +331,45 @@ void TorManager::start()
     }
 }
 
+void TorManager::requestStop()
+{
+    QList<TorProcess*> processes;
+    processes << d->process << d->singleHop.process;
+    foreach (const TorShard &shard, d->shards)
+        processes << shard.process;
+
+    foreach (TorProcess *process, processes) {
+        if (!process || process->state() < TorProcess::Starting || d->stoppingProcesses.contains(process))
+            continue;
+
+        d->stoppingProcesses.insert(process);
+        connect(process, &TorProcess::stateChanged, d,
+            [this,process](int state) {
+                if (state < TorProcess::Starting && d->stoppingProcesses.remove(process) &&
+                    d->stoppingProcesses.isEmpty())
+                    emit stopped();
+            }
+        );
+    }
+
+    if (d->stoppingProcesses.isEmpty()) {
+        emit stopped();
+        return;
+    }
+
+    foreach (TorProcess *process, d->stoppingProcesses)
+        process->requestStop();
+}
+
 void TorManagerPrivate::processStateChanged(int state)
 {
     qDebug() << Q_FUNC_INFO << state << TorProcess::Ready << process->controlPassword() << process->controlHost() << process->controlPort();
     if (state == TorProcess::Ready) {
         control->setAuthPassword(process->controlPassword());
-        control->connect(process->controlHost(), process->controlPort());
+        if (!process->controlSocketPath().isEmpty())
+            control->connect(process->controlSocketPath());
+        else
+            control->connect(process->controlHost(), process->controlPort());
     }
 }
 
@@ -214,9 +382,7 @@ void TorManagerPrivate::processErrorChanged(const QString &errorMessage)
 void TorManagerPrivate::processLogMessage(const QString &message)
 {
     qDebug() << "tor:" << message;
-    if (logMessages.size() >= 50)
-        logMessages.takeFirst();
-    logMessages.append(message);
+    logModel->appendLine(message);
 }
 
 void TorManagerPrivate::controlStatusChanged(int status)
@@ -302,5 +468,120 @@ void TorManagerPrivate::setError(const QString &message)
     emit q->errorChanged();
 }
 
+quint32 TorManagerPrivate::ringHash(const QByteArray &key)
+{
+    // qHash is seeded per process; placement should be stable across runs
+    QByteArray hash = QCryptographicHash::hash(key, QCryptographicHash::Sha1);
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(hash.constData()));
+}
+
+MetricCounter *TorManagerPrivate::routedCounter(int shard, TorManager::KeyType type)
+{
+    return MetricsRegistry::instance()->counter("ricochet_tor_shard_routed_total",
+        "Hidden services and outgoing connections assigned to each tor shard",
+        MetricsRegistry::labels("shard", QString::number(shard),
+                                "type", (type == TorManager::ServiceKey) ? QStringLiteral("service") : QStringLiteral("connection")));
+}
+
+/* Shards are created with the control objects immediately, so keys are routed
+ * consistently from the start; their processes are launched by startShards. */
+void TorManagerPrivate::createShards(int count)
+{
+    count = qBound(1, count, int(MaxShards));
+    if (!shards.isEmpty() || count == 1)
+        return;
+
+    for (int i = 1; i < count; i++) {
+        TorShard shard;
+        shard.control = new TorControl(this);
+        shard.name = QString::number(i);
+        shard.dataDir = dataDir + QStringLiteral("shard-%1/").arg(i);
+        shards.append(shard);
+        routed[i][TorManager::ServiceKey] = routedCounter(i, TorManager::ServiceKey);
+        routed[i][TorManager::ConnectionKey] = routedCounter(i, TorManager::ConnectionKey);
+    }
+
+    for (int i = 0; i < count; i++) {
+        for (int r = 0; r < ShardReplicas; r++)
+            shardRing.insert(ringHash(QStringLiteral("shard-%1-%2").arg(i).arg(r).toLatin1()), i);
+    }
+
+    qDebug() << "Using" << count << "tor shards";
+}
+
+void TorManagerPrivate::startShards()
+{
+    for (int i = 0; i < shards.size(); i++)
+        startShard(shards[i]);
+    if (singleHop.control)
+        startShard(singleHop);
+}
+
+void TorManagerPrivate::startShard(TorShard &shard)
+{
+    if (shard.process)
+        return;
+
+    if (!QFile::exists(shard.dataDir) && !createDataDir(shard.dataDir)) {
+        qWarning() << "Cannot write data location for tor shard" << shard.name << shard.dataDir;
+        return;
+    }
+
+    QString defaultTorrc = shard.dataDir + QStringLiteral("default_torrc");
+    if (!QFile::exists(defaultTorrc) && !createDefaultTorrc(defaultTorrc)) {
+        qWarning() << "Cannot write data files for tor shard" << shard.name;
+        return;
+    }
+
+    // Use the latest configuration of the first instance, which includes enabling the network
+    QString torrc = shard.dataDir + QStringLiteral("torrc");
+    QFile::remove(torrc);
+    if (!QFile::copy(dataDir + QStringLiteral("torrc"), torrc)) {
+        qWarning() << "Cannot copy configuration for tor shard" << shard.name;
+        return;
+    }
+
+    TorProcess *shardProcess = new TorProcess(this);
+    TorControl *shardControl = shard.control;
+    QString name = shard.name;
+    shard.process = shardProcess;
+
+    connect(shardProcess, &TorProcess::stateChanged, this,
+        [shardProcess,shardControl](int state) {
+            if (state == TorProcess::Ready) {
+                shardControl->setAuthPassword(shardProcess->controlPassword());
+                if (!shardProcess->controlSocketPath().isEmpty())
+                    shardControl->connect(shardProcess->controlSocketPath());
+                else
+                    shardControl->connect(shardProcess->controlHost(), shardProcess->controlPort());
+            }
+        }
+    );
+    connect(shardProcess, &TorProcess::errorMessageChanged, this,
+        [name](const QString &message) {
+            qWarning() << "tor shard" << name << "error:" << message;
+        }
+    );
+    connect(shardProcess, &TorProcess::logMessage, this,
+        [this,name](const QString &message) {
+            qDebug() << "tor" << name << message;
+            logModel->appendLine(message, name);
+        }
+    );
+    connect(shardControl, &TorControl::statusChanged, this,
+        [shardControl](int status) {
+            if (status == TorControl::Connected)
+                shardControl->takeOwnership();
+        }
+    );
+
+    shardProcess->setExecutable(process->executable());
+    shardProcess->setDataDir(shard.dataDir);
+    shardProcess->setDefaultTorrc(defaultTorrc);
+    shardProcess->setExtraSettings(shard.extraSettings);
+    shardProcess->setUseUnixControlSocket(process->useUnixControlSocket());
+    shardProcess->start();
+}
+
 #include "TorManager.moc"
 
@@ -35,22 +35,30 @@
 
 #include <QObject>
 #include <QStringList>
+#include <QVariantList>
 
 namespace Tor
 {
 
 class TorProcess;
 class TorControl;
+class TorLogModel;
 class TorManagerPrivate;
 
 /* Run/connect to an instance of Tor according to configuration, and manage
- * UI interaction, first time configuration, etc. */
+ * UI interaction, first time configuration, etc.
+ *
+ * A bundled Tor can be split into several processes with the "tor.shards"
+ * setting. The first shard is configured through the UI as usual, and is
+ * the one available as control() and the global torControl; the others are
+ * started with a copy of its configuration once it is ready. Hidden services
+ * and outbound connections are spread across shards with controlForKey(). */
 class TorManager : public QObject
 {
     Q_OBJECT
 
     Q_PROPERTY(bool configurationNeeded READ configurationNeeded NOTIFY configurationNeededChanged)
-    Q_PROPERTY(QStringList logMessages READ logMessages CONSTANT)
+    Q_PROPERTY(Tor::TorLogModel* log READ log CONSTANT)
     Q_PROPERTY(Tor::TorProcess* process READ process CONSTANT)
     Q_PROPERTY(Tor::TorControl* control READ control CONSTANT)
     Q_PROPERTY(bool hasError READ hasError NOTIFY errorChanged)
@@ -58,29 +66,54 @@ class TorManager : public QObject
     Q_PROPERTY(QString dataDirectory READ dataDirectory WRITE setDataDirectory)
 
 public:
+    enum KeyType {
+        ServiceKey,     // A hidden service published on the shard
+        ConnectionKey   // An outgoing connection through the shard's SOCKS port
+    };
+
     explicit TorManager(QObject *parent = 0);
     static TorManager *instance();
 
     TorProcess *process();
     TorControl *control();
 
+    int shardCount() const;
+    TorControl *shardControl(int shard);
+    /* Select the shard responsible for key (for example, a hostname) using
+     * consistent hashing, so that changing the number of shards only moves
+     * a fraction of keys. The type is only used to count the load of each
+     * shard, and is safe to call from any thread once tor is started. */
+    TorControl *controlForKey(const QByteArray &key, KeyType type);
+    /* Instance for services in non-anonymous single-hop mode, created on
+     * first use. Returns 0 when Tor isn't bundled. It isn't used for any
+     * outgoing connections, and isn't counted as a shard. */
+    TorControl *singleHopControl();
+    /* Health and load of each shard, as a list of maps */
+    Q_INVOKABLE QVariantList shardStatus() const;
+
     QString dataDirectory() const;
     void setDataDirectory(const QString &path);
 
     // True on first run or when the Tor configuration wizard needs to be shown
     bool configurationNeeded() const;
 
-    QStringList logMessages() const;
+    /* Recent output of all bundled Tor processes. The capacity and minimum
+     * severity are set by the "tor.logCapacity" and "tor.logLevel" settings. */
+    TorLogModel *log() const;
 
     bool hasError() const;
     QString errorMessage() const;
 
 public slots:
     void start();
+    /* Ask every bundled Tor process to exit without waiting for them, and
+     * emit stopped() once all have. An external Tor is left running. */
+    void requestStop();
 
 signals:
     void configurationNeededChanged();
     void errorChanged();
+    void stopped();
 
 private:
     TorManagerPrivate *d;
@@ -33,6 +33,7 @@
 #include "TorProcess_p.h"
 #include "utils/CryptoKey.h"
 #include "utils/SecureRNG.h"
+#include "utils/UnixSocket.h"
 #include <QDir>
 #include <QDebug>
 #include <QCoreApplication>
@@ -46,13 +47,19 @@ TorProcess::TorProcess(QObject *parent)
 
 TorProcess::~TorProcess()
 {
-    if (state() > NotStarted)
-        stop();
+    // Shutdown waits for requestStop() without blocking; don't wait any longer here
+    if (d->process.state() != QProcess::NotRunning)
+        d->process.kill();
 }
 
 TorProcessPrivate::TorProcessPrivate(TorProcess *q)
-    : QObject(q), q(q), state(TorProcess::NotStarted), controlPort(0), controlPortAttempts(0)
+    : QObject(q), q(q), state(TorProcess::NotStarted), controlPort(0), useUnixControlSocket(false),
+      stopRequested(false), controlPortAttempts(0)
 {
+    killTimer.setSingleShot(true);
+    killTimer.setInterval(KillDelay);
+    connect(&killTimer, &QTimer::timeout, this, &TorProcessPrivate::killProcess);
+
     connect(&process, &QProcess::started, this, &TorProcessPrivate::processStarted);
     connect(&process, (void (QProcess::*)(int, QProcess::ExitStatus))&QProcess::finished,
             this, &TorProcessPrivate::processFinished);
@@ -104,6 +111,16 @@ void TorProcess::setExtraSettings(const QStringList &settings)
     d->extraSettings = settings;
 }
 
+bool TorProcess::useUnixControlSocket() const
+{
+    return d->useUnixControlSocket;
+}
+
+void TorProcess::setUseUnixControlSocket(bool enabled)
+{
+    d->useUnixControlSocket = enabled;
+}
+
 TorProcess::State TorProcess::state() const
 {
     return d->state;
@@ -145,14 +162,32 @@ void TorProcess::start()
         emit stateChanged(d->state);
     }
 
+    // Tor refuses a control socket in a directory that others can access
+    QString socketPath = d->unixControlSocketPath();
+    bool unixSocket = d->useUnixControlSocket && unixSocketPathUsable(socketPath);
+    if (unixSocket) {
+        QString error;
+        if (!ensurePrivateSocketDirectory(d->dataDir, &error)) {
+            qWarning() << "Not using a unix control socket:" << error;
+            unixSocket = false;
+        }
+    } else if (d->useUnixControlSocket) {
+        qWarning() << "Not using a unix control socket: unsupported, or path is too long:" << socketPath;
+    }
+
     QStringList args;
     if (!d->defaultTorrc.isEmpty())
         args << QStringLiteral("--defaults-torrc") << d->defaultTorrc;
     args << QStringLiteral("-f") << d->torrcPath();
     args << QStringLiteral("DataDirectory") << d->dataDir;
     args << QStringLiteral("HashedControlPassword") << QString::fromLatin1(hashedPassword);
-    args << QStringLiteral("ControlPort") << QStringLiteral("auto");
-    args << QStringLiteral("ControlPortWriteToFile") << d->controlPortFilePath();
+    if (unixSocket) {
+        args << QStringLiteral("ControlPort") << QStringLiteral("0");
+        args << QStringLiteral("ControlSocket") << socketPath;
+    } else {
+        args << QStringLiteral("ControlPort") << QStringLiteral("auto");
+        args << QStringLiteral("ControlPortWriteToFile") << d->controlPortFilePath();
+    }
     args << QStringLiteral("__OwningControllerProcess") << QString::number(qApp->applicationPid());
     args << d->extraSettings;
 
@@ -161,8 +196,11 @@ void TorProcess::start()
 
     if (QFile::exists(d->controlPortFilePath()))
         QFile::remove(d->controlPortFilePath());
+    if (QFile::exists(socketPath))
+        QFile::remove(socketPath);
     d->controlPort = 0;
     d->controlHost.clear();
+    d->controlSocketPath = unixSocket ? socketPath : QString();
 
     d->process.setProcessChannelMode(QProcess::MergedChannels);
     d->process.start(d->executable, args, QIODevice::ReadOnly);
@@ -174,29 +212,45 @@ void TorProcess::stop()
         return;
 
     d->controlPortTimer.stop();
-
-    if (d->process.state() == QProcess::Starting)
-        d->process.waitForStarted(2000);
-
     d->state = NotStarted;
 
     // Windows can't terminate the process well, but Tor will clean itself up
 #ifndef Q_OS_WIN
-    if (d->process.state() == QProcess::Running) {
-        d->process.terminate();
-        if (!d->process.waitForFinished(5000)) {
-            qWarning() << "Tor process" << d->process.pid() << "did not respond to terminate, killing...";
-            d->process.kill();
-            if (!d->process.waitForFinished(2000)) {
-                qCritical() << "Tor process" << d->process.pid() << "did not respond to kill!";
-            }
-        }
+    if (d->process.state() != QProcess::NotRunning) {
+        // Don't wait for the process to exit. One that is still starting is
+        // terminated once it has started, and it's killed if it ignores that.
+        d->stopRequested = true;
+        if (d->process.state() == QProcess::Running)
+            d->process.terminate();
+        d->killTimer.start();
     }
 #endif
 
     emit stateChanged(d->state);
 }
 
+void TorProcess::requestStop()
+{
+    if (state() < Starting || d->stopRequested)
+        return;
+
+    d->controlPortTimer.stop();
+
+#ifndef Q_OS_WIN
+    if (d->process.state() != QProcess::NotRunning) {
+        // State changes to NotStarted from processFinished
+        d->stopRequested = true;
+        if (d->process.state() == QProcess::Running)
+            d->process.terminate();
+        d->killTimer.start();
+        return;
+    }
+#endif
+
+    d->state = NotStarted;
+    emit stateChanged(d->state);
+}
+
 QByteArray TorProcess::controlPassword()
 {
     if (d->controlPassword.isEmpty())
@@ -214,6 +268,11 @@ quint16 TorProcess::controlPort()
     return d->controlPort;
 }
 
+QString TorProcess::controlSocketPath()
+{
+    return d->controlSocketPath;
+}
+
 bool TorProcessPrivate::ensureFilesExist()
 {
     QFile torrc(torrcPath());
@@ -243,8 +302,18 @@ QString TorProcessPrivate::controlPortFilePath() const
     return QDir::toNativeSeparators(dataDir) + QDir::separator() + QStringLiteral("control-port");
 }
 
+QString TorProcessPrivate::unixControlSocketPath() const
+{
+    return QDir(dataDir).absoluteFilePath(QStringLiteral("control.sock"));
+}
+
 void TorProcessPrivate::processStarted()
 {
+    if (stopRequested) {
+        process.terminate();
+        return;
+    }
+
     state = TorProcess::Connecting;
     emit q->stateChanged(state);
 
@@ -254,10 +323,22 @@ void TorProcessPrivate::processStarted()
 
 void TorProcessPrivate::processFinished()
 {
-    if (state < TorProcess::Starting)
+    killTimer.stop();
+    if (state < TorProcess::Starting) {
+        // Exited after stop()
+        stopRequested = false;
         return;
+    }
 
     controlPortTimer.stop();
+
+    if (stopRequested) {
+        stopRequested = false;
+        state = TorProcess::NotStarted;
+        emit q->stateChanged(state);
+        return;
+    }
+
     errorMessage = process.errorString();
     if (errorMessage.isEmpty())
         errorMessage = QStringLiteral("Process exited unexpectedly (code %1)").arg(process.exitCode());
@@ -266,6 +347,15 @@ void TorProcessPrivate::processFinished()
     emit q->stateChanged(state);
 }
 
+void TorProcessPrivate::killProcess()
+{
+    if (process.state() == QProcess::NotRunning)
+        return;
+
+    qWarning() << "Tor process" << process.pid() << "did not respond to terminate, killing...";
+    process.kill();
+}
+
 void TorProcessPrivate::processError(QProcess::ProcessError error)
 {
     if (error == QProcess::FailedToStart || error == QProcess::Crashed)
@@ -283,20 +373,30 @@ void TorProcessPrivate::processReadable()
 
 void TorProcessPrivate::tryReadControlPort()
 {
-    QFile file(controlPortFilePath());
-    if (file.open(QIODevice::ReadOnly)) {
-        QByteArray data = file.readLine().trimmed();
-
-        int p;
-        if (data.startsWith("PORT=") && (p = data.lastIndexOf(':')) > 0) {
-            controlHost = QHostAddress(QString::fromLatin1(data.mid(5, p - 5)));
-            controlPort = data.mid(p+1).toUShort();
-
-            if (!controlHost.isNull() && controlPort > 0) {
-                controlPortTimer.stop();
-                state = TorProcess::Ready;
-                emit q->stateChanged(state);
-                return;
+    if (!controlSocketPath.isEmpty()) {
+        // The control socket is created once Tor is accepting connections
+        if (QFile::exists(controlSocketPath)) {
+            controlPortTimer.stop();
+            state = TorProcess::Ready;
+            emit q->stateChanged(state);
+            return;
+        }
+    } else {
+        QFile file(controlPortFilePath());
+        if (file.open(QIODevice::ReadOnly)) {
+            QByteArray data = file.readLine().trimmed();
+
+            int p;
+            if (data.startsWith("PORT=") && (p = data.lastIndexOf(':')) > 0) {
+                controlHost = QHostAddress(QString::fromLatin1(data.mid(5, p - 5)));
+                controlPort = data.mid(p+1).toUShort();
+
+                if (!controlHost.isNull() && controlPort > 0) {
+                    controlPortTimer.stop();
+                    state = TorProcess::Ready;
+                    emit q->stateChanged(state);
+                    return;
+                }
             }
         }
     }
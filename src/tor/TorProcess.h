@@ -75,15 +75,26 @@ public:
     QStringList extraSettings() const;
     void setExtraSettings(const QStringList &settings);
 
+    /* Use a unix socket in the data directory for the control port, if
+     * supported. controlSocketPath is set instead of controlHost and
+     * controlPort when the process is ready. */
+    bool useUnixControlSocket() const;
+    void setUseUnixControlSocket(bool enabled);
+
     State state() const;
     QString errorMessage() const;
     QHostAddress controlHost();
     quint16 controlPort();
+    QString controlSocketPath();
     QByteArray controlPassword();
 
 public slots:
     void start();
+    /* Stop immediately, without waiting for the process to exit */
     void stop();
+    /* Like stop(), but stateChanged() is emitted when the process has
+     * exited, so callers can wait for it. */
+    void requestStop();
 
 signals:
     void stateChanged(int newState);
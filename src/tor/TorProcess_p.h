@@ -54,21 +54,30 @@ public:
     QString errorMessage;
     QHostAddress controlHost;
     quint16 controlPort;
+    QString controlSocketPath;
     QByteArray controlPassword;
+    bool useUnixControlSocket;
+    bool stopRequested;
 
     QTimer controlPortTimer;
     int controlPortAttempts;
+    // Kills the process if it hasn't exited within KillDelay of being stopped
+    QTimer killTimer;
+
+    static const int KillDelay = 5000;
 
     TorProcessPrivate(TorProcess *q);
 
     QString torrcPath() const;
     QString controlPortFilePath() const;
+    QString unixControlSocketPath() const;
     bool ensureFilesExist();
 
 public slots:
     void processStarted();
     void processFinished();
     void processError(QProcess::ProcessError error);
+    void killProcess();
     void processReadable();
     void tryReadControlPort();
 };
@@ -32,6 +32,7 @@
 
 #include "TorSocket.h"
 #include "TorControl.h"
+#include "TorManager.h"
 #include <QNetworkProxy>
 
 using namespace Tor;
@@ -39,11 +40,12 @@ using namespace Tor;
 TorSocket::TorSocket(QObject *parent)
     : QTcpSocket(parent)
     , m_port(0)
+    , m_connectTimer(this)
     , m_reconnectEnabled(true)
     , m_maxInterval(900)
     , m_connectAttempts(0)
 {
-    connect(torControl, SIGNAL(connectivityChanged()), SLOT(connectivityChanged()));
+    setControl(torControl);
     connect(&m_connectTimer, SIGNAL(timeout()), SLOT(reconnect()));
     connect(this, SIGNAL(disconnected()), SLOT(onFailed()));
     connect(this, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(onFailed()));
@@ -56,6 +58,17 @@ TorSocket::~TorSocket()
 {
 }
 
+void TorSocket::setControl(TorControl *control)
+{
+    if (m_control == control)
+        return;
+
+    if (m_control)
+        disconnect(m_control, 0, this, 0);
+    m_control = control;
+    connect(m_control, SIGNAL(connectivityChanged()), SLOT(connectivityChanged()));
+}
+
 void TorSocket::setReconnectEnabled(bool enabled)
 {
     if (enabled == m_reconnectEnabled)
@@ -99,7 +112,7 @@ int TorSocket::reconnectInterval()
 
 void TorSocket::reconnect()
 {
-    if (!torControl->hasConnectivity() || !reconnectEnabled())
+    if (!m_control->hasConnectivity() || !reconnectEnabled())
         return;
 
     m_connectTimer.stop();
@@ -111,8 +124,8 @@ void TorSocket::reconnect()
 
 void TorSocket::connectivityChanged()
 {
-    if (torControl->hasConnectivity()) {
-        setProxy(torControl->connectionProxy());
+    if (m_control->hasConnectivity()) {
+        setProxy(m_control->connectionProxy());
         if (state() == QAbstractSocket::UnconnectedState)
             reconnect();
     } else {
@@ -127,11 +140,14 @@ void TorSocket::connectToHost(const QString &hostName, quint16 port, OpenMode op
     m_host = hostName;
     m_port = port;
 
-    if (!torControl->hasConnectivity())
+    // Connections to the same host always use the same shard
+    setControl(TorManager::instance()->controlForKey(hostName.toLower().toLatin1(), TorManager::ConnectionKey));
+
+    if (!m_control->hasConnectivity())
         return;
 
-    if (proxy() != torControl->connectionProxy())
-        setProxy(torControl->connectionProxy());
+    if (proxy() != m_control->connectionProxy())
+        setProxy(m_control->connectionProxy());
 
     QAbstractSocket::connectToHost(hostName, port, openMode, protocol);
 }
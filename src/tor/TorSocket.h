@@ -35,9 +35,12 @@
 
 #include <QTcpSocket>
 #include <QTimer>
+#include <QPointer>
 
 namespace Tor {
 
+class TorControl;
+
 /* Specialized QTcpSocket which makes connections over the SOCKS proxy
  * from a TorControl instance, automatically attempts reconnections, and
  * reacts to Tor's connectivity state.
@@ -82,6 +85,7 @@ private slots:
     void onFailed();
 
 private:
+    QPointer<TorControl> m_control;
     QString m_host;
     quint16 m_port;
     QTimer m_connectTimer;
@@ -89,6 +93,8 @@ private:
     int m_maxInterval;
     int m_connectAttempts;
 
+    void setControl(TorControl *control);
+
     using QAbstractSocket::connectToHost;
 };
 
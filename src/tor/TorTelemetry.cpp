@@ -0,0 +1,352 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TorTelemetry.h"
+#include "TorControlSocket.h"
+#include "TorControlCommand.h"
+#include "utils/StringUtil.h"
+#include "utils/Metrics.h"
+#include <QDebug>
+#include <algorithm>
+
+using namespace Tor;
+
+static MetricGauge *openStreamsGauge()
+{
+    static MetricGauge *gauge = MetricsRegistry::instance()->gauge("ricochet_tor_streams", "Streams known to tor");
+    return gauge;
+}
+
+TorTelemetry::TorTelemetry(QObject *parent)
+    : QObject(parent)
+{
+    reset();
+}
+
+void TorTelemetry::reset()
+{
+    m_clock.start();
+    m_bandwidth = QVector<QPair<quint64,quint64> >(BandwidthWindow, qMakePair(quint64(0), quint64(0)));
+    m_bandwidthPos = m_bandwidthCount = 0;
+    m_launchedCircuits.clear();
+    m_buildTimes.clear();
+    m_failures.clear();
+    m_circuitsBuilt = m_circuitsFailed = 0;
+    m_circuitRead = m_circuitWritten = 0;
+    m_streams.clear();
+    m_targets.clear();
+    openStreamsGauge()->set(0);
+}
+
+void TorTelemetry::registerEvents(TorControlSocket *socket)
+{
+    // Circuit and stream IDs are only meaningful for one instance of tor
+    m_launchedCircuits.clear();
+    m_streams.clear();
+    m_targets.clear();
+    openStreamsGauge()->set(0);
+
+    struct {
+        const char *event;
+        void (TorTelemetry::*handler)(int,const QByteArray&);
+    } events[] = {
+        { "BW", &TorTelemetry::bandwidthEvent },
+        { "CIRC", &TorTelemetry::circuitEvent },
+        { "CIRC_BW", &TorTelemetry::circuitBandwidthEvent },
+        { "STREAM", &TorTelemetry::streamEvent },
+        { "STREAM_BW", &TorTelemetry::streamBandwidthEvent }
+    };
+
+    for (unsigned i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+        TorControlCommand *command = new TorControlCommand;
+        connect(command, &TorControlCommand::replyLine, this, events[i].handler);
+        socket->registerEvent(events[i].event, command);
+    }
+}
+
+QHash<QByteArray,QByteArray> TorTelemetry::keywordArguments(const QList<QByteArray> &words)
+{
+    QHash<QByteArray,QByteArray> re;
+    foreach (const QByteArray &word, words) {
+        int eq = word.indexOf('=');
+        if (eq > 0)
+            re.insert(word.left(eq), unquotedString(word.mid(eq + 1)));
+    }
+    return re;
+}
+
+QByteArray TorTelemetry::hostOf(const QByteArray &target)
+{
+    int p = target.lastIndexOf(':');
+    return (p > 0) ? target.left(p).toLower() : target.toLower();
+}
+
+// 650 BW <read> <written>
+void TorTelemetry::bandwidthEvent(int code, const QByteArray &data)
+{
+    Q_UNUSED(code);
+    QList<QByteArray> words = data.split(' ');
+    if (words.size() < 3)
+        return;
+
+    static MetricCounter *readBytes = MetricsRegistry::instance()->counter("ricochet_tor_read_bytes_total", "Bytes read by tor");
+    static MetricCounter *writtenBytes = MetricsRegistry::instance()->counter("ricochet_tor_written_bytes_total", "Bytes written by tor");
+
+    m_bandwidth[m_bandwidthPos] = qMakePair(words[1].toULongLong(), words[2].toULongLong());
+    readBytes->add(m_bandwidth[m_bandwidthPos].first);
+    writtenBytes->add(m_bandwidth[m_bandwidthPos].second);
+    m_bandwidthPos = (m_bandwidthPos + 1) % BandwidthWindow;
+    m_bandwidthCount = qMin(m_bandwidthCount + 1, int(BandwidthWindow));
+}
+
+// 650 CIRC <id> <status> [path] [keyword arguments]
+void TorTelemetry::circuitEvent(int code, const QByteArray &data)
+{
+    Q_UNUSED(code);
+    QList<QByteArray> words = splitQuotedStrings(data, ' ');
+    if (words.size() < 3)
+        return;
+
+    const QByteArray &id = words[1];
+    const QByteArray &status = words[2];
+    qint64 now = m_clock.elapsed();
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+
+    if (status == "LAUNCHED") {
+        m_launchedCircuits.insert(id, now);
+    } else if (status == "BUILT") {
+        static MetricCounter *built = metrics->counter("ricochet_tor_circuits_built_total", "Circuits built by tor");
+        static MetricHistogram *buildTime = metrics->histogram("ricochet_tor_circuit_build_duration_microseconds",
+                                                               "Time from launching to building a circuit");
+        if (m_launchedCircuits.contains(id)) {
+            m_buildTimes.append(now - m_launchedCircuits.take(id));
+            if (m_buildTimes.size() > BuildTimeSamples)
+                m_buildTimes.removeFirst();
+            buildTime->record(quint64(m_buildTimes.last()) * 1000);
+        }
+        m_circuitsBuilt++;
+        built->add();
+    } else if (status == "FAILED") {
+        QByteArray reason = keywordArguments(words.mid(3)).value("REASON", "NONE");
+        m_launchedCircuits.remove(id);
+        m_circuitsFailed++;
+        m_failures.append(qMakePair(now, reason));
+        pruneFailures();
+        // Reasons are a fixed set of keywords from tor's control spec
+        metrics->counter("ricochet_tor_circuits_failed_total", "Circuits that failed, by reason",
+                         MetricsRegistry::label("reason", QString::fromLatin1(reason)))->add();
+    } else if (status == "CLOSED") {
+        m_launchedCircuits.remove(id);
+    }
+}
+
+// 650 CIRC_BW ID=<id> READ=<bytes> WRITTEN=<bytes> ...
+void TorTelemetry::circuitBandwidthEvent(int code, const QByteArray &data)
+{
+    Q_UNUSED(code);
+    static MetricCounter *readBytes = MetricsRegistry::instance()->counter("ricochet_tor_circuit_read_bytes_total",
+                                                                           "Bytes read on circuits");
+    static MetricCounter *writtenBytes = MetricsRegistry::instance()->counter("ricochet_tor_circuit_written_bytes_total",
+                                                                              "Bytes written on circuits");
+
+    QHash<QByteArray,QByteArray> args = keywordArguments(splitQuotedStrings(data, ' '));
+    quint64 read = args.value("READ").toULongLong(), written = args.value("WRITTEN").toULongLong();
+    m_circuitRead += read;
+    m_circuitWritten += written;
+    readBytes->add(read);
+    writtenBytes->add(written);
+}
+
+// 650 STREAM <id> <status> <circuit> <target> [keyword arguments]
+void TorTelemetry::streamEvent(int code, const QByteArray &data)
+{
+    Q_UNUSED(code);
+    QList<QByteArray> words = splitQuotedStrings(data, ' ');
+    if (words.size() < 5)
+        return;
+
+    const QByteArray &id = words[1];
+    const QByteArray &status = words[2];
+    qint64 now = m_clock.elapsed();
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+
+    if (status == "NEW" || status == "NEWRESOLVE") {
+        static MetricCounter *created = metrics->counter("ricochet_tor_streams_total", "Streams created by tor");
+        if (m_streams.contains(id))
+            return;
+
+        StreamInfo info;
+        info.target = words[4].toLower();
+        info.created = now;
+        info.succeeded = false;
+        m_streams.insert(id, info);
+        openStreamsGauge()->set(m_streams.size());
+        created->add();
+
+        TargetStats &target = m_targets[info.target];
+        target.live++;
+        target.streams++;
+        return;
+    }
+
+    QHash<QByteArray,StreamInfo>::iterator it = m_streams.find(id);
+    if (it == m_streams.end())
+        return;
+
+    QHash<QByteArray,TargetStats>::iterator target = m_targets.find(it->target);
+    Q_ASSERT(target != m_targets.end());
+    if (status == "SUCCEEDED") {
+        static MetricHistogram *attachTime = metrics->histogram("ricochet_tor_stream_attach_duration_microseconds",
+                                                                "Time from creating a stream to its success");
+        if (!it->succeeded) {
+            it->succeeded = true;
+            target->open++;
+            target->attachTimeTotal += now - it->created;
+            target->attachCount++;
+            attachTime->record(quint64(now - it->created) * 1000);
+        }
+    } else if (status == "FAILED") {
+        static MetricCounter *failed = metrics->counter("ricochet_tor_streams_failed_total", "Streams that failed");
+        target->failed++;
+        failed->add();
+    } else if (status == "CLOSED") {
+        if (it->succeeded)
+            target->open--;
+        // Targets are only kept while they have streams, so contacts that come and go don't accumulate
+        if (--target->live == 0)
+            m_targets.erase(target);
+        m_streams.erase(it);
+        openStreamsGauge()->set(m_streams.size());
+    }
+}
+
+// 650 STREAM_BW <id> <written> <read> [TIME=...]
+void TorTelemetry::streamBandwidthEvent(int code, const QByteArray &data)
+{
+    Q_UNUSED(code);
+    QList<QByteArray> words = data.split(' ');
+    if (words.size() < 4)
+        return;
+
+    static MetricCounter *readBytes = MetricsRegistry::instance()->counter("ricochet_tor_stream_read_bytes_total",
+                                                                           "Bytes read on streams");
+    static MetricCounter *writtenBytes = MetricsRegistry::instance()->counter("ricochet_tor_stream_written_bytes_total",
+                                                                              "Bytes written on streams");
+
+    QHash<QByteArray,StreamInfo>::const_iterator it = m_streams.constFind(words[1]);
+    if (it == m_streams.constEnd())
+        return;
+
+    quint64 written = words[2].toULongLong(), read = words[3].toULongLong();
+    TargetStats &target = m_targets[it->target];
+    target.bytesWritten += written;
+    target.bytesRead += read;
+    readBytes->add(read);
+    writtenBytes->add(written);
+}
+
+void TorTelemetry::pruneFailures()
+{
+    qint64 limit = m_clock.elapsed() - FailureWindow * 1000;
+    while (!m_failures.isEmpty() && m_failures.first().first < limit)
+        m_failures.removeFirst();
+}
+
+QVariantMap TorTelemetry::summary() const
+{
+    QVariantMap re;
+
+    quint64 read = 0, written = 0;
+    for (int i = 0; i < m_bandwidthCount; i++) {
+        read += m_bandwidth[i].first;
+        written += m_bandwidth[i].second;
+    }
+    re[QStringLiteral("readRate")] = m_bandwidthCount ? double(read) / m_bandwidthCount : 0.0;
+    re[QStringLiteral("writeRate")] = m_bandwidthCount ? double(written) / m_bandwidthCount : 0.0;
+
+    re[QStringLiteral("circuitsBuilt")] = m_circuitsBuilt;
+    re[QStringLiteral("circuitsFailed")] = m_circuitsFailed;
+    re[QStringLiteral("circuitRead")] = m_circuitRead;
+    re[QStringLiteral("circuitWritten")] = m_circuitWritten;
+    re[QStringLiteral("streams")] = m_streams.size();
+
+    QVariantMap buildTime;
+    QList<qint64> sorted = m_buildTimes;
+    std::sort(sorted.begin(), sorted.end());
+    buildTime[QStringLiteral("samples")] = sorted.size();
+    if (!sorted.isEmpty()) {
+        buildTime[QStringLiteral("p50")] = sorted[(sorted.size() - 1) * 50 / 100];
+        buildTime[QStringLiteral("p90")] = sorted[(sorted.size() - 1) * 90 / 100];
+        buildTime[QStringLiteral("p99")] = sorted[(sorted.size() - 1) * 99 / 100];
+    }
+    re[QStringLiteral("buildTime")] = buildTime;
+
+    QVariantMap failures;
+    qint64 limit = m_clock.elapsed() - FailureWindow * 1000;
+    for (QList<QPair<qint64,QByteArray> >::const_iterator it = m_failures.begin(); it != m_failures.end(); ++it) {
+        if (it->first < limit)
+            continue;
+        QString reason = QString::fromLatin1(it->second);
+        failures[reason] = failures.value(reason).toInt() + 1;
+    }
+    re[QStringLiteral("failures")] = failures;
+
+    return re;
+}
+
+QVariantMap TorTelemetry::targetStatistics(const QString &target) const
+{
+    QByteArray key = target.toLower().toLatin1();
+    bool matchHost = !key.contains(':');
+
+    TargetStats total;
+    for (QHash<QByteArray,TargetStats>::const_iterator it = m_targets.begin(); it != m_targets.end(); ++it) {
+        if (matchHost ? (hostOf(it.key()) != key) : (it.key() != key))
+            continue;
+        total.streams += it->streams;
+        total.open += it->open;
+        total.failed += it->failed;
+        total.bytesRead += it->bytesRead;
+        total.bytesWritten += it->bytesWritten;
+        total.attachTimeTotal += it->attachTimeTotal;
+        total.attachCount += it->attachCount;
+    }
+
+    QVariantMap re;
+    re[QStringLiteral("streams")] = total.streams;
+    re[QStringLiteral("open")] = total.open;
+    re[QStringLiteral("failed")] = total.failed;
+    re[QStringLiteral("bytesRead")] = total.bytesRead;
+    re[QStringLiteral("bytesWritten")] = total.bytesWritten;
+    re[QStringLiteral("attachTime")] = total.attachCount ? double(total.attachTimeTotal) / total.attachCount : 0.0;
+    return re;
+}
@@ -0,0 +1,144 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TORTELEMETRY_H
+#define TORTELEMETRY_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QVariantMap>
+#include <QElapsedTimer>
+
+namespace Tor
+{
+
+class TorControlSocket;
+
+/* Collects bandwidth, circuit, and stream events from Tor and aggregates
+ * them into rolling windows, to tell whether slowness comes from Tor or
+ * from the application.
+ *
+ * TorControl creates this when the "tor.telemetry" setting is enabled.
+ * Totals and durations are exported through MetricsRegistry as events
+ * arrive. Streams are also attributed to their target host and port, which
+ * is how TorSocket, and so contacts, identify connections; those statistics
+ * are kept only while a target has streams, and aren't exported, to keep
+ * onion addresses out of metrics.
+ */
+class TorTelemetry : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(TorTelemetry)
+
+public:
+    // Seconds of bandwidth samples, which Tor sends once per second
+    static const int BandwidthWindow = 60;
+    // Number of recent circuit build times used for percentiles
+    static const int BuildTimeSamples = 500;
+    // Seconds that circuit failures are counted for
+    static const int FailureWindow = 10 * 60;
+
+    explicit TorTelemetry(QObject *parent = 0);
+
+    /* Subscribe to the events of interest on a newly authenticated socket */
+    void registerEvents(TorControlSocket *socket);
+
+    /* Overall statistics:
+     *   readRate, writeRate: bytes per second over the bandwidth window
+     *   circuitsBuilt, circuitsFailed: totals
+     *   buildTime: map of p50, p90 and p99 in milliseconds, and samples
+     *   failures: map of reason to count, over the failure window
+     *   circuitRead, circuitWritten: total bytes reported on circuits
+     *   streams: number of open streams
+     */
+    Q_INVOKABLE QVariantMap summary() const;
+
+    /* Statistics for streams to one target, such as a contact's hostname
+     * (with or without port), since it last had no streams:
+     *   streams, open, failed, bytesRead, bytesWritten, attachTime (ms average)
+     */
+    Q_INVOKABLE QVariantMap targetStatistics(const QString &target) const;
+
+    void reset();
+
+private slots:
+    void bandwidthEvent(int code, const QByteArray &data);
+    void circuitEvent(int code, const QByteArray &data);
+    void circuitBandwidthEvent(int code, const QByteArray &data);
+    void streamEvent(int code, const QByteArray &data);
+    void streamBandwidthEvent(int code, const QByteArray &data);
+
+private:
+    struct TargetStats
+    {
+        // Streams known to tor, which keep the entry alive
+        int live;
+        int streams, open, failed;
+        quint64 bytesRead, bytesWritten;
+        qint64 attachTimeTotal;
+        int attachCount;
+
+        TargetStats() : live(0), streams(0), open(0), failed(0), bytesRead(0), bytesWritten(0),
+                        attachTimeTotal(0), attachCount(0) { }
+    };
+
+    struct StreamInfo
+    {
+        QByteArray target;
+        qint64 created;
+        bool succeeded;
+    };
+
+    QElapsedTimer m_clock;
+
+    QVector<QPair<quint64,quint64> > m_bandwidth;
+    int m_bandwidthPos, m_bandwidthCount;
+
+    QHash<QByteArray,qint64> m_launchedCircuits;
+    QList<qint64> m_buildTimes;
+    QList<QPair<qint64,QByteArray> > m_failures;
+    quint64 m_circuitsBuilt, m_circuitsFailed;
+    quint64 m_circuitRead, m_circuitWritten;
+
+    QHash<QByteArray,StreamInfo> m_streams;
+    QHash<QByteArray,TargetStats> m_targets;
+
+    void pruneFailures();
+    static QByteArray hostOf(const QByteArray &target);
+    static QHash<QByteArray,QByteArray> keywordArguments(const QList<QByteArray> &words);
+};
+
+}
+
+#endif // TORTELEMETRY_H
@@ -31,8 +31,7 @@
  */
 
 #include "LinkedText.h"
-#include <QRegularExpression>
-#include <QUrl>
+#include "utils/LinkScanner.h"
 #include <QClipboard>
 #include <QGuiApplication>
 #include <QDebug>
@@ -40,38 +39,11 @@
 LinkedText::LinkedText(QObject *parent)
     : QObject(parent)
 {
-    // Select things that look like URLs of some kind and allow QUrl::fromUserInput to validate them
-    linkRegex = QRegularExpression(QStringLiteral("([a-z]{3,9}:|www\\.)([^\\s,.);!>]|[,.);!>](?!\\s|$))+"), QRegularExpression::CaseInsensitiveOption);
-
-    allowedSchemes << QStringLiteral("http")
-                   << QStringLiteral("https")
-                   << QStringLiteral("torsion")
-                   << QStringLiteral("ricochet");
 }
 
 QString LinkedText::parsed(const QString &input)
 {
-    QString re;
-    int p = 0;
-    QRegularExpressionMatchIterator it = linkRegex.globalMatch(input);
-    while (it.hasNext()) {
-        QRegularExpressionMatch match = it.next();
-        int start = match.capturedStart();
-
-        QUrl url = QUrl::fromUserInput(match.capturedRef().toString());
-        if (!allowedSchemes.contains(url.scheme().toLower()))
-            continue;
-
-        if (start > p)
-            re.append(input.mid(p, start - p).toHtmlEscaped().replace(QLatin1Char('\n'), QStringLiteral("<br/>")));
-        re.append(QStringLiteral("<a href=\"%1\">%2</a>").arg(QString::fromLatin1(url.toEncoded()).toHtmlEscaped()).arg(match.capturedRef().toString().toHtmlEscaped()));
-        p = match.capturedEnd();
-    }
-
-    if (p < input.size())
-        re.append(input.mid(p).toHtmlEscaped().replace(QLatin1Char('\n'), QStringLiteral("<br/>")));
-
-    return re;
+    return LinkScanner::toHtml(input);
 }
 
 void LinkedText::copyToClipboard(const QString &text)
@@ -34,7 +34,6 @@
 #define LINKEDTEXT_H
 
 #include <QObject>
-#include <QRegularExpression>
 
 class LinkedText : public QObject
 {
@@ -44,12 +43,9 @@ class LinkedText : public QObject
 public:
     explicit LinkedText(QObject *parent = 0);
 
+    /* Prefer ConversationModel's parsedText role for messages, which is cached */
     Q_INVOKABLE QString parsed(const QString &input);
     Q_INVOKABLE void copyToClipboard(const QString &text);
-
-private:
-    QRegularExpression linkRegex;
-    QStringList allowedSchemes;
 };
 
 #endif
@@ -55,6 +55,20 @@ ScrollView {
         delegate: MessageDelegate { }
 
         verticalLayoutDirection: ListView.BottomToTop
+
+        // Older messages are loaded by fetchMore as the view nears the top; once scrolling
+        // settles, let the model unload pages that are far above the visible area
+        onContentYChanged: releaseTimer.restart()
+
+        Timer {
+            id: releaseTimer
+            interval: 500
+            onTriggered: {
+                var row = messageView.indexAt(messageView.width / 2, messageView.contentY + messageView.spacing)
+                if (row >= 0 && messageView.model)
+                    messageView.model.releaseRowsAfter(row)
+            }
+        }
     }
 }
 
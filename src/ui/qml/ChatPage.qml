@@ -27,6 +27,18 @@ FocusScope {
         onUnreadCountChanged: if (active) conversationModel.resetUnreadCount()
     }
 
+    Binding {
+        target: conversationModel
+        property: "windowOpen"
+        value: chatPage.visible
+        when: conversationModel !== null
+    }
+
+    Component.onDestruction: {
+        if (conversationModel !== null)
+            conversationModel.windowOpen = false
+    }
+
     RowLayout {
         id: infoBar
         anchors {
@@ -40,6 +40,8 @@ FocusScope {
                         errorBubble.show(qsTr("<b>%1</b> is already your contact").arg(contact.nickname))
                     else if (matchesIdentity(field.text))
                         errorBubble.show(qsTr("You can't add yourself as a contact"))
+                    else if (/^(torsion|ricochet):[a-z2-7]{56}$/.test(field.text))
+                        errorBubble.show(qsTr("This ID is not valid; check it for typos"))
                     else
                         errorBubble.show(qsTr("Enter an ID starting with <b>ricochet:</b>"))
                 }
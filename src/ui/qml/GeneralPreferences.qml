@@ -1,6 +1,7 @@
 import QtQuick 2.0
 import QtQuick.Controls 1.0
 import QtQuick.Layouts 1.0
+import QtQuick.Dialogs 1.1
 
 ColumnLayout {
     anchors {
@@ -24,6 +25,129 @@ ColumnLayout {
         }
     }
 
+    GroupBox {
+        title: qsTr("Identities")
+        Layout.fillWidth: true
+
+        ColumnLayout {
+            anchors.fill: parent
+
+            Label {
+                Layout.fillWidth: true
+                text: qsTr("Additional identities have their own contact ID and share the same connection to Tor. Only the first identity is shown in the contact list.")
+                wrapMode: Text.Wrap
+            }
+
+            Repeater {
+                model: identityManager.identities
+
+                Label {
+                    Layout.fillWidth: true
+                    wrapMode: Text.Wrap
+                    color: modelData.isSingleHop ? "red" : palette.windowText
+                    text: {
+                        //: %1 is the identity's nickname, %2 is its contact ID
+                        var name = modelData.nickname ? qsTr("%1 (%2)").arg(modelData.nickname).arg(modelData.contactID) : modelData.contactID
+                        //: %1 is the identity's name and contact ID
+                        return modelData.isSingleHop ? qsTr("%1 - not anonymous, single-hop").arg(name) : name
+                    }
+                }
+            }
+
+            RowLayout {
+                Layout.fillWidth: true
+
+                TextField {
+                    id: identityNickname
+                    Layout.fillWidth: true
+                    placeholderText: qsTr("Nickname")
+                }
+
+                Button {
+                    text: qsTr("Add Identity")
+                    onClicked: {
+                        identityManager.createIdentity(identityNickname.text)
+                        identityNickname.text = ""
+                    }
+                }
+            }
+        }
+    }
+
+    GroupBox {
+        id: blocklistGroup
+        title: qsTr("Blocked contacts")
+        Layout.fillWidth: true
+
+        property QtObject blocklist: userIdentity.contacts.incomingRequests.blocklist
+
+        ColumnLayout {
+            anchors.fill: parent
+
+            RowLayout {
+                Layout.fillWidth: true
+
+                Label {
+                    Layout.fillWidth: true
+                    wrapMode: Text.Wrap
+                    text: qsTr("Contact requests from %n blocked contact(s) are rejected without being shown.", "", blocklistGroup.blocklist.count)
+                }
+
+                Button {
+                    text: qsTr("Import...")
+                    onClicked: {
+                        blocklistDialog.exporting = false
+                        blocklistDialog.open()
+                    }
+                }
+
+                Button {
+                    text: qsTr("Export...")
+                    enabled: blocklistGroup.blocklist.count > 0
+                    onClicked: {
+                        blocklistDialog.exporting = true
+                        blocklistDialog.open()
+                    }
+                }
+
+                Button {
+                    text: qsTr("Clear")
+                    enabled: blocklistGroup.blocklist.count > 0
+                    onClicked: blocklistGroup.blocklist.clear()
+                }
+            }
+
+            // Result of the last import or export
+            Label {
+                id: blocklistResult
+                Layout.fillWidth: true
+                wrapMode: Text.Wrap
+                visible: text !== ""
+            }
+        }
+
+        FileDialog {
+            id: blocklistDialog
+            property bool exporting
+            title: exporting ? qsTr("Export blocked contacts") : qsTr("Import blocked contacts")
+            selectExisting: !exporting
+            nameFilters: [ qsTr("Text files (*.txt)"), qsTr("All files (*)") ]
+
+            onAccepted: {
+                if (exporting) {
+                    if (!blocklistGroup.blocklist.exportFile(fileUrl))
+                        blocklistResult.text = qsTr("The list of blocked contacts could not be written.")
+                } else {
+                    var added = blocklistGroup.blocklist.importFile(fileUrl)
+                    if (added < 0)
+                        blocklistResult.text = qsTr("The list of blocked contacts could not be read.")
+                    else
+                        blocklistResult.text = qsTr("Blocked %n new contact(s).", "", added)
+                }
+            }
+        }
+    }
+
     Item {
         Layout.fillHeight: true
         Layout.fillWidth: true
@@ -61,6 +61,26 @@ ApplicationWindow {
                 z: 3
             }
 
+            // New requests are refused while flooded; only their count is shown
+            Rectangle {
+                id: requestFloodNotice
+                property QtObject requests: userIdentity.contacts.incomingRequests
+                visible: requests.flooded
+                Layout.fillWidth: true
+                Layout.preferredHeight: requestFloodLabel.implicitHeight + 8
+                color: palette.base
+
+                Label {
+                    id: requestFloodLabel
+                    anchors {
+                        fill: parent
+                        margins: 4
+                    }
+                    wrapMode: Text.Wrap
+                    text: qsTr("Receiving too many contact requests, %n refused", "", requestFloodNotice.requests.refusedCount)
+                }
+            }
+
             Item {
                 Layout.fillHeight: true
                 Layout.fillWidth: true
@@ -103,7 +103,7 @@ Column {
             wrapMode: TextEdit.Wrap
             readOnly: true
             selectByMouse: true
-            text: LinkedText.parsed(model.text)
+            text: model.parsedText
 
             onLinkActivated: {
                 textField.deselect()
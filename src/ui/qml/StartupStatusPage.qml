@@ -34,7 +34,7 @@ Column {
     TorLogDisplay {
         id: logDisplay
         width: parent.width
-        height: text.length > 0 ? 300 : 0
+        height: count > 0 ? 300 : 0
     }
 
     RowLayout {
@@ -1,17 +1,26 @@
 import QtQuick 2.0
 import QtQuick.Controls 1.0
-import QtQuick.Layouts 1.0
+import im.ricochet 1.0
 
-TextArea {
+ScrollView {
     id: logDisplay
-    readOnly: true
-    text: torInstance.logMessages.join('\n')
-    wrapMode: TextEdit.Wrap
+    property alias count: logView.count
 
-    Connections {
-        target: torInstance.process
-        onLogMessage: {
-            logDisplay.append(message)
+    // Only delegates for visible lines are created, regardless of log length
+    ListView {
+        id: logView
+        model: torInstance.log
+
+        SystemPalette { id: logPalette }
+
+        delegate: Text {
+            width: logView.width
+            text: (model.source !== "" ? "[" + model.source + "] " : "") + model.message
+            color: model.severity >= TorLogModel.Warning ? "#c00000" : logPalette.text
+            wrapMode: Text.Wrap
         }
+
+        Component.onCompleted: positionViewAtEnd()
+        onCountChanged: positionViewAtEnd()
     }
 }
@@ -28,7 +28,15 @@ Item {
             Label { text: qsTr("Circuits established:") }
             Label { font.bold: true; text: ((torInstance.control.torStatus == TorControl.TorReady) ? qsTr("Yes") : qsTr("No")) }
             Label { text: qsTr("Hidden service:") }
-            Label { font.bold: true; text: (userIdentity.isOnline ? qsTr("Online") : qsTr("Offline")) }
+            Label {
+                font.bold: true
+                color: userIdentity.isSingleHop ? "red" : palette.windowText
+                text: {
+                    var status = userIdentity.isOnline ? qsTr("Online") : qsTr("Offline")
+                    //: %1 is the hidden service status, Online or Offline
+                    return userIdentity.isSingleHop ? qsTr("%1 (not anonymous, single-hop)").arg(status) : status
+                }
+            }
             Label { text: qsTr("Version:") }
             Label { font.bold: true; text: torControl.torVersion }
             //Label { text: "Recommended:" }
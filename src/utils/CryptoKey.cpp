@@ -37,6 +37,34 @@
 #include <QFile>
 #include <openssl/bio.h>
 #include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/sha.h>
+#include <openssl/err.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define CRYPTOKEY_ED25519
+#endif
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static void RSA_get0_key(const RSA *r, const BIGNUM **n, const BIGNUM **e, const BIGNUM **d)
+{
+    if (n)
+        *n = r->n;
+    if (e)
+        *e = r->e;
+    if (d)
+        *d = r->d;
+}
+
+static void RSA_get0_factors(const RSA *r, const BIGNUM **p, const BIGNUM **q)
+{
+    if (p)
+        *p = r->p;
+    if (q)
+        *q = r->q;
+}
+#endif
 
 void base32_encode(char *dest, unsigned destlen, const char *src, unsigned srclen);
 bool base32_decode(char *dest, unsigned destlen, const char *src, unsigned srclen);
@@ -57,6 +85,14 @@ CryptoKey::Data::~Data()
         RSA_free(key);
         key = 0;
     }
+
+#ifdef CRYPTOKEY_ED25519
+    if (ed25519)
+    {
+        EVP_PKEY_free(ed25519);
+        ed25519 = 0;
+    }
+#endif
 }
 
 void CryptoKey::clear()
@@ -118,19 +154,148 @@ bool CryptoKey::loadFromFile(const QString &path, KeyType type, KeyFormat format
     return loadFromData(data, type, format);
 }
 
+bool CryptoKey::generateRSA(int bits)
+{
+    clear();
+
+    RSA *key = RSA_new();
+    BIGNUM *e = BN_new();
+    bool ok = key && e && BN_set_word(e, RSA_F4) && RSA_generate_key_ex(key, bits, e, NULL);
+    BN_free(e);
+
+    if (!ok) {
+        qWarning() << "Failed to generate RSA key:" << ERR_get_error();
+        RSA_free(key);
+        return false;
+    }
+
+    d = new Data(key);
+    return true;
+}
+
+bool CryptoKey::hasEd25519Support()
+{
+#ifdef CRYPTOKEY_ED25519
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool CryptoKey::generateEd25519()
+{
+    clear();
+
+    QByteArray seed = SecureRNG::random(32);
+    if (seed.size() != 32)
+        return false;
+
+    return loadEd25519(seed, PrivateKey);
+}
+
+bool CryptoKey::loadEd25519(const QByteArray &rawKey, KeyType type)
+{
+    clear();
+
+    if (rawKey.size() != 32) {
+        qWarning() << "Invalid size for Ed25519" << (type == PrivateKey ? "private" : "public") << "key";
+        return false;
+    }
+
+#ifdef CRYPTOKEY_ED25519
+    const uchar *data = reinterpret_cast<const uchar*>(rawKey.constData());
+    EVP_PKEY *key;
+    if (type == PrivateKey)
+        key = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, data, rawKey.size());
+    else
+        key = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, data, rawKey.size());
+
+    if (!key) {
+        qWarning() << "Failed to load Ed25519" << (type == PrivateKey ? "private" : "public") << "key";
+        return false;
+    }
+
+    d = new Data;
+    d->ed25519 = key;
+    d->ed25519Private = (type == PrivateKey);
+    return true;
+#else
+    qWarning() << "Ed25519 keys are not supported with this version of OpenSSL";
+    return false;
+#endif
+}
+
+QByteArray CryptoKey::rawEd25519Key(KeyType type) const
+{
+    if (!isLoaded() || !d->ed25519 || (type == PrivateKey && !d->ed25519Private))
+        return QByteArray();
+
+#ifdef CRYPTOKEY_ED25519
+    QByteArray re(32, 0);
+    size_t size = re.size();
+    uchar *data = reinterpret_cast<uchar*>(re.data());
+    int r = (type == PrivateKey) ? EVP_PKEY_get_raw_private_key(d->ed25519, data, &size)
+                                 : EVP_PKEY_get_raw_public_key(d->ed25519, data, &size);
+    if (r != 1 || size != 32) {
+        BUG() << "Failed to encode raw Ed25519 key";
+        return QByteArray();
+    }
+    return re;
+#else
+    return QByteArray();
+#endif
+}
+
+QByteArray CryptoKey::torExpandedEd25519Key() const
+{
+    QByteArray seed = rawEd25519Key(PrivateKey);
+    if (seed.isEmpty())
+        return QByteArray();
+
+    // Tor keeps the SHA-512 of the seed, with the scalar half clamped as per RFC 8032
+    QByteArray re(64, 0);
+    uchar *h = reinterpret_cast<uchar*>(re.data());
+    if (!SHA512(reinterpret_cast<const uchar*>(seed.constData()), seed.size(), h))
+        return QByteArray();
+
+    h[0] &= 248;
+    h[31] &= 63;
+    h[31] |= 64;
+    return re;
+}
+
+CryptoKey::KeyAlgorithm CryptoKey::algorithm() const
+{
+    return (isLoaded() && d->ed25519) ? Ed25519Key : RSAKey;
+}
+
 bool CryptoKey::isPrivate() const
 {
-    return isLoaded() && d->key->p != 0;
+    if (!isLoaded())
+        return false;
+    if (d->ed25519)
+        return d->ed25519Private;
+
+    const BIGNUM *p = 0;
+    RSA_get0_factors(d->key, &p, NULL);
+    return p != 0;
 }
 
 int CryptoKey::bits() const
 {
-    return isLoaded() ? BN_num_bits(d->key->n) : 0;
+    if (!isLoaded())
+        return 0;
+    if (d->ed25519)
+        return 256;
+
+    const BIGNUM *n = 0;
+    RSA_get0_key(d->key, &n, NULL, NULL);
+    return BN_num_bits(n);
 }
 
 QByteArray CryptoKey::publicKeyDigest() const
 {
-    if (!isLoaded())
+    if (!isLoaded() || !d->key)
         return QByteArray();
 
     QByteArray buf = encodedPublicKey(DER);
@@ -153,6 +318,26 @@ QByteArray CryptoKey::encodedPublicKey(KeyFormat format) const
     if (!isLoaded())
         return QByteArray();
 
+    if (d->ed25519) {
+#ifdef CRYPTOKEY_ED25519
+        if (format == PEM) {
+            BIO *b = BIO_new(BIO_s_mem());
+            if (!PEM_write_bio_PUBKEY(b, d->ed25519)) {
+                BUG() << "Failed to encode public key in PEM format";
+                BIO_free(b);
+                return QByteArray();
+            }
+
+            char *data = 0;
+            long size = BIO_get_mem_data(b, &data);
+            QByteArray re(data, int(size));
+            BIO_free(b);
+            return re;
+        }
+#endif
+        return rawEd25519Key(PublicKey);
+    }
+
     if (format == PEM) {
         BIO *b = BIO_new(BIO_s_mem());
 
@@ -190,11 +375,88 @@ QByteArray CryptoKey::encodedPublicKey(KeyFormat format) const
     return QByteArray();
 }
 
+QByteArray CryptoKey::encodedPrivateKey(KeyFormat format) const
+{
+    if (!isPrivate())
+        return QByteArray();
+
+    if (d->ed25519)
+        return (format == DER) ? rawEd25519Key(PrivateKey) : QByteArray();
+
+    if (format == PEM) {
+        BIO *b = BIO_new(BIO_s_mem());
+        if (!PEM_write_bio_RSAPrivateKey(b, d->key, NULL, NULL, 0, NULL, NULL)) {
+            BUG() << "Failed to encode private key in PEM format";
+            BIO_free(b);
+            return QByteArray();
+        }
+
+        char *data = 0;
+        long size = BIO_get_mem_data(b, &data);
+        QByteArray re(data, int(size));
+        BIO_free(b);
+        return re;
+    } else if (format == DER) {
+        uchar *buf = NULL;
+        int len = i2d_RSAPrivateKey(d->key, &buf);
+        if (len <= 0 || !buf) {
+            BUG() << "Failed to encode private key in DER format";
+            return QByteArray();
+        }
+
+        QByteArray re((const char*)buf, len);
+        OPENSSL_cleanse(buf, len);
+        OPENSSL_free(buf);
+        return re;
+    }
+
+    return QByteArray();
+}
+
+QByteArray CryptoKey::torServiceChecksum(const QByteArray &publicKey)
+{
+#ifdef CRYPTOKEY_ED25519
+    // checksum = SHA3-256(".onion checksum" | pubkey | version)[:2]
+    static const char version = 0x03;
+    QByteArray checksumData = QByteArray(".onion checksum") + publicKey + version;
+    uchar checksum[EVP_MAX_MD_SIZE];
+    unsigned checksumSize = 0;
+    if (!EVP_Digest(checksumData.constData(), checksumData.size(), checksum, &checksumSize, EVP_sha3_256(), NULL))
+        return QByteArray();
+
+    return QByteArray(reinterpret_cast<const char*>(checksum), 2);
+#else
+    Q_UNUSED(publicKey);
+    return QByteArray();
+#endif
+}
+
 QString CryptoKey::torServiceID() const
 {
     if (!isLoaded())
         return QString();
 
+    if (d->ed25519) {
+#ifdef CRYPTOKEY_ED25519
+        // v3 address is base32(pubkey | checksum | version)
+        QByteArray publicKey = rawEd25519Key(PublicKey);
+        if (publicKey.isEmpty())
+            return QString();
+
+        QByteArray checksum = torServiceChecksum(publicKey);
+        if (checksum.isEmpty())
+            return QString();
+
+        QByteArray address = publicKey + checksum + char(0x03);
+        QByteArray re(57, 0);
+        base32_encode(re.data(), re.size(), address.constData(), address.size());
+        re.chop(1);
+        return QString::fromLatin1(re);
+#else
+        return QString();
+#endif
+    }
+
     QByteArray digest = publicKeyDigest();
     if (digest.isNull())
         return QString();
@@ -229,6 +491,30 @@ QByteArray CryptoKey::signSHA256(const QByteArray &digest) const
     if (!isPrivate())
         return QByteArray();
 
+    if (d->ed25519) {
+#ifdef CRYPTOKEY_ED25519
+        QByteArray re(64, 0);
+        size_t sigsize = re.size();
+        EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+        int r = EVP_DigestSignInit(ctx, NULL, NULL, NULL, d->ed25519);
+        if (r == 1) {
+            r = EVP_DigestSign(ctx, reinterpret_cast<uchar*>(re.data()), &sigsize,
+                               reinterpret_cast<const uchar*>(digest.constData()), digest.size());
+        }
+        EVP_MD_CTX_free(ctx);
+
+        if (r != 1) {
+            qWarning() << "Ed25519 signature failed";
+            return QByteArray();
+        }
+
+        re.truncate(int(sigsize));
+        return re;
+#else
+        return QByteArray();
+#endif
+    }
+
     QByteArray re(RSA_size(d->key), 0);
     unsigned sigsize = 0;
     int r = RSA_sign(NID_sha256, reinterpret_cast<const unsigned char*>(digest.constData()), digest.size(),
@@ -262,6 +548,21 @@ bool CryptoKey::verifySHA256(const QByteArray &digest, QByteArray signature) con
     if (!isLoaded())
         return false;
 
+    if (d->ed25519) {
+#ifdef CRYPTOKEY_ED25519
+        EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+        int r = EVP_DigestVerifyInit(ctx, NULL, NULL, NULL, d->ed25519);
+        if (r == 1) {
+            r = EVP_DigestVerify(ctx, reinterpret_cast<const uchar*>(signature.constData()), signature.size(),
+                                 reinterpret_cast<const uchar*>(digest.constData()), digest.size());
+        }
+        EVP_MD_CTX_free(ctx);
+        return r == 1;
+#else
+        return false;
+#endif
+    }
+
     int r = RSA_verify(NID_sha256, reinterpret_cast<const uchar*>(digest.constData()), digest.size(),
                        reinterpret_cast<uchar*>(signature.data()), signature.size(), d->key);
     if (r != 1)
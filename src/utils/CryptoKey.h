@@ -50,6 +50,12 @@ public:
         DER
     };
 
+    /* RSA keys are used by legacy (v2) onion services, and Ed25519 keys by v3 */
+    enum KeyAlgorithm {
+        RSAKey,
+        Ed25519Key
+    };
+
     CryptoKey();
     CryptoKey(const CryptoKey &other) : d(other.d) { }
     ~CryptoKey();
@@ -58,12 +64,33 @@ public:
     bool loadFromFile(const QString &path, KeyType type, KeyFormat format = PEM);
     void clear();
 
-    bool isLoaded() const { return d.data() && d->key != 0; }
+    /* Generate a new RSA private key, as used by legacy (v2) hidden services */
+    bool generateRSA(int bits = 1024);
+
+    /* Ed25519 keys are loaded from the raw 32 byte private key (seed) or
+     * public key. They require OpenSSL 1.1.1; see hasEd25519Support(). */
+    static bool hasEd25519Support();
+    bool generateEd25519();
+    bool loadEd25519(const QByteArray &rawKey, KeyType type);
+    QByteArray rawEd25519Key(KeyType type) const;
+    /* Private key in the expanded form used by Tor, for ADD_ONION ED25519-V3 */
+    QByteArray torExpandedEd25519Key() const;
+
+    bool isLoaded() const { return d.data() && (d->key != 0 || d->ed25519 != 0); }
     bool isPrivate() const;
+    KeyAlgorithm algorithm() const;
 
+    // SHA-1 digest of the DER-encoded RSA public key; empty for Ed25519 keys
     QByteArray publicKeyDigest() const;
+    // For Ed25519 keys, DER format is the raw 32 byte public key
     QByteArray encodedPublicKey(KeyFormat format = PEM) const;
+    // PEM format matches the private_key file of a hidden service. For
+    // Ed25519 keys, DER format is the raw 32 byte private key.
+    QByteArray encodedPrivateKey(KeyFormat format = PEM) const;
+    // 16 characters for RSA keys, or 56 characters for Ed25519 (v3) keys
     QString torServiceID() const;
+    // 2 byte checksum in a v3 address for the raw public key; empty without SHA3 support
+    static QByteArray torServiceChecksum(const QByteArray &publicKey);
     int bits() const;
 
     // Calculate and sign SHA-256 digest of data using this key and PKCS #1 v2.0 padding
@@ -72,6 +99,7 @@ public:
     bool verifyData(const QByteArray &data, QByteArray signature) const;
 
     // Sign the input SHA-256 digest using this key and PKCS #1 v2.0 padding
+    // Ed25519 keys sign the digest itself as the message
     QByteArray signSHA256(const QByteArray &digest) const;
     // Verify a signature as per signSHA256
     bool verifySHA256(const QByteArray &digest, QByteArray signature) const;
@@ -80,9 +108,12 @@ private:
     struct Data : public QSharedData
     {
         typedef struct rsa_st RSA;
+        typedef struct evp_pkey_st EVP_PKEY;
         RSA *key;
+        EVP_PKEY *ed25519;
+        bool ed25519Private;
 
-        Data(RSA *k = 0) : key(k) { }
+        Data(RSA *k = 0) : key(k), ed25519(0), ed25519Private(false) { }
         ~Data();
     };
 
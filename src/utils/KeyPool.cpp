@@ -0,0 +1,145 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "KeyPool.h"
+#include "utils/Settings.h"
+#include <QCoreApplication>
+#include <QDebug>
+
+KeyPool::KeyPool(int size, QObject *parent)
+    : QThread(parent)
+    , m_size(qMax(size, 0))
+    , m_stopping(false)
+{
+    setObjectName(QStringLiteral("KeyPool"));
+}
+
+KeyPool::~KeyPool()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wanted.wakeAll();
+    }
+    wait();
+}
+
+KeyPool *KeyPool::instance()
+{
+    static KeyPool *p = 0;
+    if (!p) {
+        p = new KeyPool(SettingsObject(QStringLiteral("tor")).read("keyPoolSize").toInt(), qApp);
+        if (p->isEnabled())
+            p->start(QThread::LowestPriority);
+    }
+    return p;
+}
+
+QQueue<KeyPool::Key> &KeyPool::queue(CryptoKey::KeyAlgorithm algorithm)
+{
+    return (algorithm == CryptoKey::Ed25519Key) ? m_ed25519Keys : m_rsaKeys;
+}
+
+int KeyPool::available(CryptoKey::KeyAlgorithm algorithm) const
+{
+    QMutexLocker locker(&m_mutex);
+    return (algorithm == CryptoKey::Ed25519Key) ? m_ed25519Keys.size() : m_rsaKeys.size();
+}
+
+int KeyPool::neededAlgorithm()
+{
+    // Ed25519 keys are nearly free; keep those topped up first so they are never waiting on RSA
+    if (CryptoKey::hasEd25519Support() && m_ed25519Keys.size() < m_size)
+        return CryptoKey::Ed25519Key;
+    if (m_rsaKeys.size() < m_size)
+        return CryptoKey::RSAKey;
+    return -1;
+}
+
+KeyPool::Key KeyPool::generateKey(CryptoKey::KeyAlgorithm algorithm)
+{
+    Key re;
+    bool ok = (algorithm == CryptoKey::Ed25519Key) ? re.key.generateEd25519() : re.key.generateRSA(1024);
+    if (ok) {
+        re.serviceID = re.key.torServiceID();
+    } else {
+        qWarning() << "Failed to generate" << (algorithm == CryptoKey::Ed25519Key ? "Ed25519" : "RSA") << "key";
+        re.key.clear();
+    }
+    return re;
+}
+
+KeyPool::Key KeyPool::takeKey(CryptoKey::KeyAlgorithm algorithm)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        QQueue<Key> &keys = queue(algorithm);
+        if (!keys.isEmpty()) {
+            Key re = keys.dequeue();
+            m_wanted.wakeAll();
+            return re;
+        }
+    }
+
+    if (isEnabled())
+        qDebug() << "Key pool is empty; generating a key now";
+    return generateKey(algorithm);
+}
+
+void KeyPool::run()
+{
+    QMutexLocker locker(&m_mutex);
+    int retryDelay = 0;
+    while (!m_stopping) {
+        int algorithm = neededAlgorithm();
+        if (algorithm < 0) {
+            m_wanted.wait(&m_mutex);
+            continue;
+        }
+
+        locker.unlock();
+        Key key = generateKey(static_cast<CryptoKey::KeyAlgorithm>(algorithm));
+        locker.relock();
+
+        if (key.serviceID.isEmpty()) {
+            // takeKey still works by generating on demand, so keep trying instead of stopping the pool
+            retryDelay = retryDelay ? qMin(retryDelay * 2, int(MaxRetryDelay)) : int(MinRetryDelay);
+            qWarning() << "Key pool will retry in" << retryDelay << "ms";
+            m_wanted.wait(&m_mutex, retryDelay);
+            continue;
+        }
+        retryDelay = 0;
+
+        queue(static_cast<CryptoKey::KeyAlgorithm>(algorithm)).enqueue(key);
+        emit keyGenerated(algorithm);
+    }
+}
@@ -0,0 +1,101 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef KEYPOOL_H
+#define KEYPOOL_H
+
+#include "CryptoKey.h"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+
+/* Keys generated in advance for new hidden services
+ *
+ * A worker thread keeps a number of fresh RSA and Ed25519 keys ready, along
+ * with their service IDs, so that identities can be created without waiting
+ * for key generation. The pool size is set with the "tor.keyPoolSize"
+ * setting; it is disabled by default, leaving Tor to generate keys for new
+ * legacy services as before.
+ *
+ * takeKey() may be called from any thread.
+ */
+class KeyPool : public QThread
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(KeyPool)
+
+public:
+    // Delay after a failed generation, doubling for each consecutive failure
+    static const int MinRetryDelay = 1000;
+    static const int MaxRetryDelay = 60000;
+
+    struct Key
+    {
+        CryptoKey key;
+        QString serviceID;
+    };
+
+    explicit KeyPool(int size, QObject *parent = 0);
+    virtual ~KeyPool();
+
+    static KeyPool *instance();
+
+    int size() const { return m_size; }
+    bool isEnabled() const { return m_size > 0; }
+    int available(CryptoKey::KeyAlgorithm algorithm) const;
+
+    /* Take a pregenerated key, or generate one now if none are ready */
+    Key takeKey(CryptoKey::KeyAlgorithm algorithm);
+
+    static Key generateKey(CryptoKey::KeyAlgorithm algorithm);
+
+signals:
+    void keyGenerated(int algorithm);
+
+protected:
+    virtual void run();
+
+private:
+    const int m_size;
+    mutable QMutex m_mutex;
+    QWaitCondition m_wanted;
+    QQueue<Key> m_rsaKeys;
+    QQueue<Key> m_ed25519Keys;
+    bool m_stopping;
+
+    QQueue<Key> &queue(CryptoKey::KeyAlgorithm algorithm);
+    // The algorithm that most needs another key, or -1 if both are full
+    int neededAlgorithm();
+};
+
+#endif // KEYPOOL_H
@@ -0,0 +1,119 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "LinkScanner.h"
+#include <QRegularExpression>
+#include <QUrl>
+
+static const char * const allowedSchemes[] = { "http", "https", "ricochet", "torsion" };
+
+static bool isAsciiLetter(ushort c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool isAllowedScheme(const QStringRef &scheme)
+{
+    for (unsigned i = 0; i < sizeof(allowedSchemes) / sizeof(*allowedSchemes); i++) {
+        if (scheme.compare(QLatin1String(allowedSchemes[i]), Qt::CaseInsensitive) == 0)
+            return true;
+    }
+    return false;
+}
+
+static QString escaped(const QStringRef &text)
+{
+    return text.toString().toHtmlEscaped().replace(QLatin1Char('\n'), QStringLiteral("<br/>"));
+}
+
+bool LinkScanner::mayContainLinks(const QString &text)
+{
+    const QChar *data = text.constData();
+    const int size = text.size();
+
+    for (int i = 0; i < size; i++) {
+        ushort c = data[i].unicode();
+        if (c == ':') {
+            // The regex takes the longest run of up to 9 letters before the colon as the scheme
+            int start = i;
+            while (start > 0 && i - start < 9 && isAsciiLetter(data[start - 1].unicode()))
+                start--;
+            if (i - start < 3)
+                continue;
+            if (isAllowedScheme(QStringRef(&text, start, i - start)))
+                return true;
+            // QUrl::fromUserInput reads "host:port" as an http URL
+            if (i + 1 < size && data[i+1].isDigit())
+                return true;
+        } else if (c == '.' && i >= 3) {
+            if ((data[i-1] == QLatin1Char('w') || data[i-1] == QLatin1Char('W')) &&
+                (data[i-2] == QLatin1Char('w') || data[i-2] == QLatin1Char('W')) &&
+                (data[i-3] == QLatin1Char('w') || data[i-3] == QLatin1Char('W')))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+QString LinkScanner::toHtml(const QString &input)
+{
+    if (!mayContainLinks(input))
+        return escaped(QStringRef(&input));
+
+    // Select things that look like URLs of some kind and allow QUrl::fromUserInput to validate them
+    static const QRegularExpression linkRegex(QStringLiteral("([a-z]{3,9}:|www\\.)([^\\s,.);!>]|[,.);!>](?!\\s|$))+"),
+                                              QRegularExpression::CaseInsensitiveOption);
+
+    QString re;
+    int p = 0;
+    QRegularExpressionMatchIterator it = linkRegex.globalMatch(input);
+    while (it.hasNext()) {
+        QRegularExpressionMatch match = it.next();
+        int start = match.capturedStart();
+
+        QUrl url = QUrl::fromUserInput(match.capturedRef().toString());
+        QString scheme = url.scheme();
+        if (!isAllowedScheme(QStringRef(&scheme)))
+            continue;
+
+        if (start > p)
+            re.append(escaped(QStringRef(&input, p, start - p)));
+        re.append(QStringLiteral("<a href=\"%1\">%2</a>").arg(QString::fromLatin1(url.toEncoded()).toHtmlEscaped()).arg(match.capturedRef().toString().toHtmlEscaped()));
+        p = match.capturedEnd();
+    }
+
+    if (p < input.size())
+        re.append(escaped(QStringRef(&input, p, input.size() - p)));
+
+    return re;
+}
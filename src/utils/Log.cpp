@@ -0,0 +1,227 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Log.h"
+#include "utils/Settings.h"
+#include <QTime>
+#include <stdio.h>
+#include <string.h>
+
+Q_LOGGING_CATEGORY(lcConnection, "ricochet.connection")
+Q_LOGGING_CATEGORY(lcChannel, "ricochet.channel")
+Q_LOGGING_CATEGORY(lcContact, "ricochet.contact")
+Q_LOGGING_CATEGORY(lcTorControl, "ricochet.tor.control")
+Q_LOGGING_CATEGORY(lcDiagnostics, "ricochet.diagnostics")
+
+static std::atomic<AsyncLogger*> currentLogger(0);
+
+static void asyncMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &message)
+{
+    static const char levels[] = { 'D', 'W', 'C', 'F' };
+
+    QByteArray line = QTime::currentTime().toString(QStringLiteral("HH:mm:ss.zzz")).toLatin1();
+    line += ' ';
+    line += (int(type) < int(sizeof(levels))) ? levels[type] : '?';
+    line += ' ';
+    if (context.category && strcmp(context.category, "default") != 0) {
+        line += context.category;
+        line += ": ";
+    }
+    line += message.toLocal8Bit();
+    line += '\n';
+
+    AsyncLogger *logger = currentLogger.load(std::memory_order_acquire);
+    if (logger) {
+        logger->append(line);
+        // The process aborts after a fatal message returns
+        if (type == QtFatalMsg)
+            logger->flush();
+    } else {
+        fputs(line.constData(), stderr);
+    }
+}
+
+AsyncLogger::AsyncLogger(QObject *parent)
+    : QThread(parent)
+    , m_enqueuePos(0)
+    , m_dropped(0)
+    , m_dequeuePos(0)
+    , m_reportedDropped(0)
+    , m_stopping(false)
+{
+    Q_STATIC_ASSERT((QueueSize & (QueueSize - 1)) == 0);
+    setObjectName(QStringLiteral("AsyncLogger"));
+
+    for (int i = 0; i < QueueSize; i++)
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+
+    SettingsObject settings(QStringLiteral("logging"));
+    QString rules = settings.read("rules").toString();
+    rules.replace(QLatin1Char(';'), QLatin1Char('\n'));
+#ifdef QT_NO_DEBUG
+    // Release builds have historically produced no log output; keep that unless asked for
+    if (rules.isEmpty())
+        rules = QStringLiteral("*.debug=false\n*.warning=false");
+#endif
+    if (!rules.isEmpty())
+        QLoggingCategory::setFilterRules(rules);
+
+    m_filePath = settings.read("file").toString();
+    if (!m_filePath.isEmpty()) {
+        m_file.setFileName(m_filePath);
+        if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+            fprintf(stderr, "Cannot open log file %s: %s\n", qPrintable(m_filePath), qPrintable(m_file.errorString()));
+    }
+
+    currentLogger.store(this, std::memory_order_release);
+    m_previousHandler = qInstallMessageHandler(asyncMessageHandler);
+    start(QThread::LowPriority);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    qInstallMessageHandler(m_previousHandler);
+    currentLogger.store(0, std::memory_order_release);
+
+    {
+        QMutexLocker locker(&m_stopMutex);
+        m_stopping = true;
+        m_stopCondition.wakeAll();
+    }
+    wait();
+    flush();
+}
+
+AsyncLogger *AsyncLogger::instance()
+{
+    return currentLogger.load(std::memory_order_acquire);
+}
+
+/* Bounded multi-producer queue, after Dmitry Vyukov's design. Each cell's
+ * sequence tells whether it's free for the enqueue position, or holds the
+ * line for the dequeue position.
+ */
+bool AsyncLogger::append(const QByteArray &line)
+{
+    quint64 pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &m_cells[pos & (QueueSize - 1)];
+        quint64 sequence = cell->sequence.load(std::memory_order_acquire);
+        qint64 diff = qint64(sequence - pos);
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->line = line;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+void AsyncLogger::flush()
+{
+    QMutexLocker locker(&m_writeMutex);
+    drain();
+    if (m_file.isOpen())
+        m_file.flush();
+    else
+        fflush(stderr);
+}
+
+void AsyncLogger::run()
+{
+    QMutexLocker locker(&m_stopMutex);
+    while (!m_stopping) {
+        m_stopCondition.wait(&m_stopMutex, DrainInterval);
+
+        QMutexLocker writeLocker(&m_writeMutex);
+        drain();
+        if (m_file.isOpen())
+            m_file.flush();
+    }
+}
+
+// Must hold m_writeMutex
+void AsyncLogger::drain()
+{
+    QByteArray data;
+    for (;;) {
+        Cell &cell = m_cells[m_dequeuePos & (QueueSize - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1)
+            break;
+        data += cell.line;
+        cell.line.clear();
+        cell.sequence.store(m_dequeuePos + QueueSize, std::memory_order_release);
+        m_dequeuePos++;
+    }
+
+    quint64 dropped = droppedCount();
+    if (dropped != m_reportedDropped) {
+        data += QByteArray::number(dropped - m_reportedDropped) + " log messages dropped\n";
+        m_reportedDropped = dropped;
+    }
+
+    if (!data.isEmpty())
+        write(data);
+}
+
+void AsyncLogger::write(const QByteArray &data)
+{
+    if (!m_file.isOpen()) {
+        fwrite(data.constData(), 1, data.size(), stderr);
+        return;
+    }
+
+    m_file.write(data);
+    if (m_file.size() >= MaxFileSize)
+        rotate();
+}
+
+void AsyncLogger::rotate()
+{
+    m_file.close();
+
+    QFile::remove(m_filePath + QLatin1Char('.') + QString::number(MaxFiles - 1));
+    for (int i = MaxFiles - 2; i > 0; i--)
+        QFile::rename(m_filePath + QLatin1Char('.') + QString::number(i), m_filePath + QLatin1Char('.') + QString::number(i + 1));
+    QFile::rename(m_filePath, m_filePath + QStringLiteral(".1"));
+
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        fprintf(stderr, "Cannot open log file %s: %s\n", qPrintable(m_filePath), qPrintable(m_file.errorString()));
+}
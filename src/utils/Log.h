@@ -0,0 +1,133 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QLoggingCategory>
+#include <QFile>
+#include <atomic>
+
+/* Logging categories for subsystems that log on hot paths
+ *
+ * Use LOG_DEBUG and LOG_WARNING with these instead of qDebug and qWarning.
+ * The message is only formatted if the category is enabled, so a disabled
+ * category costs a branch. Unlike qDebug, they are not compiled out of release
+ * builds; instead release builds disable all debug and warning output by
+ * default, and the "logging.rules" setting enables categories at runtime.
+ */
+Q_DECLARE_LOGGING_CATEGORY(lcConnection)
+Q_DECLARE_LOGGING_CATEGORY(lcChannel)
+Q_DECLARE_LOGGING_CATEGORY(lcContact)
+Q_DECLARE_LOGGING_CATEGORY(lcTorControl)
+Q_DECLARE_LOGGING_CATEGORY(lcDiagnostics)
+
+#define LOG_MESSAGE_(category, level) \
+    for (bool logEnabled = category().is##level##Enabled(); logEnabled; logEnabled = false) \
+        QMessageLogger(QT_MESSAGELOG_FILE, QT_MESSAGELOG_LINE, QT_MESSAGELOG_FUNC, category().categoryName())
+#define LOG_DEBUG(category) LOG_MESSAGE_(category, Debug).debug()
+#define LOG_WARNING(category) LOG_MESSAGE_(category, Warning).warning()
+
+/* Asynchronous log output
+ *
+ * Installs a message handler that formats each message and puts it in a
+ * lock-free queue, which a background thread writes out every DrainInterval
+ * ms. Callers never wait on I/O; if the queue is full, messages are dropped
+ * and counted. Fatal messages flush the queue before returning.
+ *
+ * Settings, in "logging":
+ *   rules: QLoggingCategory filter rules, separated by newlines or ';',
+ *       such as "ricochet.tor.control.debug=true"
+ *   file: path of a log file, which is rotated at MaxFileSize, keeping
+ *       MaxFiles files. Without a file, messages are written to stderr.
+ */
+class AsyncLogger : public QThread
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(AsyncLogger)
+
+public:
+    // Must be a power of two
+    static const int QueueSize = 4096;
+    static const int DrainInterval = 50;
+    static const qint64 MaxFileSize = 4 * 1024 * 1024;
+    // The current file, and older files named with a suffix of .1, .2, ...
+    static const int MaxFiles = 3;
+
+    explicit AsyncLogger(QObject *parent = 0);
+    virtual ~AsyncLogger();
+
+    static AsyncLogger *instance();
+
+    /* Queue a formatted line; returns false if it was dropped */
+    bool append(const QByteArray &line);
+    /* Write all queued lines now, on the calling thread */
+    void flush();
+
+    quint64 droppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+
+protected:
+    virtual void run();
+
+private:
+    struct Cell
+    {
+        std::atomic<quint64> sequence;
+        QByteArray line;
+    };
+
+    Cell m_cells[QueueSize];
+    std::atomic<quint64> m_enqueuePos;
+    std::atomic<quint64> m_dropped;
+
+    // Held by whoever is writing out the queue, which is normally the logger thread
+    QMutex m_writeMutex;
+    quint64 m_dequeuePos;
+    quint64 m_reportedDropped;
+    QString m_filePath;
+    QFile m_file;
+
+    QMutex m_stopMutex;
+    QWaitCondition m_stopCondition;
+    bool m_stopping;
+
+    QtMessageHandler m_previousHandler;
+
+    void drain();
+    void write(const QByteArray &data);
+    void rotate();
+};
+
+#endif // LOG_H
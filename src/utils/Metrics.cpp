@@ -0,0 +1,308 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Metrics.h"
+#include "utils/Settings.h"
+#include "utils/UnixSocket.h"
+#include <QSaveFile>
+#include <QTcpSocket>
+#include <QCoreApplication>
+#include <QDebug>
+
+MetricHistogram::MetricHistogram()
+    : m_count(0)
+    , m_sum(0)
+{
+    for (int i = 0; i < BucketCount; i++)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+}
+
+int MetricHistogram::bucketIndex(quint64 value)
+{
+    if (value < quint64(SubBucketCount))
+        return int(value);
+
+    int exponent = 63;
+    while (!(value & (Q_UINT64_C(1) << exponent)))
+        exponent--;
+
+    int mantissa = int(value >> (exponent - SubBucketBits)) & (SubBucketCount - 1);
+    return (exponent - SubBucketBits + 1) * SubBucketCount + mantissa;
+}
+
+quint64 MetricHistogram::bucketUpperBound(int index)
+{
+    if (index < SubBucketCount)
+        return quint64(index);
+
+    int shift = index / SubBucketCount - 1;
+    quint64 mantissa = quint64(SubBucketCount + index % SubBucketCount);
+    // Written to avoid overflow for the last bucket, which ends at UINT64_MAX
+    return (mantissa << shift) + ((Q_UINT64_C(1) << shift) - 1);
+}
+
+void MetricHistogram::record(quint64 value)
+{
+    m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+quint64 MetricHistogram::percentile(double fraction) const
+{
+    quint64 total = 0;
+    for (int i = 0; i < BucketCount; i++)
+        total += bucketCount(i);
+    if (!total)
+        return 0;
+
+    quint64 target = qMax(quint64(1), quint64(fraction * total + 0.5));
+    quint64 seen = 0;
+    for (int i = 0; i < BucketCount; i++) {
+        seen += bucketCount(i);
+        if (seen >= target)
+            return bucketUpperBound(i);
+    }
+    return bucketUpperBound(BucketCount - 1);
+}
+
+MetricsRegistry::MetricsRegistry()
+{
+}
+
+MetricsRegistry::~MetricsRegistry()
+{
+    foreach (const Family &family, m_families) {
+        foreach (void *metric, family.metrics) {
+            switch (family.type) {
+                case Counter: delete static_cast<MetricCounter*>(metric); break;
+                case Gauge: delete static_cast<MetricGauge*>(metric); break;
+                case Histogram: delete static_cast<MetricHistogram*>(metric); break;
+            }
+        }
+    }
+}
+
+MetricsRegistry *MetricsRegistry::instance()
+{
+    // Intentionally never destroyed, because metrics may be updated during static destruction
+    static MetricsRegistry *registry = new MetricsRegistry;
+    return registry;
+}
+
+void *MetricsRegistry::find(const char *name, const char *help, MetricType type, const QByteArray &labels)
+{
+    QMutexLocker locker(&m_mutex);
+    QByteArray key(name);
+
+    auto it = m_families.find(key);
+    if (it == m_families.end()) {
+        Family family;
+        family.help = QByteArray(help);
+        family.type = type;
+        it = m_families.insert(key, family);
+    } else if (it->type != type) {
+        qWarning() << "Metric" << key << "is registered with more than one type";
+        return 0;
+    }
+
+    void *&metric = it->metrics[labels];
+    if (!metric) {
+        switch (type) {
+            case Counter: metric = new MetricCounter; break;
+            case Gauge: metric = new MetricGauge; break;
+            case Histogram: metric = new MetricHistogram; break;
+        }
+    }
+    return metric;
+}
+
+MetricCounter *MetricsRegistry::counter(const char *name, const char *help, const QByteArray &labels)
+{
+    static MetricCounter invalid;
+    MetricCounter *re = static_cast<MetricCounter*>(find(name, help, Counter, labels));
+    return re ? re : &invalid;
+}
+
+MetricGauge *MetricsRegistry::gauge(const char *name, const char *help, const QByteArray &labels)
+{
+    static MetricGauge invalid;
+    MetricGauge *re = static_cast<MetricGauge*>(find(name, help, Gauge, labels));
+    return re ? re : &invalid;
+}
+
+MetricHistogram *MetricsRegistry::histogram(const char *name, const char *help, const QByteArray &labels)
+{
+    static MetricHistogram invalid;
+    MetricHistogram *re = static_cast<MetricHistogram*>(find(name, help, Histogram, labels));
+    return re ? re : &invalid;
+}
+
+QByteArray MetricsRegistry::label(const char *key, const QString &value)
+{
+    QByteArray re(key);
+    re += "=\"";
+    foreach (char c, value.toUtf8()) {
+        if (c == '\\' || c == '"')
+            re += '\\';
+        if (c == '\n')
+            re += "\\n";
+        else
+            re += c;
+    }
+    re += '"';
+    return re;
+}
+
+QByteArray MetricsRegistry::labels(const char *key1, const QString &value1, const char *key2, const QString &value2)
+{
+    return label(key1, value1) + ',' + label(key2, value2);
+}
+
+static void appendSample(QByteArray &out, const QByteArray &name, const QByteArray &labels, const QByteArray &value)
+{
+    out += name;
+    if (!labels.isEmpty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+QByteArray MetricsRegistry::prometheusText() const
+{
+    static const char * const typeNames[] = { "counter", "gauge", "histogram" };
+
+    QMutexLocker locker(&m_mutex);
+    QByteArray out;
+
+    for (auto it = m_families.constBegin(); it != m_families.constEnd(); it++) {
+        const QByteArray &name = it.key();
+        const Family &family = it.value();
+
+        out += "# HELP " + name + ' ' + family.help + '\n';
+        out += "# TYPE " + name + ' ' + typeNames[family.type] + '\n';
+
+        for (auto mit = family.metrics.constBegin(); mit != family.metrics.constEnd(); mit++) {
+            const QByteArray &labels = mit.key();
+
+            if (family.type == Counter) {
+                appendSample(out, name, labels, QByteArray::number(static_cast<MetricCounter*>(mit.value())->value()));
+            } else if (family.type == Gauge) {
+                appendSample(out, name, labels, QByteArray::number(static_cast<MetricGauge*>(mit.value())->value()));
+            } else {
+                const MetricHistogram *histogram = static_cast<MetricHistogram*>(mit.value());
+                QByteArray bucketName = name + "_bucket";
+                QByteArray prefix = labels.isEmpty() ? labels : labels + ',';
+
+                // Only buckets with values are written; the counts are cumulative
+                quint64 cumulative = 0;
+                for (int i = 0; i < MetricHistogram::BucketCount; i++) {
+                    quint64 n = histogram->bucketCount(i);
+                    if (!n)
+                        continue;
+                    cumulative += n;
+                    appendSample(out, bucketName, prefix + "le=\"" + QByteArray::number(MetricHistogram::bucketUpperBound(i)) + '"',
+                                 QByteArray::number(cumulative));
+                }
+                appendSample(out, bucketName, prefix + "le=\"+Inf\"", QByteArray::number(cumulative));
+                appendSample(out, name + "_sum", labels, QByteArray::number(histogram->sum()));
+                appendSample(out, name + "_count", labels, QByteArray::number(cumulative));
+            }
+        }
+    }
+
+    return out;
+}
+
+MetricsExporter::MetricsExporter(QObject *parent)
+    : QObject(parent)
+    , m_timer(this)
+    , m_socketServer(0)
+{
+    SettingsObject settings(QStringLiteral("metrics"));
+    m_filePath = settings.read("exportFile").toString();
+    QString socketPath = settings.read("exportSocket").toString();
+
+    if (!m_filePath.isEmpty()) {
+        int interval = settings.read("exportInterval").toInt();
+        if (interval <= 0)
+            interval = DefaultExportInterval;
+        m_timer.setInterval(interval * 1000);
+        connect(&m_timer, &QTimer::timeout, this, &MetricsExporter::writeFile);
+        m_timer.start();
+        qDebug() << "Writing metrics to" << m_filePath << "every" << interval << "seconds";
+    }
+
+    if (!socketPath.isEmpty()) {
+        if (!unixSocketsSupported() || !unixSocketPathUsable(socketPath)) {
+            qWarning() << "Cannot export metrics on unix socket" << socketPath << "- unsupported, or path is too long";
+        } else {
+            m_socketServer = new UnixSocketServer(this);
+            if (!m_socketServer->listenPath(socketPath)) {
+                qWarning() << "Failed to open metrics socket:" << m_socketServer->errorString();
+                delete m_socketServer;
+                m_socketServer = 0;
+            } else {
+                connect(m_socketServer, &QLocalServer::newConnection, this, &MetricsExporter::socketConnected);
+                qDebug() << "Serving metrics on unix socket" << socketPath;
+            }
+        }
+    }
+}
+
+void MetricsExporter::writeFile()
+{
+    if (m_filePath.isEmpty())
+        return;
+
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        file.write(MetricsRegistry::instance()->prometheusText()) < 0 ||
+        !file.commit())
+    {
+        qWarning() << "Failed to write metrics to" << m_filePath << ":" << file.errorString();
+    }
+}
+
+void MetricsExporter::socketConnected()
+{
+    while (m_socketServer->hasPendingSockets()) {
+        QTcpSocket *socket = m_socketServer->nextPendingSocket();
+        connect(socket, &QAbstractSocket::disconnected, socket, &QObject::deleteLater);
+        socket->write(MetricsRegistry::instance()->prometheusText());
+        socket->disconnectFromHost();
+    }
+}
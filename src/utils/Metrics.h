@@ -0,0 +1,196 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QObject>
+#include <QMutex>
+#include <QMap>
+#include <QTimer>
+#include <atomic>
+
+class UnixSocketServer;
+
+/* In-process metrics, exported in the Prometheus text format
+ *
+ * Counters, gauges and histograms are registered by name and label set with
+ * MetricsRegistry, which returns the same object for the same name and
+ * labels. Objects are never deleted, so call sites look them up once and keep
+ * the pointer. Updates are relaxed atomic operations and safe from any
+ * thread; they are always enabled, unlike debug output.
+ *
+ * Durations are recorded in microseconds and sizes in bytes.
+ */
+class MetricCounter
+{
+    Q_DISABLE_COPY(MetricCounter)
+
+public:
+    MetricCounter() : m_value(0) { }
+
+    void add(quint64 n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value;
+};
+
+class MetricGauge
+{
+    Q_DISABLE_COPY(MetricGauge)
+
+public:
+    MetricGauge() : m_value(0) { }
+
+    void set(qint64 value) { m_value.store(value, std::memory_order_relaxed); }
+    void add(qint64 n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_value;
+};
+
+/* Log-linear buckets in the style of HdrHistogram: each power of two is
+ * split into 2^SubBucketBits buckets, so any value is recorded with less than
+ * 1/2^SubBucketBits relative error, at a fixed size and without allocation.
+ */
+class MetricHistogram
+{
+    Q_DISABLE_COPY(MetricHistogram)
+
+public:
+    static const int SubBucketBits = 3;
+    static const int SubBucketCount = 1 << SubBucketBits;
+    static const int BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+    MetricHistogram();
+
+    void record(quint64 value);
+
+    quint64 count() const { return m_count.load(std::memory_order_relaxed); }
+    quint64 sum() const { return m_sum.load(std::memory_order_relaxed); }
+    quint64 bucketCount(int index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+
+    /* Upper bound of the bucket holding the given fraction (0 to 1) of values */
+    quint64 percentile(double fraction) const;
+
+    static int bucketIndex(quint64 value);
+    // Largest value recorded in the bucket
+    static quint64 bucketUpperBound(int index);
+
+private:
+    std::atomic<quint64> m_buckets[BucketCount];
+    std::atomic<quint64> m_count;
+    std::atomic<quint64> m_sum;
+};
+
+class MetricsRegistry
+{
+    Q_DISABLE_COPY(MetricsRegistry)
+
+public:
+    enum MetricType {
+        Counter,
+        Gauge,
+        Histogram
+    };
+
+    MetricsRegistry();
+    ~MetricsRegistry();
+
+    static MetricsRegistry *instance();
+
+    /* Names should follow Prometheus conventions, such as a _total suffix on
+     * counters and the unit in histogram names. Labels are pre-formatted, as
+     * from label(), and the help text is taken from the first registration.
+     */
+    MetricCounter *counter(const char *name, const char *help, const QByteArray &labels = QByteArray());
+    MetricGauge *gauge(const char *name, const char *help, const QByteArray &labels = QByteArray());
+    MetricHistogram *histogram(const char *name, const char *help, const QByteArray &labels = QByteArray());
+
+    /* Format a label set; values are escaped. Use multiple pairs by joining
+     * the results with ','. */
+    static QByteArray label(const char *key, const QString &value);
+    static QByteArray labels(const char *key1, const QString &value1, const char *key2, const QString &value2);
+
+    QByteArray prometheusText() const;
+
+private:
+    struct Family
+    {
+        QByteArray help;
+        MetricType type;
+        QMap<QByteArray,void*> metrics;
+    };
+
+    mutable QMutex m_mutex;
+    QMap<QByteArray,Family> m_families;
+
+    void *find(const char *name, const char *help, MetricType type, const QByteArray &labels);
+};
+
+/* Writes the metrics periodically to a file, and to any client of a unix
+ * socket, according to the "metrics" settings:
+ *
+ *   exportFile: path of a file replaced with the current text
+ *   exportSocket: path of a unix socket; each connection receives the current
+ *       text and is closed
+ *   exportInterval: seconds between writes to exportFile, default 15
+ *
+ * Nothing is exported if neither path is set.
+ */
+class MetricsExporter : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(MetricsExporter)
+
+public:
+    static const int DefaultExportInterval = 15;
+
+    explicit MetricsExporter(QObject *parent = 0);
+
+    bool isEnabled() const { return !m_filePath.isEmpty() || m_socketServer; }
+
+public slots:
+    void writeFile();
+
+private slots:
+    void socketConnected();
+
+private:
+    QString m_filePath;
+    QTimer m_timer;
+    UnixSocketServer *m_socketServer;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,173 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OnionId.h"
+#include <QDebug>
+#include <QHash>
+#include <string.h>
+
+static const char base32Alphabet[] = "abcdefghijklmnopqrstuvwxyz234567";
+
+/* 5-bit value of each base32 character, in either case, or -1 */
+static const qint8 base32Values[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, 26, 27, 28, 29, 30, 31, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1
+};
+
+OnionId OnionId::fromString(const QString &text)
+{
+    const QChar *begin = text.constData();
+    const QChar *end = begin + text.size();
+
+    int colon = text.lastIndexOf(QLatin1Char(':'));
+    if (colon >= 0) {
+        QStringRef scheme(&text, 0, colon);
+        if (scheme.compare(QLatin1String("ricochet"), Qt::CaseInsensitive) != 0 &&
+            scheme.compare(QLatin1String("torsion"), Qt::CaseInsensitive) != 0)
+            return OnionId();
+        begin += colon + 1;
+    }
+
+    static const int suffixLength = 6;
+    if (end - begin > suffixLength &&
+        QStringRef(&text, (end - suffixLength) - text.constData(), suffixLength)
+            .compare(QLatin1String(".onion"), Qt::CaseInsensitive) == 0)
+    {
+        end -= suffixLength;
+    }
+
+    OnionId re;
+    int length = end - begin;
+    if (length == LegacyLength)
+        re.m_size = LegacySize;
+    else if (length == V3Length)
+        re.m_size = V3Size;
+    else
+        return OnionId();
+
+    // Both lengths are whole bytes, so nothing is left over at the end
+    quint32 buffer = 0;
+    int bits = 0;
+    quint8 *out = re.m_data;
+    for (const QChar *p = begin; p != end; ++p) {
+        ushort c = p->unicode();
+        if (c >= sizeof(base32Values) || base32Values[c] < 0)
+            return OnionId();
+        buffer = (buffer << 5) | quint32(base32Values[c]);
+        bits += 5;
+        if (bits >= 8) {
+            bits -= 8;
+            *out++ = quint8(buffer >> bits);
+            buffer &= (1u << bits) - 1;
+        }
+    }
+
+    // The last byte of a v3 address is the version; its checksum is not verified here
+    if (re.m_size == V3Size && re.m_data[V3Size - 1] != 3)
+        return OnionId();
+    return re;
+}
+
+OnionId OnionId::fromData(const QByteArray &data)
+{
+    OnionId re;
+    if (data.size() != LegacySize && (data.size() != V3Size || data.at(V3Size - 1) != 3))
+        return re;
+    memcpy(re.m_data, data.constData(), data.size());
+    re.m_size = quint8(data.size());
+    return re;
+}
+
+QString OnionId::serviceId() const
+{
+    if (!isValid())
+        return QString();
+
+    QString re((m_size * 8) / 5, Qt::Uninitialized);
+    QChar *out = re.data();
+    quint32 buffer = 0;
+    int bits = 0;
+    for (int i = 0; i < m_size; i++) {
+        buffer = (buffer << 8) | m_data[i];
+        bits += 8;
+        while (bits >= 5) {
+            bits -= 5;
+            *out++ = QLatin1Char(base32Alphabet[(buffer >> bits) & 0x1f]);
+        }
+        buffer &= (1u << bits) - 1;
+    }
+    return re;
+}
+
+QString OnionId::hostname() const
+{
+    if (!isValid())
+        return QString();
+    return serviceId() + QStringLiteral(".onion");
+}
+
+bool OnionId::operator==(const OnionId &o) const
+{
+    return m_size == o.m_size && memcmp(m_data, o.m_data, m_size) == 0;
+}
+
+bool OnionId::operator<(const OnionId &o) const
+{
+    if (m_size != o.m_size)
+        return m_size < o.m_size;
+    return memcmp(m_data, o.m_data, m_size) < 0;
+}
+
+uint qHash(const OnionId &id, uint seed)
+{
+    // Hash every byte, so peers can't choose IDs that collide under the per-process seed
+#if QT_VERSION >= 0x050400
+    return qHashBits(id.m_data, id.m_size, seed);
+#else
+    return qHash(QByteArray::fromRawData(reinterpret_cast<const char*>(id.m_data), id.m_size), seed);
+#endif
+}
+
+QDebug operator<<(QDebug debug, const OnionId &id)
+{
+    if (id.isValid())
+        debug << id.hostname();
+    else
+        debug << "OnionId()";
+    return debug;
+}
@@ -0,0 +1,96 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ONIONID_H
+#define ONIONID_H
+
+#include <QString>
+#include <QByteArray>
+#include <QMetaType>
+
+class QDebug;
+
+/* Identity of a hidden service, stored as the decoded onion address
+ *
+ * Legacy (v2) addresses hold the 10-byte key digest; v3 addresses hold the
+ * 32-byte public key followed by the checksum and version bytes, which keeps
+ * conversion to and from the text form exact. Comparison and hashing work on
+ * the raw bytes, so OnionId is cheap to pass around and use as a key.
+ *
+ * Text forms are only used at the edges (UI, settings and tor). fromString
+ * accepts a service ID with or without the ".onion" suffix, or a contact ID,
+ * in any case. An OnionId that failed to parse is invalid and compares equal
+ * only to other invalid IDs.
+ */
+class OnionId
+{
+public:
+    enum {
+        LegacySize = 10,
+        V3Size = 35,
+        LegacyLength = 16,
+        V3Length = 56
+    };
+
+    OnionId() : m_size(0) { }
+
+    static OnionId fromString(const QString &text);
+    static OnionId fromData(const QByteArray &data);
+
+    bool isValid() const { return m_size != 0; }
+    /* Hidden service version, 2 or 3, or 0 for an invalid ID */
+    int version() const { return m_size == V3Size ? 3 : (m_size == LegacySize ? 2 : 0); }
+
+    QByteArray data() const { return QByteArray(reinterpret_cast<const char*>(m_data), m_size); }
+    /* Base32 service ID, without the ".onion" suffix */
+    QString serviceId() const;
+    /* Service ID with the ".onion" suffix, as used for hostnames in settings */
+    QString hostname() const;
+
+    bool operator==(const OnionId &o) const;
+    bool operator!=(const OnionId &o) const { return !operator==(o); }
+    bool operator<(const OnionId &o) const;
+
+private:
+    quint8 m_data[V3Size];
+    quint8 m_size;
+
+    friend uint qHash(const OnionId &id, uint seed);
+};
+
+uint qHash(const OnionId &id, uint seed = 0);
+QDebug operator<<(QDebug debug, const OnionId &id);
+
+Q_DECLARE_TYPEINFO(OnionId, Q_MOVABLE_TYPE);
+Q_DECLARE_METATYPE(OnionId)
+
+#endif // ONIONID_H
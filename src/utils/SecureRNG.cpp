@@ -31,15 +31,208 @@
  */
 
 #include "SecureRNG.h"
+#include "Useful.h"
 #include <QtDebug>
+#include <QThreadStorage>
+#include <QAtomicInt>
+#include <QtEndian>
 #include <openssl/rand.h>
 #include <openssl/err.h>
 #include <limits.h>
+#include <string.h>
 
 #ifdef Q_OS_WIN
 #include <Wincrypt.h>
 #endif
 
+#ifdef Q_OS_UNIX
+#include <pthread.h>
+#endif
+
+namespace {
+
+/* Incremented in the child process after fork(), which would otherwise
+ * continue with the same keystream as its parent */
+QAtomicInt forkGeneration;
+
+#ifdef Q_OS_UNIX
+void onFork()
+{
+    forkGeneration.ref();
+}
+#endif
+
+/* ChaCha20-based DRBG with fast key erasure
+ *
+ * Each refill generates several blocks of keystream; the start of it
+ * immediately replaces the key, and the rest is handed out and erased as it
+ * is used. Earlier output can't be recovered from the state at any point.
+ * New entropy from OpenSSL is mixed into the key after ReseedInterval bytes
+ * or a fork.
+ */
+class ChaChaRNG
+{
+public:
+    static const int KeySize = 32;
+    static const int NonceSize = 8;
+    static const int SeedSize = KeySize + NonceSize;
+    static const int BlockSize = 64;
+    static const int BufferBlocks = 16;
+    static const int BufferSize = BlockSize * BufferBlocks;
+    static const int ReseedInterval = 1024 * 1024;
+
+    ChaChaRNG();
+    ~ChaChaRNG();
+
+    bool read(char *out, int size);
+
+private:
+    quint32 m_state[16];
+    quint8 m_buffer[BufferSize];
+    int m_available;
+    int m_sinceReseed;
+    int m_forkGeneration;
+    bool m_seeded;
+
+    bool reseed();
+    void setKey(const quint8 *seed);
+    void refill();
+    static void block(const quint32 input[16], quint8 *output);
+};
+
+ChaChaRNG::ChaChaRNG()
+    : m_available(0), m_sinceReseed(0), m_forkGeneration(0), m_seeded(false)
+{
+#ifdef Q_OS_UNIX
+    static bool forkHandler = (pthread_atfork(NULL, NULL, onFork) == 0);
+    if (!forkHandler)
+        qWarning() << "Unable to register fork handler for RNG";
+#endif
+
+    memset(m_state, 0, sizeof(m_state));
+    memset(m_buffer, 0, sizeof(m_buffer));
+}
+
+ChaChaRNG::~ChaChaRNG()
+{
+    memset(m_state, 0, sizeof(m_state));
+    memset(m_buffer, 0, sizeof(m_buffer));
+}
+
+bool ChaChaRNG::reseed()
+{
+    quint8 seed[SeedSize];
+    if (!RAND_bytes(seed, sizeof(seed))) {
+        qWarning() << "RNG failed:" << ERR_get_error();
+        return false;
+    }
+
+    // Mix into the current key, so a weak seed can't make the state worse
+    if (m_seeded) {
+        for (int i = 0; i < KeySize / 4; i++)
+            qToLittleEndian<quint32>(qFromLittleEndian<quint32>(seed + i * 4) ^ m_state[4 + i], seed + i * 4);
+    }
+
+    setKey(seed);
+    memset(seed, 0, sizeof(seed));
+
+    m_seeded = true;
+    m_sinceReseed = 0;
+    m_forkGeneration = forkGeneration.load();
+    refill();
+    return true;
+}
+
+void ChaChaRNG::setKey(const quint8 *seed)
+{
+    // "expand 32-byte k"
+    m_state[0] = 0x61707865;
+    m_state[1] = 0x3320646e;
+    m_state[2] = 0x79622d32;
+    m_state[3] = 0x6b206574;
+    for (int i = 0; i < KeySize / 4; i++)
+        m_state[4 + i] = qFromLittleEndian<quint32>(seed + i * 4);
+    // 64-bit block counter and nonce
+    m_state[12] = 0;
+    m_state[13] = 0;
+    m_state[14] = qFromLittleEndian<quint32>(seed + KeySize);
+    m_state[15] = qFromLittleEndian<quint32>(seed + KeySize + 4);
+}
+
+void ChaChaRNG::refill()
+{
+    for (int i = 0; i < BufferBlocks; i++) {
+        block(m_state, m_buffer + i * BlockSize);
+        if (++m_state[12] == 0)
+            m_state[13]++;
+    }
+
+    // Fast key erasure: the first part of the keystream becomes the next key
+    setKey(m_buffer);
+    memset(m_buffer, 0, SeedSize);
+    m_available = BufferSize - SeedSize;
+}
+
+bool ChaChaRNG::read(char *out, int size)
+{
+    if (!m_seeded || m_sinceReseed >= ReseedInterval || m_forkGeneration != forkGeneration.load()) {
+        if (!reseed())
+            return false;
+    }
+
+    m_sinceReseed += size;
+    while (size > 0) {
+        if (!m_available)
+            refill();
+
+        // Output is taken from the end of the buffer, so the key part is never used
+        int n = qMin(size, m_available);
+        quint8 *p = m_buffer + BufferSize - m_available;
+        memcpy(out, p, n);
+        memset(p, 0, n);
+        m_available -= n;
+        out += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8); \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+void ChaChaRNG::block(const quint32 input[16], quint8 *output)
+{
+    quint32 x[16];
+    memcpy(x, input, sizeof(x));
+
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12])
+        QUARTERROUND(x[1], x[5], x[9], x[13])
+        QUARTERROUND(x[2], x[6], x[10], x[14])
+        QUARTERROUND(x[3], x[7], x[11], x[15])
+        QUARTERROUND(x[0], x[5], x[10], x[15])
+        QUARTERROUND(x[1], x[6], x[11], x[12])
+        QUARTERROUND(x[2], x[7], x[8], x[13])
+        QUARTERROUND(x[3], x[4], x[9], x[14])
+    }
+
+    for (int i = 0; i < 16; i++)
+        qToLittleEndian<quint32>(x[i] + input[i], output + i * 4);
+    memset(x, 0, sizeof(x));
+}
+
+#undef QUARTERROUND
+#undef ROTL32
+
+QThreadStorage<ChaChaRNG*> threadRNG;
+
+}
+
 #if QT_VERSION >= 0x040700
 #include <QElapsedTimer>
 #endif
@@ -95,6 +288,12 @@ bool SecureRNG::seed()
 
 bool SecureRNG::random(char *buf, int size)
 {
+    if (size <= BufferedRequestSize) {
+        if (!threadRNG.hasLocalData())
+            threadRNG.setLocalData(new ChaChaRNG);
+        return threadRNG.localData()->read(buf, size);
+    }
+
     int r = RAND_bytes(reinterpret_cast<unsigned char*>(buf), size);
     if (!r)
     {
@@ -126,30 +325,59 @@ QByteArray SecureRNG::randomPrintable(int length)
 
 unsigned SecureRNG::randomInt(unsigned max)
 {
-    unsigned cutoff = UINT_MAX - (UINT_MAX % max);
+    if (max == 0) {
+        BUG() << "randomInt called with an empty range";
+        return 0;
+    }
+
+    // Values below (2^32 % max) would make the low results more likely
+    unsigned threshold = (0u - max) % max;
     unsigned value = 0;
 
     for (;;)
     {
-        random(reinterpret_cast<char*>(&value), sizeof(value));
-        if (value < cutoff)
+        if (!random(reinterpret_cast<char*>(&value), sizeof(value)))
+            qFatal("Secure random number generator failed");
+        if (value >= threshold)
             return value % max;
     }
 }
 
-#ifndef UINT64_MAX
-#define UINT64_MAX ((quint64)-1)
-#endif
-
 quint64 SecureRNG::randomInt64(quint64 max)
 {
-    quint64 cutoff = UINT64_MAX - (UINT64_MAX % max);
+    if (max == 0) {
+        BUG() << "randomInt64 called with an empty range";
+        return 0;
+    }
+
+    quint64 threshold = (Q_UINT64_C(0) - max) % max;
     quint64 value = 0;
 
     for (;;)
     {
-        random(reinterpret_cast<char*>(value), sizeof(value));
-        if (value < cutoff)
+        if (!random(reinterpret_cast<char*>(&value), sizeof(value)))
+            qFatal("Secure random number generator failed");
+        if (value >= threshold)
             return value % max;
     }
 }
+
+quint64 SecureRNG::randomInt64()
+{
+    quint64 value = 0;
+    if (!random(reinterpret_cast<char*>(&value), sizeof(value)))
+        qFatal("Secure random number generator failed");
+    return value;
+}
+
+qint64 SecureRNG::randomRange(qint64 min, qint64 max)
+{
+    if (max <= min) {
+        BUG() << "randomRange called with an empty range";
+        return min;
+    }
+
+    // The difference always fits in an unsigned value
+    quint64 span = quint64(max) - quint64(min);
+    return qint64(quint64(min) + randomInt64(span));
+}
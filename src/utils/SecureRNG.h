@@ -35,17 +35,33 @@
 
 #include <QByteArray>
 
+/* Cryptographically secure random numbers
+ *
+ * Small requests are served from a buffered ChaCha20 keystream kept for each
+ * thread, which is seeded from OpenSSL's RNG and periodically reseeded, and
+ * also reseeded in the child after a fork. This avoids taking OpenSSL's RNG
+ * lock for every cookie and identifier. Larger requests, such as key
+ * material, are read from OpenSSL directly.
+ */
 class SecureRNG
 {
 public:
+    // Requests up to this many bytes are served from the thread's keystream
+    static const int BufferedRequestSize = 64;
+
     static bool seed();
 
     static bool random(char *buf, int size);
     static QByteArray random(int size);
 
     static QByteArray randomPrintable(int length);
+    // Uniformly distributed in [0, max); max must not be 0
     static unsigned randomInt(unsigned max);
     static quint64 randomInt64(quint64 max);
+    // Uniformly distributed over all values
+    static quint64 randomInt64();
+    // Uniformly distributed in [min, max); max must be greater than min
+    static qint64 randomRange(qint64 min, qint64 max);
 };
 
 #endif // SECURERNG_H
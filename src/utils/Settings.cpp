@@ -31,6 +31,8 @@
  */
 
 #include "Settings.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <QCoreApplication>
 #include <QJsonDocument>
 #include <QJsonParseError>
@@ -39,8 +41,11 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QDebug>
 #include <QPointer>
+#include <QMutex>
+#include <QThread>
 
 class SettingsFilePrivate : public QObject
 {
@@ -53,6 +58,8 @@ public:
     QTimer syncTimer;
     QJsonObject jsonRoot;
     SettingsObject *rootObject;
+    // Protects jsonRoot, which may be read and written by identities on worker threads
+    mutable QMutex rootLock;
 
     SettingsFilePrivate(SettingsFile *qp);
     virtual ~SettingsFilePrivate();
@@ -63,6 +70,9 @@ public:
     bool readFile();
     bool writeFile();
 
+    QJsonObject root() const;
+    void setRoot(const QJsonObject &value);
+
     static QStringList splitPath(const QString &input, bool &ok);
     QJsonValue read(const QJsonObject &base, const QStringList &path);
     bool write(const QStringList &path, const QJsonValue &value);
@@ -87,6 +97,7 @@ SettingsFile::~SettingsFile()
 SettingsFilePrivate::SettingsFilePrivate(SettingsFile *qp)
     : QObject(qp)
     , q(qp)
+    , syncTimer(this)
     , rootObject(0)
 {
     syncTimer.setInterval(0);
@@ -106,8 +117,20 @@ void SettingsFilePrivate::reset()
     filePath.clear();
     errorMessage.clear();
 
-    jsonRoot = QJsonObject();
-    emit modified(QStringList(), jsonRoot);
+    setRoot(QJsonObject());
+    emit modified(QStringList(), QJsonObject());
+}
+
+QJsonObject SettingsFilePrivate::root() const
+{
+    QMutexLocker locker(&rootLock);
+    return jsonRoot;
+}
+
+void SettingsFilePrivate::setRoot(const QJsonObject &value)
+{
+    QMutexLocker locker(&rootLock);
+    jsonRoot = value;
 }
 
 QString SettingsFile::filePath() const
@@ -180,17 +203,30 @@ const SettingsObject *SettingsFile::root() const
     return d->rootObject;
 }
 
+void SettingsFile::sync()
+{
+    d->sync();
+}
+
 void SettingsFilePrivate::sync()
 {
     if (filePath.isEmpty())
         return;
 
     syncTimer.stop();
+
+    QElapsedTimer timer;
+    timer.start();
     writeFile();
+
+    static MetricHistogram *duration = MetricsRegistry::instance()->histogram(
+        "ricochet_settings_sync_duration_microseconds", "Time to write the settings file");
+    duration->record(timer.nsecsElapsed() / 1000);
 }
 
 bool SettingsFilePrivate::readFile()
 {
+    TRACE_SPAN("settings.read");
     QFile file(filePath);
     if (!file.open(QIODevice::ReadWrite)) {
         setError(file.errorString());
@@ -204,7 +240,7 @@ bool SettingsFilePrivate::readFile()
     }
 
     if (data.isEmpty()) {
-        jsonRoot = QJsonObject();
+        setRoot(QJsonObject());
         return true;
     }
 
@@ -220,9 +256,9 @@ bool SettingsFilePrivate::readFile()
         return false;
     }
 
-    jsonRoot = document.object();
+    setRoot(document.object());
 
-    emit modified(QStringList(), jsonRoot);
+    emit modified(QStringList(), document.object());
     return true;
 }
 
@@ -234,7 +270,7 @@ bool SettingsFilePrivate::writeFile()
         return false;
     }
 
-    QJsonDocument document(jsonRoot);
+    QJsonDocument document(root());
     QByteArray data = document.toJson();
     if (data.isEmpty() && !document.isEmpty()) {
         setError(QStringLiteral("Encoding failure"));
@@ -322,6 +358,7 @@ bool SettingsFilePrivate::write(const QStringList &path, const QJsonValue &value
 {
     typedef QVarLengthArray<QPair<QString,QJsonObject> > ObjectStack;
     ObjectStack stack;
+    QMutexLocker locker(&rootLock);
     QJsonValue current = jsonRoot;
     QJsonValue originalValue;
     QString currentKey;
@@ -351,7 +388,12 @@ bool SettingsFilePrivate::write(const QStringList &path, const QJsonValue &value
 
     // current is now the updated jsonRoot
     jsonRoot = current.toObject();
-    syncTimer.start();
+    locker.unlock();
+
+    if (QThread::currentThread() == thread())
+        syncTimer.start();
+    else
+        QMetaObject::invokeMethod(&syncTimer, "start", Qt::QueuedConnection);
 
     ModifiedList modified;
     findModifiedRecursive(modified, path, originalValue, value);
@@ -445,7 +487,7 @@ void SettingsObjectPrivate::modified(const QStringList &key, const QJsonValue &v
             return;
     }
 
-    object = file->d->read(file->d->jsonRoot, path).toObject();
+    object = file->d->read(file->d->root(), path).toObject();
     emit q->modified(QStringList(key.mid(path.size())).join(QLatin1Char('.')), value);
     emit q->dataChanged();
 }
@@ -487,7 +529,7 @@ void SettingsObject::setPath(const QString &input)
     d->path = newPath;
     if (d->file) {
         d->invalid = false;
-        d->object = d->file->d->read(d->file->d->jsonRoot, d->path).toObject();
+        d->object = d->file->d->read(d->file->d->root(), d->path).toObject();
         emit dataChanged();
     }
 
@@ -75,6 +75,9 @@ public:
     SettingsObject *root();
     const SettingsObject *root() const;
 
+    /* Write pending changes to the file now, instead of from the event loop */
+    void sync();
+
 signals:
     void filePathChanged();
     void error();
@@ -0,0 +1,207 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "StallWatchdog.h"
+#include "utils/Metrics.h"
+#include "utils/Settings.h"
+#include "utils/Trace.h"
+#include "utils/Log.h"
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#define HAVE_STALL_BACKTRACE
+
+static pthread_t mainThread;
+static void *backtraceFrames[StallWatchdog::MaxBacktraceFrames];
+static std::atomic<int> backtraceFrameCount(0);
+
+static void backtraceSignalHandler(int)
+{
+    backtraceFrameCount.store(backtrace(backtraceFrames, StallWatchdog::MaxBacktraceFrames), std::memory_order_release);
+}
+#endif
+
+StallWatchdog::StallWatchdog(QObject *parent)
+    : QThread(parent)
+    , m_captureBacktrace(false)
+    , m_heartbeatTimer(this)
+    , m_lastBeat(0)
+    , m_stopping(false)
+    , m_inStall(false)
+{
+    setObjectName(QStringLiteral("StallWatchdog"));
+
+    SettingsObject settings(QStringLiteral("diagnostics"));
+    QJsonValue threshold = settings.read("stallThreshold");
+    m_threshold = threshold.isDouble() ? qMax(threshold.toInt(), 0) : int(DefaultThreshold);
+
+    MetricsRegistry *metrics = MetricsRegistry::instance();
+    m_stalls = metrics->counter("ricochet_event_loop_stalls_total", "Main event loop stalls over the watchdog threshold");
+    m_stallDuration = metrics->histogram("ricochet_event_loop_stall_duration_microseconds", "Duration of main event loop stalls");
+    m_lag = metrics->histogram("ricochet_event_loop_lag_microseconds", "Delay of main event loop heartbeats past their interval");
+
+    if (!isEnabled())
+        return;
+
+    // Lets captureContext report the span even when tracing is off
+    Tracing::trackActiveSpans();
+
+    if (settings.read("stallBacktrace").toBool()) {
+#ifdef HAVE_STALL_BACKTRACE
+        mainThread = pthread_self();
+        // The first call to backtrace may allocate while loading libgcc, which isn't safe in a signal handler
+        backtrace(backtraceFrames, 1);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = backtraceSignalHandler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGUSR2, &action, 0) == 0)
+            m_captureBacktrace = true;
+        else
+            LOG_WARNING(lcDiagnostics) << "Cannot install signal handler for stall backtraces";
+#else
+        LOG_WARNING(lcDiagnostics) << "Stall backtraces are not supported on this platform";
+#endif
+    }
+
+    m_clock.start();
+    m_lastBeat.store(m_clock.nsecsElapsed(), std::memory_order_relaxed);
+
+    m_heartbeatTimer.setTimerType(Qt::PreciseTimer);
+    m_heartbeatTimer.setInterval(HeartbeatInterval);
+    connect(&m_heartbeatTimer, &QTimer::timeout, this, &StallWatchdog::heartbeat);
+    m_heartbeatTimer.start();
+
+    start(QThread::HighPriority);
+}
+
+StallWatchdog::~StallWatchdog()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wake.wakeAll();
+    }
+    wait();
+}
+
+void StallWatchdog::heartbeat()
+{
+    qint64 now = m_clock.nsecsElapsed();
+    qint64 lag = (now - m_lastBeat.exchange(now, std::memory_order_relaxed)) / 1000 - HeartbeatInterval * 1000;
+    lag = qMax(lag, qint64(0));
+    m_lag->record(lag);
+
+    if (lag < qint64(m_threshold) * 1000)
+        return;
+
+    QStringList context;
+    {
+        QMutexLocker locker(&m_mutex);
+        context = m_stallContext;
+        m_stallContext.clear();
+        m_inStall = false;
+    }
+
+    m_stalls->add();
+    m_stallDuration->record(lag);
+    LOG_WARNING(lcDiagnostics) << "Main event loop was stalled for" << lag / 1000 << "ms";
+    foreach (const QString &line, context)
+        LOG_WARNING(lcDiagnostics) << "  " << line;
+}
+
+void StallWatchdog::run()
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_stopping) {
+        m_wake.wait(&m_mutex, HeartbeatInterval);
+        if (m_stopping || m_inStall)
+            continue;
+
+        qint64 delay = (m_clock.nsecsElapsed() - m_lastBeat.load(std::memory_order_relaxed)) / 1000000 - HeartbeatInterval;
+        if (delay < m_threshold)
+            continue;
+
+        // Capture without the lock, so a recovering main thread doesn't wait for it
+        m_inStall = true;
+        locker.unlock();
+        QStringList context = captureContext();
+        LOG_WARNING(lcDiagnostics) << "Main event loop is stalled for over" << delay << "ms";
+        foreach (const QString &line, context)
+            LOG_WARNING(lcDiagnostics) << "  " << line;
+        locker.relock();
+
+        // Only keep the context if the heartbeat didn't arrive in the meantime
+        if (m_inStall)
+            m_stallContext = context;
+    }
+}
+
+QStringList StallWatchdog::captureContext()
+{
+    QStringList re;
+
+    const char *span = Tracing::mainThreadSpan();
+    if (span)
+        re.append(QStringLiteral("in span %1").arg(QLatin1String(span)));
+
+#ifdef HAVE_STALL_BACKTRACE
+    if (m_captureBacktrace) {
+        backtraceFrameCount.store(-1, std::memory_order_relaxed);
+        if (pthread_kill(mainThread, SIGUSR2) == 0) {
+            int count = -1;
+            for (int i = 0; i < BacktraceTimeout && count < 0; i++) {
+                QThread::msleep(1);
+                count = backtraceFrameCount.load(std::memory_order_acquire);
+            }
+
+            if (count > 0) {
+                char **symbols = backtrace_symbols(backtraceFrames, count);
+                // Skip the signal handler and trampoline frames
+                for (int i = 2; symbols && i < count; i++)
+                    re.append(QString::fromLocal8Bit(symbols[i]));
+                free(symbols);
+            } else {
+                re.append(QStringLiteral("backtrace of main thread timed out"));
+            }
+        }
+    }
+#endif
+
+    return re;
+}
@@ -0,0 +1,116 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STALLWATCHDOG_H
+#define STALLWATCHDOG_H
+
+#include <QThread>
+#include <QTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <atomic>
+
+class MetricCounter;
+class MetricHistogram;
+
+/* Detects stalls of the main event loop
+ *
+ * A precise timer on the main thread records a heartbeat every
+ * HeartbeatInterval milliseconds, and a watchdog thread checks that it keeps
+ * arriving. When the main thread hasn't returned to the event loop for longer
+ * than the threshold, the watchdog logs what it was doing: the innermost
+ * TraceSpan, which is tracked while the watchdog runs unless built with
+ * RICOCHET_NO_TRACE, and a backtrace of the main thread, if enabled and
+ * supported. Once the loop recovers, the stall is logged with its duration
+ * and recorded in metrics.
+ *
+ * Messages are warnings in the "ricochet.diagnostics" category. Release
+ * builds disable warnings by default, so enable them with a "logging.rules"
+ * setting such as "ricochet.diagnostics.warning=true"; metrics are always
+ * recorded.
+ *
+ * Settings, in "diagnostics":
+ *   stallThreshold: milliseconds of delay counted as a stall; 0 disables
+ *       the watchdog. Default is DefaultThreshold.
+ *   stallBacktrace: capture a backtrace of the main thread during stalls,
+ *       using a signal. Only available with glibc. Default is false.
+ *
+ * Must be created on the main thread.
+ */
+class StallWatchdog : public QThread
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(StallWatchdog)
+
+public:
+    static const int DefaultThreshold = 250;
+    static const int HeartbeatInterval = 50;
+    // Milliseconds to wait for the main thread to record a backtrace
+    static const int BacktraceTimeout = 100;
+    static const int MaxBacktraceFrames = 64;
+
+    explicit StallWatchdog(QObject *parent = 0);
+    virtual ~StallWatchdog();
+
+    int threshold() const { return m_threshold; }
+    bool isEnabled() const { return m_threshold > 0; }
+
+protected:
+    virtual void run();
+
+private slots:
+    void heartbeat();
+
+private:
+    int m_threshold;
+    bool m_captureBacktrace;
+    QElapsedTimer m_clock;
+    QTimer m_heartbeatTimer;
+    std::atomic<qint64> m_lastBeat;
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    bool m_stopping;
+    // Set by the watchdog during a stall, and taken by the next heartbeat
+    bool m_inStall;
+    QStringList m_stallContext;
+
+    MetricCounter *m_stalls;
+    MetricHistogram *m_stallDuration;
+    MetricHistogram *m_lag;
+
+    QStringList captureContext();
+};
+
+#endif // STALLWATCHDOG_H
@@ -0,0 +1,266 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Trace.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThreadStorage>
+#include <QThread>
+#include <QMutex>
+#include <QList>
+#include <QSaveFile>
+#include <QDebug>
+
+std::atomic<bool> Tracing::s_enabled(false);
+std::atomic<bool> Tracing::s_trackSpans(false);
+
+namespace {
+
+struct TraceEvent
+{
+    const char *name;
+    const char *category;
+    qint64 timestamp;
+    qint64 duration;
+    quint64 id;
+    char phase;
+};
+
+struct TraceBuffer
+{
+    int threadId;
+    QByteArray threadName;
+    // Total events written; the newest BufferSize are in events
+    std::atomic<quint64> written;
+    TraceEvent events[Tracing::BufferSize];
+
+    TraceBuffer() : threadId(0), written(0) { }
+};
+
+// Stored by value, so the buffer isn't deleted when its thread exits
+struct TraceBufferRef
+{
+    TraceBuffer *buffer;
+    // Separate from the buffer, which isn't allocated unless tracing was started
+    std::atomic<const char*> *activeSpan;
+    TraceBufferRef() : buffer(0), activeSpan(0) { }
+};
+
+QElapsedTimer clock;
+QString outputPath;
+QMutex buffersMutex;
+QList<TraceBuffer*> buffers;
+QThreadStorage<TraceBufferRef> threadBuffer;
+std::atomic<std::atomic<const char*>*> mainActiveSpan(0);
+
+bool isMainThread()
+{
+    return qApp && QThread::currentThread() == qApp->thread();
+}
+
+TraceBuffer *currentBuffer()
+{
+    TraceBufferRef &ref = threadBuffer.localData();
+    if (!ref.buffer) {
+        TraceBuffer *buffer = new TraceBuffer;
+        QThread *thread = QThread::currentThread();
+        if (isMainThread())
+            buffer->threadName = "main";
+        else if (!thread->objectName().isEmpty())
+            buffer->threadName = thread->objectName().toUtf8();
+
+        QMutexLocker locker(&buffersMutex);
+        buffers.append(buffer);
+        buffer->threadId = buffers.size();
+        if (buffer->threadName.isEmpty())
+            buffer->threadName = "thread " + QByteArray::number(buffer->threadId);
+        ref.buffer = buffer;
+    }
+    return ref.buffer;
+}
+
+std::atomic<const char*> *currentActiveSpan()
+{
+    TraceBufferRef &ref = threadBuffer.localData();
+    if (!ref.activeSpan) {
+        ref.activeSpan = new std::atomic<const char*>(0);
+        if (isMainThread())
+            mainActiveSpan.store(ref.activeSpan, std::memory_order_release);
+    }
+    return ref.activeSpan;
+}
+
+void record(TraceBuffer *buffer, char phase, const char *category, const char *name, qint64 timestamp,
+            qint64 duration, quint64 id)
+{
+    quint64 n = buffer->written.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[n % Tracing::BufferSize];
+    event.name = name;
+    event.category = category;
+    event.timestamp = timestamp;
+    event.duration = duration;
+    event.id = id;
+    event.phase = phase;
+    buffer->written.store(n + 1, std::memory_order_release);
+}
+
+void appendString(QByteArray &out, const char *s)
+{
+    out += '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            out += '\\';
+        out += *s;
+    }
+    out += '"';
+}
+
+// Microseconds, as the format expects, keeping nanosecond precision
+QByteArray microseconds(qint64 ns)
+{
+    return QByteArray::number(double(ns) / 1000, 'f', 3);
+}
+
+}
+
+void Tracing::start(const QString &path)
+{
+    if (isEnabled())
+        return;
+
+    outputPath = path;
+    clock.start();
+    s_trackSpans.store(true, std::memory_order_relaxed);
+    s_enabled.store(true, std::memory_order_release);
+    qDebug() << "Tracing to" << path;
+}
+
+void Tracing::stop()
+{
+    if (!isEnabled())
+        return;
+    s_enabled.store(false, std::memory_order_relaxed);
+
+    QSaveFile file(outputPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        file.write(chromeTraceJson()) < 0 ||
+        !file.commit())
+    {
+        qWarning() << "Failed to write trace to" << outputPath << ":" << file.errorString();
+    }
+}
+
+void Tracing::trackActiveSpans()
+{
+    s_trackSpans.store(true, std::memory_order_relaxed);
+}
+
+qint64 Tracing::now()
+{
+    return clock.nsecsElapsed();
+}
+
+const char *Tracing::enterSpan(const char *name)
+{
+    return currentActiveSpan()->exchange(name, std::memory_order_relaxed);
+}
+
+void Tracing::exitSpan(const char *name, qint64 start, const char *parent)
+{
+    if (start >= 0)
+        record(currentBuffer(), 'X', "span", name, start, now() - start, 0);
+    currentActiveSpan()->store(parent, std::memory_order_relaxed);
+}
+
+void Tracing::instant(const char *name)
+{
+    record(currentBuffer(), 'i', "span", name, now(), 0, 0);
+}
+
+void Tracing::beginAsync(const char *category, const char *name, quint64 id)
+{
+    record(currentBuffer(), 'b', category, name, now(), 0, id);
+}
+
+void Tracing::endAsync(const char *category, const char *name, quint64 id)
+{
+    record(currentBuffer(), 'e', category, name, now(), 0, id);
+}
+
+const char *Tracing::mainThreadSpan()
+{
+    std::atomic<const char*> *span = mainActiveSpan.load(std::memory_order_acquire);
+    return span ? span->load(std::memory_order_relaxed) : 0;
+}
+
+QByteArray Tracing::chromeTraceJson()
+{
+    QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    QByteArray out("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+
+    QMutexLocker locker(&buffersMutex);
+    foreach (TraceBuffer *buffer, buffers) {
+        QByteArray tid = QByteArray::number(buffer->threadId);
+
+        if (!first)
+            out += ',';
+        first = false;
+        out += "\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid + ",\"tid\":" + tid + ",\"args\":{\"name\":";
+        appendString(out, buffer->threadName.constData());
+        out += "}}";
+
+        quint64 written = buffer->written.load(std::memory_order_acquire);
+        quint64 i = (written > quint64(BufferSize)) ? written - BufferSize : 0;
+        for (; i < written; i++) {
+            const TraceEvent &event = buffer->events[i % BufferSize];
+            out += ",\n{\"ph\":\"";
+            out += event.phase;
+            out += "\",\"cat\":";
+            appendString(out, event.category);
+            out += ",\"name\":";
+            appendString(out, event.name);
+            out += ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"ts\":" + microseconds(event.timestamp);
+
+            if (event.phase == 'X')
+                out += ",\"dur\":" + microseconds(event.duration);
+            else if (event.phase == 'i')
+                out += ",\"s\":\"t\"";
+            else
+                out += ",\"id\":\"0x" + QByteArray::number(event.id, 16) + '"';
+            out += '}';
+        }
+    }
+
+    out += "\n]}\n";
+    return out;
+}
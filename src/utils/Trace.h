@@ -0,0 +1,147 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+
+/* Span tracing, written in the Chrome trace event format for Perfetto
+ *
+ * Trace points record into a fixed ring buffer for each thread without
+ * locking, and cost a single branch unless tracing was started, which is done
+ * by setting RICOCHET_TRACE to the path of the output file. The trace is
+ * written when the application exits; only the newest BufferSize events of
+ * each thread are kept. Building with DEFINES+=RICOCHET_NO_TRACE removes all
+ * trace points.
+ *
+ * Independently of tracing, trackActiveSpans() makes TraceSpan keep the
+ * innermost span of each thread, without recording events, for
+ * mainThreadSpan(). StallWatchdog uses this to report what stalled.
+ *
+ * Names and categories must be string literals, because only the pointers
+ * are recorded. Spans that cross event loop iterations use the async macros,
+ * with an identifier (often from pointerId) that pairs the begin and end.
+ * Buffers are kept after their thread exits, so avoid tracing in short-lived
+ * threads.
+ */
+class Tracing
+{
+public:
+    // Events kept for each thread
+    static const int BufferSize = 16384;
+
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    // True once tracing was started or trackActiveSpans() was called
+    static bool isTrackingSpans() { return s_trackSpans.load(std::memory_order_relaxed); }
+
+    /* Start recording events, to be written to path by stop() */
+    static void start(const QString &path);
+    static void stop();
+    /* Keep the active span of each thread, even while tracing is off */
+    static void trackActiveSpans();
+
+    // Nanoseconds since tracing started
+    static qint64 now();
+    static quint64 pointerId(const void *p) { return quint64(quintptr(p)); }
+
+    /* Used by TraceSpan; enterSpan returns the span that was active. The
+     * span is only recorded if start isn't negative. */
+    static const char *enterSpan(const char *name);
+    static void exitSpan(const char *name, qint64 start, const char *parent);
+    static void instant(const char *name);
+    static void beginAsync(const char *category, const char *name, quint64 id);
+    static void endAsync(const char *category, const char *name, quint64 id);
+
+    /* All recorded events, as a JSON trace. This should be called once other
+     * threads are idle; events written concurrently may be incomplete. */
+    static QByteArray chromeTraceJson();
+
+    /* Innermost TraceSpan open on the main thread, or null. This may be
+     * called from any thread. */
+    static const char *mainThreadSpan();
+
+private:
+    static std::atomic<bool> s_enabled;
+    static std::atomic<bool> s_trackSpans;
+};
+
+/* Records a complete event for its scope */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name)
+        : m_name(Tracing::isTrackingSpans() ? name : 0)
+        , m_start(-1)
+        , m_parent(0)
+    {
+        if (m_name) {
+            m_parent = Tracing::enterSpan(m_name);
+            if (Tracing::isEnabled())
+                m_start = Tracing::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (m_name)
+            Tracing::exitSpan(m_name, m_start, m_parent);
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    const char *m_name;
+    qint64 m_start;
+    const char *m_parent;
+};
+
+#ifndef RICOCHET_NO_TRACE
+# define TRACE_CONCAT_(a, b) a##b
+# define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+# define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan_, __LINE__)(name)
+# define TRACE_INSTANT(name) \
+    do { if (Tracing::isEnabled()) Tracing::instant(name); } while (0)
+# define TRACE_ASYNC_BEGIN(category, name, id) \
+    do { if (Tracing::isEnabled()) Tracing::beginAsync(category, name, id); } while (0)
+# define TRACE_ASYNC_END(category, name, id) \
+    do { if (Tracing::isEnabled()) Tracing::endAsync(category, name, id); } while (0)
+#else
+# define TRACE_SPAN(name) do { } while (0)
+# define TRACE_INSTANT(name) do { } while (0)
+# define TRACE_ASYNC_BEGIN(category, name, id) do { } while (0)
+# define TRACE_ASYNC_END(category, name, id) do { } while (0)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,187 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "UnixSocket.h"
+#include <QTcpSocket>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+bool unixSocketsSupported()
+{
+#ifdef Q_OS_UNIX
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool unixSocketPathUsable(const QString &path)
+{
+#ifdef Q_OS_UNIX
+    if (path.isEmpty())
+        return false;
+
+    // Tor's configuration parser doesn't handle unquoted spaces in unix: targets
+    if (path.contains(QLatin1Char(' ')) || path.contains(QLatin1Char('"')))
+        return false;
+
+    sockaddr_un addr;
+    return QFile::encodeName(path).size() < int(sizeof(addr.sun_path));
+#else
+    Q_UNUSED(path);
+    return false;
+#endif
+}
+
+bool ensurePrivateSocketDirectory(const QString &path, QString *errorMessage)
+{
+    static const QFile::Permissions desired = QFileDevice::ReadUser | QFileDevice::WriteUser | QFileDevice::ExeUser;
+    static const QFile::Permissions ignored = QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner;
+
+    QDir dir(path);
+    if (!dir.exists() && !dir.mkpath(QStringLiteral("."))) {
+        if (errorMessage)
+            *errorMessage = QStringLiteral("Cannot create socket directory: %1").arg(path);
+        return false;
+    }
+
+    QFile file(path);
+    if ((file.permissions() & ~ignored) != desired) {
+        qDebug() << "Correcting permissions on socket directory" << path;
+        if (!file.setPermissions(desired) || (file.permissions() & ~ignored) != desired) {
+            if (errorMessage)
+                *errorMessage = QStringLiteral("Cannot restrict permissions of socket directory: %1").arg(path);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool connectUnixSocket(QAbstractSocket *socket, const QString &path, QString *errorMessage)
+{
+#ifdef Q_OS_UNIX
+    if (!unixSocketPathUsable(path)) {
+        if (errorMessage)
+            *errorMessage = QStringLiteral("Invalid unix socket path: %1").arg(path);
+        return false;
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        if (errorMessage)
+            *errorMessage = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    QByteArray encodedPath = QFile::encodeName(path);
+    memcpy(addr.sun_path, encodedPath.constData(), encodedPath.size());
+
+    int re;
+    do {
+        re = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    } while (re < 0 && errno == EINTR);
+
+    if (re < 0) {
+        if (errorMessage)
+            *errorMessage = QString::fromLocal8Bit(strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    if (!socket->setSocketDescriptor(fd, QAbstractSocket::ConnectedState)) {
+        if (errorMessage)
+            *errorMessage = socket->errorString();
+        ::close(fd);
+        return false;
+    }
+
+    return true;
+#else
+    Q_UNUSED(socket);
+    Q_UNUSED(path);
+    if (errorMessage)
+        *errorMessage = QStringLiteral("Unix sockets are not supported on this platform");
+    return false;
+#endif
+}
+
+UnixSocketServer::UnixSocketServer(QObject *parent)
+    : QLocalServer(parent)
+{
+    setSocketOptions(QLocalServer::UserAccessOption);
+}
+
+bool UnixSocketServer::listenPath(const QString &path)
+{
+    if (!unixSocketPathUsable(path))
+        return false;
+
+    QLocalServer::removeServer(path);
+    return listen(path);
+}
+
+QTcpSocket *UnixSocketServer::nextPendingSocket()
+{
+    if (m_pending.isEmpty())
+        return 0;
+    return m_pending.dequeue();
+}
+
+void UnixSocketServer::incomingConnection(quintptr socketDescriptor)
+{
+    QTcpSocket *socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(socketDescriptor, QAbstractSocket::ConnectedState)) {
+        qWarning() << "Cannot adopt incoming unix socket:" << socket->errorString();
+        delete socket;
+#ifdef Q_OS_UNIX
+        ::close(int(socketDescriptor));
+#endif
+        return;
+    }
+
+    m_pending.enqueue(socket);
+    emit newConnection();
+}
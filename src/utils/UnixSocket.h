@@ -0,0 +1,86 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef UNIXSOCKET_H
+#define UNIXSOCKET_H
+
+#include <QLocalServer>
+#include <QQueue>
+
+class QAbstractSocket;
+class QTcpSocket;
+
+/* Unix domain sockets avoid the overhead and port usage of loopback TCP for
+ * connections between Tor and the application. They are only available on
+ * unix platforms, and in paths that are short enough to fit in a sockaddr_un;
+ * callers are expected to fall back to TCP otherwise.
+ *
+ * Connected unix sockets are adopted by a QTcpSocket, so they can be used
+ * with code that expects one. Address-related functions are meaningless on
+ * those sockets, but reading, writing, and state all behave normally. */
+
+bool unixSocketsSupported();
+bool unixSocketPathUsable(const QString &path);
+
+/* Create a directory accessible only by the current user, or verify and
+ * correct the permissions of an existing directory. Sockets should only be
+ * created in such a directory. */
+bool ensurePrivateSocketDirectory(const QString &path, QString *errorMessage = 0);
+
+/* Connect socket to the unix socket at path. The connection is established
+ * synchronously, and socket is in ConnectedState when this returns true;
+ * note that QAbstractSocket::connected is not emitted. */
+bool connectUnixSocket(QAbstractSocket *socket, const QString &path, QString *errorMessage = 0);
+
+/* Listen on a unix socket, and provide connections as QTcpSocket */
+class UnixSocketServer : public QLocalServer
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(UnixSocketServer)
+
+public:
+    explicit UnixSocketServer(QObject *parent = 0);
+
+    /* Listen at path, removing any stale socket first */
+    bool listenPath(const QString &path);
+
+    bool hasPendingSockets() const { return !m_pending.isEmpty(); }
+    QTcpSocket *nextPendingSocket();
+
+protected:
+    virtual void incomingConnection(quintptr socketDescriptor);
+
+private:
+    QQueue<QTcpSocket*> m_pending;
+};
+
+#endif // UNIXSOCKET_H
@@ -0,0 +1,172 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FAKETOR_H
+#define FAKETOR_H
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHash>
+
+/* Minimal control port that accepts null authentication, reports that
+ * circuits are established, and accepts every other command. Commands are
+ * recorded for inspection. */
+class FakeTor : public QObject
+{
+    Q_OBJECT
+
+public:
+    QTcpServer server;
+    QTcpSocket *socket;
+    QList<QByteArray> commands;
+    // Reported as the SOCKS listener
+    quint16 socksPort;
+
+    FakeTor() : socket(0), socksPort(9050)
+    {
+        connect(&server, &QTcpServer::newConnection, this, &FakeTor::onNewConnection);
+        server.listen(QHostAddress::LocalHost);
+    }
+
+    QList<QByteArray> commandsStartingWith(const QByteArray &prefix) const
+    {
+        QList<QByteArray> re;
+        foreach (const QByteArray &command, commands) {
+            if (command.startsWith(prefix))
+                re.append(command);
+        }
+        return re;
+    }
+
+private slots:
+    void onNewConnection()
+    {
+        socket = server.nextPendingConnection();
+        connect(socket, &QTcpSocket::readyRead, this, &FakeTor::onReadyRead);
+    }
+
+    void onReadyRead()
+    {
+        while (socket->canReadLine()) {
+            QByteArray line = socket->readLine().trimmed();
+            commands.append(line);
+
+            if (line.startsWith("PROTOCOLINFO")) {
+                socket->write("250-PROTOCOLINFO 1\r\n"
+                              "250-AUTH METHODS=NULL\r\n"
+                              "250-VERSION Tor=\"0.4.8.9\"\r\n"
+                              "250 OK\r\n");
+            } else if (line.startsWith("GETINFO status/")) {
+                socket->write("250-status/circuit-established=1\r\n"
+                              "250-status/bootstrap-phase=NOTICE BOOTSTRAP PROGRESS=100 TAG=done SUMMARY=\"Done\"\r\n"
+                              "250-net/listeners/socks=\"127.0.0.1:" + QByteArray::number(socksPort) + "\"\r\n"
+                              "250 OK\r\n");
+            } else if (line.startsWith("GETINFO config-text")) {
+                // No torrc is written without a config file
+                socket->write("250-config-text=\r\n250-config-file=\r\n250 OK\r\n");
+            } else {
+                socket->write("250 OK\r\n");
+            }
+        }
+    }
+};
+
+/* SOCKS5 proxy standing in for the tor network: connections to a hostname in
+ * services are relayed to that local port, and others are refused. */
+class FakeSocks : public QObject
+{
+    Q_OBJECT
+
+public:
+    QTcpServer server;
+    QHash<QByteArray,quint16> services;
+    int connectionCount;
+
+    FakeSocks() : connectionCount(0)
+    {
+        connect(&server, &QTcpServer::newConnection, this, &FakeSocks::onNewConnection);
+        server.listen(QHostAddress::LocalHost);
+    }
+
+private slots:
+    void onNewConnection()
+    {
+        while (server.hasPendingConnections()) {
+            QTcpSocket *socket = server.nextPendingConnection();
+            connect(socket, &QTcpSocket::readyRead, this, &FakeSocks::onReadyRead);
+            connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        }
+    }
+
+    void onReadyRead()
+    {
+        QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+        QByteArray data = socket->peek(socket->bytesAvailable());
+
+        // Method selection; no authentication is required
+        if (!socket->property("greeted").toBool()) {
+            if (data.size() < 2 || data.size() < 2 + uchar(data[1]))
+                return;
+            socket->read(2 + uchar(data[1]));
+            socket->write("\x05\x00", 2);
+            socket->setProperty("greeted", true);
+            data = socket->peek(socket->bytesAvailable());
+        }
+
+        // CONNECT request with a hostname
+        if (data.size() < 5 || data.size() < 7 + uchar(data[4]))
+            return;
+        QByteArray host = data.mid(5, uchar(data[4]));
+        socket->read(7 + uchar(data[4]));
+        disconnect(socket, &QTcpSocket::readyRead, this, &FakeSocks::onReadyRead);
+
+        quint16 port = services.value(host);
+        if (!port) {
+            // Host unreachable
+            socket->write("\x05\x04\x00\x01\x00\x00\x00\x00\x00\x00", 10);
+            socket->disconnectFromHost();
+            return;
+        }
+
+        connectionCount++;
+        QTcpSocket *target = new QTcpSocket(socket);
+        connect(target, &QTcpSocket::connected, socket,
+            [socket]() { socket->write("\x05\x00\x00\x01\x00\x00\x00\x00\x00\x00", 10); });
+        connect(target, &QTcpSocket::readyRead, socket, [socket,target]() { socket->write(target->readAll()); });
+        connect(socket, &QTcpSocket::readyRead, target, [socket,target]() { target->write(socket->readAll()); });
+        connect(target, &QTcpSocket::disconnected, socket, &QTcpSocket::disconnectFromHost);
+        connect(socket, &QTcpSocket::disconnected, target, &QTcpSocket::disconnectFromHost);
+        target->connectToHost(QHostAddress::LocalHost, port);
+    }
+};
+
+#endif // FAKETOR_H
@@ -0,0 +1,322 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include "utils/CryptoKey.h"
+#include "utils/SecureRNG.h"
+#include "utils/StringUtil.h"
+#include "utils/OnionId.h"
+#include "ui/LinkedText.h"
+#include <openssl/rand.h>
+
+void base32_encode(char *dest, unsigned destlen, const char *src, unsigned srclen);
+bool base32_decode(char *dest, unsigned destlen, const char *src, unsigned srclen);
+
+/* Microbenchmarks for the utility and crypto code on hot paths
+ *
+ * This is not part of "make check"; run "make benchmark" to write the
+ * results to bench.xml in QTest's XML format, which can be compared
+ * between releases.
+ */
+class TestBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void loadKey_data();
+    void loadKey();
+    void torServiceID_data();
+    void torServiceID();
+    void signSHA256_data();
+    void signSHA256();
+    void verifySHA256_data();
+    void verifySHA256();
+
+    void base32Encode();
+    void base32Decode();
+
+    void secureRandom_data();
+    void secureRandom();
+    void secureRandomOpenSSL_data();
+    void secureRandomOpenSSL();
+    void secureRandomInt();
+
+    void quotedString();
+    void unquotedString();
+    void splitQuotedStrings();
+
+    void onionIdFromString_data();
+    void onionIdFromString();
+
+    void linkedText_data();
+    void linkedText();
+
+private:
+    CryptoKey rsaKey;
+    CryptoKey ed25519Key;
+
+    void addKeyRows();
+    const CryptoKey &keyForRow(const QString &algorithm);
+};
+
+void TestBench::initTestCase()
+{
+    QVERIFY(rsaKey.generateRSA(1024));
+    if (CryptoKey::hasEd25519Support())
+        QVERIFY(ed25519Key.generateEd25519());
+}
+
+void TestBench::addKeyRows()
+{
+    QTest::addColumn<QString>("algorithm");
+    QTest::newRow("rsa") << QStringLiteral("rsa");
+    if (CryptoKey::hasEd25519Support())
+        QTest::newRow("ed25519") << QStringLiteral("ed25519");
+}
+
+const CryptoKey &TestBench::keyForRow(const QString &algorithm)
+{
+    return algorithm == QLatin1String("rsa") ? rsaKey : ed25519Key;
+}
+
+void TestBench::loadKey_data()
+{
+    QTest::addColumn<QByteArray>("data");
+    QTest::addColumn<int>("type");
+    QTest::addColumn<int>("format");
+
+    QTest::newRow("rsa private pem") << rsaKey.encodedPrivateKey(CryptoKey::PEM)
+        << int(CryptoKey::PrivateKey) << int(CryptoKey::PEM);
+    QTest::newRow("rsa private der") << rsaKey.encodedPrivateKey(CryptoKey::DER)
+        << int(CryptoKey::PrivateKey) << int(CryptoKey::DER);
+    QTest::newRow("rsa public pem") << rsaKey.encodedPublicKey(CryptoKey::PEM)
+        << int(CryptoKey::PublicKey) << int(CryptoKey::PEM);
+    QTest::newRow("rsa public der") << rsaKey.encodedPublicKey(CryptoKey::DER)
+        << int(CryptoKey::PublicKey) << int(CryptoKey::DER);
+}
+
+void TestBench::loadKey()
+{
+    QFETCH(QByteArray, data);
+    QFETCH(int, type);
+    QFETCH(int, format);
+
+    QBENCHMARK {
+        CryptoKey key;
+        QVERIFY(key.loadFromData(data, CryptoKey::KeyType(type), CryptoKey::KeyFormat(format)));
+    }
+}
+
+void TestBench::torServiceID_data()
+{
+    addKeyRows();
+}
+
+void TestBench::torServiceID()
+{
+    QFETCH(QString, algorithm);
+    const CryptoKey &key = keyForRow(algorithm);
+
+    QBENCHMARK {
+        QVERIFY(!key.torServiceID().isEmpty());
+    }
+}
+
+void TestBench::signSHA256_data()
+{
+    addKeyRows();
+}
+
+void TestBench::signSHA256()
+{
+    QFETCH(QString, algorithm);
+    const CryptoKey &key = keyForRow(algorithm);
+    QByteArray digest = QCryptographicHash::hash("proof", QCryptographicHash::Sha256);
+
+    QBENCHMARK {
+        QVERIFY(!key.signSHA256(digest).isEmpty());
+    }
+}
+
+void TestBench::verifySHA256_data()
+{
+    addKeyRows();
+}
+
+void TestBench::verifySHA256()
+{
+    QFETCH(QString, algorithm);
+    const CryptoKey &key = keyForRow(algorithm);
+    QByteArray digest = QCryptographicHash::hash("proof", QCryptographicHash::Sha256);
+    QByteArray signature = key.signSHA256(digest);
+
+    QBENCHMARK {
+        QVERIFY(key.verifySHA256(digest, signature));
+    }
+}
+
+// 35 bytes is the size of a decoded v3 onion address
+void TestBench::base32Encode()
+{
+    QByteArray data = SecureRNG::random(OnionId::V3Size);
+    char encoded[OnionId::V3Length + 1];
+
+    QBENCHMARK {
+        base32_encode(encoded, sizeof(encoded), data.constData(), data.size());
+    }
+}
+
+void TestBench::base32Decode()
+{
+    QByteArray data = SecureRNG::random(OnionId::V3Size);
+    char encoded[OnionId::V3Length + 1];
+    base32_encode(encoded, sizeof(encoded), data.constData(), data.size());
+    char decoded[OnionId::V3Size + 1];
+
+    QBENCHMARK {
+        QVERIFY(base32_decode(decoded, sizeof(decoded), encoded, OnionId::V3Length));
+    }
+}
+
+void TestBench::secureRandom_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("16 bytes") << 16;
+    QTest::newRow("64 bytes") << int(SecureRNG::BufferedRequestSize);
+    QTest::newRow("1024 bytes") << 1024;
+}
+
+void TestBench::secureRandom()
+{
+    QFETCH(int, size);
+    QByteArray buf(size, 0);
+
+    QBENCHMARK {
+        QVERIFY(SecureRNG::random(buf.data(), buf.size()));
+    }
+}
+
+void TestBench::secureRandomOpenSSL_data()
+{
+    secureRandom_data();
+}
+
+// The same requests without SecureRNG's buffering, for comparison
+void TestBench::secureRandomOpenSSL()
+{
+    QFETCH(int, size);
+    QByteArray buf(size, 0);
+
+    QBENCHMARK {
+        QVERIFY(RAND_bytes(reinterpret_cast<unsigned char*>(buf.data()), buf.size()) == 1);
+    }
+}
+
+void TestBench::secureRandomInt()
+{
+    QBENCHMARK {
+        SecureRNG::randomInt(1000);
+    }
+}
+
+// A typical tor control reply value, with escapes
+static const char quotableString[] = "/home/user/.local/share/Ricochet/tor/\"hidden service\"\\data";
+
+void TestBench::quotedString()
+{
+    QByteArray input(quotableString);
+
+    QBENCHMARK {
+        ::quotedString(input);
+    }
+}
+
+void TestBench::unquotedString()
+{
+    QByteArray input = ::quotedString(QByteArray(quotableString));
+
+    QBENCHMARK {
+        ::unquotedString(input);
+    }
+}
+
+void TestBench::splitQuotedStrings()
+{
+    QByteArray input("250-status/bootstrap-phase=\"NOTICE BOOTSTRAP PROGRESS=100 TAG=done SUMMARY=\\\"Done\\\"\" "
+                     "net/listeners/socks=\"127.0.0.1:9050\" version=\"0.4.8.9\"");
+
+    QBENCHMARK {
+        ::splitQuotedStrings(input, ' ');
+    }
+}
+
+/* ContactIDValidator::hostnameFromID can't be built without the rest of
+ * core, so this measures OnionId, which contact lookups use for IDs. */
+void TestBench::onionIdFromString_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::newRow("v2 contact id") << QStringLiteral("ricochet:qn2zbvfwhkelqfpn");
+    QTest::newRow("v3 contact id") << QStringLiteral("ricochet:pg6mmjiyjmcrsslvykfwnntlaru7p5svn6y2ymmju6nubxndf4pscryd");
+    QTest::newRow("v3 hostname") << QStringLiteral("pg6mmjiyjmcrsslvykfwnntlaru7p5svn6y2ymmju6nubxndf4pscryd.onion");
+}
+
+void TestBench::onionIdFromString()
+{
+    QFETCH(QString, text);
+
+    QBENCHMARK {
+        QVERIFY(OnionId::fromString(text).isValid());
+    }
+}
+
+void TestBench::linkedText_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::newRow("plain") << QStringLiteral("Are you around later? I was hoping to go over the notes from yesterday before the meeting.");
+    QTest::newRow("link") << QStringLiteral("Are you around later? The notes are at https://example.com/notes/2014-06-12.txt if you want them.");
+    QTest::newRow("multiline") << QStringLiteral("first line\nsecond line with <markup> & entities\nthird line");
+}
+
+void TestBench::linkedText()
+{
+    QFETCH(QString, text);
+    LinkedText linkedText;
+
+    QBENCHMARK {
+        QVERIFY(!linkedText.parsed(text).isEmpty());
+    }
+}
+
+QTEST_GUILESS_MAIN(TestBench)
+#include "tst_bench.moc"
@@ -0,0 +1,21 @@
+CONFIG += openssl
+include(../tests.pri)
+
+# Benchmarks are too slow for "make check"; "make benchmark" runs them and
+# writes QTest's XML results to bench.xml
+CONFIG -= testcase
+QT += gui
+
+benchmark.commands = ./$${TARGET} -o bench.xml,xml
+benchmark.depends = $${TARGET}
+QMAKE_EXTRA_TARGETS += benchmark
+
+SOURCES += tst_bench.cpp \
+    $${SRC}/utils/CryptoKey.cpp \
+    $${SRC}/utils/SecureRNG.cpp \
+    $${SRC}/utils/StringUtil.cpp \
+    $${SRC}/utils/OnionId.cpp \
+    $${SRC}/utils/LinkScanner.cpp \
+    $${SRC}/ui/LinkedText.cpp
+
+HEADERS += $${SRC}/ui/LinkedText.h
@@ -0,0 +1,114 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include "protocol/ContactRequestProof.h"
+
+using namespace Protocol;
+
+class TestContactRequestProof : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void difficultyForRate();
+    void solve();
+    void wrongClient();
+    void badSalt();
+};
+
+static OnionId testClient()
+{
+    return OnionId::fromString(QStringLiteral("aebagbafaydqqcik"));
+}
+
+void TestContactRequestProof::difficultyForRate()
+{
+    QCOMPARE(ContactRequestProof::difficultyForRate(0, 20), 0);
+    QCOMPARE(ContactRequestProof::difficultyForRate(20, 20), 0);
+    QCOMPARE(ContactRequestProof::difficultyForRate(21, 20), int(ContactRequestProof::BaseDifficulty));
+    QCOMPARE(ContactRequestProof::difficultyForRate(40, 20), ContactRequestProof::BaseDifficulty + 1);
+    QCOMPARE(ContactRequestProof::difficultyForRate(80, 20), ContactRequestProof::BaseDifficulty + 2);
+    QCOMPARE(ContactRequestProof::difficultyForRate(1000000, 20), int(ContactRequestProof::MaxDifficulty));
+}
+
+void TestContactRequestProof::solve()
+{
+    QByteArray salt = ContactRequestProof::challengeSalt(testClient());
+    QCOMPARE(salt.size(), int(ContactRequestProof::SaltSize));
+    QCOMPARE(ContactRequestProof::challengeSalt(testClient()), salt);
+
+    ContactRequestProofSolver solver(8, testClient(), salt);
+    solver.start();
+    QVERIFY(solver.wait(10000));
+    QVERIFY(solver.isSolved());
+
+    QVERIFY(ContactRequestProof::verify(8, testClient(), salt, solver.nonce()));
+    QVERIFY(ContactRequestProof::verify(0, testClient(), QByteArray(), 0));
+
+    // Almost no nonce also meets a much higher difficulty
+    int failed = 0;
+    for (quint64 nonce = solver.nonce() + 1; nonce < solver.nonce() + 64; nonce++) {
+        if (!ContactRequestProof::verify(16, testClient(), salt, nonce))
+            failed++;
+    }
+    QVERIFY(failed >= 60);
+}
+
+void TestContactRequestProof::wrongClient()
+{
+    QByteArray salt = ContactRequestProof::challengeSalt(testClient());
+    ContactRequestProofSolver solver(8, testClient(), salt);
+    solver.start();
+    QVERIFY(solver.wait(10000));
+    QVERIFY(solver.isSolved());
+
+    OnionId other = OnionId::fromString(QStringLiteral("aebagbafaydqqcil"));
+    QVERIFY(ContactRequestProof::challengeSalt(other) != salt);
+    QVERIFY(!ContactRequestProof::verify(8, other, salt, solver.nonce()));
+    QVERIFY(!ContactRequestProof::verify(8, OnionId(), salt, solver.nonce()));
+}
+
+void TestContactRequestProof::badSalt()
+{
+    QByteArray salt(ContactRequestProof::SaltSize, 'x');
+    ContactRequestProofSolver solver(4, testClient(), salt);
+    solver.start();
+    QVERIFY(solver.wait(10000));
+    QVERIFY(solver.isSolved());
+
+    // The solution is valid for that salt, but the salt wasn't issued by this process
+    QVERIFY(!ContactRequestProof::verify(4, testClient(), salt, solver.nonce()));
+}
+
+QTEST_MAIN(TestContactRequestProof)
+#include "tst_contactrequestproof.moc"
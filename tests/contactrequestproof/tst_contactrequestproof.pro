@@ -0,0 +1,9 @@
+CONFIG += openssl
+include(../tests.pri)
+
+SOURCES += tst_contactrequestproof.cpp \
+    $${SRC}/protocol/ContactRequestProof.cpp \
+    $${SRC}/utils/OnionId.cpp \
+    $${SRC}/utils/SecureRNG.cpp
+
+HEADERS += $${SRC}/protocol/ContactRequestProof.h
@@ -0,0 +1,109 @@
+# Tests of identities and contacts build everything except the UI. Include
+# after tests.pri, with CONFIG += openssl.
+
+QT += network qml
+CONFIG += c++11
+DEFINES += QT_NO_CAST_FROM_ASCII QT_NO_CAST_TO_ASCII
+
+SOURCES += \
+    $${SRC}/tor/TorControl.cpp \
+    $${SRC}/tor/TorControlSocket.cpp \
+    $${SRC}/tor/TorControlCommand.cpp \
+    $${SRC}/tor/ProtocolInfoCommand.cpp \
+    $${SRC}/tor/AuthenticateCommand.cpp \
+    $${SRC}/tor/SetConfCommand.cpp \
+    $${SRC}/tor/AddOnionCommand.cpp \
+    $${SRC}/tor/GetConfCommand.cpp \
+    $${SRC}/tor/HiddenService.cpp \
+    $${SRC}/tor/TorProcess.cpp \
+    $${SRC}/tor/TorManager.cpp \
+    $${SRC}/tor/TorSocket.cpp \
+    $${SRC}/tor/TorTelemetry.cpp \
+    $${SRC}/tor/TorLogModel.cpp \
+    $${SRC}/core/ContactsManager.cpp \
+    $${SRC}/core/ContactUser.cpp \
+    $${SRC}/core/OutgoingContactRequest.cpp \
+    $${SRC}/core/IncomingRequestManager.cpp \
+    $${SRC}/core/HostnameBlocklist.cpp \
+    $${SRC}/core/ContactIDValidator.cpp \
+    $${SRC}/core/UserIdentity.cpp \
+    $${SRC}/core/IdentityManager.cpp \
+    $${SRC}/core/ConversationModel.cpp \
+    $${SRC}/core/ShutdownCoordinator.cpp \
+    $${SRC}/utils/StringUtil.cpp \
+    $${SRC}/utils/CryptoKey.cpp \
+    $${SRC}/utils/SecureRNG.cpp \
+    $${SRC}/utils/KeyPool.cpp \
+    $${SRC}/utils/OnionId.cpp \
+    $${SRC}/utils/LinkScanner.cpp \
+    $${SRC}/utils/Metrics.cpp \
+    $${SRC}/utils/Trace.cpp \
+    $${SRC}/utils/StallWatchdog.cpp \
+    $${SRC}/utils/Log.cpp \
+    $${SRC}/utils/Settings.cpp \
+    $${SRC}/utils/PendingOperation.cpp \
+    $${SRC}/utils/UnixSocket.cpp \
+    $${SRC}/protocol/Channel.cpp \
+    $${SRC}/protocol/ControlChannel.cpp \
+    $${SRC}/protocol/Connection.cpp \
+    $${SRC}/protocol/OutboundConnector.cpp \
+    $${SRC}/protocol/AuthHiddenServiceChannel.cpp \
+    $${SRC}/protocol/ChatChannel.cpp \
+    $${SRC}/protocol/ContactRequestChannel.cpp \
+    $${SRC}/protocol/ContactRequestProof.cpp
+
+HEADERS += \
+    $${SRC}/tor/TorControl.h \
+    $${SRC}/tor/TorControlSocket.h \
+    $${SRC}/tor/TorControlCommand.h \
+    $${SRC}/tor/ProtocolInfoCommand.h \
+    $${SRC}/tor/AuthenticateCommand.h \
+    $${SRC}/tor/SetConfCommand.h \
+    $${SRC}/tor/AddOnionCommand.h \
+    $${SRC}/tor/GetConfCommand.h \
+    $${SRC}/tor/HiddenService.h \
+    $${SRC}/tor/TorProcess.h \
+    $${SRC}/tor/TorProcess_p.h \
+    $${SRC}/tor/TorManager.h \
+    $${SRC}/tor/TorSocket.h \
+    $${SRC}/tor/TorTelemetry.h \
+    $${SRC}/tor/TorLogModel.h \
+    $${SRC}/core/ContactsManager.h \
+    $${SRC}/core/ContactUser.h \
+    $${SRC}/core/OutgoingContactRequest.h \
+    $${SRC}/core/IncomingRequestManager.h \
+    $${SRC}/core/HostnameBlocklist.h \
+    $${SRC}/core/ContactIDValidator.h \
+    $${SRC}/core/UserIdentity.h \
+    $${SRC}/core/IdentityManager.h \
+    $${SRC}/core/ConversationModel.h \
+    $${SRC}/core/ShutdownCoordinator.h \
+    $${SRC}/utils/StringUtil.h \
+    $${SRC}/utils/CryptoKey.h \
+    $${SRC}/utils/SecureRNG.h \
+    $${SRC}/utils/KeyPool.h \
+    $${SRC}/utils/OnionId.h \
+    $${SRC}/utils/LinkScanner.h \
+    $${SRC}/utils/Metrics.h \
+    $${SRC}/utils/Trace.h \
+    $${SRC}/utils/StallWatchdog.h \
+    $${SRC}/utils/Log.h \
+    $${SRC}/utils/Settings.h \
+    $${SRC}/utils/PendingOperation.h \
+    $${SRC}/utils/UnixSocket.h \
+    $${SRC}/protocol/Channel.h \
+    $${SRC}/protocol/Channel_p.h \
+    $${SRC}/protocol/ControlChannel.h \
+    $${SRC}/protocol/Connection.h \
+    $${SRC}/protocol/Connection_p.h \
+    $${SRC}/protocol/OutboundConnector.h \
+    $${SRC}/protocol/AuthHiddenServiceChannel.h \
+    $${SRC}/protocol/ChatChannel.h \
+    $${SRC}/protocol/ContactRequestChannel.h \
+    $${SRC}/protocol/ContactRequestProof.h
+
+include($$PWD/../protobuf.pri)
+PROTOS += $${SRC}/protocol/ControlChannel.proto \
+    $${SRC}/protocol/AuthHiddenService.proto \
+    $${SRC}/protocol/ChatChannel.proto \
+    $${SRC}/protocol/ContactRequestChannel.proto
@@ -43,6 +43,7 @@ private slots:
     void encodedPublicKey();
     void torServiceID();
     void sign();
+    void ed25519();
 };
 
 const char *alice =
@@ -74,6 +75,13 @@ const char *bob =
 const char *bobDigest = "b4780cabdfc3593004431644977cf73bf8475848";
 const char *bobTorID = "wr4azk67ynmtabcd";
 
+// RFC 8032 test vector 1
+const char *carolSeed = "9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60";
+const char *carolPublicKey = "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a";
+const char *carolTorID = "25njqamcweflpvkl73j4szahhihoc4xt3ktcgjnpaingr5yhkenl5sid";
+const char *carolExpandedKey = "307c83864f2833cb427a2ef1c00a013cfdff2768d980c0a3a520f006904de94f9b4f0afe280b746a778684e75442502057b7473a03f08f96f5a38e9287e01f8f";
+const char *carolSignedTestData = "a575d344a85f1aba45b76f1603531c2ff1374a62164696e2333372dbb4c5ec15e46ea67a1cca73aaafb5b007ca8dace62ec7bcb6fe45b083be7b06a4e588060f";
+
 void TestCryptoKey::load()
 {
     CryptoKey key;
@@ -201,5 +209,57 @@ void TestCryptoKey::sign()
     QVERIFY(key.verifySHA256(dataDigest, signaturep));
 }
 
+void TestCryptoKey::ed25519()
+{
+    if (!CryptoKey::hasEd25519Support())
+        QSKIP("Ed25519 requires OpenSSL 1.1.1");
+
+    CryptoKey key;
+    QVERIFY(key.loadEd25519(QByteArray::fromHex(carolSeed), CryptoKey::PrivateKey));
+    QVERIFY(key.isLoaded());
+    QVERIFY(key.isPrivate());
+    QCOMPARE(key.algorithm(), CryptoKey::Ed25519Key);
+    QCOMPARE(key.bits(), 256);
+    QCOMPARE(key.rawEd25519Key(CryptoKey::PrivateKey).toHex(), QByteArray(carolSeed));
+    QCOMPARE(key.rawEd25519Key(CryptoKey::PublicKey).toHex(), QByteArray(carolPublicKey));
+    QCOMPARE(key.encodedPublicKey(CryptoKey::DER).toHex(), QByteArray(carolPublicKey));
+    QCOMPARE(key.torExpandedEd25519Key().toHex(), QByteArray(carolExpandedKey));
+
+    QString id = key.torServiceID();
+    QCOMPARE(id.size(), 56);
+    QCOMPARE(id, QLatin1String(carolTorID));
+    QCOMPARE(CryptoKey::torServiceChecksum(QByteArray::fromHex(carolPublicKey)).toHex(), QByteArray("bec9"));
+
+    // Signatures are deterministic
+    QByteArray data = "test data";
+    QByteArray signature = key.signData(data);
+    QCOMPARE(signature.toHex(), QByteArray(carolSignedTestData));
+    QVERIFY(key.verifyData(data, signature));
+    QVERIFY(!key.verifyData("different", signature));
+    QVERIFY(!key.verifyData(data, signature.mid(0, signature.size() - 10)));
+
+    // Public key
+    CryptoKey key2;
+    QVERIFY(key2.loadEd25519(QByteArray::fromHex(carolPublicKey), CryptoKey::PublicKey));
+    QVERIFY(!key2.isPrivate());
+    QCOMPARE(key2.torServiceID(), id);
+    QVERIFY(key2.verifyData(data, signature));
+    QVERIFY(key2.signData(data).isEmpty());
+    QVERIFY(key2.rawEd25519Key(CryptoKey::PrivateKey).isEmpty());
+
+    // Generated keys
+    CryptoKey key3;
+    QVERIFY(key3.generateEd25519());
+    QVERIFY(key3.isPrivate());
+    QVERIFY(key3.torServiceID() != id);
+    QVERIFY(key3.verifyData(data, key3.signData(data)));
+    QVERIFY(!key2.verifyData(data, key3.signData(data)));
+
+    // Invalid keys
+    CryptoKey key4;
+    QVERIFY(!key4.loadEd25519(QByteArray::fromHex(carolSeed).mid(0, 31), CryptoKey::PrivateKey));
+    QVERIFY(!key4.isLoaded());
+}
+
 QTEST_MAIN(TestCryptoKey)
 #include "tst_cryptokey.moc"
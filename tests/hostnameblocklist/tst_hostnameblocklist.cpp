@@ -0,0 +1,199 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include "core/HostnameBlocklist.h"
+#include "utils/Settings.h"
+
+class TestHostnameBlocklist : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void saveLoad();
+    void legacyMigration();
+    void parseList();
+    void exportList();
+    void files();
+
+private:
+    QTemporaryDir dataDir;
+    SettingsFile *settings;
+};
+
+static const char legacyId[] = "aebagbafaydqqcik";
+static const char v3Id[] = "25njqamcweflpvkl73j4szahhihoc4xt3ktcgjnpaingr5yhkenl5sid";
+
+void TestHostnameBlocklist::init()
+{
+    QVERIFY(dataDir.isValid());
+    settings = new SettingsFile(this);
+    QString name = QString::fromLatin1(QTest::currentTestFunction());
+    QVERIFY(settings->setFilePath(dataDir.path() + QStringLiteral("/%1.json").arg(name)));
+    SettingsObject::setDefaultFile(settings);
+}
+
+void TestHostnameBlocklist::cleanup()
+{
+    SettingsObject::setDefaultFile(0);
+    delete settings;
+    settings = 0;
+}
+
+void TestHostnameBlocklist::saveLoad()
+{
+    OnionId legacy = OnionId::fromString(QString::fromLatin1(legacyId));
+    OnionId v3 = OnionId::fromString(QString::fromLatin1(v3Id));
+    SettingsObject identity(QStringLiteral("identity"));
+
+    HostnameBlocklist list;
+    list.load(&identity);
+    QCOMPARE(list.count(), 0);
+    QVERIFY(list.add(legacy));
+    QVERIFY(!list.add(legacy));
+    QVERIFY(list.add(QString::fromLatin1(v3Id) + QStringLiteral(".onion")));
+    QVERIFY(!list.add(QStringLiteral("invalid")));
+    QCOMPARE(list.count(), 2);
+
+    // Raw IDs, each after a length byte
+    QByteArray data = identity.read<Base64Encode>("hostnameBlocklist");
+    QCOMPARE(data.size(), 2 + int(OnionId::LegacySize) + int(OnionId::V3Size));
+    QVERIFY(data.contains(char(OnionId::LegacySize) + legacy.data()));
+    QVERIFY(data.contains(char(OnionId::V3Size) + v3.data()));
+
+    HostnameBlocklist loaded;
+    loaded.load(&identity);
+    QCOMPARE(loaded.count(), 2);
+    QVERIFY(loaded.contains(legacy));
+    QVERIFY(loaded.contains(v3));
+    QVERIFY(loaded.contains(QStringLiteral("ricochet:") + QString::fromLatin1(legacyId)));
+
+    // An empty list removes the setting
+    QVERIFY(loaded.remove(legacy));
+    loaded.clear();
+    QCOMPARE(loaded.count(), 0);
+    QVERIFY(identity.read("hostnameBlocklist").isUndefined());
+
+    // Data that can't be parsed is ignored from that point
+    QByteArray truncated = char(OnionId::LegacySize) + legacy.data() + char(OnionId::V3Size) + v3.data().left(4);
+    identity.write("hostnameBlocklist", Base64Encode(truncated));
+    loaded.load(&identity);
+    QCOMPARE(loaded.count(), 1);
+    QVERIFY(loaded.contains(legacy));
+}
+
+void TestHostnameBlocklist::legacyMigration()
+{
+    SettingsObject identity(QStringLiteral("identity"));
+    identity.write("hostnameBlocklist", Base64Encode(char(OnionId::V3Size) + OnionId::fromString(QString::fromLatin1(v3Id)).data()));
+    QJsonArray legacy;
+    legacy.append(QString::fromLatin1(legacyId) + QStringLiteral(".onion"));
+    legacy.append(QStringLiteral("invalid.onion"));
+    legacy.append(QString::fromLatin1(v3Id) + QStringLiteral(".onion"));
+    identity.write("hostnameBlacklist", legacy);
+
+    HostnameBlocklist list;
+    list.load(&identity);
+    QCOMPARE(list.count(), 2);
+    QVERIFY(list.contains(QString::fromLatin1(legacyId)));
+    QVERIFY(list.contains(QString::fromLatin1(v3Id)));
+
+    // The old key is replaced by the new format
+    QVERIFY(identity.read("hostnameBlacklist").isUndefined());
+    HostnameBlocklist loaded;
+    loaded.load(&identity);
+    QCOMPARE(loaded.count(), 2);
+    QVERIFY(loaded.contains(QString::fromLatin1(legacyId)));
+}
+
+void TestHostnameBlocklist::parseList()
+{
+    QByteArray text = QByteArray("# Blocked contacts\n")
+        + "ricochet:" + legacyId + "\r\n"
+        + "\n"
+        + "   " + v3Id + ".onion  \n"
+        + "#" + legacyId + "\n"
+        + "not a hostname\n"
+        + "TORSION:" + QByteArray(legacyId).toUpper();
+
+    QList<OnionId> hosts = HostnameBlocklist::parseList(text);
+    QCOMPARE(hosts.size(), 3);
+    QCOMPARE(hosts[0], OnionId::fromString(QString::fromLatin1(legacyId)));
+    QCOMPARE(hosts[1], OnionId::fromString(QString::fromLatin1(v3Id)));
+    QCOMPARE(hosts[2], hosts[0]);
+
+    QVERIFY(HostnameBlocklist::parseList(QByteArray()).isEmpty());
+}
+
+void TestHostnameBlocklist::exportList()
+{
+    SettingsObject identity(QStringLiteral("identity"));
+    HostnameBlocklist list;
+    list.load(&identity);
+    QVERIFY(list.exportList().isEmpty());
+
+    QList<OnionId> hosts = HostnameBlocklist::parseList(QByteArray(v3Id) + "\n" + legacyId + "\n" + legacyId);
+    QCOMPARE(list.import(hosts), 2);
+    QCOMPARE(list.import(hosts), 0);
+
+    // Sorted contact IDs, one per line
+    QByteArray expected = QByteArray("ricochet:") + v3Id + "\nricochet:" + legacyId + "\n";
+    QCOMPARE(list.exportList(), expected);
+    QCOMPARE(HostnameBlocklist::parseList(list.exportList()), hosts.mid(0, 2));
+}
+
+void TestHostnameBlocklist::files()
+{
+    SettingsObject identity(QStringLiteral("identity"));
+    HostnameBlocklist list;
+    list.load(&identity);
+    list.add(QString::fromLatin1(legacyId));
+    list.add(QString::fromLatin1(v3Id));
+
+    QUrl path = QUrl::fromLocalFile(dataDir.path() + QStringLiteral("/blocklist.txt"));
+    QVERIFY(list.exportFile(path));
+
+    HostnameBlocklist imported;
+    imported.load(&identity);
+    imported.clear();
+    QCOMPARE(imported.importFile(path), 2);
+    QCOMPARE(imported.count(), 2);
+    QCOMPARE(imported.importFile(path), 0);
+
+    QCOMPARE(imported.importFile(QUrl::fromLocalFile(dataDir.path() + QStringLiteral("/missing.txt"))), -1);
+    QVERIFY(!imported.exportFile(QUrl::fromLocalFile(dataDir.path() + QStringLiteral("/missing/blocklist.txt"))));
+}
+
+QTEST_MAIN(TestHostnameBlocklist)
+#include "tst_hostnameblocklist.moc"
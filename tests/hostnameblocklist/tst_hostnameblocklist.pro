@@ -0,0 +1,18 @@
+include(../tests.pri)
+
+QT += network
+CONFIG += c++11
+
+SOURCES += tst_hostnameblocklist.cpp \
+    $${SRC}/core/HostnameBlocklist.cpp \
+    $${SRC}/utils/OnionId.cpp \
+    $${SRC}/utils/Metrics.cpp \
+    $${SRC}/utils/Settings.cpp \
+    $${SRC}/utils/Trace.cpp \
+    $${SRC}/utils/UnixSocket.cpp
+
+HEADERS += \
+    $${SRC}/core/HostnameBlocklist.h \
+    $${SRC}/utils/Metrics.h \
+    $${SRC}/utils/Settings.h \
+    $${SRC}/utils/UnixSocket.h
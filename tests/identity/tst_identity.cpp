@@ -0,0 +1,310 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include <QAtomicPointer>
+#include "../FakeTor.h"
+#include "core/IdentityManager.h"
+#include "core/UserIdentity.h"
+#include "core/ContactsManager.h"
+#include "core/ContactUser.h"
+#include "tor/TorManager.h"
+#include "tor/TorControl.h"
+#include "tor/HiddenService.h"
+#include "utils/CryptoKey.h"
+#include "utils/KeyPool.h"
+#include "utils/Settings.h"
+
+/* Identities connecting to each other through a fake tor, which relays the
+ * connections of each hidden service to its local listener. */
+class TestIdentity : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void workerThread();
+    void idleClose();
+    void legacyMigration();
+    void legacyServiceHostname();
+    void pooledKey();
+
+private:
+    QTemporaryDir dataDir;
+    SettingsFile *settings;
+
+    QString createService(const QString &name);
+    void writeIdentity(int id, const QString &service, const QString &contactHostname, bool workerThread = false);
+    void connectTor(FakeTor *tor, FakeSocks *socks, IdentityManager *manager);
+};
+
+void TestIdentity::initTestCase()
+{
+    QVERIFY(dataDir.isValid());
+    settings = 0;
+    init();
+    torControl = Tor::TorManager::instance()->control();
+}
+
+void TestIdentity::init()
+{
+    // Each test starts with its own identities
+    delete settings;
+    settings = new SettingsFile(this);
+    QString name = QString::fromLatin1(QTest::currentTestFunction());
+    QVERIFY(settings->setFilePath(dataDir.path() + QStringLiteral("/%1.json").arg(name)));
+    SettingsObject::setDefaultFile(settings);
+}
+
+void TestIdentity::cleanup()
+{
+    SettingsObject::setDefaultFile(0);
+}
+
+// Returns the hostname of a new service with an RSA key
+QString TestIdentity::createService(const QString &name)
+{
+    Tor::HiddenService service(dataDir.path() + QLatin1Char('/') + name);
+    CryptoKey key;
+    if (!key.generateRSA(1024) || !service.createFromKey(key))
+        return QString();
+    return service.hostname();
+}
+
+void TestIdentity::writeIdentity(int id, const QString &service, const QString &contactHostname, bool workerThread)
+{
+    SettingsObject identity(UserIdentity::settingsPath(id, QStringLiteral("identity")));
+    identity.write("dataDirectory", dataDir.path() + QLatin1Char('/') + service);
+    if (workerThread)
+        identity.write("workerThread", true);
+    if (contactHostname.isEmpty())
+        return;
+
+    SettingsObject contact(UserIdentity::settingsPath(id, QStringLiteral("contacts.0")));
+    contact.write("nickname", QStringLiteral("peer"));
+    contact.write("hostname", contactHostname);
+}
+
+// Route connections to the services of manager, and connect to tor
+void TestIdentity::connectTor(FakeTor *tor, FakeSocks *socks, IdentityManager *manager)
+{
+    foreach (UserIdentity *identity, manager->identities()) {
+        QList<Tor::HiddenService::Target> targets = identity->hiddenService()->targets();
+        QVERIFY(!targets.isEmpty());
+        socks->services.insert(identity->hostname().toLatin1(), targets.first().targetPort);
+    }
+
+    tor->socksPort = socks->server.serverPort();
+    torControl->connect(QHostAddress::LocalHost, tor->server.serverPort());
+    QTRY_VERIFY(torControl->hasConnectivity());
+}
+
+// An identity on a worker thread connects to one on the main thread, while its service stays with tor
+void TestIdentity::workerThread()
+{
+    QString primaryHostname = createService(QStringLiteral("worker-primary"));
+    QString workerHostname = createService(QStringLiteral("worker-second"));
+    QVERIFY(!primaryHostname.isEmpty() && !workerHostname.isEmpty());
+    writeIdentity(0, QStringLiteral("worker-primary"), workerHostname);
+    writeIdentity(1, QStringLiteral("worker-second"), primaryHostname, true);
+
+    FakeTor tor;
+    FakeSocks socks;
+    QAtomicPointer<QThread> connectedThread;
+
+    IdentityManager manager;
+    QCOMPARE(manager.identities().size(), 2);
+    UserIdentity *primary = manager.identities().at(0);
+    UserIdentity *worker = manager.identities().at(1);
+
+    QThread *thread = manager.identityThread(worker);
+    QVERIFY(thread);
+    QVERIFY(!manager.identityThread(primary));
+    QCOMPARE(worker->thread(), thread);
+    QCOMPARE(worker->hiddenService()->thread(), QThread::currentThread());
+    QCOMPARE(worker->hostname(), workerHostname);
+    QCOMPARE(manager.lookupHostname(workerHostname), worker);
+
+    ContactUser *primaryContact = primary->contacts.contacts().value(0);
+    ContactUser *workerContact = worker->contacts.contacts().value(0);
+    QVERIFY(primaryContact && workerContact);
+    connect(workerContact, &ContactUser::connected, workerContact,
+        [&connectedThread]() { connectedThread.store(QThread::currentThread()); },
+        Qt::DirectConnection);
+
+    connectTor(&tor, &socks, &manager);
+    QTRY_COMPARE(worker->hiddenService()->status(), Tor::HiddenService::Online);
+    QTRY_VERIFY_WITH_TIMEOUT(primaryContact->isConnected(), 15000);
+    QTRY_VERIFY_WITH_TIMEOUT(connectedThread.load() != 0, 15000);
+    QCOMPARE(connectedThread.load(), thread);
+    QVERIFY(socks.connectionCount > 0);
+}
+
+// Only the first identity closes idle connections, and the second must not redial after it does
+void TestIdentity::idleClose()
+{
+    QString firstHostname = createService(QStringLiteral("idle-first"));
+    QString secondHostname = createService(QStringLiteral("idle-second"));
+    QVERIFY(!firstHostname.isEmpty() && !secondHostname.isEmpty());
+    writeIdentity(0, QStringLiteral("idle-first"), secondHostname);
+    writeIdentity(1, QStringLiteral("idle-second"), firstHostname);
+    // In minutes; three seconds
+    SettingsObject(UserIdentity::settingsPath(0, QStringLiteral("contacts.0"))).write("idleTimeout", 0.05);
+
+    FakeTor tor;
+    FakeSocks socks;
+
+    IdentityManager manager;
+    QCOMPARE(manager.identities().size(), 2);
+    ContactUser *first = manager.identities().at(0)->contacts.contacts().value(0);
+    ContactUser *second = manager.identities().at(1)->contacts.contacts().value(0);
+    QVERIFY(first && second);
+    QCOMPARE(first->idleTimeout(), 3);
+    QCOMPARE(second->idleTimeout(), 0);
+
+    connectTor(&tor, &socks, &manager);
+    QTRY_VERIFY_WITH_TIMEOUT(first->connection() && second->connection(), 15000);
+
+    QTRY_VERIFY_WITH_TIMEOUT(first->isIdle(), 15000);
+    QTRY_VERIFY(second->isIdle());
+    QVERIFY(!first->connection());
+    QVERIFY(!second->connection());
+    QCOMPARE(first->status(), ContactUser::Online);
+    QCOMPARE(second->status(), ContactUser::Online);
+
+    // Neither side dials again until it has something to send
+    int connections = socks.connectionCount;
+    QTest::qWait(5000);
+    QCOMPARE(socks.connectionCount, connections);
+    QVERIFY(!first->connection());
+    QVERIFY(!second->connection());
+    QVERIFY(second->isIdle());
+}
+
+// A contact that moved to v3 proves its v2 hostname, and the peer updates the contact
+void TestIdentity::legacyMigration()
+{
+    if (!CryptoKey::hasEd25519Support())
+        QSKIP("Ed25519 requires OpenSSL 1.1.1");
+
+    QString movedHostname = createService(QStringLiteral("legacy-moved"));
+    QString peerHostname = createService(QStringLiteral("legacy-peer"));
+    QVERIFY(!movedHostname.isEmpty() && !peerHostname.isEmpty());
+    writeIdentity(0, QStringLiteral("legacy-moved"), peerHostname);
+    writeIdentity(1, QStringLiteral("legacy-peer"), movedHostname);
+    SettingsObject(UserIdentity::settingsPath(0, QStringLiteral("identity"))).write("onionVersion", 3);
+
+    FakeTor tor;
+    FakeSocks socks;
+
+    IdentityManager manager;
+    UserIdentity *moved = manager.identities().at(0);
+    QCOMPARE(moved->hiddenService()->version(), 3);
+    QVERIFY(moved->hostname() != movedHostname);
+    QVERIFY(moved->hiddenService()->publishesLegacyService());
+
+    ContactUser *movedContact = moved->contacts.contacts().value(0);
+    ContactUser *peerContact = manager.identities().at(1)->contacts.contacts().value(0);
+    QVERIFY(movedContact && peerContact);
+    QCOMPARE(peerContact->hostname(), movedHostname);
+
+    // Only the new hostname is reachable, so the peer learns it from the connection of the moved identity
+    connectTor(&tor, &socks, &manager);
+    QTRY_COMPARE(tor.commandsStartingWith("ADD_ONION ED25519-V3:").size(), 1);
+    QTRY_COMPARE(tor.commandsStartingWith("ADD_ONION RSA1024:").size(), 1);
+
+    QTRY_COMPARE_WITH_TIMEOUT(peerContact->hostname(), moved->hostname(), 15000);
+    QTRY_VERIFY_WITH_TIMEOUT(peerContact->isConnected(), 15000);
+    QTRY_VERIFY(movedContact->isConnected());
+    QCOMPARE(manager.identities().at(1)->contacts.lookupHostname(moved->hostname()), peerContact);
+}
+
+// A client that only knows the v2 hostname of a moved service can still authenticate to it
+void TestIdentity::legacyServiceHostname()
+{
+    if (!CryptoKey::hasEd25519Support())
+        QSKIP("Ed25519 requires OpenSSL 1.1.1");
+
+    QString movedHostname = createService(QStringLiteral("legacyhost-moved"));
+    QString peerHostname = createService(QStringLiteral("legacyhost-peer"));
+    QVERIFY(!movedHostname.isEmpty() && !peerHostname.isEmpty());
+    // The moved identity doesn't know the peer, so it never dials
+    writeIdentity(0, QStringLiteral("legacyhost-moved"), QString());
+    writeIdentity(1, QStringLiteral("legacyhost-peer"), movedHostname);
+    SettingsObject(UserIdentity::settingsPath(0, QStringLiteral("identity"))).write("onionVersion", 3);
+
+    FakeTor tor;
+    FakeSocks socks;
+
+    IdentityManager manager;
+    UserIdentity *moved = manager.identities().at(0);
+    ContactUser *peerContact = manager.identities().at(1)->contacts.contacts().value(0);
+    QVERIFY(peerContact);
+
+    socks.services.insert(movedHostname.toLatin1(), moved->hiddenService()->targets().first().targetPort);
+    connectTor(&tor, &socks, &manager);
+
+    // Authentication succeeds, and the moved identity says it doesn't know the peer
+    QTRY_VERIFY_WITH_TIMEOUT(peerContact->settings()->read("rejected").toBool(), 15000);
+    QCOMPARE(peerContact->hostname(), movedHostname);
+}
+
+// A new identity with a pregenerated key is finished initializing before tor publishes it
+void TestIdentity::pooledKey()
+{
+    QVERIFY(!createService(QStringLiteral("pooled-primary")).isEmpty());
+    writeIdentity(0, QStringLiteral("pooled-primary"), QString());
+    // Read when the pool is first used, which is by this test
+    SettingsObject(QStringLiteral("tor")).write("keyPoolSize", 1);
+    QVERIFY(KeyPool::instance()->isEnabled());
+
+    QString hostname;
+    {
+        IdentityManager manager;
+        UserIdentity *identity = manager.createIdentity(QStringLiteral("pooled"), dataDir.path() + QStringLiteral("/pooled-new"));
+        QVERIFY(identity && identity->hiddenService());
+        QCOMPARE(identity->hiddenService()->status(), Tor::HiddenService::Offline);
+        QVERIFY(identity->settings()->read("initializing").isUndefined());
+        hostname = identity->hostname();
+        QVERIFY(!hostname.isEmpty());
+    }
+
+    // The service is kept when the identity is loaded again
+    IdentityManager manager;
+    QCOMPARE(manager.identities().size(), 2);
+    QCOMPARE(manager.identities().at(1)->hostname(), hostname);
+}
+
+QTEST_MAIN(TestIdentity)
+#include "tst_identity.moc"
@@ -0,0 +1,7 @@
+CONFIG += openssl
+include(../tests.pri)
+include(../core.pri)
+
+SOURCES += tst_identity.cpp
+
+HEADERS += ../FakeTor.h
@@ -0,0 +1,126 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include <QRegularExpression>
+#include <QUrl>
+#include "utils/LinkScanner.h"
+
+class TestLinkScanner : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void toHtml_data();
+    void toHtml();
+    void matchesRegex_data();
+    void matchesRegex();
+};
+
+// The regex-only conversion that LinkScanner replaces, which it must match exactly
+static QString regexToHtml(const QString &input)
+{
+    QRegularExpression linkRegex(QStringLiteral("([a-z]{3,9}:|www\\.)([^\\s,.);!>]|[,.);!>](?!\\s|$))+"), QRegularExpression::CaseInsensitiveOption);
+    QStringList allowedSchemes;
+    allowedSchemes << QStringLiteral("http") << QStringLiteral("https") << QStringLiteral("torsion") << QStringLiteral("ricochet");
+
+    QString re;
+    int p = 0;
+    QRegularExpressionMatchIterator it = linkRegex.globalMatch(input);
+    while (it.hasNext()) {
+        QRegularExpressionMatch match = it.next();
+        int start = match.capturedStart();
+
+        QUrl url = QUrl::fromUserInput(match.capturedRef().toString());
+        if (!allowedSchemes.contains(url.scheme().toLower()))
+            continue;
+
+        if (start > p)
+            re.append(input.mid(p, start - p).toHtmlEscaped().replace(QLatin1Char('\n'), QStringLiteral("<br/>")));
+        re.append(QStringLiteral("<a href=\"%1\">%2</a>").arg(QString::fromLatin1(url.toEncoded()).toHtmlEscaped()).arg(match.capturedRef().toString().toHtmlEscaped()));
+        p = match.capturedEnd();
+    }
+
+    if (p < input.size())
+        re.append(input.mid(p).toHtmlEscaped().replace(QLatin1Char('\n'), QStringLiteral("<br/>")));
+    return re;
+}
+
+void TestLinkScanner::toHtml_data()
+{
+    QTest::addColumn<QString>("input");
+    QTest::addColumn<QString>("output");
+
+    QTest::newRow("plain") << QStringLiteral("hello") << QStringLiteral("hello");
+    QTest::newRow("escaped") << QStringLiteral("a <b> & c\nd") << QStringLiteral("a &lt;b&gt; &amp; c<br/>d");
+    QTest::newRow("http") << QStringLiteral("see http://example.com.")
+                          << QStringLiteral("see <a href=\"http://example.com\">http://example.com</a>.");
+    QTest::newRow("www") << QStringLiteral("www.example.com")
+                         << QStringLiteral("<a href=\"http://www.example.com\">www.example.com</a>");
+    QTest::newRow("other scheme") << QStringLiteral("ftp://example.com") << QStringLiteral("ftp://example.com");
+    QTest::newRow("colon") << QStringLiteral("note: this") << QStringLiteral("note: this");
+}
+
+void TestLinkScanner::toHtml()
+{
+    QFETCH(QString, input);
+    QFETCH(QString, output);
+    QCOMPARE(LinkScanner::toHtml(input), output);
+}
+
+void TestLinkScanner::matchesRegex_data()
+{
+    QTest::addColumn<QString>("input");
+
+    QTest::newRow("empty") << QString();
+    QTest::newRow("plain") << QStringLiteral("just some words, and punctuation: here.");
+    QTest::newRow("link") << QStringLiteral("look at https://example.com/a?b=c&d, ok?");
+    QTest::newRow("upper") << QStringLiteral("HTTPS://EXAMPLE.COM and WWW.EXAMPLE.ORG");
+    QTest::newRow("contact") << QStringLiteral("add me: ricochet:aebagbafaydqqcik");
+    QTest::newRow("long prefix") << QStringLiteral("abcdefghijhttp://example.com");
+    QTest::newRow("prefixed scheme") << QStringLiteral("xhttp://example.com");
+    QTest::newRow("prefixed www") << QStringLiteral("awww.example.com");
+    QTest::newRow("after other") << QStringLiteral("ftp:x http://example.com");
+    QTest::newRow("inside other") << QStringLiteral("ftp:xhttp://example.com");
+    QTest::newRow("multiline") << QStringLiteral("one\nhttp://a.example\n<two>");
+    QTest::newRow("host port") << QStringLiteral("try localhost:8080/x");
+    QTest::newRow("trailing") << QStringLiteral("(http://example.com)!");
+}
+
+void TestLinkScanner::matchesRegex()
+{
+    QFETCH(QString, input);
+    QCOMPARE(LinkScanner::toHtml(input), regexToHtml(input));
+}
+
+QTEST_MAIN(TestLinkScanner)
+#include "tst_linkscanner.moc"
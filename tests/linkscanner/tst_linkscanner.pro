@@ -0,0 +1,4 @@
+include(../tests.pri)
+
+SOURCES += tst_linkscanner.cpp \
+    $${SRC}/utils/LinkScanner.cpp
@@ -0,0 +1,141 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include "utils/Metrics.h"
+
+class TestMetrics : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void histogramBuckets();
+    void histogramPercentile();
+    void registry();
+    void prometheusText();
+};
+
+void TestMetrics::histogramBuckets()
+{
+    QCOMPARE(MetricHistogram::bucketIndex(0), 0);
+    QCOMPARE(MetricHistogram::bucketIndex(7), 7);
+    QCOMPARE(MetricHistogram::bucketIndex(8), 8);
+    QCOMPARE(MetricHistogram::bucketIndex(Q_UINT64_C(0xffffffffffffffff)), int(MetricHistogram::BucketCount) - 1);
+    QCOMPARE(MetricHistogram::bucketUpperBound(MetricHistogram::BucketCount - 1), Q_UINT64_C(0xffffffffffffffff));
+
+    // Every value falls within its bucket, and buckets are contiguous
+    QList<quint64> values;
+    for (quint64 v = 0; v < 5000; v++)
+        values.append(v);
+    for (int shift = 12; shift < 64; shift++) {
+        values.append((Q_UINT64_C(1) << shift) - 1);
+        values.append(Q_UINT64_C(1) << shift);
+        values.append((Q_UINT64_C(1) << shift) + (Q_UINT64_C(1) << (shift - 2)) + 1);
+    }
+
+    foreach (quint64 v, values) {
+        int index = MetricHistogram::bucketIndex(v);
+        QVERIFY(index >= 0 && index < MetricHistogram::BucketCount);
+        QVERIFY(v <= MetricHistogram::bucketUpperBound(index));
+        if (index > 0)
+            QVERIFY(v > MetricHistogram::bucketUpperBound(index - 1));
+        // Relative error is bounded by the number of sub-buckets
+        QVERIFY(MetricHistogram::bucketUpperBound(index) - v <= v / MetricHistogram::SubBucketCount);
+    }
+}
+
+void TestMetrics::histogramPercentile()
+{
+    MetricHistogram histogram;
+    QCOMPARE(histogram.percentile(0.5), quint64(0));
+
+    for (int i = 1; i <= 1000; i++)
+        histogram.record(i);
+
+    QCOMPARE(histogram.count(), quint64(1000));
+    QCOMPARE(histogram.sum(), quint64(500500));
+
+    quint64 p50 = histogram.percentile(0.5);
+    QVERIFY(p50 >= 500 && p50 <= 500 + 500 / MetricHistogram::SubBucketCount);
+    quint64 p99 = histogram.percentile(0.99);
+    QVERIFY(p99 >= 990 && p99 <= 990 + 990 / MetricHistogram::SubBucketCount);
+}
+
+void TestMetrics::registry()
+{
+    MetricsRegistry registry;
+
+    MetricCounter *a = registry.counter("test_total", "Test", MetricsRegistry::label("x", QStringLiteral("1")));
+    MetricCounter *b = registry.counter("test_total", "Test", MetricsRegistry::label("x", QStringLiteral("2")));
+    QVERIFY(a != b);
+    QCOMPARE(registry.counter("test_total", "Test", MetricsRegistry::label("x", QStringLiteral("1"))), a);
+
+    // A name can't be reused with another type
+    MetricGauge *gauge = registry.gauge("test_total", "Test");
+    QVERIFY(gauge != 0);
+    gauge->set(5);
+    QVERIFY(!registry.prometheusText().contains("test_total 5"));
+
+    QCOMPARE(MetricsRegistry::label("k", QStringLiteral("a\"b\\c\nd")), QByteArray("k=\"a\\\"b\\\\c\\nd\""));
+}
+
+void TestMetrics::prometheusText()
+{
+    MetricsRegistry registry;
+
+    registry.counter("packets_total", "Packets", MetricsRegistry::label("type", QStringLiteral("chat")))->add(3);
+    registry.gauge("connections", "Connections")->add(-2);
+    MetricHistogram *histogram = registry.histogram("duration_microseconds", "Duration",
+                                                    MetricsRegistry::label("state", QStringLiteral("ready")));
+    histogram->record(3);
+    histogram->record(3);
+    histogram->record(100);
+
+    QByteArray expected =
+        "# HELP connections Connections\n"
+        "# TYPE connections gauge\n"
+        "connections -2\n"
+        "# HELP duration_microseconds Duration\n"
+        "# TYPE duration_microseconds histogram\n"
+        "duration_microseconds_bucket{state=\"ready\",le=\"3\"} 2\n"
+        "duration_microseconds_bucket{state=\"ready\",le=\"103\"} 3\n"
+        "duration_microseconds_bucket{state=\"ready\",le=\"+Inf\"} 3\n"
+        "duration_microseconds_sum{state=\"ready\"} 106\n"
+        "duration_microseconds_count{state=\"ready\"} 3\n"
+        "# HELP packets_total Packets\n"
+        "# TYPE packets_total counter\n"
+        "packets_total{type=\"chat\"} 3\n";
+    QCOMPARE(registry.prometheusText(), expected);
+}
+
+QTEST_MAIN(TestMetrics)
+#include "tst_metrics.moc"
@@ -0,0 +1,14 @@
+include(../tests.pri)
+
+QT += network
+
+SOURCES += tst_metrics.cpp \
+    $${SRC}/utils/Metrics.cpp \
+    $${SRC}/utils/Settings.cpp \
+    $${SRC}/utils/Trace.cpp \
+    $${SRC}/utils/UnixSocket.cpp
+
+HEADERS += \
+    $${SRC}/utils/Metrics.h \
+    $${SRC}/utils/Settings.h \
+    $${SRC}/utils/UnixSocket.h
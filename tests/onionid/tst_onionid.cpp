@@ -0,0 +1,134 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include <QSet>
+#include "utils/OnionId.h"
+
+class TestOnionId : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void parse_data();
+    void parse();
+    void encode();
+    void compare();
+};
+
+static const char v3ServiceId[] = "25njqamcweflpvkl73j4szahhihoc4xt3ktcgjnpaingr5yhkenl5sid";
+
+void TestOnionId::parse_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<int>("version");
+
+    QTest::newRow("legacy") << QStringLiteral("aebagbafaydqqcik") << 2;
+    QTest::newRow("legacy hostname") << QStringLiteral("aebagbafaydqqcik.onion") << 2;
+    QTest::newRow("legacy upper") << QStringLiteral("AEBAGBAFAYDQQCIK.ONION") << 2;
+    QTest::newRow("legacy contact id") << QStringLiteral("ricochet:aebagbafaydqqcik") << 2;
+    QTest::newRow("torsion contact id") << QStringLiteral("torsion:aebagbafaydqqcik") << 2;
+    QTest::newRow("v3") << QString::fromLatin1(v3ServiceId) << 3;
+    QTest::newRow("v3 hostname") << QString::fromLatin1(v3ServiceId) + QStringLiteral(".onion") << 3;
+    QTest::newRow("v3 contact id") << QStringLiteral("ricochet:") + QString::fromLatin1(v3ServiceId) << 3;
+
+    QTest::newRow("empty") << QString() << 0;
+    QTest::newRow("suffix only") << QStringLiteral(".onion") << 0;
+    QTest::newRow("short") << QStringLiteral("aebagbafaydqqci") << 0;
+    QTest::newRow("long") << QStringLiteral("aebagbafaydqqcika") << 0;
+    QTest::newRow("bad character") << QStringLiteral("aebagbafaydqqci1") << 0;
+    QTest::newRow("non-latin") << QString::fromUtf8("aebagbafaydqqci\xc3\xa9") << 0;
+    QTest::newRow("bad scheme") << QStringLiteral("http:aebagbafaydqqcik") << 0;
+    // Last character changes the version byte of a v3 address
+    QTest::newRow("v3 bad version") << QString::fromLatin1(v3ServiceId).replace(55, 1, QLatin1Char('a')) << 0;
+}
+
+void TestOnionId::parse()
+{
+    QFETCH(QString, text);
+    QFETCH(int, version);
+
+    OnionId id = OnionId::fromString(text);
+    QCOMPARE(id.isValid(), version != 0);
+    QCOMPARE(id.version(), version);
+    if (version)
+        QCOMPARE(OnionId::fromData(id.data()), id);
+}
+
+void TestOnionId::encode()
+{
+    QByteArray legacy;
+    for (char i = 1; i <= 10; i++)
+        legacy.append(i);
+
+    OnionId id = OnionId::fromData(legacy);
+    QVERIFY(id.isValid());
+    QCOMPARE(id.data(), legacy);
+    QCOMPARE(id.serviceId(), QStringLiteral("aebagbafaydqqcik"));
+    QCOMPARE(id.hostname(), QStringLiteral("aebagbafaydqqcik.onion"));
+
+    id = OnionId::fromString(QString::fromLatin1(v3ServiceId).toUpper());
+    QCOMPARE(id.data().size(), int(OnionId::V3Size));
+    QCOMPARE(id.serviceId(), QString::fromLatin1(v3ServiceId));
+
+    QVERIFY(!OnionId::fromData(legacy.left(9)).isValid());
+    QVERIFY(OnionId().serviceId().isNull());
+    QVERIFY(OnionId().hostname().isNull());
+}
+
+void TestOnionId::compare()
+{
+    OnionId a = OnionId::fromString(QStringLiteral("aebagbafaydqqcik.onion"));
+    OnionId b = OnionId::fromString(QStringLiteral("ricochet:AEBAGBAFAYDQQCIK"));
+    OnionId c = OnionId::fromString(QStringLiteral("aebagbafaydqqcil"));
+    OnionId d = OnionId::fromString(QString::fromLatin1(v3ServiceId));
+
+    QVERIFY(a == b);
+    QCOMPARE(qHash(a), qHash(b));
+    QVERIFY(a != c);
+    // Only the last byte differs
+    QVERIFY(qHash(a) != qHash(c));
+    QVERIFY(a != d);
+    QVERIFY(a < c);
+    QVERIFY(!(c < a));
+    QVERIFY(a < d);
+    QVERIFY(OnionId() == OnionId());
+    QVERIFY(a != OnionId());
+
+    QSet<OnionId> set;
+    set << a << b << c << d;
+    QCOMPARE(set.size(), 3);
+    QVERIFY(set.contains(OnionId::fromString(QStringLiteral("aebagbafaydqqcil"))));
+}
+
+QTEST_MAIN(TestOnionId)
+#include "tst_onionid.moc"
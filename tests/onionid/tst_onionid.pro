@@ -0,0 +1,4 @@
+include(../tests.pri)
+
+SOURCES += tst_onionid.cpp \
+    $${SRC}/utils/OnionId.cpp
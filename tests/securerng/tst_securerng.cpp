@@ -0,0 +1,149 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include "utils/SecureRNG.h"
+#include <limits>
+#include <limits.h>
+
+class TestSecureRNG : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void random();
+    void randomInt();
+    void randomInt64();
+    void randomRange();
+    void threads();
+};
+
+void TestSecureRNG::random()
+{
+    // Buffered and direct requests
+    for (int size = 1; size <= SecureRNG::BufferedRequestSize * 2; size++) {
+        QByteArray a = SecureRNG::random(size);
+        QByteArray b = SecureRNG::random(size);
+        QCOMPARE(a.size(), size);
+        QCOMPARE(b.size(), size);
+        if (size >= 8)
+            QVERIFY(a != b);
+    }
+
+    // Enough to refill and reseed several times
+    QSet<QByteArray> values;
+    for (int i = 0; i < 100000; i++)
+        values.insert(SecureRNG::random(16));
+    QCOMPARE(values.size(), 100000);
+}
+
+void TestSecureRNG::randomInt()
+{
+    QVector<int> counts(10);
+    for (int i = 0; i < 10000; i++) {
+        unsigned value = SecureRNG::randomInt(10);
+        QVERIFY(value < 10);
+        counts[value]++;
+    }
+
+    foreach (int count, counts)
+        QVERIFY(count > 800 && count < 1200);
+
+    QCOMPARE(SecureRNG::randomInt(1), 0u);
+    QVERIFY(SecureRNG::randomInt(UINT_MAX) < UINT_MAX);
+}
+
+void TestSecureRNG::randomInt64()
+{
+    // All bits are used, including the high 32
+    quint64 seen = 0;
+    for (int i = 0; i < 64; i++)
+        seen |= SecureRNG::randomInt64();
+    QCOMPARE(seen, ~Q_UINT64_C(0));
+
+    quint64 max = Q_UINT64_C(3) << 60;
+    bool high = false;
+    for (int i = 0; i < 100; i++) {
+        quint64 value = SecureRNG::randomInt64(max);
+        QVERIFY(value < max);
+        if (value >= (Q_UINT64_C(1) << 60))
+            high = true;
+    }
+    QVERIFY(high);
+
+    QCOMPARE(SecureRNG::randomInt64(1), Q_UINT64_C(0));
+}
+
+void TestSecureRNG::randomRange()
+{
+    for (int i = 0; i < 1000; i++) {
+        qint64 value = SecureRNG::randomRange(-5, 5);
+        QVERIFY(value >= -5 && value < 5);
+    }
+
+    // The full span of qint64 doesn't overflow
+    qint64 value = SecureRNG::randomRange(std::numeric_limits<qint64>::min(), std::numeric_limits<qint64>::max());
+    QVERIFY(value < std::numeric_limits<qint64>::max());
+}
+
+class RNGThread : public QThread
+{
+public:
+    QSet<QByteArray> values;
+
+    virtual void run()
+    {
+        for (int i = 0; i < 10000; i++)
+            values.insert(SecureRNG::random(16));
+    }
+};
+
+void TestSecureRNG::threads()
+{
+    // Each thread has its own keystream, which must not repeat another's
+    QList<RNGThread*> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.append(new RNGThread);
+        threads.last()->start();
+    }
+
+    QSet<QByteArray> values;
+    foreach (RNGThread *thread, threads) {
+        QVERIFY(thread->wait(30000));
+        values.unite(thread->values);
+    }
+    QCOMPARE(values.size(), 40000);
+    qDeleteAll(threads);
+}
+
+QTEST_MAIN(TestSecureRNG)
+#include "tst_securerng.moc"
@@ -0,0 +1,5 @@
+CONFIG += openssl
+include(../tests.pri)
+
+SOURCES += tst_securerng.cpp \
+    $${SRC}/utils/SecureRNG.cpp
@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS += cryptokey
+SUBDIRS += cryptokey securerng onionid contactrequestproof linkscanner metrics trace torcontrol tortelemetry identity hostnameblocklist bench
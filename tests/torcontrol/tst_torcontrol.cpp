@@ -0,0 +1,141 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include "../FakeTor.h"
+#include "tor/TorControl.h"
+#include "tor/HiddenService.h"
+#include "utils/CryptoKey.h"
+#include "utils/Settings.h"
+
+class TestTorControl : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void twoServices();
+    void serviceAddedWhileConnected();
+
+private:
+    QTemporaryDir dataDir;
+    SettingsFile *settings;
+
+    Tor::HiddenService *createService(const QString &name, quint16 targetPort, QObject *parent);
+};
+
+void TestTorControl::initTestCase()
+{
+    QVERIFY(dataDir.isValid());
+    settings = new SettingsFile(this);
+    QVERIFY(settings->setFilePath(dataDir.path() + QStringLiteral("/ricochet.json")));
+    SettingsObject::setDefaultFile(settings);
+}
+
+void TestTorControl::cleanupTestCase()
+{
+    SettingsObject::setDefaultFile(0);
+}
+
+// A service with an RSA key, as a new identity with a pooled key would have
+Tor::HiddenService *TestTorControl::createService(const QString &name, quint16 targetPort, QObject *parent)
+{
+    Tor::HiddenService *service = new Tor::HiddenService(dataDir.path() + QLatin1Char('/') + name, parent);
+    CryptoKey key;
+    if (!key.generateRSA(1024) || !service->createFromKey(key))
+        return 0;
+    service->addTarget(9878, QHostAddress::LocalHost, targetPort);
+    return service;
+}
+
+// Two identities share one tor instance, and are published together
+void TestTorControl::twoServices()
+{
+    FakeTor tor;
+    QVERIFY(tor.server.isListening());
+
+    Tor::TorControl control;
+    Tor::HiddenService *first = createService(QStringLiteral("two-first"), 1001, &control);
+    Tor::HiddenService *second = createService(QStringLiteral("two-second"), 1002, &control);
+    QVERIFY(first && second);
+    QVERIFY(first->hostname() != second->hostname());
+
+    control.addHiddenService(first);
+    control.addHiddenService(second);
+    QCOMPARE(control.hiddenServices().size(), 2);
+
+    control.connect(QHostAddress::LocalHost, tor.server.serverPort());
+    QTRY_COMPARE(control.torStatus(), Tor::TorControl::TorReady);
+    QTRY_COMPARE(first->status(), Tor::HiddenService::Online);
+    QTRY_COMPARE(second->status(), Tor::HiddenService::Online);
+
+    // Tor replaces the set of services on every SETCONF, so both are in one command
+    QList<QByteArray> setconf = tor.commandsStartingWith("SETCONF");
+    QCOMPARE(setconf.size(), 1);
+    QCOMPARE(setconf[0].count("HiddenServiceDir="), 2);
+    QVERIFY(setconf[0].contains(QDir(first->dataPath).absolutePath().toLocal8Bit()));
+    QVERIFY(setconf[0].contains(QDir(second->dataPath).absolutePath().toLocal8Bit()));
+    QVERIFY(setconf[0].contains("127.0.0.1:1001"));
+    QVERIFY(setconf[0].contains("127.0.0.1:1002"));
+}
+
+// An identity created at runtime is published without dropping the others
+void TestTorControl::serviceAddedWhileConnected()
+{
+    FakeTor tor;
+    QVERIFY(tor.server.isListening());
+
+    Tor::TorControl control;
+    Tor::HiddenService *first = createService(QStringLiteral("added-first"), 1003, &control);
+    QVERIFY(first);
+    control.addHiddenService(first);
+
+    control.connect(QHostAddress::LocalHost, tor.server.serverPort());
+    QTRY_COMPARE(first->status(), Tor::HiddenService::Online);
+    QCOMPARE(tor.commandsStartingWith("SETCONF").size(), 1);
+
+    Tor::HiddenService *second = createService(QStringLiteral("added-second"), 1004, &control);
+    QVERIFY(second);
+    control.addHiddenService(second);
+    QTRY_COMPARE(second->status(), Tor::HiddenService::Online);
+    QCOMPARE(first->status(), Tor::HiddenService::Online);
+
+    QList<QByteArray> setconf = tor.commandsStartingWith("SETCONF");
+    QCOMPARE(setconf.size(), 2);
+    QCOMPARE(setconf[1].count("HiddenServiceDir="), 2);
+    QVERIFY(setconf[1].contains("127.0.0.1:1003"));
+    QVERIFY(setconf[1].contains("127.0.0.1:1004"));
+}
+
+QTEST_MAIN(TestTorControl)
+#include "tst_torcontrol.moc"
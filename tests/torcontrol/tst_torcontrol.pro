@@ -0,0 +1,42 @@
+CONFIG += openssl
+include(../tests.pri)
+
+QT += network qml
+
+SOURCES += tst_torcontrol.cpp \
+    $${SRC}/tor/TorControl.cpp \
+    $${SRC}/tor/TorControlSocket.cpp \
+    $${SRC}/tor/TorControlCommand.cpp \
+    $${SRC}/tor/TorTelemetry.cpp \
+    $${SRC}/tor/ProtocolInfoCommand.cpp \
+    $${SRC}/tor/AuthenticateCommand.cpp \
+    $${SRC}/tor/SetConfCommand.cpp \
+    $${SRC}/tor/GetConfCommand.cpp \
+    $${SRC}/tor/AddOnionCommand.cpp \
+    $${SRC}/tor/HiddenService.cpp \
+    $${SRC}/utils/CryptoKey.cpp \
+    $${SRC}/utils/SecureRNG.cpp \
+    $${SRC}/utils/StringUtil.cpp \
+    $${SRC}/utils/Settings.cpp \
+    $${SRC}/utils/PendingOperation.cpp \
+    $${SRC}/utils/UnixSocket.cpp \
+    $${SRC}/utils/Metrics.cpp \
+    $${SRC}/utils/Trace.cpp \
+    $${SRC}/utils/Log.cpp
+
+HEADERS += ../FakeTor.h \
+    $${SRC}/tor/TorControl.h \
+    $${SRC}/tor/TorControlSocket.h \
+    $${SRC}/tor/TorControlCommand.h \
+    $${SRC}/tor/TorTelemetry.h \
+    $${SRC}/tor/ProtocolInfoCommand.h \
+    $${SRC}/tor/AuthenticateCommand.h \
+    $${SRC}/tor/SetConfCommand.h \
+    $${SRC}/tor/GetConfCommand.h \
+    $${SRC}/tor/AddOnionCommand.h \
+    $${SRC}/tor/HiddenService.h \
+    $${SRC}/utils/Settings.h \
+    $${SRC}/utils/PendingOperation.h \
+    $${SRC}/utils/UnixSocket.h \
+    $${SRC}/utils/Metrics.h \
+    $${SRC}/utils/Log.h
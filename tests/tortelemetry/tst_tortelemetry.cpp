@@ -0,0 +1,235 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include <QTcpServer>
+#include "tor/TorTelemetry.h"
+#include "tor/TorControlSocket.h"
+#include "utils/Metrics.h"
+
+using namespace Tor;
+
+/* Events are written by a local server standing in for tor's control port,
+ * and parsed by the same socket that TorControl uses. */
+class TestTorTelemetry : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void bandwidth();
+    void circuits();
+    void circuitBandwidth();
+    void streams();
+    void streamBandwidth();
+    void malformed();
+
+private:
+    QTcpServer server;
+    QTcpSocket *control;
+    TorControlSocket *socket;
+    TorTelemetry *telemetry;
+
+    // Send events, and wait until they have been handled
+    void sendEvents(const QByteArray &events);
+};
+
+void TestTorTelemetry::init()
+{
+    QVERIFY(server.isListening() || server.listen(QHostAddress::LocalHost));
+    socket = new TorControlSocket;
+    telemetry = new TorTelemetry;
+    socket->connectToHost(QHostAddress::LocalHost, server.serverPort());
+    QVERIFY(server.waitForNewConnection(5000));
+    control = server.nextPendingConnection();
+    QTRY_COMPARE(socket->state(), QAbstractSocket::ConnectedState);
+
+    telemetry->registerEvents(socket);
+    // Each registration sends SETEVENTS
+    for (int i = 0; i < 5; i++) {
+        QTRY_VERIFY(control->canReadLine());
+        QVERIFY(control->readLine().startsWith("SETEVENTS"));
+        control->write("250 OK\r\n");
+    }
+}
+
+void TestTorTelemetry::cleanup()
+{
+    delete telemetry;
+    delete socket;
+    delete control;
+}
+
+void TestTorTelemetry::sendEvents(const QByteArray &events)
+{
+    // Events are handled in order, so a marker circuit shows when all are done
+    static int marker = 0;
+    QByteArray id = "marker" + QByteArray::number(++marker);
+    quint64 built = telemetry->summary().value(QStringLiteral("circuitsBuilt")).toULongLong();
+    control->write(events + "650 CIRC " + id + " BUILT\r\n");
+    QTRY_COMPARE(telemetry->summary().value(QStringLiteral("circuitsBuilt")).toULongLong(), built + 1);
+}
+
+void TestTorTelemetry::bandwidth()
+{
+    MetricCounter *read = MetricsRegistry::instance()->counter("ricochet_tor_read_bytes_total", "");
+    quint64 readBefore = read->value();
+
+    sendEvents("650 BW 100 40\r\n"
+               "650 BW 300 0\r\n");
+    QVariantMap summary = telemetry->summary();
+    QCOMPARE(summary.value(QStringLiteral("readRate")).toDouble(), 200.0);
+    QCOMPARE(summary.value(QStringLiteral("writeRate")).toDouble(), 20.0);
+    QCOMPARE(read->value() - readBefore, quint64(400));
+
+    // Only the latest window of samples counts
+    QByteArray events;
+    for (int i = 0; i < TorTelemetry::BandwidthWindow; i++)
+        events += "650 BW 10 20\r\n";
+    sendEvents(events);
+    summary = telemetry->summary();
+    QCOMPARE(summary.value(QStringLiteral("readRate")).toDouble(), 10.0);
+    QCOMPARE(summary.value(QStringLiteral("writeRate")).toDouble(), 20.0);
+}
+
+void TestTorTelemetry::circuits()
+{
+    MetricCounter *timeouts = MetricsRegistry::instance()->counter("ricochet_tor_circuits_failed_total", "",
+                                                                   MetricsRegistry::label("reason", QStringLiteral("TIMEOUT")));
+    quint64 timeoutsBefore = timeouts->value();
+
+    sendEvents("650 CIRC 1 LAUNCHED BUILD_FLAGS=NEED_CAPACITY PURPOSE=GENERAL\r\n"
+               "650 CIRC 2 LAUNCHED\r\n"
+               "650 CIRC 3 LAUNCHED\r\n"
+               "650 CIRC 1 EXTENDED $AAAA~relay\r\n"
+               "650 CIRC 1 BUILT $AAAA~relay,$BBBB~other BUILD_FLAGS=NEED_CAPACITY PURPOSE=GENERAL\r\n"
+               "650 CIRC 2 FAILED $AAAA~relay REASON=TIMEOUT\r\n"
+               "650 CIRC 3 FAILED REASON=\"DESTROYED\" REMOTE_REASON=FINISHED\r\n"
+               "650 CIRC 4 FAILED\r\n"
+               "650 CIRC 1 CLOSED REASON=FINISHED\r\n");
+
+    QVariantMap summary = telemetry->summary();
+    // Including the marker circuit, which wasn't launched and has no build time
+    QCOMPARE(summary.value(QStringLiteral("circuitsBuilt")).toInt(), 2);
+    QCOMPARE(summary.value(QStringLiteral("circuitsFailed")).toInt(), 3);
+    QCOMPARE(summary.value(QStringLiteral("buildTime")).toMap().value(QStringLiteral("samples")).toInt(), 1);
+
+    QVariantMap failures = summary.value(QStringLiteral("failures")).toMap();
+    QCOMPARE(failures.size(), 3);
+    QCOMPARE(failures.value(QStringLiteral("TIMEOUT")).toInt(), 1);
+    QCOMPARE(failures.value(QStringLiteral("DESTROYED")).toInt(), 1);
+    QCOMPARE(failures.value(QStringLiteral("NONE")).toInt(), 1);
+    QCOMPARE(timeouts->value() - timeoutsBefore, quint64(1));
+}
+
+void TestTorTelemetry::circuitBandwidth()
+{
+    sendEvents("650 CIRC_BW ID=1 READ=500 WRITTEN=200 TIME=2023-01-01T00:00:00.000000\r\n"
+               "650 CIRC_BW ID=2 READ=20 WRITTEN=0 DELIVERED_READ=10\r\n");
+    QVariantMap summary = telemetry->summary();
+    QCOMPARE(summary.value(QStringLiteral("circuitRead")).toULongLong(), quint64(520));
+    QCOMPARE(summary.value(QStringLiteral("circuitWritten")).toULongLong(), quint64(200));
+}
+
+void TestTorTelemetry::streams()
+{
+    sendEvents("650 STREAM 1 NEW 0 abcdefghijklmnop.onion:9878 SOURCE_ADDR=127.0.0.1:5000 PURPOSE=USER\r\n"
+               "650 STREAM 2 NEW 0 ABCDEFGHIJKLMNOP.onion:80\r\n"
+               "650 STREAM 3 NEW 0 qrstuvwxyzabcdef.onion:9878\r\n"
+               "650 STREAM 1 SENTCONNECT 5 abcdefghijklmnop.onion:9878\r\n"
+               "650 STREAM 1 SUCCEEDED 5 abcdefghijklmnop.onion:9878\r\n"
+               "650 STREAM 2 FAILED 5 abcdefghijklmnop.onion:80 REASON=TIMEOUT\r\n"
+               "650 STREAM 3 SUCCEEDED 6 qrstuvwxyzabcdef.onion:9878\r\n");
+
+    QCOMPARE(telemetry->summary().value(QStringLiteral("streams")).toInt(), 3);
+
+    QVariantMap host = telemetry->targetStatistics(QStringLiteral("abcdefghijklmnop.onion"));
+    QCOMPARE(host.value(QStringLiteral("streams")).toInt(), 2);
+    QCOMPARE(host.value(QStringLiteral("open")).toInt(), 1);
+    QCOMPARE(host.value(QStringLiteral("failed")).toInt(), 1);
+
+    QVariantMap port = telemetry->targetStatistics(QStringLiteral("ABCDEFGHIJKLMNOP.onion:9878"));
+    QCOMPARE(port.value(QStringLiteral("streams")).toInt(), 1);
+    QCOMPARE(port.value(QStringLiteral("open")).toInt(), 1);
+    QCOMPARE(port.value(QStringLiteral("failed")).toInt(), 0);
+
+    // Targets are forgotten once their streams are closed
+    sendEvents("650 STREAM 1 CLOSED 5 abcdefghijklmnop.onion:9878 REASON=DONE\r\n"
+               "650 STREAM 2 CLOSED 5 abcdefghijklmnop.onion:80 REASON=TIMEOUT\r\n");
+    QCOMPARE(telemetry->summary().value(QStringLiteral("streams")).toInt(), 1);
+    host = telemetry->targetStatistics(QStringLiteral("abcdefghijklmnop.onion"));
+    QCOMPARE(host.value(QStringLiteral("streams")).toInt(), 0);
+    QCOMPARE(host.value(QStringLiteral("failed")).toInt(), 0);
+    QCOMPARE(telemetry->targetStatistics(QStringLiteral("qrstuvwxyzabcdef.onion")).value(QStringLiteral("open")).toInt(), 1);
+
+    // Events for unknown streams are ignored
+    sendEvents("650 STREAM 9 SUCCEEDED 5 abcdefghijklmnop.onion:9878\r\n"
+               "650 STREAM 9 CLOSED 5 abcdefghijklmnop.onion:9878\r\n");
+    QCOMPARE(telemetry->targetStatistics(QStringLiteral("abcdefghijklmnop.onion")).value(QStringLiteral("open")).toInt(), 0);
+    QCOMPARE(telemetry->summary().value(QStringLiteral("streams")).toInt(), 1);
+}
+
+void TestTorTelemetry::streamBandwidth()
+{
+    MetricCounter *read = MetricsRegistry::instance()->counter("ricochet_tor_stream_read_bytes_total", "");
+    quint64 readBefore = read->value();
+
+    sendEvents("650 STREAM 1 NEW 0 abcdefghijklmnop.onion:9878\r\n"
+               "650 STREAM_BW 1 100 300 2023-01-01T00:00:00.000000\r\n"
+               "650 STREAM_BW 1 50 0\r\n"
+               "650 STREAM_BW 2 1000 1000\r\n");
+
+    QVariantMap stats = telemetry->targetStatistics(QStringLiteral("abcdefghijklmnop.onion"));
+    // Written is reported before read
+    QCOMPARE(stats.value(QStringLiteral("bytesWritten")).toULongLong(), quint64(150));
+    QCOMPARE(stats.value(QStringLiteral("bytesRead")).toULongLong(), quint64(300));
+    QCOMPARE(read->value() - readBefore, quint64(300));
+}
+
+void TestTorTelemetry::malformed()
+{
+    sendEvents("650 BW 100\r\n"
+               "650 CIRC 1\r\n"
+               "650 STREAM 1 NEW 0\r\n"
+               "650 STREAM_BW 1\r\n"
+               "650 CIRC_BW\r\n");
+
+    QVariantMap summary = telemetry->summary();
+    QCOMPARE(summary.value(QStringLiteral("readRate")).toDouble(), 0.0);
+    QCOMPARE(summary.value(QStringLiteral("circuitsFailed")).toInt(), 0);
+    QCOMPARE(summary.value(QStringLiteral("streams")).toInt(), 0);
+    QCOMPARE(summary.value(QStringLiteral("circuitRead")).toULongLong(), quint64(0));
+}
+
+QTEST_MAIN(TestTorTelemetry)
+#include "tst_tortelemetry.moc"
@@ -0,0 +1,24 @@
+include(../tests.pri)
+
+QT += network
+CONFIG += c++11
+
+SOURCES += tst_tortelemetry.cpp \
+    $${SRC}/tor/TorTelemetry.cpp \
+    $${SRC}/tor/TorControlSocket.cpp \
+    $${SRC}/tor/TorControlCommand.cpp \
+    $${SRC}/utils/StringUtil.cpp \
+    $${SRC}/utils/Settings.cpp \
+    $${SRC}/utils/UnixSocket.cpp \
+    $${SRC}/utils/Metrics.cpp \
+    $${SRC}/utils/Trace.cpp \
+    $${SRC}/utils/Log.cpp
+
+HEADERS += \
+    $${SRC}/tor/TorTelemetry.h \
+    $${SRC}/tor/TorControlSocket.h \
+    $${SRC}/tor/TorControlCommand.h \
+    $${SRC}/utils/Settings.h \
+    $${SRC}/utils/UnixSocket.h \
+    $${SRC}/utils/Metrics.h \
+    $${SRC}/utils/Log.h
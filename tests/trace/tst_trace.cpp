@@ -0,0 +1,172 @@
+/* Ricochet - https://ricochet.im/
+ * Copyright (C) 2014, John Brooks <john.brooks@dereferenced.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include "utils/Trace.h"
+
+class TestTrace : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void chromeTrace();
+    void threads();
+    void ringBuffer();
+};
+
+static QJsonArray traceEvents()
+{
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(Tracing::chromeTraceJson(), &error);
+    if (error.error != QJsonParseError::NoError)
+        qWarning() << "Trace is not valid JSON:" << error.errorString();
+    return document.object().value(QStringLiteral("traceEvents")).toArray();
+}
+
+static QList<QJsonObject> eventsNamed(const QJsonArray &events, const QString &name)
+{
+    QList<QJsonObject> re;
+    foreach (const QJsonValue &value, events) {
+        if (value.toObject().value(QStringLiteral("name")).toString() == name)
+            re.append(value.toObject());
+    }
+    return re;
+}
+
+void TestTrace::initTestCase()
+{
+    QVERIFY(!Tracing::isEnabled());
+    {
+        TRACE_SPAN("test.beforeStart");
+        QVERIFY(!Tracing::mainThreadSpan());
+    }
+
+    // As used by StallWatchdog, without recording events
+    Tracing::trackActiveSpans();
+    {
+        TRACE_SPAN("test.tracked");
+        QCOMPARE(Tracing::mainThreadSpan(), "test.tracked");
+    }
+    QVERIFY(!Tracing::mainThreadSpan());
+    QVERIFY(!Tracing::isEnabled());
+
+    Tracing::start(QDir::temp().filePath(QStringLiteral("tst_trace.json")));
+    QVERIFY(Tracing::isEnabled());
+}
+
+void TestTrace::chromeTrace()
+{
+    {
+        TRACE_SPAN("test.outer");
+        TRACE_SPAN("test.inner");
+        QTest::qSleep(2);
+    }
+    TRACE_INSTANT("test.instant");
+    TRACE_ASYNC_BEGIN("test", "test.async", Tracing::pointerId(this));
+    TRACE_ASYNC_END("test", "test.async", Tracing::pointerId(this));
+
+    QJsonArray events = traceEvents();
+    QVERIFY(eventsNamed(events, QStringLiteral("test.beforeStart")).isEmpty());
+    QVERIFY(eventsNamed(events, QStringLiteral("test.tracked")).isEmpty());
+
+    QList<QJsonObject> outer = eventsNamed(events, QStringLiteral("test.outer"));
+    QList<QJsonObject> inner = eventsNamed(events, QStringLiteral("test.inner"));
+    QCOMPARE(outer.size(), 1);
+    QCOMPARE(inner.size(), 1);
+    QCOMPARE(outer[0].value(QStringLiteral("ph")).toString(), QStringLiteral("X"));
+    QVERIFY(outer[0].value(QStringLiteral("dur")).toDouble() >= 2000);
+    QVERIFY(outer[0].value(QStringLiteral("ts")).toDouble() <= inner[0].value(QStringLiteral("ts")).toDouble());
+    QVERIFY(outer[0].value(QStringLiteral("dur")).toDouble() >= inner[0].value(QStringLiteral("dur")).toDouble());
+
+    QCOMPARE(eventsNamed(events, QStringLiteral("test.instant")).size(), 1);
+
+    QList<QJsonObject> async = eventsNamed(events, QStringLiteral("test.async"));
+    QCOMPARE(async.size(), 2);
+    QCOMPARE(async[0].value(QStringLiteral("ph")).toString(), QStringLiteral("b"));
+    QCOMPARE(async[1].value(QStringLiteral("ph")).toString(), QStringLiteral("e"));
+    QCOMPARE(async[0].value(QStringLiteral("id")), async[1].value(QStringLiteral("id")));
+    QCOMPARE(async[0].value(QStringLiteral("cat")).toString(), QStringLiteral("test"));
+}
+
+class TraceThread : public QThread
+{
+protected:
+    virtual void run()
+    {
+        TRACE_SPAN("test.thread");
+    }
+};
+
+void TestTrace::threads()
+{
+    TraceThread thread;
+    thread.setObjectName(QStringLiteral("TraceThread"));
+    thread.start();
+    QVERIFY(thread.wait(5000));
+
+    {
+        TRACE_SPAN("test.flush");
+    }
+
+    QJsonArray events = traceEvents();
+    QList<QJsonObject> threadEvents = eventsNamed(events, QStringLiteral("test.thread"));
+    QList<QJsonObject> mainEvents = eventsNamed(events, QStringLiteral("test.flush"));
+    QCOMPARE(threadEvents.size(), 1);
+    QCOMPARE(mainEvents.size(), 1);
+    int tid = threadEvents[0].value(QStringLiteral("tid")).toInt();
+    QVERIFY(tid != mainEvents[0].value(QStringLiteral("tid")).toInt());
+
+    bool named = false;
+    foreach (const QJsonObject &meta, eventsNamed(events, QStringLiteral("thread_name"))) {
+        if (meta.value(QStringLiteral("tid")).toInt() == tid)
+            named = meta.value(QStringLiteral("args")).toObject().value(QStringLiteral("name")).toString() == QStringLiteral("TraceThread");
+    }
+    QVERIFY(named);
+}
+
+void TestTrace::ringBuffer()
+{
+    TRACE_INSTANT("test.oldest");
+    for (int i = 0; i < Tracing::BufferSize; i++)
+        TRACE_INSTANT("test.fill");
+
+    QJsonArray events = traceEvents();
+    QVERIFY(eventsNamed(events, QStringLiteral("test.oldest")).isEmpty());
+    QCOMPARE(eventsNamed(events, QStringLiteral("test.fill")).size(), int(Tracing::BufferSize));
+}
+
+QTEST_MAIN(TestTrace)
+#include "tst_trace.moc"
@@ -0,0 +1,4 @@
+include(../tests.pri)
+
+SOURCES += tst_trace.cpp \
+    $${SRC}/utils/Trace.cpp